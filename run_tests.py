@@ -4,13 +4,13 @@ import os
 import random
 import string
 
-def run_test(code: str, expected_exit_code=None, expected_output=None):
+def run_test(code: str, expected_exit_code=None, expected_output=None, flags=()):
     """Helper function to compile and run a Zura program, checking exit code and/or output."""
 
     with open("zura_files/main.zu", "w") as f:
         f.write(code)
     
-    subprocess.run(["./zura", "build", "zura_files/main.zu", "-name", "main", "-quiet"], check=True)
+    subprocess.run(["./zura", "build", "zura_files/main.zu", "-name", "main", "-quiet", *flags], check=True)
     
     result = subprocess.run("./main", capture_output=True, text=True)
     exit_code = result.returncode
@@ -57,6 +57,91 @@ class TestZuraPrograms(unittest.TestCase):
     def test_add_to_itself(self):
         run_test("const main := fn () int! { have x: int! = 4; return x + x; };", expected_exit_code=8)
 
+    def test_multiply_by_power_of_two(self):
+        run_test("const main := fn () int! { have x: int! = 5; have a: int! = x * 4; have b: int! = 8 * x; return a + b; };", expected_exit_code=60)
+
+    def test_loop_swapping_variables(self):
+        # Too many iterations to run at compile time, so the phis in the loop header have to swap for real
+        run_test("const mix := fn (n: int!) int! { have a: int! = 1; have b: int! = 2; loop (i = 0; i < n) : (i++) { have t: int! = a; a = b; b = t + 1; } return a + b; }; const main := fn () int! { return mix(1000001); };", expected_exit_code=68)
+
+    def test_more_live_values_than_registers(self):
+        # 15 values alive around the whole loop, so some of them have to be spilled
+        run_test("const mix := fn (x: int!, y: int!) int! { return (x * 31 + y) % 1009; }; const main := fn () int! { have a: int! = 1; have b: int! = 2; have c: int! = 3; have d: int! = 4; have e: int! = 5; have f: int! = 6; have g: int! = 7; have h: int! = 8; have i: int! = 9; have j: int! = 10; have k: int! = 11; have l: int! = 12; have m: int! = 13; have n: int! = 14; have s: int! = 0; loop (t = 0; t < 50) : (t++) { a = mix(a, b); b = mix(b, c); c = mix(c, d); d = mix(d, e); e = mix(e, f); f = mix(f, g); g = mix(g, h); h = mix(h, i); i = mix(i, j); j = mix(j, k); k = mix(k, l); l = mix(l, m); m = mix(m, n); n = mix(n, a); s = (s + a + b + c + d + e + f + g + h + i + j + k + l + m + n) % 100000; } return s % 256; };", expected_exit_code=26)
+
+    def test_locals_in_registers_around_address_taken_local(self):
+        # i and s can live in registers, x had its address taken so it has to stay in memory
+        run_test("const main := fn () int! { have x: int! = 5; have p: *int! = &x; have s: int! = 0; loop (i = 0; i < 4) : (i++) { s = s + x; } @outputln(1, s); return s; };", expected_output="20", expected_exit_code=20)
+
+    def test_stack_slot_forwarding(self):
+        # x = 7 is never read, the loads of x come straight from the stores, and p& still has to see the last one
+        run_test("const id := fn (v: int!) int! { return v; }; const main := fn () int! { have x: int! = 5; have p: *int! = &x; have a: int! = x; x = 7; x = 9; have b: int! = id(x); have c: int! = p&; @outputln(1, a, \" \", b, \" \", c); return a + b + c; };", expected_output="5 9 9", expected_exit_code=23)
+
+    def test_common_subexpressions(self):
+        # a[j] is worked out three times per iteration, a * b once before the branch and twice after it
+        run_test("const main := fn () int! { have a: [3]int! = [5, 6, 7]; have s: int! = 0; loop (j = 0; j < 3) : (j++) { if (a[j] > 5) { s = s + a[j] * a[j]; } s = s + a[j]; } @outputln(1, s, \" \", a[1] + a[1]); return s; };", expected_output="103 12", expected_exit_code=103)
+        run_test("const f := fn (a: int!, b: int!, n: int!) int! { have s: int! = 0; loop (i = 0; i < n) : (i++) { if (a * b > i) { s = s + a * b; } s = s + b * a - i; } return s; }; const main := fn () int! { return f(2, 3, 4); };", expected_exit_code=42)
+
+    def test_nested_binary_operands(self):
+        # Both sides of each + and - need somewhere to put their left half while the right half is worked out
+        run_test("const f := fn (a: int!, b: int!, c: int!, d: int!, e: int!) int! { @outputln(1, (a * b * c) + (d * e), \" \", (a + b) * (c + d) - e % 4); return a * b - (c - d * (e - a)); }; const main := fn () int! { return f(2, 3, 4, 5, 6) % 256; };", expected_output="54 43", expected_exit_code=22)
+
+    def test_strength_reduction(self):
+        # Multiplies and divides by constants come out as shifts, leas and magic numbers instead of imul and div
+        run_test("const main := fn () int! { have s: int! = 0; have t: int? = 0; loop (i = 0; i < 100) : (i++) { s = (s * 31 + i) % 1009; t = t + (0 - i) / 10 + i * 9; } return s + @cast<int!>(t % 7); };", expected_exit_code=161)
+
+    def test_instruction_selection(self):
+        # Cheap ifs come out as cmov, `a + i * 8 + 16` as one lea and `a == 0` as test + sete
+        run_test("const max := fn (a: int?, b: int?) int? { if (a > b) { return a; } return b; }; const pick := fn (a: int?, b: int?) int? { have r: int? = b; if (a < b) { r = a; } return r; }; const idx := fn (a: int!, i: int!) int! { return a + i * 8 + 16; }; const isz := fn (a: int?) bool { return a == 0; }; const main := fn () int! { have s: int! = 0; loop (i = 0; i < 10) : (i++) { s = s + idx(i, 3) + @cast<int!>(max(@cast<int?>(i), 4) + pick(@cast<int?>(i), 5)); if (isz(@cast<int?>(i))) { s++; } } return s % 256; };", expected_exit_code=24)
+
+    def test_match_dispatch(self):
+        # 0-5 is a jump table (with a hole at 4), 1000-1004 another one, and the rest a binary search around them
+        run_test("const f := fn (x: int!) int! { match (x) { case 0 -> { return 10; } case 1 -> { return 11; } case 2 -> { return 12; } case 3 -> { return 13; } case 5 -> { return 15; } case 100 -> { return 20; } case 1000 -> { return 21; } case 1001 -> { return 22; } case 1002 -> { return 23; } case 1004 -> { return 24; } case 5000 -> { return 25; } case 70000 -> { return 26; } default -> { return 99; } } return 0; }; const main := fn () int! { have s: int! = 0; loop (i = 0; i < 1010) : (i++) { s = s * 3 + f(i); s = s % 100003; } s = s + f(5000) + f(70000) + f(69999) + f(0 - 1); return s % 256; };", expected_exit_code=6)
+
+    def test_match_strings(self):
+        # By length, then by the byte that tells them apart, then one compare. The second "get" never wins
+        run_test("const route := fn (p: str) int! { match (p) { case \"get\" -> { return 1; } case \"post\" -> { return 2; } case \"put\" -> { return 3; } case \"delete\" -> { return 4; } case \"\" -> { return 8; } case \"a/very/long/path/for/routing\" -> { return 10; } case \"a/very/long/path/for/routinG\" -> { return 11; } case \"get\" -> { return 13; } default -> { return 50; } } return 0; }; const main := fn () int! { return route(\"get\") + route(\"post\") * 2 + route(\"put\") * 3 + route(\"delete\") * 4 + route(\"\") * 5 + route(\"a/very/long/path/for/routinG\") + route(\"pot\") + route(\"a/very/long/path/for/routinx\"); };", expected_exit_code=181)
+
+    def test_rotated_loops(self):
+        # Test at the bottom: continue still has to run the step, and break/continue find their own loop
+        run_test("const count := fn (n: int!) int! { have s: int! = 0; loop (i = 0; i < n) : (i++) { if (i == 3) { continue; } if (i > 100) { return 0; } s = s + i; } return s; }; const main := fn () int! { have s: int! = 0; have t: int! = 0; loop (i = 0; i < 20) : (i++) { if (i % 2 == 1) { continue; } loop (j = 0; j < 10) : (j++) { if (j == 4) { break; } t = t + j; } if (i == 16) { break; } s = s + i; } have w: int! = 0; loop (true) { w = w + 1; if (w == 7) { break; } } loop (false) { w = 0; } return s + t + w + count(6) + count(0); };", expected_exit_code=129)
+
+    def test_loop_invariants_and_inductions(self):
+        # n * m leaves the loop, i * 12 and i * m + 7 become counters of their own, and f's i goes away
+        run_test("const f := fn (n: int!, m: int!) int! { have s: int! = 0; loop (i = 0; i < 100) : (i++) { s = s + i * 12 + n * m; } return s; }; const g := fn (n: int!, m: int!) int! { have s: int! = 0; loop (i = 0; i < n) : (i++) { s = s + (i * m + 7); s = s % 1000003; } return s; }; const h := fn (n: int!) int! { have s: int! = 0; loop (i = 3; i <= n) : (i += 2) { s = s + i * 7 - 5; } return s; }; const main := fn () int! { return (f(3, 4) + g(50, 11) + h(21)) % 256; };", expected_exit_code=207)
+
+    def test_unrolled_loops(self):
+        # Fully unrolled (constant 16 trips), unrolled by 8 with a leftover loop (runtime bound), @unroll(4) with leftovers, and @unroll(1)
+        run_test("const sum := fn (n: int!) int! { have s: int! = 0; loop (i = 0; i < n) : (i++) { s = s + i * 3; } return s; }; const down := fn (n: int!) int! { have s: int! = 0; loop (i = 100; i >= n) : (i -= 3) { have t: int! = i + 1; s = s + t; } return s; }; const main := fn () int! { have buf: [16]int! = [0, 1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225]; have total: int! = 0; loop (i = 0; i < 16) : (i++) { total = total + buf[i]; } have c: int! = 0; @unroll(4) loop (j = 1; j <= 30) : (j += 2) { c = c + j; } @unroll(1) loop (j = 0; j < 5) : (j++) { c = c + 1; } have r: int! = total + c + sum(7) + sum(1) + sum(0) + down(50) + down(101); @outputln(1, total, \" \", c, \" \", sum(7), \" \", sum(13), \" \", down(50), \" \", down(0)); return r % 256; };", expected_output="1240 230 63 234 1309 1751", expected_exit_code=26)
+
+    def test_vectorized_loops(self):
+        # A sum, a map with a broadcast k, a count and a search, 2 ints at a time with a scalar loop for the rest (n = 7 and 1 leave some over)
+        run_test("const scan := fn (n: int!) int! { have a: [20]int! = [0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]; have b: [20]int! = [0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]; loop (i = 0; i < 20) : (i++) { a[i] = (i * 7) % 11; } have s: int! = 0; loop (i = 0; i < n) : (i++) { s = s + a[i]; } have k: int! = 3; loop (i = 0; i < n) : (i++) { b[i] = a[i] * 4 + k; } have c: int! = 0; loop (i = 0; i < n) : (i++) { if (a[i] == 9) { c = c + 1; } } have at: int! = 99; loop (i = 0; i < n) : (i++) { if (b[i] == 31) { at = i; } } @outputln(1, s, \" \", b[n - 1], \" \", c, \" \", at); return s; }; const main := fn () int! { have r: int! = scan(20) + scan(7) + scan(1); return r % 256; };", expected_output="98 7 2 12\n37 39 1 1\n0 3 0 99", expected_exit_code=135)
+
+    def test_stack_arguments(self):
+        # 8 args (the last 2 on the stack), one of them another call; and a leaf whose frame doesn't fit in the red zone
+        run_test("const many := fn (a: int!, b: int!, c: int!, d: int!, e: int!, f: int!, g: int!, h: int!) int! { return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h; }; const big := fn (n: int!) int! { have a: [20]int! = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20]; a[n] = 100; have s: int! = 0; loop (i = 0; i < 20) : (i++) { s = s + a[i]; } return s; }; const main := fn () int! { have n: int! = @getArgc(); return (many(n, n, n, n, n, n, many(n, n, n, n, n, n, n, n), n) + big(n)) % 256; };", expected_exit_code=60)
+
+    def test_tail_calls(self):
+        # A million deep without a stack to match, and a sibling call that passes its arguments on rotated
+        run_test("const pick := fn (a: int!, b: int!, c: int!, d: int!, e: int!, f: int!) int! { return a * 100000 + b * 10000 + c * 1000 + d * 100 + e * 10 + f; }; const rotate := fn (a: int!, b: int!, c: int!, d: int!, e: int!, f: int!) int! { @tailcall return pick(f, a, b, c, d, e); }; const sum := fn (n: int!, acc: int!) int! { if (n == 0) { return acc; } return sum(n - 1, acc + n); }; const main := fn () int! { have n: int! = @getArgc(); have r: int! = rotate(n, n + 1, n + 2, n + 3, n + 4, n + 5); have s: int! = sum(n * 1000000, 0); return (r % 200) + (s % 7); };", expected_exit_code=146)
+
+    def test_stack_slots(self):
+        # Bools packed below the ints, and locals of sibling blocks sharing one slot
+        run_test("const mix := fn (n: int!) int! { have big: bool = n > 3; have odd: bool = n % 2 == 1; have r: int! = 0; if (big) { have a: int! = n * 3; have b: int! = a + 1; r = r + a * b; } else { have c: int! = n + 10; r = r + c; } loop (i = 0; i < n) : (i++) { have sq: int! = i * i; have small: bool = sq < 10; if (small) { r = r + sq; } } if (odd) { have d: int! = r / 2; r = r + d; } if (big) { r = r + 1; } @output(1, r, \" \"); return r; }; const main := fn () int! { have n: int! = @getArgc(); return (mix(n) + mix(n + 4) + mix(n + 5)) % 256; };", expected_output="357 382 16", expected_exit_code=243)
+
+    def test_profile_guided(self):
+        # The same answers with the counters in, and again laid out by the profile they wrote to main.zprof
+        code = "const classify := fn (x: int!) int! { match (x % 8) { case 0 -> { return 5; } case 1 -> { return 7; } case 2 -> { return 11; } case 3 -> { return 13; } case 4 -> { return 17; } case 5 -> { return 19; } default -> { return 1; } } return 0; }; const step := fn (x: int!) int! { if (x < 0) { return 0 - x; } if (x % 3 == 0) { return x / 3; } else { return x * 2 + 1; } }; const report := fn (n: int!) int! { have s: int! = 0; loop (i = 0; i < n) : (i++) { if (i > 100000) { @output(1, \"never \"); s = s - 1; } else { s = s + classify(i * 8) + step(i); } } @output(1, s, \" \"); return s; }; const main := fn () int! { have argc: int! = @getArgc(); have n: int! = argc * 1000; have r: int! = report(n) + report(n + 7); @outputln(1, \"done\"); return r % 256; };"
+        try:
+            run_test(code, expected_output="737348 726611 done", expected_exit_code=151, flags=["-profile-generate"])
+            assert os.path.getsize("main.zprof") > 24, "Expected the counters in main.zprof"
+            run_test(code, expected_output="737348 726611 done", expected_exit_code=151, flags=["-profile-use"])
+        finally:
+            if os.path.exists("main.zprof"): os.remove("main.zprof")
+
+    def test_float_folding(self):
+        run_test("const main := fn () int! { have x: float = 1.5 * 2.0 + @cast<float>(3); return @cast<int!>(x); };", expected_exit_code=6)
+
     def test_add_negatives(self):
         run_test("const main := fn () int! { have x: int? = -4; return 7 + x; };", expected_exit_code=3)
     
@@ -76,6 +161,12 @@ class TestZuraPrograms(unittest.TestCase):
     def test_function_returning_parameter(self):
         run_test("const foo := fn (a: int!, b: int!) int { return b; }; const main := fn () int! { return foo(83, 40); };", expected_exit_code=40)
     
+    def test_inline_early_return(self):
+        run_test("const clamp := @inline fn (v: int!, hi: int!) int! { if (v > hi) { return hi; } return v; }; const main := fn () int! { have a: int! = clamp(50, 9); have b: int! = clamp(a, 20); return a + b; };", expected_exit_code=18)
+
+    def test_compile_time_call(self):
+        run_test("const collatz := fn (n: int!) int! { have steps: int! = 0; loop (n != 1) { if (n % 2 == 0) { n = n / 2; } else { n = 3 * n + 1; } steps = steps + 1; } return steps; }; const main := fn () int! { have table: [10]int! = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]; return collatz(27) - table[9]; };", expected_exit_code=101)
+
     def test_for_loop(self):
         run_test("const main := fn () int! { have a: int! = 0; loop (i = 0; i < 10) : (i++) { a = a + 1; } return a; };", expected_exit_code=10)
 
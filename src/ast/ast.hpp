@@ -103,6 +103,7 @@ public:
     NodeKind kind;
     size_t file_id;
     Type *asmType;
+    int registerNeed = 0; // Sethi-Ullman number, codegen fills it in the first time it asks
     virtual void debug(int ident = 0) const = 0;
     virtual ~Expr() = default;
   };
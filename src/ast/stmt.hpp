@@ -235,6 +235,9 @@ public:
   bool isMain = false;
   bool isEntry = false;
   bool isTemplate = false;
+  // @inline / @noinline; Auto leaves it up to the inliner's cost model
+  enum class Inline { Auto, Always, Never };
+  Inline inlineHint = Inline::Auto;
 
   FnStmt(int line, int pos, std::string name,
          std::vector<std::pair<IdentExpr *, Node::Type *>> params,
@@ -291,6 +294,8 @@ class ReturnStmt : public Node::Stmt {
 public:
   int line, pos;
   Node::Expr *expr;
+  // @tailcall; it's a compile error if the call can't be turned into a jump (see optimizer/tailcall.hpp)
+  bool isTailCall = false;
 
   ReturnStmt(int line, int pos, Node::Expr *expr, size_t file = 0)
       : line(line), pos(pos), expr(expr) {
@@ -438,6 +443,10 @@ public:
   Node::Expr *condition;
   Node::Expr *optional;
   Node::Stmt *block;
+  // @unroll(n); -1 leaves it up to the unroller, 0 and 1 mean leave it alone
+  int unroll = -1;
+  // The vectorizer wants this one (see optimizer/vectorize.hpp), so the unroller keeps its hands off
+  bool vectorize = false;
 
   ForStmt(int line, int pos, std::string name, Node::Expr *forLoop,
           Node::Expr *condition, Node::Expr *optional, Node::Stmt *block,
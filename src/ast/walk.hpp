@@ -0,0 +1,273 @@
+#pragma once
+
+#include <functional>
+
+#include "expr.hpp"
+#include "stmt.hpp"
+
+// Generic "visit my direct children" helpers for the AST.
+// The whole-program passes (call graph, inliner, ...) need to see every child of every node,
+// and writing that switch over and over is how one of them ends up forgetting @memcpy.
+//
+// The callbacks get a *reference* to the child pointer, so a pass can swap a node out in place.
+// Null children (no else branch, `return;`, `have x: int;`) are skipped.
+// Both functions return false if they hit a node kind they don't know about, so a pass that
+// needs to be conservative can bail out instead of silently missing something.
+namespace Walk {
+using ExprFn = std::function<void(Node::Expr *&)>;
+using StmtFn = std::function<void(Node::Stmt *&)>;
+
+inline bool children(Node::Expr *expr, const ExprFn &onExpr) {
+  auto visit = [&](Node::Expr *&child) {
+    if (child != nullptr) onExpr(child);
+  };
+  switch (expr->kind) {
+    case ND_INT:
+    case ND_FLOAT:
+    case ND_IDENT:
+    case ND_STRING:
+    case ND_CHAR:
+    case ND_BOOL:
+    case ND_NULL:
+    case ND_GETARGC:
+    case ND_GETARGV:
+    case ND_ARRAY_AUTO_FILL:
+      return true;
+    case ND_BINARY: {
+      BinaryExpr *e = static_cast<BinaryExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_UNARY: visit(static_cast<UnaryExpr *>(expr)->expr); return true;
+    case ND_PREFIX: visit(static_cast<PrefixExpr *>(expr)->expr); return true;
+    case ND_POSTFIX: visit(static_cast<PostfixExpr *>(expr)->expr); return true;
+    case ND_GROUP: visit(static_cast<GroupExpr *>(expr)->expr); return true;
+    case ND_CAST: visit(static_cast<CastExpr *>(expr)->castee); return true;
+    case ND_ADDRESS: visit(static_cast<AddressExpr *>(expr)->right); return true;
+    case ND_DEREFERENCE: visit(static_cast<DereferenceExpr *>(expr)->left); return true;
+    case ND_ALLOC_MEMORY: visit(static_cast<AllocMemoryExpr *>(expr)->bytesToAlloc); return true;
+    case ND_SIZEOF: visit(static_cast<SizeOfExpr *>(expr)->whatToSizeOf); return true;
+    case ND_ARRAY:
+      for (Node::Expr *&elem : static_cast<ArrayExpr *>(expr)->elements) visit(elem);
+      return true;
+    case ND_INDEX: {
+      IndexExpr *e = static_cast<IndexExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_POP: {
+      PopExpr *e = static_cast<PopExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_PUSH: {
+      PushExpr *e = static_cast<PushExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      visit(e->index);
+      return true;
+    }
+    case ND_ASSIGN: {
+      AssignmentExpr *e = static_cast<AssignmentExpr *>(expr);
+      visit(e->assignee);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_CALL: {
+      CallExpr *e = static_cast<CallExpr *>(expr);
+      visit(e->callee);
+      for (Node::Expr *&arg : e->args) visit(arg);
+      return true;
+    }
+    case ND_TEMPLATE_CALL: {
+      TemplateCallExpr *e = static_cast<TemplateCallExpr *>(expr);
+      visit(e->callee);
+      visit(e->args);
+      return true;
+    }
+    case ND_EXTERNAL_CALL:
+      for (Node::Expr *&arg : static_cast<ExternalCall *>(expr)->args) visit(arg);
+      return true;
+    case ND_TERNARY: {
+      TernaryExpr *e = static_cast<TernaryExpr *>(expr);
+      visit(e->condition);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_MEMBER: {
+      MemberExpr *e = static_cast<MemberExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_RESOLUTION: {
+      ResolutionExpr *e = static_cast<ResolutionExpr *>(expr);
+      visit(e->lhs);
+      visit(e->rhs);
+      return true;
+    }
+    case ND_STRUCT:
+      for (auto &pair : static_cast<StructExpr *>(expr)->values) visit(pair.second);
+      return true;
+    case ND_FREE_MEMORY: {
+      FreeMemoryExpr *e = static_cast<FreeMemoryExpr *>(expr);
+      visit(e->whatToFree);
+      visit(e->bytesToFree);
+      return true;
+    }
+    case ND_MEMCPY_MEMORY: {
+      MemcpyExpr *e = static_cast<MemcpyExpr *>(expr);
+      visit(e->dest);
+      visit(e->src);
+      visit(e->bytes);
+      return true;
+    }
+    case ND_OPEN: {
+      OpenExpr *e = static_cast<OpenExpr *>(expr);
+      visit(e->filename);
+      visit(e->canRead);
+      visit(e->canWrite);
+      visit(e->canCreate);
+      return true;
+    }
+    case ND_STRCMP: {
+      StrCmp *e = static_cast<StrCmp *>(expr);
+      visit(e->v1);
+      visit(e->v2);
+      return true;
+    }
+    case ND_SOCKET: {
+      SocketExpr *e = static_cast<SocketExpr *>(expr);
+      visit(e->domain);
+      visit(e->socketType);
+      visit(e->protocol);
+      return true;
+    }
+    case ND_BIND: {
+      BindExpr *e = static_cast<BindExpr *>(expr);
+      visit(e->socket);
+      visit(e->structPtr);
+      visit(e->structSize);
+      return true;
+    }
+    case ND_LISTEN: {
+      ListenExpr *e = static_cast<ListenExpr *>(expr);
+      visit(e->socket);
+      visit(e->backlog);
+      return true;
+    }
+    case ND_ACCEPT: {
+      AcceptExpr *e = static_cast<AcceptExpr *>(expr);
+      visit(e->socketFd);
+      visit(e->structPtr);
+      visit(e->structSize);
+      return true;
+    }
+    case ND_RECV: {
+      RecvExpr *e = static_cast<RecvExpr *>(expr);
+      visit(e->socketFd);
+      visit(e->buffer);
+      visit(e->length);
+      visit(e->flags);
+      return true;
+    }
+    case ND_SEND: {
+      SendExpr *e = static_cast<SendExpr *>(expr);
+      visit(e->socketFd);
+      visit(e->buffer);
+      visit(e->length);
+      visit(e->flags);
+      return true;
+    }
+    case ND_COMMAND:
+      for (Node::Expr *&arg : static_cast<CommandExpr *>(expr)->args) visit(arg);
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline bool children(Node::Stmt *stmt, const ExprFn &onExpr, const StmtFn &onStmt) {
+  auto visitE = [&](Node::Expr *&child) {
+    if (child != nullptr) onExpr(child);
+  };
+  auto visitS = [&](Node::Stmt *&child) {
+    if (child != nullptr) onStmt(child);
+  };
+  switch (stmt->kind) {
+    case ND_LINK_STMT:
+    case ND_EXTERN_STMT:
+    case ND_BREAK_STMT:
+    case ND_CONTINUE_STMT:
+    case ND_ENUM_STMT:
+      return true;
+    case ND_PROGRAM:
+      for (Node::Stmt *&s : static_cast<ProgramStmt *>(stmt)->stmt) visitS(s);
+      return true;
+    case ND_EXPR_STMT: visitE(static_cast<ExprStmt *>(stmt)->expr); return true;
+    case ND_CONST_STMT: visitS(static_cast<ConstStmt *>(stmt)->value); return true;
+    case ND_VAR_STMT: visitE(static_cast<VarStmt *>(stmt)->expr); return true;
+    case ND_RETURN_STMT: visitE(static_cast<ReturnStmt *>(stmt)->expr); return true;
+    case ND_FN_STMT: visitS(static_cast<FnStmt *>(stmt)->block); return true;
+    case ND_IMPORT_STMT: visitS(static_cast<ImportStmt *>(stmt)->stmt); return true;
+    case ND_CLOSE: visitE(static_cast<CloseStmt *>(stmt)->fd); return true;
+    case ND_BLOCK_STMT:
+      for (Node::Stmt *&s : static_cast<BlockStmt *>(stmt)->stmts) visitS(s);
+      return true;
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *&s : static_cast<StructStmt *>(stmt)->stmts) visitS(s);
+      return true;
+    case ND_PRINT_STMT: {
+      OutputStmt *s = static_cast<OutputStmt *>(stmt);
+      visitE(s->fd);
+      for (Node::Expr *&arg : s->args) visitE(arg);
+      return true;
+    }
+    case ND_IF_STMT: {
+      IfStmt *s = static_cast<IfStmt *>(stmt);
+      visitE(s->condition);
+      visitS(s->thenStmt);
+      visitS(s->elseStmt);
+      return true;
+    }
+    case ND_WHILE_STMT: {
+      WhileStmt *s = static_cast<WhileStmt *>(stmt);
+      visitE(s->condition);
+      visitE(s->optional);
+      visitS(s->block);
+      return true;
+    }
+    case ND_FOR_STMT: {
+      ForStmt *s = static_cast<ForStmt *>(stmt);
+      visitE(s->forLoop);
+      visitE(s->condition);
+      visitE(s->optional);
+      visitS(s->block);
+      return true;
+    }
+    case ND_MATCH_STMT: {
+      MatchStmt *s = static_cast<MatchStmt *>(stmt);
+      visitE(s->coverExpr);
+      for (auto &c : s->cases) {
+        visitE(c.first);
+        visitS(c.second);
+      }
+      visitS(s->defaultCase);
+      return true;
+    }
+    case ND_INPUT_STMT: {
+      InputStmt *s = static_cast<InputStmt *>(stmt);
+      visitE(s->fd);
+      visitE(s->bufferOut);
+      visitE(s->maxBytes);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+} // namespace Walk
@@ -3,7 +3,7 @@
 
 #include "../typeChecker/type.hpp"
 #include "gen.hpp"
-#include "optimizer/compiler.hpp"
+#include "optimizer/callgraph.hpp"
 #include "optimizer/instr.hpp"
 
 void codegen::print(Node::Stmt *stmt) {
@@ -14,7 +14,7 @@ void codegen::print(Node::Stmt *stmt) {
   pushDebug(print->line, stmt->file_id);
 
   for (Node::Expr *arg : print->args) {
-    Node::Expr *optimizedArg = CompileOptimizer::optimizeExpr(arg);
+    Node::Expr *optimizedArg = arg;
     std::string argType = TypeChecker::type_to_string(optimizedArg->asmType);
     if (optimizedArg->kind == ND_INT || optimizedArg->kind == ND_BOOL ||
                optimizedArg->kind == ND_CHAR ||
@@ -45,6 +45,9 @@ void codegen::importDecl(Node::Stmt *stmt) {
   // Keep track of its imports to ensure there are no circular dependencies.
 
   ImportStmt *s = static_cast<ImportStmt *>(stmt);
+  // Only functions nobody calls? Then there's nothing to import
+  if (!CallGraph::isImportLive(s))
+    return;
   push(Instr{.var = Comment{.comment = "Import file '" + s->name + "'."},
              .type = InstrType::Comment},
        Section::Main);
@@ -310,29 +313,9 @@ void codegen::externalCall(Node::Expr *expr) {
   // ... Minus the "usr_" prefix
   ExternalCall *e = static_cast<ExternalCall *>(expr);
   pushDebug(e->line, expr->file_id, e->pos);
-  // Push each argument one by one.
-  int intArgCount = 0;
-  int floatArgCount = 0;
-  for (size_t i = 0; i < e->args.size(); i++) {
-    // evaluate them
-    visitExpr(e->args.at(i));
-    if (getUnderlying(e->args[i]->asmType) == "float" &&
-        e->args[i]->asmType->kind == ND_SYMBOL_TYPE) {
-      popToRegister(floatArgOrder[floatArgCount++]);
-    } else {
-      popToRegister(intArgOrder[intArgCount++]);
-    }
-  }
-  // Call the function
-  push(Instr{.var =
-                 CallInstr{
-                     .name =
-                         e->name +
-                         "@PLT"}, // the @PLT is for dynamic linking where the
-                                  // function is not in defined in this current
-                                  // asm file and is imported elsewhere
-             .type = InstrType::Call},
-       Section::Main);
+  // Same convention as C, so C functions don't need anything in between.
+  // The @PLT is for dynamic linking, where the function isn't defined in this asm file but imported from elsewhere
+  callFunction(e->name + "@PLT", passArguments(e->args, nullptr, true));
   pushRegister("%rax");
 }
 
@@ -465,24 +448,10 @@ void codegen::strcmp(Node::Expr *expr) {
   popToRegister("%rsi");
 
   // call the native strcmp function
-  // Subtract variable count before call because of course we do
-  long long offsetAmount = round(variableCount - 8, 8);
-  if (offsetAmount)
-    push(Instr{.var = SubInstr{.lhs = "%rsp",
-                               .rhs = "$" + std::to_string(offsetAmount),
-                               .size = DataSize::Qword},
-               .type = InstrType::Sub},
-         Section::Main);
   push(
       Instr{.var = CallInstr{.name = "native_strcmp"}, .type = InstrType::Call},
       Section::Main);
   nativeFunctionsUsed[NativeASMFunc::strcmp] = true;
-  if (offsetAmount)
-    push(Instr{.var = AddInstr{.lhs = "%rsp",
-                               .rhs = "$" + std::to_string(offsetAmount),
-                               .size = DataSize::Qword},
-               .type = InstrType::Sub},
-         Section::Main);
   // The return value is in %rax, so we can just push it
   push(Instr{.var =
                  PushInstr{
@@ -666,24 +635,9 @@ void codegen::commandExpr(Node::Expr *expr) {
   popToRegister("%rdx"); // This will be the third argument to native_system
 
   // 3. Call the native system function
-  long long offsetAmount = round(variableCount - 8, 8);
-  if (offsetAmount)
-    push(Instr{.var = SubInstr{.lhs = "%rsp",
-                               .rhs = "$" + std::to_string(offsetAmount),
-                               .size = DataSize::Qword},
-               .type = InstrType::Sub},
-         Section::Main);
-
   push(Instr{.var = CallInstr{.name = "native_system"}, .type = InstrType::Call}, Section::Main);
   nativeFunctionsUsed[NativeASMFunc::system] = true;
 
-  if (offsetAmount)
-    push(Instr{.var = AddInstr{.lhs = "%rsp",
-                               .rhs = "$" + std::to_string(offsetAmount),
-                               .size = DataSize::Qword},
-               .type = InstrType::Add},
-         Section::Main);
-
   // 4. Push return value (if any)
   push(Instr{.var = PushInstr{.what = "%rax", .whatSize = DataSize::Qword},
              .type = InstrType::Push},
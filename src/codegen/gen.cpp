@@ -2,7 +2,9 @@
 #include "../common.hpp"
 
 #include "gen.hpp"
-#include "optimizer/optimize.hpp"
+#include "ir/builder.hpp"
+#include "optimizer/passes.hpp"
+#include "optimizer/profile.hpp"
 #include "optimizer/stringify.hpp"
 #include <cstdlib>
 #include <fstream>
@@ -28,12 +30,10 @@ void codegen::gen(Node::Stmt *stmt, bool isSaved, std::string output_filename,
   std::string input_dir = input_path.parent_path().string();
   std::string input_file = input_path.filename().string();
   // stmt->debug();
+  PassManager::runAst(stmt);
+  ir::Builder::collect(stmt);
   visitStmt(stmt);
-
-  // Make 3 passes of optimization
-  text_section = Optimizer::optimizeInstrs(text_section);
-  text_section = Optimizer::optimizeInstrs(text_section);
-  text_section = Optimizer::optimizeInstrs(text_section);
+  PassManager::runMachine(text_section);
   
   // data section cannot be optimized
   // rodata section cant be optimized either
@@ -94,7 +94,8 @@ void codegen::gen(Node::Stmt *stmt, bool isSaved, std::string output_filename,
             "  leaq 8(%rsp), %rax\n"
             "  movq %rax, .Largv(%rip)\n"
             "  call main\n"
-            "  xorq %rdi, %rdi\n"
+         << (Profile::mode == Profile::Mode::Generate ? "  call native_zprof_write\n" : "")
+         << "  xorq %rdi, %rdi\n"
             "  movq $60, %rax\n"
             "  syscall\n"
             "  .cfi_endproc\n"
@@ -103,7 +104,8 @@ void codegen::gen(Node::Stmt *stmt, bool isSaved, std::string output_filename,
     file << "_start:\n"
             "  .cfi_startproc\n"
             "  call main\n"
-            "  xorq %rdi, %rdi\n"
+         << (Profile::mode == Profile::Mode::Generate ? "  call native_zprof_write\n" : "")
+         << "  xorq %rdi, %rdi\n"
             "  movq $60, %rax\n"
             "  syscall\n"
             "  .cfi_endproc\n"
@@ -277,6 +279,7 @@ void codegen::gen(Node::Stmt *stmt, bool isSaved, std::string output_filename,
             "  ret\n"
             ".size native_system, .-native_system\n";
   }
+  if (Profile::mode == Profile::Mode::Generate) file << Profile::runtime();
   if (debug) 
     file << ".Ldebug_text0:\n";
   if (head_section.size() > 0) {
@@ -294,6 +297,7 @@ void codegen::gen(Node::Stmt *stmt, bool isSaved, std::string output_filename,
             "\n.data\n";
     file << Stringifier::stringifyInstrs(data_section);
   }
+  if (Profile::mode == Profile::Mode::Generate) file << Profile::data();
 
   // DWARF debug yayy
   if (debug) {
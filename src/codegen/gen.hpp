@@ -39,11 +39,16 @@ void initMaps(void);
 
 // Start at one because retrieving 0(%rbp) results in unusual behavior
 inline int64_t variableCount = 8;
+// The deepest variableCount has gone in the function we're in, so the prologue can reserve all of it at once
+inline int64_t frameSize = 8;
 
 // String could be register (%rdi, %rdx, ...) or effective address (-8(%rbp), ...)
 inline std::unordered_map<std::string, std::string> variableTable = {};
+inline std::unordered_map<std::string, std::string> promotedLocals = {}; // name -> register, see optimizer/promote.hpp
+inline std::vector<std::pair<std::string, std::string>> savedRegisters = {}; // register -> where the prologue put it
 inline std::vector<size_t> stackSizesForScopes = {};  // wordy term for "when we start a scope, push its stack size"
 inline size_t stackSize = 0;
+inline size_t heldOperands = 0; // how many of handleBinaryExprs' holding registers are taken right now
 inline std::string insideStructName = "";
 
 inline bool useArguments = false;  // if calling @getArgc or @getArgv at any point in the program
@@ -67,6 +72,7 @@ void expr(Node::Stmt *stmt);
 void _break(Node::Stmt *stmt);
 void _continue(Node::Stmt *stmt);
 void _return(Node::Stmt *stmt);
+bool tailCall(ReturnStmt *stmt);
 void linkFile(Node::Stmt *stmt);
 void externName(Node::Stmt *stmt);
 void matchStmt(Node::Stmt *stmt);
@@ -115,6 +121,7 @@ using StructMember = std::pair<std::string, std::pair<Node::Type *, unsigned sho
 // <size, <StructMember>>
 using Struct = std::pair<unsigned short, std::vector<StructMember>>;
 inline std::set<std::string> enumTable = {};
+inline std::unordered_map<std::string, int64_t> enumValues = {}; // "enum_Color_Red" -> 0, for whoever needs the actual number
 inline std::unordered_map<std::string, Struct> structByteSizes = {};  // Name of a struct and its size in bytes
 
 void orderStructFields(std::unordered_map<std::string, Node::Expr *> &fields, std::string &structName, std::vector<std::pair<std::string, Node::Expr *>> *orderedFields);
@@ -254,12 +261,18 @@ inline std::vector<std::pair<size_t, int64_t>> scopes = {};
 inline unsigned char loopDepth = 0;
 inline std::vector<std::string> fileIDs = {};
 inline bool isEntryPoint = false;
+inline FnStmt *currentFunction = nullptr; // the one funcDecl is in the middle of
 inline size_t dieCount = 1;  // Labels! Labels galore! Im not counting bytes, man! Let LD do it !!!
 inline size_t howBadIsRbp = 0;
 inline size_t conditionalCount = 0;
 inline size_t stringCount = 0;
 inline size_t floatCount = 0;
+inline std::unordered_map<std::string, std::string> floatLabels = {}; // "f1.5" -> "float0"
 inline size_t loopCount = 0;
+inline std::vector<size_t> loopLabels = {}; // the loops we are inside of, innermost last (for break and continue)
+inline size_t matchLabelCount = 0; // jump tables and binary search nodes
+// Arms the profile says never ran, moved out of the way to the end of the function (see ifStmt)
+inline std::vector<Instr> coldCode = {};
 inline size_t arrayCount = 0;
 inline bool isUsingNewline = false;
 //                            idx    # ELEM
@@ -278,7 +291,21 @@ inline bool debug = false;
 
 // Function argument order
 inline static const std::vector<std::string> intArgOrder = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
-inline static const std::vector<std::string> floatArgOrder = {"%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5"};
+inline static const std::vector<std::string> floatArgOrder = {"%xmm0", "%xmm1", "%xmm2", "%xmm3",
+                                                               "%xmm4", "%xmm5", "%xmm6", "%xmm7"};
+
+// Where passArguments put everything, so callFunction knows what to clean up afterwards
+struct CallArguments {
+  long long stackBytes = 0; // stack arguments plus padding, popped off after the call
+  int floatCount = 0;       // how many went into xmm registers (%al, for variadic C functions)
+  std::string savedRsp;     // where %rsp went while we lined it up for C, if we did
+  int64_t slotsFrom = 0;    // variableCount before we borrowed any slots
+};
+// SysV: integers and pointers in intArgOrder, floats and doubles in floatArgOrder, the rest on the stack.
+// `self` (a method's struct) goes first, `isForeign` is for C functions
+CallArguments passArguments(const std::vector<Node::Expr *> &args, Node::Expr *self = nullptr, bool isForeign = false);
+void callFunction(const std::string &name, const CallArguments &args);
+void releaseSlots(int64_t to);
 
 // Helper functions for printing to the console
 void prepareSyscallWrite(void);
@@ -294,15 +321,16 @@ std::string addBackslashes(std::string str);
 void moveRegister(const std::string &dest, const std::string &src, DataSize dest_size, DataSize src_size);
 void popToRegister(const std::string &reg, DataSize regSize = DataSize::Qword);
 void pushRegister(const std::string &reg, DataSize regSize = DataSize::Qword);
-void handleBinaryExprs(int lhsDepth, int rhsDepth, std::string lhsReg, std::string rhsReg, Node::Expr *lhs, Node::Expr *rhs);
+void handleBinaryExprs(std::string lhsReg, std::string rhsReg, Node::Expr *lhs, Node::Expr *rhs);
 void pushDebug(size_t line, size_t file, long column = -1);
 void handleExitSyscall(void);
 void handleInputSyscall(void);
+void countProfile(Node::Stmt *stmt, size_t point); // bumps the -profile-generate counter, if it has one
 void handleReturnCleanup(void);
 
 // Helper for the if statement condition
 JumpCondition processComparison(Node::Expr *cond);
-int getExpressionDepth(Node::Expr *e);
+int registerNeed(Node::Expr *e);
 JumpCondition getOpposite(JumpCondition in);
 JumpCondition getJumpCondition(const std::string &op);
 
@@ -5,10 +5,11 @@
 #include "gen.hpp"
 #include "optimizer/compiler.hpp"
 #include "optimizer/instr.hpp"
+#include "optimizer/strength.hpp"
 
 void codegen::visitExpr(Node::Expr *expr) {
-  // Optimize the expression before we handle it!
-  Node::Expr *realExpr = CompileOptimizer::optimizeExpr(expr);
+  // Already folded by the pass manager, see passes.hpp
+  Node::Expr *realExpr = expr;
   if (int(realExpr->kind) > (int)NodeKind::ND_NULL) {  // im dumb ignore me i put
                                                        // the wrong sign :sob: ya
     std::cout << "stinky node D:"
@@ -103,14 +104,22 @@ void codegen::primary(Node::Expr *expr) {
     }
     case NodeKind::ND_FLOAT: {
       FloatExpr *floating = static_cast<FloatExpr *>(expr);
-      std::string label = "float" + std::to_string(floatCount++);
+      bool isDouble = CompileOptimizer::isDoubleType(floating->asmType);
+      DataSize size = isDouble ? DataSize::SD : DataSize::SS;
       pushDebug(floating->line, expr->file_id, floating->pos);
 
+      // Every constant only needs to live in the rodata once, no matter how many times it is used
+      std::string key = (isDouble ? "d" : "f") + floating->value;
+      bool isNew = !floatLabels.contains(key);
+      if (isNew) floatLabels[key] = "float" + std::to_string(floatCount++);
+      std::string label = floatLabels[key];
+
       // Push the label onto the stack
-      moveRegister("%xmm0", label + "(%rip)", DataSize::SS, DataSize::SS);
-      push(Instr{.var = PushInstr{.what = "%xmm0", .whatSize = DataSize::SS},
+      moveRegister("%xmm0", label + "(%rip)", size, size);
+      push(Instr{.var = PushInstr{.what = "%xmm0", .whatSize = size},
                  .type = InstrType::Push},
            Section::Main);
+      if (!isNew) break;
 
       // define the string in the data section
       push(Instr{.var = Label{.name = label}, .type = InstrType::Label},
@@ -122,7 +131,7 @@ void codegen::primary(Node::Expr *expr) {
            Section::ReadonlyData);
       push(Instr{.var =
                      DataSectionInstr{
-                         .bytesToDefine = DataSize::SS /* long, aka 32-bits */,
+                         .bytesToDefine = size /* .float or .double */,
                          .what = floating->value},
                  .type = InstrType::DB},
            Section::ReadonlyData);
@@ -148,6 +157,55 @@ void codegen::primary(Node::Expr *expr) {
   }
 }
 
+// `x * 10`, `x / 10` and `x % 10` never need 10 in a register, and usually don't need imul or div either.
+// See optimizer/strength.hpp. False if it didn't apply, and then nothing was emitted.
+static bool reduceBinary(BinaryExpr *e, const std::string &op, const std::string &lhsReg, DataSize size, bool isSigned) {
+  bool isMultiply = op == "imul";
+  if (!isMultiply && op != "idiv" && op != "div" && op != "mod") return false;
+  Node::Expr *constant = e->rhs->kind == ND_INT ? e->rhs : isMultiply && e->lhs->kind == ND_INT ? e->lhs : nullptr;
+  if (constant == nullptr) return false;
+  Node::Expr *other = constant == e->rhs ? e->lhs : e->rhs;
+  long long by = static_cast<IntExpr *>(constant)->value;
+  int bytes = static_cast<int>(codegen::getByteSizeOfType(e->asmType));
+
+  std::vector<Instr> code;
+  auto emit = [&](Instr instr) { code.push_back(instr); };
+  if (isMultiply ? !StrengthReduce::multiply(Reg::Rax, by, bytes, Reg::Rbx, emit)
+                 : !StrengthReduce::divide(by, bytes, isSigned, op == "mod", Reg::Rcx, emit))
+    return false;
+
+  codegen::visitExpr(other);
+  codegen::popToRegister(lhsReg, size);
+  if (!isMultiply) {
+    // Division works on all 64 bits, so they had better mean the same thing as the `bytes` we have
+    auto extend = [&](const std::string &how) {
+      codegen::push(Instr{.var = BinaryInstr{.op = how, .src = lhsReg, .dst = how == "movl" ? lhsReg : "%rax"}, .type = InstrType::Binary},
+                    codegen::Section::Main);
+    };
+    switch (size) {
+      case DataSize::Byte: extend(isSigned ? "movsbq" : "movzbq"); break;
+      case DataSize::Word: extend(isSigned ? "movswq" : "movzwq"); break;
+      case DataSize::Dword: extend(isSigned ? "movslq" : "movl"); break; // writing %eax clears the top half
+      default: break;
+    }
+  }
+  for (Instr &instr : code) codegen::push(instr, codegen::Section::Main);
+  codegen::push(Instr{.var = PushInstr{.what = lhsReg, .whatSize = size}, .type = InstrType::Push}, codegen::Section::Main);
+  return true;
+}
+
+// `base + %rdi * size` as one address. The scale does 1, 2, 4 and 8 on its own, so any other size
+// leaves its power of two to the scale and only multiplies %rdi by what's left (usually an lea, not an imul)
+static std::string indexAddress(const std::string &base, long long size) {
+  int scale = size % 8 == 0 ? 8 : size % 4 == 0 ? 4 : size % 2 == 0 ? 2 : 1;
+  long long rest = size / scale;
+  auto emit = [](Instr instr) { codegen::push(instr, codegen::Section::Main); };
+  if (rest != 1 && !StrengthReduce::multiply(Reg::Rdi, rest, 8, Reg::Rax, emit))
+    emit(Instr{.var = BinaryInstr{.op = "imul", .src = "$" + std::to_string(rest), .dst = "%rdi"}, .type = InstrType::Binary});
+  if (scale == 1) return "(" + base + ", %rdi)";
+  return "(" + base + ", %rdi, " + std::to_string(scale) + ")";
+}
+
 void codegen::binary(Node::Expr *expr) {
   BinaryExpr *e = static_cast<BinaryExpr *>(expr);
   pushDebug(e->line, expr->file_id, e->pos);
@@ -182,17 +240,16 @@ void codegen::binary(Node::Expr *expr) {
 
   // TODO: Replace with "isIntBasedType" Function
   if (TypeChecker::isIntBasedType(returnType)) {
-    int lhsDepth = getExpressionDepth(e->lhs);
-    int rhsDepth = getExpressionDepth(e->rhs);
-    handleBinaryExprs(lhsDepth, rhsDepth, lhsReg, rhsReg, e->lhs, e->rhs);
+    std::string op = lookup(opMap, e->op);
+    // We cannot check the result of the division, as a (neg / neg = pos) and that would ruin this
+    bool isSignedOp = (static_cast<SymbolType *>(e->lhs->asmType))->signedness == SymbolType::Signedness::SIGNED ||
+                      (static_cast<SymbolType *>(e->rhs->asmType))->signedness == SymbolType::Signedness::SIGNED;
+    if (reduceBinary(e, op, lhsReg, size, isSignedOp)) return;
+    handleBinaryExprs(lhsReg, rhsReg, e->lhs, e->rhs);
 
     // Perform the operation
-    std::string op = lookup(opMap, e->op);
     if (op == "idiv" || op == "div" || op == "mod") {
       // Division requires special handling because of RDX:RAX input (more precision or something)
-      // We cannot check the result of the division, as a (neg / neg = pos) and that would ruin this
-      bool isSignedOp = (static_cast<SymbolType *>(e->lhs->asmType))->signedness == SymbolType::Signedness::SIGNED ||
-                        (static_cast<SymbolType *>(e->rhs->asmType))->signedness == SymbolType::Signedness::SIGNED;
       if (isSignedOp) {
         // Although C likes making really stupid optimizations, technically, it works without them.
         switch (size) {
@@ -214,7 +271,7 @@ void codegen::binary(Node::Expr *expr) {
       } else {
         // it was unsigned so we have way less shit to worry about
         DataSize size2 = intDataToSize(getByteSizeOfType(returnType));
-        push(Instr{.var = XorInstr{.lhs = "%rdi", .rhs = "%rdi"}, .type = InstrType::Xor}, Section::Main);
+        push(Instr{.var = XorInstr{.lhs = "%rdx", .rhs = "%rdx"}, .type = InstrType::Xor}, Section::Main);
         push(Instr{.var = DivInstr{.from = rhsReg, .isSigned = false, .size = size2}, .type = InstrType::Div}, Section::Main);
       }
 
@@ -227,11 +284,11 @@ void codegen::binary(Node::Expr *expr) {
             push(Instr{.var = PushInstr{.what = "%dx", .whatSize = DataSize::Word}, .type = InstrType::Push}, Section::Main);
             break;
           case 4:
-            push(Instr{.var = PushInstr{.what = "%ebx", .whatSize = DataSize::Dword}, .type = InstrType::Push}, Section::Main);
+            push(Instr{.var = PushInstr{.what = "%edx", .whatSize = DataSize::Dword}, .type = InstrType::Push}, Section::Main);
             break;
           case 8:
           default:
-            push(Instr{.var = PushInstr{.what = "%rbx", .whatSize = DataSize::Qword}, .type = InstrType::Push}, Section::Main);
+            push(Instr{.var = PushInstr{.what = "%rdx", .whatSize = DataSize::Qword}, .type = InstrType::Push}, Section::Main);
             break;
         }
       } else {
@@ -249,11 +306,11 @@ void codegen::binary(Node::Expr *expr) {
           push(Instr{.var = PushInstr{.what = lhsReg, .whatSize = size}, .type = InstrType::Push}, Section::Main);
           return;
         }
-        push(Instr{.var = BinaryInstr{.op = op, .src = "$" + std::to_string(shiftAmount), .dst = rhsReg},
+        push(Instr{.var = BinaryInstr{.op = op, .src = "$" + std::to_string(shiftAmount), .dst = lhsReg},
                    .type = InstrType::Binary},
              Section::Main);
         // push the result
-        push(Instr{.var = PushInstr{.what = rhsReg, .whatSize = size}, .type = InstrType::Push}, Section::Main);
+        push(Instr{.var = PushInstr{.what = lhsReg, .whatSize = size}, .type = InstrType::Push}, Section::Main);
       } else {
         // If there is no immediate, we need to pop the value into CL
         push(Instr{.var = MovInstr{.dest = "%cl", .src = rhsReg, .destSize = DataSize::Byte, .srcSize = size},
@@ -277,9 +334,7 @@ void codegen::binary(Node::Expr *expr) {
     // Similar logic for floats
     size = returnType->name == "float" ? DataSize::SS : DataSize::SD;
     std::string suffix = size == DataSize::SS ? "ss" : "sd";
-    int lhsDepth = getExpressionDepth(static_cast<BinaryExpr *>(e->lhs));
-    int rhsDepth = getExpressionDepth(static_cast<BinaryExpr *>(e->rhs));
-    handleBinaryExprs(lhsDepth, rhsDepth, "%xmm0", "%xmm1", e->lhs, e->rhs);
+    handleBinaryExprs("%xmm0", "%xmm1", e->lhs, e->rhs);
 
     std::string op;
     if (e->op == "+")
@@ -331,9 +386,7 @@ void codegen::binary(Node::Expr *expr) {
         size = DataSize::SD;
       }
     }
-    int lhsDepth = getExpressionDepth(e->lhs);
-    int rhsDepth = getExpressionDepth(e->rhs);
-    handleBinaryExprs(lhsDepth, rhsDepth, lhsReg, rhsReg, e->lhs, e->rhs);
+    handleBinaryExprs(lhsReg, rhsReg, e->lhs, e->rhs);
     // Get the operation
     std::string op = lookup(opMap, e->op);
     // Perform the operation
@@ -384,7 +437,7 @@ void codegen::unary(Node::Expr *expr) {
   } else if (e->op == "++" || e->op == "--") {
     // Perform the operation
     PushInstr instr = std::get<PushInstr>(text_section.at(text_section.size() - 1).var);
-    std::string whatWasPushed = instr.what;
+    Operand whatWasPushed = instr.what;
   
     text_section.pop_back();
     std::string res = (e->op == "++") ? "inc" : "dec";
@@ -405,8 +458,7 @@ void codegen::unary(Node::Expr *expr) {
         character = "q";
         break;
     }
-    // Dear code reader, i apologize
-    push(Instr{.var = LinkerDirective{.value = res + character + " " + whatWasPushed + "\n\t"}, .type = InstrType::Linker}, Section::Main);
+    push(Instr{.var = BinaryInstr{.op = res + character, .src = whatWasPushed}, .type = InstrType::Binary}, Section::Main);
     // Push the result
     push(Instr{.var=PushInstr{
       .what = whatWasPushed,
@@ -438,78 +490,7 @@ void codegen::call(Node::Expr *expr) {
   if (e->callee->kind == ND_IDENT) {
     IdentExpr *n = static_cast<IdentExpr *>(e->callee);
     pushDebug(e->line, expr->file_id, e->pos);
-    // Push each argument one by one.
-    if (e->args.size() > intArgOrder.size()) {
-      std::cerr << "Too many arguments in call - consider reducing them or "
-                   "moving them to a globally defined space."
-                << std::endl;
-      exit(-1);
-    }
-    long long offsetAmount = round(variableCount - 8, 8);
-    if (offsetAmount)
-      push(Instr{.var = SubInstr{.lhs = "%rsp",
-                                 .rhs = "$" + std::to_string(offsetAmount),
-                                 .size = DataSize::Qword},
-                 .type = InstrType::Sub},
-           Section::Main);
-    int intArgCount = 0;
-    int floatArgCount = 0;
-
-    for (size_t i = 0; i < e->args.size(); i++) {
-      // evaluate them
-      visitExpr(e->args.at(i));
-      // Check if the argument was a struct or array
-      // That requires an lea, not a mov (that will be implicitly created here)
-      bool isLea = false;
-      if (e->args[i]->asmType->kind == ND_ARRAY_TYPE) {
-        // lea should be false, because the value being processed is already
-        // technically a pointer
-      }
-      if (e->args[i]->asmType->kind == ND_SYMBOL_TYPE) {
-        SymbolType *sym = static_cast<SymbolType *>(e->args[i]->asmType);
-        if (structByteSizes.find(sym->name) != structByteSizes.end()) {
-          // FIRST we check the size of the struct type
-          if (structByteSizes[sym->name].first > 16) {
-            isLea = true;  // It was in there!
-          }
-        }
-      }
-      if (isLea) {
-        // Get rid of the pushexpr
-        PushInstr instr =
-            std::get<PushInstr>(text_section.at(text_section.size() - 1).var);
-        std::string whatWasPushed = instr.what;
-        text_section.pop_back();
-        // Now we can lea
-        // ... IF what was pushed was an address ...
-        if (whatWasPushed.find('(') == std::string::npos) {
-          // run additional check to see if float or int
-          if (getUnderlying(e->args[i]->asmType) == "float" &&
-              e->args[i]->asmType->kind == ND_SYMBOL_TYPE) {
-            popToRegister(floatArgOrder[floatArgCount++]);
-          } else {
-            popToRegister(intArgOrder[intArgCount++]);
-          }
-        } else
-          push(Instr{.var = LeaInstr{.size = DataSize::Qword,
-                                     .dest = intArgOrder[i],
-                                     .src = whatWasPushed},
-                     .type = InstrType::Lea},
-               Section::Main);
-      } else
-        popToRegister(intArgOrder[i]);
-    }
-    // Call the function
-    push(Instr{.var = CallInstr{.name = "usr_" + n->name},
-               .type = InstrType::Call,
-               .optimize = false},
-         Section::Main);
-    if (offsetAmount)
-      push(Instr{.var = AddInstr{.lhs = "%rsp",
-                                 .rhs = "$" + std::to_string(offsetAmount),
-                                 .size = DataSize::Qword},
-                 .type = InstrType::Sub},
-           Section::Main);
+    callFunction("usr_" + n->name, passArguments(e->args));
     // What we push as the result depends on the return type of the function
     if (e->asmType->kind == ND_POINTER_TYPE ||
         e->asmType->kind == ND_ARRAY_TYPE ||
@@ -532,7 +513,7 @@ void codegen::call(Node::Expr *expr) {
         if (structByteSizes[st->name].first > 8 && 
             structByteSizes[st->name].first <= 16) {
           // Put into the variable
-          push(Instr{.var = MovInstr{.dest = "-" + std::to_string(variableCount) + "(%rbp)", .src = "%rdi",
+          push(Instr{.var = MovInstr{.dest = "-" + std::to_string(variableCount) + "(%rbp)", .src = "%rdx",
                                      .destSize = DataSize::Qword,
                                      .srcSize = DataSize::Qword},
                      .type = InstrType::Mov},
@@ -587,43 +568,8 @@ void codegen::call(Node::Expr *expr) {
       structName = getUnderlying(member->lhs->asmType);
     std::string fnName = static_cast<IdentExpr *>(member->rhs)->name;
     pushDebug(e->line, expr->file_id, e->pos);
-    // Push each argument one by one.
-    // Evaluate the struct
-    visitExpr(member->lhs);
-    // Note: Removed LEA Because when visiting a struct, we push %rcx, which alr
-    // contains the address :P
-    popToRegister(intArgOrder[0]);
-    int intArgCount = 1;  // 1st is preserved for struct ptr above
-    int floatArgCount = 0;
-    long long offsetAmount = round(variableCount - 8, 8);
-    if (offsetAmount)
-      push(Instr{.var = SubInstr{.lhs = "%rsp",
-                                 .rhs = "$" + std::to_string(offsetAmount),
-                                 .size = DataSize::Qword},
-                 .type = InstrType::Sub},
-           Section::Main);
-    for (size_t i = 0; i < e->args.size(); i++) {
-      // evaluate them
-      visitExpr(e->args.at(i));
-      if (getUnderlying(e->args[i]->asmType) == "float" &&
-          e->args[i]->asmType->kind == ND_SYMBOL_TYPE) {
-        popToRegister(floatArgOrder[floatArgCount++]);
-      } else {
-        popToRegister(intArgOrder[intArgCount++]);
-      }
-    }
-    // Call the function
-    push(Instr{.var =
-                   CallInstr{.name = "usrstruct_" + structName + "_" + fnName},
-               .type = InstrType::Call,
-               .optimize = false},
-         Section::Main);
-    if (offsetAmount)
-      push(Instr{.var = AddInstr{.lhs = "%rsp",
-                                 .rhs = "$" + std::to_string(offsetAmount),
-                                 .size = DataSize::Qword},
-                 .type = InstrType::Sub},
-           Section::Main);
+    // The struct goes first, as `self`. Note: no LEA, visiting a struct pushes %rcx, which already has its address
+    callFunction("usrstruct_" + structName + "_" + fnName, passArguments(e->args, member->lhs));
     if (e->asmType->kind == ND_POINTER_TYPE ||
         e->asmType->kind == ND_ARRAY_TYPE ||
         e->asmType->kind == ND_FUNCTION_TYPE ||
@@ -647,7 +593,7 @@ void codegen::call(Node::Expr *expr) {
                      .type = InstrType::Mov},
                Section::Main);
           variableCount += 8;
-          push(Instr{.var = MovInstr{.dest = "-" + std::to_string(variableCount) + "(%rbp)", .src = "%rdi",
+          push(Instr{.var = MovInstr{.dest = "-" + std::to_string(variableCount) + "(%rbp)", .src = "%rdx",
                                     .destSize = DataSize::Qword,
                                     .srcSize = DataSize::Qword},
                     .type = InstrType::Mov},
@@ -747,12 +693,17 @@ void codegen::assign(Node::Expr *expr) {
       IdentExpr *lhs = static_cast<IdentExpr *>(e->assignee);
       visitExpr(e->rhs);
       std::string res = variableTable[lhs->name];
-      push(Instr{.var=PopInstr{.where = res, .whereSize = intDataToSize(getByteSizeOfType(e->rhs->asmType))},
+      DataSize size = intDataToSize(getByteSizeOfType(e->rhs->asmType));
+      // As wide as the variable, not the value: a char's neighbours are packed right up against it (see optimizer/slots.hpp)
+      long width = lhs->asmType != nullptr && lhs->asmType->kind != ND_ARRAY_TYPE ? getByteSizeOfType(lhs->asmType) : 0;
+      if (width == 1 || width == 2 || width == 4 || width == 8) size = intDataToSize(width);
+      if (promotedLocals.contains(lhs->name)) size = DataSize::Qword; // the whole register, whatever the rhs said
+      push(Instr{.var=PopInstr{.where = res, .whereSize = size},
                  .type = InstrType::Pop},
            Section::Main);
       // Assignments are expressions that reutrn things. Chances likely are that this will be ignored
       // but this is still required
-      push(Instr{.var=PushInstr{.what = res, .whatSize = intDataToSize(getByteSizeOfType(e->rhs->asmType))},
+      push(Instr{.var=PushInstr{.what = res, .whatSize = size},
                  .type = InstrType::Push},
            Section::Main);
     }
@@ -771,7 +722,7 @@ void codegen::arrayElem(Node::Expr *expr) {
   // If all things go well, we should be able to do some very funny x64 magic!
   // If not, then we will collectively cry.
   std::string expression = ""; // Depending on if the element is a struct or array, or a normal value, this will be lea'd
-  Node::Expr *optimizedRhs = CompileOptimizer::optimizeExpr(e->rhs);
+  Node::Expr *optimizedRhs = e->rhs;
   long elementByteSize = 0;
   dwarf::useType(e->lhs->asmType);
   if (e->lhs->asmType->kind == ND_ARRAY_TYPE) {
@@ -804,21 +755,7 @@ void codegen::arrayElem(Node::Expr *expr) {
     // We will pop this into %rdi. Hopefully nothing important was happening in there.
     popToRegister("%rdi"); // Pop the index into %rdi
     // Now we can do the funny x64 magic! Hooray!
-    if (elementByteSize == 2 || elementByteSize == 4 || elementByteSize == 8) {
-      expression = "(%rcx, %rdi, " + std::to_string(elementByteSize) + ")";
-    } else if (elementByteSize == 1) {
-      expression = "(%rcx, %rdi)";
-    } else {
-      // Fine!! We'll do the calculation...
-      // Multiply rdi by the size of the elemnt
-      push(Instr{.var= BinaryInstr{.op = "imul",
-                                              .src = "$" + std::to_string(elementByteSize),
-                                              .dst = "%rdi"},
-                 .type = InstrType::Binary},
-           Section::Main);
-      // Now we can return the expression as if we are all normal
-      expression = "(%rcx, %rdi)";
-    }
+    expression = indexAddress("%rcx", elementByteSize);
   }
   // Finally! Time to actually push (or lea) the expression
   if (structByteSizes.contains(getUnderlying(e->asmType)) || e->asmType->kind == ND_ARRAY_TYPE) {
@@ -882,7 +819,7 @@ void codegen::memberExpr(Node::Expr *expr) {
     // Get the offset and lea and stuff
     PushInstr instr =
         std::get<PushInstr>(text_section.at(text_section.size() - 1).var);
-    std::string whatWasPushed = instr.what;
+    Operand whatWasPushed = instr.what;
     text_section.pop_back();
     size_t elementIndex = 99999; // This would be a stupid struct to have.
     for (size_t i = 0; i < structByteSizes[lhsName].second.size(); i++) {
@@ -896,7 +833,7 @@ void codegen::memberExpr(Node::Expr *expr) {
     // long long inStructOffset = thisStructSizes.at(elementIndex).second.second;
     long long inStructOffset = structByteSizes[lhsName].first - (thisStructSizes[elementIndex].second.second) - getByteSizeOfType(thisStructSizes[0].second.first);
     // Check what was pushed. Was it an effective address?
-    if (whatWasPushed.find('(') == std::string::npos) {
+    if (!whatWasPushed.isMemory()) {
       // It was an effective address, so we can just push the offset
       // If the member is another struct, we need to lea
       Node::Type *memberType = structByteSizes[lhsName].second[elementIndex].second.first;
@@ -904,7 +841,7 @@ void codegen::memberExpr(Node::Expr *expr) {
         // We need to lea the address of the member
         push(Instr{.var = LeaInstr{.size = DataSize::Qword,
                                    .dest = "%rcx",
-                                   .src = std::to_string(inStructOffset) + "(" + whatWasPushed + ")"},
+                                   .src = std::to_string(inStructOffset) + "(" + whatWasPushed.str() + ")"},
                    .type = InstrType::Lea},
              Section::Main);
         pushRegister("%rcx");
@@ -913,7 +850,7 @@ void codegen::memberExpr(Node::Expr *expr) {
       // Otherwise, we push
       DataSize size = intDataToSize(getByteSizeOfType(memberType));
       push(Instr{.var = PushInstr{.what = std::to_string(inStructOffset) + "(" +
-                                          whatWasPushed + ")",
+                                          whatWasPushed.str() + ")",
                                       .whatSize = size},
                  .type = InstrType::Push},
            Section::Main);
@@ -921,12 +858,9 @@ void codegen::memberExpr(Node::Expr *expr) {
     }
     // Phew! If we reached this point, then that means we pushed something with an address in it.
     // Uh oh.
-    // It was likely something similar to "-8(%rbp)", so we must extract -8 and %rbp.
-    size_t openParen = whatWasPushed.find('(');
-    size_t closeParen = whatWasPushed.find(')');
-    int offset = openParen == 0 ? 0 : std::stoi(whatWasPushed.substr(0, openParen));
-    std::string baseRegister = whatWasPushed.substr(openParen + 1, closeParen - openParen - 1);
-    // Now that we have extracted -8 and %rbp, we can do the work!
+    // It was likely something similar to "-8(%rbp)", so the member lives at -8 + offset(%rbp).
+    Operand member = whatWasPushed;
+    member.value += inStructOffset;
     // Check if the member is a struct
     Node::Type *memberType = structByteSizes[lhsName].second[elementIndex].second.first;
     if (structByteSizes.contains(getUnderlying(memberType)) &&
@@ -937,8 +871,7 @@ void codegen::memberExpr(Node::Expr *expr) {
       // i created the instruction so oopsies its here to stay until zura self host
       push(Instr{.var = LeaInstr{.size = DataSize::Qword,
                                  .dest = "%rcx",
-                                 .src = std::to_string(offset + inStructOffset) + "(" +
-                                        baseRegister + ")"},
+                                 .src = member},
                  .type = InstrType::Lea},
            Section::Main);
       pushRegister("%rcx");
@@ -946,9 +879,7 @@ void codegen::memberExpr(Node::Expr *expr) {
     }
     // Otherwise, we push the offset
     DataSize size = intDataToSize(getByteSizeOfType(memberType));
-    push(Instr{.var = PushInstr{.what = std::to_string(offset + inStructOffset) + "(" +
-                                        baseRegister + ")",
-                                .whatSize = size},
+    push(Instr{.var = PushInstr{.what = member, .whatSize = size},
                .type = InstrType::Push},
          Section::Main);
     return; // Hopefully it works!
@@ -978,15 +909,15 @@ void codegen::addressExpr(Node::Expr *expr) {
   // It was a struct or something like that
   // Get the address of it. The address is the return type (becuase it's a
   // pointer)
-  Node::Expr *realRight = CompileOptimizer::optimizeExpr(e->right);
+  Node::Expr *realRight = e->right;
   visitExpr(realRight);
   // We don't want that push!
   PushInstr instr =
       std::get<PushInstr>(text_section.at(text_section.size() - 1).var);
-  std::string whatWasPushed = instr.what;
+  Operand whatWasPushed = instr.what;
   text_section.pop_back();
   // Lea that and then push the effective address
-  if (whatWasPushed.find('(') == std::string::npos) {
+  if (!whatWasPushed.isMemory()) {
     // It was a pointer, so we can just push it
     push(Instr{.var = PushInstr{.what = whatWasPushed, .whatSize = DataSize::Qword},
                .type = InstrType::Push},
@@ -1152,34 +1083,18 @@ void codegen::assignArray(Node::Expr *expr) {
     PushInstr instr =
         std::get<PushInstr>(text_section.at(text_section.size() - 1).var);
     text_section.pop_back();
-    push(Instr{.var = LeaInstr{.size = DataSize::Qword,
-                               .dest = "%r11",
-                               .src = instr.what},
-               .type = InstrType::Lea},
+    // Arrays pushed their address in %rcx, *chars their value: either way it's what we want in %r11
+    push(Instr{.var = MovInstr{.dest = "%r11",
+                               .src = instr.what,
+                               .destSize = DataSize::Qword,
+                               .srcSize = DataSize::Qword},
+               .type = InstrType::Mov},
          Section::Main);
     visitExpr(e->rhs);
     popToRegister("%rdi", intDataToSize(getByteSizeOfType(e->rhs->asmType))); // Pop the index into %rdi
-    long byteSize = getByteSizeOfType(e->asmType);
-    if (byteSize == 1 || byteSize == 2 || byteSize == 4 || byteSize == 8)
-      push(Instr{.var=LeaInstr{
-          .size = DataSize::Qword,
-          .dest = "%r11",
-          .src = "(%r11, %rdi, " + std::to_string(getByteSizeOfType(e->asmType)) + ")" // 1 is the multiplier
-        }, .type = InstrType::Lea},
-      Section::Main);
-    else {
-      push(Instr{.var = BinaryInstr{.op = "imul",
-                                    .src = "$" + std::to_string(getByteSizeOfType(e->asmType)),
-                                    .dst = "%rdi"},
-                 .type = InstrType::Binary},
-           Section::Main);
-      push(Instr{.var=LeaInstr{
-          .size = DataSize::Qword,
-          .dest = "%r11",
-          .src = "(%r11, %rdi)"
-        }, .type = InstrType::Lea},
-      Section::Main);
-    }
+    push(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%r11", .src = indexAddress("%r11", getByteSizeOfType(e->asmType))},
+               .type = InstrType::Lea},
+         Section::Main);
     visitExpr(assign->rhs);
     // get the location of where to pop to
     popToRegister("(%r11)", intDataToSize(getByteSizeOfType(e->asmType)));
@@ -1211,35 +1126,9 @@ void codegen::assignArray(Node::Expr *expr) {
       return;
     }
     pushLinker("incq %rdi\n\t", Section::Main); // its off by one or something
-    if (elementByteSize == 2 ||
-        elementByteSize == 4 || elementByteSize == 8) {
-      push(Instr{.var=LeaInstr{
-        .size = DataSize::Qword,
-        .dest = "%r14",
-        .src = "(%r14, %rdi, " + std::to_string(elementByteSize) + ")" 
-      }, .type = InstrType::Lea},
-           Section::Main);
-    } else if (elementByteSize == 1) {
-      push(Instr{.var=LeaInstr{
-        .size = DataSize::Qword,
-        .dest = "%r14",
-        .src = "(%r14, %rdi)"
-      }, .type = InstrType::Lea},
-           Section::Main);
-    } else {
-      // We will multiply rdi by the size of the element
-      push(Instr{.var = BinaryInstr{.op = "imul",
-                                    .src = "$" + std::to_string(elementByteSize),
-                                    .dst = "%rdi"},
-                 .type = InstrType::Binary},
-           Section::Main);
-      push(Instr{.var=LeaInstr{
-        .size = DataSize::Qword,
-        .dest = "%r14",
-        .src = "(%r14, %rdi)"
-      }, .type = InstrType::Lea},
-           Section::Main);
-    }
+    push(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%r14", .src = indexAddress("%r14", elementByteSize)},
+               .type = InstrType::Lea},
+         Section::Main);
     push(Instr{.var=SubInstr{.lhs="%r14",.rhs="$8",.size=DataSize::Qword},
                .type=InstrType::Add}, // its still off
          Section::Main);
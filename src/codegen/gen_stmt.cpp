@@ -1,18 +1,29 @@
 #include <sys/cdefs.h>
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <string>
 
 #include "../common.hpp"
 #include "../helper/error/error.hpp"
 #include "gen.hpp"
-#include "optimizer/compiler.hpp"
+#include "ir/backend.hpp"
+#include "ir/builder.hpp"
+#include "optimizer/callgraph.hpp"
+#include "optimizer/ctfe.hpp"
 #include "optimizer/instr.hpp"
+#include "optimizer/passes.hpp"
+#include "optimizer/profile.hpp"
+#include "optimizer/promote.hpp"
+#include "optimizer/slots.hpp"
+#include "optimizer/tailcall.hpp"
+#include "optimizer/vectorize.hpp"
 
 void codegen::visitStmt(Node::Stmt *stmt) {
-  // compiler optimize the statement
-  Node::Stmt *realStmt = CompileOptimizer::optimizeStmt(stmt);
+  // Already folded by the pass manager, see passes.hpp
+  Node::Stmt *realStmt = stmt;
   StmtHandler handler = lookup(stmtHandlers, realStmt->kind);
   if (handler) {
     handler(realStmt);
@@ -53,10 +64,25 @@ void codegen::funcDecl(Node::Stmt *stmt) {
   // size_t preStackSize = stackSize;
 
   isEntryPoint = (s->name == "main" && insideStructName == "") ? true : false;
+  currentFunction = s;
   std::string funcName = (isEntryPoint) ? "main"
                          : (insideStructName != "")
                              ? "usrstruct_" + insideStructName + "_" + s->name
                              : "usr_" + s->name;
+  // Nothing can ever call this, so don't even bother with the body, its strings or its DIEs
+  if (!isEntryPoint && !CallGraph::isReachable(funcName))
+    return;
+
+  // Plain integer functions go through the SSA IR instead of the stack machine.
+  // (Not with -debug though, the IR doesn't know how to describe its values to DWARF yet)
+  if (!debug && PassManager::level != OptLevel::O0 && insideStructName.empty()) {
+    if (ir::Function *fn = ir::Builder::build(s, funcName, isEntryPoint)) {
+      PassManager::runIr(*fn);
+      ir::Backend::emit(*fn);
+      delete fn;
+      return;
+    }
+  }
 
   // WOO YEAH BABY DEBUG TIME
 
@@ -154,7 +180,8 @@ void codegen::funcDecl(Node::Stmt *stmt) {
   pushLinker("\n.type " + funcName + ", @function", Section::Main);
   pushLinker("\n.globl " + funcName + "\n",
              Section::Main); // All functions are global (public, linker viewable) functions for now.
-  push(Instr{.var = Label{.name = funcName}, .type = InstrType::Label},
+  push(Instr{.var = Label{.name = funcName, .align = PassManager::alignsCode() ? Alignment::Function : Alignment::None},
+             .type = InstrType::Label},
        Section::Main);
   // push linker directive for the debug info (the line number)
   pushDebug(s->line, stmt->file_id, s->pos);
@@ -192,23 +219,36 @@ void codegen::funcDecl(Node::Stmt *stmt) {
   // Function args
   // Reset the variableCount first, though
   size_t preVC = variableCount;
+  int64_t preFrameSize = frameSize;
   variableCount = 8;
-  int intArgCount = 0;
-  int floatArgCount = 0;
+  frameSize = 8;
+  // Make room for every local up front. We only know how much that is after the body, so fill it in then
+  size_t frameIndex = text_section.size();
+  push(Instr{.var = SubInstr{.lhs = "%rsp", .rhs = "$0", .size = DataSize::Qword}, .type = InstrType::Sub},
+       Section::Main);
+  size_t intArgCount = 0;
+  size_t floatArgCount = 0;
+  long long stackArg = 16; // past the return address and the caller's %rbp
   for (size_t i = 0; i < s->params.size(); i++) {
-    // Move the argument to the stack
-    std::string where = std::to_string(-(long long)(variableCount)) + "(%rbp)";
-    if (getUnderlying(s->params.at(i).second) == "float")
-      // Floats are passed in xmm registers
-      moveRegister(where, floatArgOrder[floatArgCount++], DataSize::Qword,
-                   DataSize::Qword);
-    else
-      // Integers are passed in general purpose registers
-      moveRegister(where, intArgOrder[intArgCount++], DataSize::Qword,
+    Node::Type *type = s->params.at(i).second;
+    bool isFloat = type->kind == ND_SYMBOL_TYPE && (getUnderlying(type) == "float" || getUnderlying(type) == "double");
+    std::string where;
+    long long location; // for DWARF, off of the CFA
+    if (isFloat ? floatArgCount < floatArgOrder.size() : intArgCount < intArgOrder.size()) {
+      // Move the argument to the stack
+      where = std::to_string(-(long long)(variableCount)) + "(%rbp)";
+      // Floats and doubles are passed in xmm registers, everything else in general purpose registers
+      moveRegister(where, isFloat ? floatArgOrder[floatArgCount++] : intArgOrder[intArgCount++], DataSize::Qword,
                    DataSize::Qword);
-
+      variableCount += 8; // the whole register went in, whatever the type, so a char can't have less than that
+      location = -(long long)variableCount - 8;
+    } else {
+      // Out of registers, so the caller left it above the return address. It can stay right there
+      where = std::to_string(stackArg) + "(%rbp)";
+      location = stackArg - 16;
+      stackArg += 8;
+    }
     variableTable.insert({s->params.at(i).first->name, where});
-    variableCount += getByteSizeOfType(s->params.at(i).second);
 
     if (debug) {
       // Use the parameter type
@@ -217,9 +257,9 @@ void codegen::funcDecl(Node::Stmt *stmt) {
       pushLinker(
           "\n.uleb128 " + std::to_string((int)dwarf::DIEAbbrev::FunctionParam) +
           "\n.long .L" + type_to_diename(s->params.at(i).second) + "_debug_type\n" +
-          "\n.uleb128 " + std::to_string(1 + sizeOfLEB(-(long long)variableCount - 8)) + // length of location expression
+          "\n.uleb128 " + std::to_string(1 + sizeOfLEB(location)) + // length of location expression
           "\n.byte 0x91" // DW_OP_fbreg
-          "\n.sleb128 " + std::to_string(-(long long)variableCount - 8) +
+          "\n.sleb128 " + std::to_string(location) +
           "\n.long .L" + s->params.at(i).first->name + "_string"
           "\n",
           Section::DIE);
@@ -236,21 +276,61 @@ void codegen::funcDecl(Node::Stmt *stmt) {
     variableCount += getByteSizeOfType(s->returnType);
   }
 
+  // Locals that never have their address taken can skip the stack altogether.
+  // (Not with -debug, DWARF only knows how to find variables at an offset from the frame)
+  promotedLocals.clear();
+  savedRegisters.clear();
+  if (!debug && PassManager::level != OptLevel::O0) promotedLocals = RegisterPromotion::run(s);
+  std::vector<std::string> promotedRegisters;
+  for (auto &[name, reg] : promotedLocals) promotedRegisters.push_back(reg);
+  std::sort(promotedRegisters.begin(), promotedRegisters.end());
+  // They're callee saved, so put the caller's values somewhere safe first.
+  // main exits instead of returning, so nobody is waiting for those back
+  for (const std::string &reg : promotedRegisters) {
+    if (isEntryPoint) break;
+    std::string where = std::to_string(-(long long)(variableCount)) + "(%rbp)";
+    moveRegister(where, reg, DataSize::Qword, DataSize::Qword);
+    savedRegisters.push_back({reg, where});
+    variableCount += 8;
+  }
+
+  // The scalar locals get their slots all at once, packed and (when optimizing) shared, see optimizer/slots.hpp
+  int64_t used = (int64_t)round((size_t)variableCount - 8, 8);
+  variableCount = 8 + used +
+                  StackSlots::run(s, used, !debug && PassManager::level != OptLevel::O0, promotedLocals);
+
   // Do not push the lexical block to the dwarf stack
   dwarf::nextBlockDIE = false;
+  std::vector<Instr> outerColdCode = std::move(coldCode);
+  coldCode.clear();
+  size_t bodyIndex = text_section.size();
+  countProfile(s, Profile::Entry);
   codegen::visitStmt(s->block);
   dwarf::nextBlockDIE = true; // reset it
+  // Everything below %rbp anybody used, kept 16 byte aligned for the calls we make
+  frameSize = std::max(frameSize, variableCount);
+  std::get<SubInstr>(text_section.at(frameIndex).var).rhs = "$" + std::to_string(round(frameSize, 16));
   variableCount = preVC;
+  frameSize = preFrameSize;
 
   // Check if last instruction was a "RET"
   if (text_section.back().type != InstrType::Ret) {
     // Push a ret anyway
     // Otherwise we SEGFAULTT
-    popToRegister("%rbp");
+    for (auto &[reg, where] : savedRegisters) moveRegister(reg, where, DataSize::Qword, DataSize::Qword);
+    push(Instr{.var = BinaryInstr{.op = "leave", .src = {}, .dst = {}}, .type = InstrType::Binary}, Section::Main);
     pushLinker(".cfi_def_cfa %rsp, 8\n\t", Section::Main);
     push(Instr{.var = Ret{.fromWhere = funcName}, .type = InstrType::Ret},
          Section::Main);
   }
+  // The arms that never ran (see ifStmt). They still have the body's frame, not what the epilogue left
+  if (!coldCode.empty()) {
+    text_section.insert(text_section.begin() + (long)bodyIndex,
+                        Instr{.var = LinkerDirective{.value = ".cfi_remember_state\n\t"}, .type = InstrType::Linker});
+    pushLinker(".cfi_restore_state\n\t", Section::Main);
+    text_section.insert(text_section.end(), coldCode.begin(), coldCode.end());
+  }
+  coldCode = std::move(outerColdCode);
 
   // Function ends with ret so we can't really push any other instructions.
   if (debug) {
@@ -269,6 +349,10 @@ void codegen::funcDecl(Node::Stmt *stmt) {
   for (size_t i = 0; i < s->params.size(); i++) {
     variableTable.erase(s->params.at(i).first->name);
   }
+  // The next function might have a local with the same name, and it won't be in our register
+  for (auto &[name, reg] : promotedLocals) variableTable.erase(name);
+  promotedLocals.clear();
+  savedRegisters.clear();
 };
 
 void codegen::varDecl(Node::Stmt *stmt) {
@@ -282,9 +366,26 @@ void codegen::varDecl(Node::Stmt *stmt) {
   // push another .loc
   pushDebug(s->line, stmt->file_id, s->pos);
 
-  long long whereBytes = -variableCount;
+  // Scalars already have a slot, see optimizer/slots.hpp. Anything else goes below whatever is in use
+  auto slot = StackSlots::offsets.find(stmt);
+  bool hasSlot = slot != StackSlots::offsets.end();
+  long long whereBytes = hasSlot ? slot->second : -variableCount;
   std::string where = std::to_string(whereBytes) + "(%rbp)";
-  if (s->expr != nullptr) {
+  Ctfe::ReadonlyArray *readonly = Ctfe::readonlyArray(s);
+  if (readonly != nullptr) {
+    // Constant and never written to- no need to build it on the stack every time, it's already in the binary
+    DataSize size = readonly->isFloating ? intDataToSizeFloat(readonly->elementSize)
+                                         : intDataToSize(readonly->elementSize);
+    pushLinker(".p2align " + std::to_string(readonly->elementSize >= 8 ? 3 : readonly->elementSize >= 4 ? 2 : 0) + "\n",
+               Section::ReadonlyData);
+    push(Instr{.var = Label{.name = readonly->label}, .type = InstrType::Label}, Section::ReadonlyData);
+    for (const std::string &value : readonly->values)
+      push(Instr{.var = DataSectionInstr{.bytesToDefine = size, .what = value}, .type = InstrType::DB},
+           Section::ReadonlyData);
+    // Unlike everything else, this one is in order: arr[0] really is the first element
+    where = readonly->label + "(%rip)";
+    variableTable[s->name] = where; // Ctfe made sure nobody else ever uses this name
+  } else if (s->expr != nullptr) {
     // The first clause: If it's a literal, straight up, struct declaration.
     // It might be a pointer to struct declaration, but the underlyingType func
     // makes it seem like a normal one instead.
@@ -345,20 +446,30 @@ void codegen::varDecl(Node::Stmt *stmt) {
                           : intDataToSize(getByteSizeOfType(s->type));
       // If it was a call expression, and it returned a struct, DONT DO THIS
      if (s->expr->kind == ND_CALL && structByteSizes.contains(getUnderlying(s->type)) && getByteSizeOfType(s->type) > 8) {
-       variableCount += getByteSizeOfType(s->type);
+       // Up to 16 bytes, the call already put %rax:%rdx in the next two slots (and counted them), see codegen::call.
+       // Counting them again used to point the variable at whatever the callee left lying around below us
+       if (getByteSizeOfType(s->type) > 16) variableCount += getByteSizeOfType(s->type);
        variableTable.insert({s->name, std::to_string(-(variableCount-8)) + "(%rbp)"});
+      } else if (promotedLocals.contains(s->name)) {
+        // Lives in a register, no stack space needed
+        push(Instr{.var = PopInstr{.where = promotedLocals[s->name], .whereSize = DataSize::Qword},
+          .type = InstrType::Pop},
+             Section::Main);
+        variableTable[s->name] = promotedLocals[s->name];
       } else {
         push(Instr{.var = PopInstr{.where = where, .whereSize = size},
           .type = InstrType::Pop},
              Section::Main); // For values small enough to fit in a register.
-        variableTable.insert({s->name, where});
-        variableCount += getByteSizeOfType(s->type);
+        variableTable[s->name] = where;
+        if (!hasSlot) variableCount += getByteSizeOfType(s->type);
       }
     }
+  } else if (promotedLocals.contains(s->name)) {
+    variableTable[s->name] = promotedLocals[s->name];
   } else {
-    variableTable.insert({s->name, where}); // Insert into table
-    variableCount += getByteSizeOfType(
-        s->type); // Allocation (leaving space for future variables)
+    variableTable[s->name] = where; // Insert into table
+    if (!hasSlot)
+      variableCount += getByteSizeOfType(s->type); // Allocation (leaving space for future variables)
   }
   // Update the symbol table with the variable's position
 
@@ -413,14 +524,18 @@ void codegen::varDecl(Node::Stmt *stmt) {
           "\n" // Line column
           ".long .L" +
           asmName +
-          "_debug_type\n" // Type - point to the DIE of the DW_TAG_base_type
-          ".uleb128 " +
-          std::to_string(                 // Length of data in location
-              1 + sizeOfLEB(fbreg_loc)) + // DW_OP_fbreg (length of data)
-          "\n.byte 0x91\n" // DW_OP_fbreg (first byte determines variable is
-                           // offset from frame pointer rbp)
-          ".sleb128 " +
-          std::to_string(fbreg_loc) + "\n", // DW_OP_fbreg (actual offset)
+          "_debug_type\n" + // Type - point to the DIE of the DW_TAG_base_type
+          (readonly != nullptr
+               ? ".uleb128 9\n"   // 1 opcode byte + an 8 byte address
+                 ".byte 0x03\n"   // DW_OP_addr (it lives in .rodata, not on the stack)
+                 ".quad " + readonly->label + "\n"
+               : ".uleb128 " +
+                 std::to_string(                 // Length of data in location
+                     1 + sizeOfLEB(fbreg_loc)) + // DW_OP_fbreg (length of data)
+                 "\n.byte 0x91\n" // DW_OP_fbreg (first byte determines variable is
+                                  // offset from frame pointer rbp)
+                 ".sleb128 " +
+                 std::to_string(fbreg_loc) + "\n"), // DW_OP_fbreg (actual offset)
       Section::DIE);
 
   // DIE String pointer
@@ -474,23 +589,72 @@ void codegen::block(Node::Stmt *stmt) {
            Section::Main);
   }
   stackSize = scopes.at(scopes.size() - 1).first;
-  variableCount = scopes.at(scopes.size() - 1).second;
+  releaseSlots(scopes.at(scopes.size() - 1).second);
   scopes.pop_back();
 };
 
+// With -profile-use, whichever arm ran more falls through. An arm that never ran at all goes to the end of the
+// function (see funcDecl), so the code that does run stays together:
+//     cond; jtrue .Lifcold<n>
+//     <else arm>
+//   .Lifend<n>:
+//     ...
+//   .Lifcold<n>:             (after the function's last ret)
+//     <then arm>
+//     jmp .Lifend<n>
 void codegen::ifStmt(Node::Stmt *stmt) {
   IfStmt *s = static_cast<IfStmt *>(stmt);
   std::string elseLabel = ".Lifelse" + std::to_string(conditionalCount);
   std::string endLabel = ".Lifend" + std::to_string(conditionalCount);
+  std::string thenLabel = ".Lifthen" + std::to_string(conditionalCount); // when it comes after the else arm
+  std::string coldLabel = ".Lifcold" + std::to_string(conditionalCount);
   conditionalCount++;
+  countProfile(s, Profile::Reached);
+  int64_t reached = debug ? -1 : Profile::count(s, Profile::Reached);
+  int64_t taken = Profile::count(s, Profile::Taken);
+  bool isThenCold = reached > 0 && taken == 0;
+  bool isElseCold = reached > 0 && s->elseStmt != nullptr && taken == reached;
   JumpCondition jc =
       processComparison(s->condition); // This produces the comparison code for
                                        // us. We need to jump
+  if (isThenCold || isElseCold) {
+    push(Instr{.var = JumpInstr{.op = isThenCold ? jc : getOpposite(jc), .label = coldLabel},
+               .type = InstrType::Jmp},
+         Section::Main);
+    if (isElseCold) visitStmt(s->thenStmt);
+    size_t coldFrom = text_section.size();
+    push(Instr{.var = Label{.name = coldLabel}, .type = InstrType::Label}, Section::Main);
+    visitStmt(isThenCold ? s->thenStmt : s->elseStmt);
+    push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned, .label = endLabel},
+               .type = InstrType::Jmp},
+         Section::Main);
+    coldCode.insert(coldCode.end(), text_section.begin() + (long)coldFrom, text_section.end());
+    text_section.resize(coldFrom);
+    if (isThenCold && s->elseStmt != nullptr) visitStmt(s->elseStmt);
+    push(Instr{.var = Label{.name = endLabel}, .type = InstrType::Label}, Section::Main);
+    return;
+  }
+  if (s->elseStmt != nullptr && reached > 0 && reached - taken > taken) {
+    // The else arm is the hot one: jump away to the then arm instead
+    push(Instr{.var = JumpInstr{.op = jc, .label = thenLabel}, .type = InstrType::Jmp}, Section::Main);
+    size_t thenFrom = text_section.size();
+    push(Instr{.var = Label{.name = thenLabel}, .type = InstrType::Label}, Section::Main);
+    visitStmt(s->thenStmt);
+    size_t elseFrom = text_section.size();
+    visitStmt(s->elseStmt);
+    push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned, .label = endLabel},
+               .type = InstrType::Jmp},
+         Section::Main);
+    std::rotate(text_section.begin() + (long)thenFrom, text_section.begin() + (long)elseFrom, text_section.end());
+    push(Instr{.var = Label{.name = endLabel}, .type = InstrType::Label}, Section::Main);
+    return;
+  }
   if (s->elseStmt == nullptr) {
     // if () {};
     push(Instr{.var = JumpInstr{.op = getOpposite(jc), .label = endLabel},
                .type = InstrType::Jmp},
          Section::Main);
+    countProfile(s, Profile::Taken);
     visitStmt(s->thenStmt);
     push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
                                 .label = endLabel},
@@ -501,6 +665,7 @@ void codegen::ifStmt(Node::Stmt *stmt) {
     push(Instr{.var = JumpInstr{.op = getOpposite(jc), .label = elseLabel},
                .type = InstrType::Jmp},
          Section::Main);
+    countProfile(s, Profile::Taken);
     visitStmt(s->thenStmt);
     push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
                                 .label = endLabel},
@@ -561,6 +726,7 @@ void codegen::enumDecl(Node::Stmt *stmt) {
 
     // Add the enum field to the global table
     variableTable.insert({field->name, field->name});
+    enumValues["enum_" + s->name + "_" + field->name] = fieldCount - 1;
 
     if (debug) {
       // Push the enum member DIE
@@ -681,10 +847,42 @@ void codegen::structDecl(Node::Stmt *stmt) {
   }
 }
 
+// `return f(...)` as a jump: f gets our arguments in registers and returns straight to our caller.
+// Every @tailcall has to make it through here, the rest only when optimizing (see optimizer/tailcall.hpp)
+bool codegen::tailCall(ReturnStmt *stmt) {
+  if (stmt->expr == nullptr) return false;
+  if (!stmt->isTailCall && (PassManager::level == OptLevel::O0 || debug)) return false;
+  Node::Expr *expr = stmt->expr;
+  while (expr->kind == ND_GROUP) expr = static_cast<GroupExpr *>(expr)->expr;
+  // Worked out at compile time (see optimizer/ctfe.hpp), there's no call left to turn into a jump
+  if (expr->kind != ND_CALL) return false;
+  std::string reason = isEntryPoint ? "main exits instead of returning" : TailCalls::whyNot(currentFunction, stmt);
+  if (!reason.empty()) {
+    if (stmt->isTailCall) handleError(stmt->line, stmt->pos, "@tailcall: " + reason, "Codegen", true);
+    return false;
+  }
+
+  CallExpr *call = static_cast<CallExpr *>(expr);
+  CallArguments args = passArguments(call->args);
+  for (auto &[reg, where] : savedRegisters) moveRegister(reg, where, DataSize::Qword, DataSize::Qword);
+  // More code follows the jump, and that code still has a frame
+  pushLinker(".cfi_remember_state\n\t", Section::Main);
+  push(Instr{.var = BinaryInstr{.op = "leave", .src = {}, .dst = {}}, .type = InstrType::Binary}, Section::Main);
+  pushLinker(".cfi_def_cfa %rsp, 8\n\t", Section::Main);
+  push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
+                              .label = "usr_" + static_cast<IdentExpr *>(call->callee)->name},
+             .type = InstrType::Jmp},
+       Section::Main);
+  pushLinker(".cfi_restore_state\n\t", Section::Main);
+  releaseSlots(args.slotsFrom);
+  return true;
+}
+
 void codegen::_return(Node::Stmt *stmt) {
   ReturnStmt *returnStmt = static_cast<ReturnStmt *>(stmt);
 
   pushDebug(returnStmt->line, stmt->file_id, returnStmt->pos);
+  if (tailCall(returnStmt)) return;
   if (returnStmt->expr == nullptr) {
     if (isEntryPoint) {
       // Entry point (Main) function is an unsigned int, meaning that it is
@@ -833,9 +1031,9 @@ void codegen::_return(Node::Stmt *stmt) {
         // then return it
         declareStructVariable(returnStmt->expr, st->name, "%rbp", variableCount);
         // We already know that it is greater than 8 bytes large, so we will automatically
-        // put its fields into %rax and %rdi (%RAX = bottom half)
+        // put its fields into %rax and %rdx, like C (%RAX = bottom half)
 
-        push(Instr{.var = MovInstr{.dest = "%rdi",
+        push(Instr{.var = MovInstr{.dest = "%rdx",
                                     .src = std::to_string(-(variableCount)) + "(%rbp)",
                                     .destSize = DataSize::Qword,
                                     .srcSize = DataSize::Qword},
@@ -857,7 +1055,7 @@ void codegen::_return(Node::Stmt *stmt) {
          structByteSizes.contains(getUnderlying(returnStmt->expr->asmType)))) {
         visitExpr(returnStmt->expr);
         popToRegister("%rcx");
-        push(Instr{.var = MovInstr{.dest = "%rdi",
+        push(Instr{.var = MovInstr{.dest = "%rdx",
                                     .src = "8(%rcx)",
                                     .destSize = DataSize::Qword,
                                     .srcSize = DataSize::Qword},
@@ -911,6 +1109,95 @@ void codegen::_return(Node::Stmt *stmt) {
   }
 }
 
+static void pushCompare(const std::string &lhs, int64_t value, DataSize size = DataSize::Qword) {
+  codegen::push(Instr{.var = CmpInstr{.lhs = lhs, .rhs = "$" + std::to_string(value), .size = size}, .type = InstrType::Cmp},
+                codegen::Section::Main);
+}
+static void pushJump(JumpCondition op, const std::string &label) {
+  codegen::push(Instr{.var = JumpInstr{.op = op, .label = label}, .type = InstrType::Jmp}, codegen::Section::Main);
+}
+static void pushBinary(const std::string &op, const std::string &src, const std::string &dst = "") {
+  codegen::push(Instr{.var = BinaryInstr{.op = op, .src = src, .dst = dst}, .type = InstrType::Binary}, codegen::Section::Main);
+}
+static void pushLabel(const std::string &name, codegen::Section section = codegen::Section::Main,
+                      Alignment align = Alignment::None) {
+  codegen::push(Instr{.var = Label{.name = name, .align = align}, .type = InstrType::Label}, section);
+}
+
+
+// Jumps to `label` when `cond` comes out as `when`. A literal true or false doesn't need to be tested
+static void jumpIf(Node::Expr *cond, bool when, const std::string &label) {
+  if (cond->kind == ND_BOOL) {
+    if (static_cast<BoolExpr *>(cond)->value == when) pushJump(JumpCondition::Unconditioned, label);
+    return;
+  }
+  JumpCondition jc = codegen::processComparison(cond);
+  pushJump(when ? jc : codegen::getOpposite(jc), label);
+}
+
+// Small enough to test twice (once to get in, once at the bottom), and it makes no labels of its own
+static bool isCheapCondition(Node::Expr *cond) {
+  auto isLeaf = [](Node::Expr *e) {
+    return e->kind == ND_INT || e->kind == ND_CHAR || e->kind == ND_BOOL || e->kind == ND_IDENT;
+  };
+  if (isLeaf(cond)) return true;
+  if (cond->kind != ND_BINARY) return false;
+  BinaryExpr *bin = static_cast<BinaryExpr *>(cond);
+  static const std::set<std::string> compares = {"==", "!=", "<", ">", "<=", ">="};
+  return compares.contains(bin->op) && isLeaf(bin->lhs) && isLeaf(bin->rhs);
+}
+
+// Everything past the loop setup, for both kinds of loops. `loop_pre<n>` is always right before the step
+// (that's where continue goes) and `loop_post<n>` is right after the loop (that's where break goes).
+// With optimizations on the test goes at the bottom, so an iteration is one taken jcc and nothing else:
+//     test; jfalse post      (or: jmp test, if the test is too big to have twice or we're at -Os)
+//   body:                    (aligned)
+//     ...
+//   pre:
+//     step
+//   test:
+//     test; jtrue body
+//   post:
+static void loopBody(Node::Stmt *stmt, Node::Expr *cond, Node::Stmt *block, Node::Expr *step, size_t loop) {
+  std::string pre = "loop_pre" + std::to_string(loop);
+  std::string post = "loop_post" + std::to_string(loop);
+  std::string test = "loop_test" + std::to_string(loop);
+  std::string body = "loop_body" + std::to_string(loop);
+  codegen::loopLabels.push_back(loop);
+  auto doStep = [&]() {
+    if (step == nullptr) return;
+    codegen::visitExpr(step);
+    codegen::text_section.pop_back(); // the value it pushed, nobody wants it
+  };
+  codegen::countProfile(stmt, Profile::Reached);
+
+  if (PassManager::level == OptLevel::O0) {
+    pushLabel(test);
+    jumpIf(cond, false, post);
+    codegen::countProfile(stmt, Profile::Taken);
+    codegen::visitStmt(block);
+    pushLabel(pre);
+    doStep();
+    pushJump(JumpCondition::Unconditioned, test);
+    pushLabel(post);
+    codegen::loopLabels.pop_back();
+    return;
+  }
+
+  bool isGuarded = cond->kind == ND_BOOL || (PassManager::level != OptLevel::Os && isCheapCondition(cond));
+  if (isGuarded) jumpIf(cond, false, post);
+  else pushJump(JumpCondition::Unconditioned, test);
+  pushLabel(body, codegen::Section::Main, PassManager::alignsCode() ? Alignment::Loop : Alignment::None);
+  codegen::countProfile(stmt, Profile::Taken);
+  codegen::visitStmt(block);
+  pushLabel(pre);
+  doStep();
+  if (!isGuarded) pushLabel(test);
+  jumpIf(cond, true, body);
+  pushLabel(post);
+  codegen::loopLabels.pop_back();
+}
+
 void codegen::forLoop(Node::Stmt *stmt) {
   ForStmt *s = static_cast<ForStmt *>(stmt);
   loopDepth++;
@@ -921,8 +1208,9 @@ void codegen::forLoop(Node::Stmt *stmt) {
        Section::Main);
 
   // Create unique labels for the loop start and end
-  std::string preLoopLabel = "loop_pre" + std::to_string(loopCount);
-  std::string postLoopLabel = "loop_post" + std::to_string(loopCount++);
+  size_t loop = loopCount++;
+  std::string preLoopLabel = "loop_pre" + std::to_string(loop);
+  std::string postLoopLabel = "loop_post" + std::to_string(loop);
 
   // Declare the loop variable
   AssignmentExpr *assign = static_cast<AssignmentExpr *>(s->forLoop);
@@ -933,9 +1221,14 @@ void codegen::forLoop(Node::Stmt *stmt) {
        Section::Main);
   pushDebug(s->line, stmt->file_id, s->pos);
   // assign var
-  variableTable.insert(
-      {assignee->name, std::to_string(-variableCount) + "(%rbp)"});
-  variableCount += 8;
+  auto slot = StackSlots::offsets.find(stmt);
+  bool hasSlot = slot != StackSlots::offsets.end();
+  long long counterAt = hasSlot ? slot->second : -variableCount;
+  if (promotedLocals.contains(assignee->name))
+    variableTable[assignee->name] = promotedLocals[assignee->name];
+  else
+    variableTable[assignee->name] = std::to_string(counterAt) + "(%rbp)";
+  if (!hasSlot) variableCount += 8;
   // Push a variable declaration for the loop variable
   if (debug) {
     dwarf::useAbbrev(dwarf::DIEAbbrev::Variable);
@@ -958,9 +1251,9 @@ void codegen::forLoop(Node::Stmt *stmt) {
                    "\n.long " + std::to_string(s->pos) +                               // Line column
                    "\n.long .L" + type_to_diename(assignee->asmType) + "_debug_type\n" // Type - point to the DIE of
                                                                                        // the DW_TAG_base_type
-                   "\n.uleb128 " + std::to_string(1 + sizeOfLEB(-variableCount - 8)) + // 1 byte is gonna follow
+                   "\n.uleb128 " + std::to_string(1 + sizeOfLEB(counterAt - 16)) + // 1 byte is gonna follow
                    "\n.byte 0x91\n" // DW_OP_fbreg (first byte)
-                   "\n.sleb128 " + std::to_string(-variableCount - 8) + "\n",
+                   "\n.sleb128 " + std::to_string(counterAt - 16) + "\n",
                Section::DIE);
     // Push the name of the variable
     dwarf::useStringP(assignee->name);
@@ -968,34 +1261,10 @@ void codegen::forLoop(Node::Stmt *stmt) {
   visitExpr(assign); // Process the initial loop assignment (e.g., i = 0)
   // Remove the last instruction!! Its a push and thats bad!
   text_section.pop_back();
+  // Most of the trips, a vector at a time. The loop below picks up where it stopped
+  if (s->vectorize) Vectorizer::emit(s, loop);
 
-  // Set loop start label
-  push(Instr{.var = Label{.name = preLoopLabel}, .type = InstrType::Label},
-       Section::Main);
-  // Evaluate the loop condition
-  JumpCondition jc = processComparison(s->condition);
-  push(Instr{.var = JumpInstr{.op = getOpposite(jc), .label = postLoopLabel},
-             .type = InstrType::Jmp},
-       Section::Main);
-
-  // Execute the loop body (if condition is true)
-  visitStmt(s->block); // Visit the statements inside the loop body
-
-  // Evaluate the loop increment (e.g., i++)
-  if (s->optional != nullptr) {
-    visitExpr(s->optional); // Process the loop increment if provided
-    text_section.pop_back();
-  }
-
-  // Jump back to the loop start
-  push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                              .label = preLoopLabel},
-             .type = InstrType::Jmp},
-       Section::Main);
-
-  // Set loop end label
-  push(Instr{.var = Label{.name = postLoopLabel}, .type = InstrType::Label},
-       Section::Main);
+  loopBody(s, s->condition, s->block, s->optional, loop);
   if (debug) {
     push(Instr{.var=Label{.name=".Ldie_" + postLoopLabel},.type=InstrType::Label},Section::Main);
     pushLinker(".byte 0 # </FOR BLOCK>\n", Section::DIE); // Explain that the LexicalBlock is over!
@@ -1003,7 +1272,7 @@ void codegen::forLoop(Node::Stmt *stmt) {
   dwarf::nextBlockDIE = true;
   // Pop the loop variable from the stack
   variableTable.erase(assignee->name);
-  variableCount -= 8; // We now have room for another variable!
+  if (!hasSlot) releaseSlots(variableCount - 8); // We now have room for another variable!
   loopDepth--;
 };
 
@@ -1014,54 +1283,12 @@ void codegen::whileLoop(Node::Stmt *stmt) {
   dwarf::nextBlockDIE = false;
   std::string preconCount = std::to_string(conditionalCount++);
   
-  // Fix: Store current loop count before incrementing
-  int currentLoop = loopCount;
-  std::string preLoopLabel = "loop_pre" + std::to_string(currentLoop);
-  std::string postLoopLabel = "loop_post" + std::to_string(currentLoop);
-  loopCount++; // Increment after using the value
+  size_t currentLoop = loopCount++;
   
   push(Instr{.var = Comment{.comment = "while loop"}, .type = InstrType::Comment},
        Section::Main);
   
-  // Set loop start label
-  push(Instr{.var = Label{.name = preLoopLabel}, .type = InstrType::Label},
-       Section::Main);
-  
-  // Evaluate the loop condition
-  if (s->condition->kind != ND_BOOL) {
-    // For non-boolean conditions, process comparison and jump
-    JumpCondition jc = processComparison(s->condition);
-    push(Instr{.var = JumpInstr{.op = getOpposite(jc), .label = postLoopLabel},
-               .type = InstrType::Jmp},
-         Section::Main);
-  } else {
-    // Fix: For boolean conditions, we need to evaluate the expression first
-    visitExpr(s->condition); // This should put 0 or 1 on the stack
-    // Then compare with 0 and jump if equal (false)
-    push(Instr{.var = JumpInstr{.op = JumpCondition::Equal,
-                                .label = postLoopLabel},
-               .type = InstrType::Jmp},
-         Section::Main);
-  }
-  
-  // Execute the loop body (if condition is true)
-  visitStmt(s->block); // Visit the statements inside the loop body
-  
-  if (s->optional != nullptr) {
-    // Evaluate the loop increment (e.g., i++)
-    visitExpr(s->optional); // Process the loop increment if provided
-    text_section.pop_back();
-  }
-  
-  // Jump back to the loop start
-  push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                              .label = preLoopLabel},
-             .type = InstrType::Jmp},
-       Section::Main);
-  
-  // Set loop end label
-  push(Instr{.var = Label{.name = postLoopLabel}, .type = InstrType::Label},
-       Section::Main);
+  loopBody(s, s->condition, s->block, s->optional, currentLoop);
   
   if (debug) {
     push(Instr{.var=Label{.name=".Ldie_loop" + std::to_string(currentLoop) + "_end"},.type=InstrType::Label},Section::Main);
@@ -1082,8 +1309,7 @@ void codegen::_break(Node::Stmt *stmt) {
 
   // Jump to the end of the loop
   push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                              .label =
-                                  "loop_post" + std::to_string(loopCount - 1)},
+                              .label = "loop_post" + std::to_string(loopLabels.empty() ? loopCount - 1 : loopLabels.back())},
              .type = InstrType::Jmp},
        Section::Main);
 
@@ -1102,7 +1328,7 @@ void codegen::_continue(Node::Stmt *stmt) {
   pushDebug(s->line, stmt->file_id, s->pos);
   // Jump to the start of the loop
   push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                              .label = "loop_pre" + std::to_string(loopCount)},
+                              .label = "loop_pre" + std::to_string(loopLabels.empty() ? loopCount - 1 : loopLabels.back())},
              .type = InstrType::Jmp},
        Section::Main);  
   // Continue statements are only valid inside loops
@@ -1112,12 +1338,242 @@ void codegen::_continue(Node::Stmt *stmt) {
   // }
 };
 
+// A match on nothing but constants doesn't have to try the cases one by one: runs of cases that are close
+// together become one jump table in .rodata, and whatever is left gets a binary search.
+struct MatchCase {
+  int64_t value;
+  std::string label;
+  int64_t weight = -1; // times the case ran, from -profile-use
+};
+struct MatchCluster {
+  std::vector<MatchCase> cases; // sorted. More than one means it's a jump table
+  bool isTable() const { return cases.size() > 1; }
+};
+
+// Every case's value and label, sorted, or nothing if some case isn't a constant we know
+static std::vector<MatchCase> matchConstants(const std::vector<Operand> &values, size_t firstCase,
+                                             const std::vector<int64_t> &weights) {
+  std::vector<MatchCase> cases = {};
+  for (size_t i = 0; i < values.size(); i++) {
+    int64_t value = values[i].value;
+    if (!values[i].isImmediate()) return {};
+    if (values[i].symbol != -1) {
+      std::string name = values[i].str().substr(1); // `$enum_Color_Red`
+      if (!codegen::enumValues.contains(name)) return {};
+      value = codegen::enumValues[name];
+    }
+    if (value < INT32_MIN || value > INT32_MAX) return {}; // cmp can't take it as an immediate
+    cases.push_back({value, ".Lmatch_case" + std::to_string(firstCase + i), weights.empty() ? -1 : weights[i]});
+  }
+  // The first case of a value wins, like it does when they're tried in order
+  std::stable_sort(cases.begin(), cases.end(), [](const MatchCase &a, const MatchCase &b) { return a.value < b.value; });
+  cases.erase(std::unique(cases.begin(), cases.end(), [](const MatchCase &a, const MatchCase &b) { return a.value == b.value; }),
+              cases.end());
+  return cases;
+}
+
+// A table is worth it with at least 4 cases, as long as enough of its slots are real cases and not holes.
+// At -Os, the 4 bytes per slot have to beat the ~6 bytes of cmp + je per case, so it has to be a lot fuller
+static std::vector<MatchCluster> clusterMatch(const std::vector<MatchCase> &cases) {
+  constexpr size_t minTableCases = 4;
+  constexpr int64_t maxTableSlots = 4096;
+  int64_t density = PassManager::level == OptLevel::Os ? 40 : 10; // percent
+  std::vector<MatchCluster> clusters = {};
+  for (size_t i = 0; i < cases.size();) {
+    size_t end = i + 1;
+    for (size_t j = i + minTableCases - 1; j < cases.size(); j++) {
+      int64_t slots = cases[j].value - cases[i].value + 1;
+      if (slots <= maxTableSlots && (int64_t)(j - i + 1) * 100 >= slots * density) end = j + 1;
+    }
+    clusters.push_back({std::vector<MatchCase>(cases.begin() + (long)i, cases.begin() + (long)end)});
+    i = end;
+  }
+  return clusters;
+}
+
+static bool isLinearMatch(const std::vector<MatchCluster> &clusters, size_t from, size_t to) {
+  bool isLinear = to - from <= 3;
+  for (size_t i = from; i < to; i++) isLinear = isLinear && !clusters[i].isTable();
+  return isLinear;
+}
+
+// The value is in %rax, and everything ends in a jump (to a case, or to `noMatch`)
+static void dispatchMatch(const std::vector<MatchCluster> &clusters, size_t from, size_t to, const std::string &noMatch) {
+  if (isLinearMatch(clusters, from, to)) {
+    // Just try them, the ones that ran the most first. Not worth a tree
+    std::vector<MatchCase> cases = {};
+    for (size_t i = from; i < to; i++) cases.push_back(clusters[i].cases[0]);
+    std::stable_sort(cases.begin(), cases.end(), [](const MatchCase &a, const MatchCase &b) { return a.weight > b.weight; });
+    for (const MatchCase &c : cases) {
+      pushCompare("%rax", c.value);
+      pushJump(JumpCondition::Equal, c.label);
+    }
+    pushJump(JumpCondition::Unconditioned, noMatch);
+    return;
+  }
+  if (to - from == 1) {
+    // Shift it down to start at 0, and anything past the end (or below 0, which wrapped around) has no case
+    const std::vector<MatchCase> &cases = clusters[from].cases;
+    std::string table = ".Lmatch_table" + std::to_string(codegen::matchLabelCount++);
+    if (cases.front().value != 0) pushBinary("subq", "$" + std::to_string(cases.front().value), "%rax");
+    pushCompare("%rax", cases.back().value - cases.front().value);
+    pushJump(JumpCondition::Above, noMatch);
+    codegen::push(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%rcx", .src = table + "(%rip)"}, .type = InstrType::Lea},
+                  codegen::Section::Main);
+    pushBinary("movslq", "(%rcx, %rax, 4)", "%rax");
+    pushBinary("addq", "%rcx", "%rax");
+    pushJump(JumpCondition::Unconditioned, "*%rax");
+
+    // Where each case is, relative to the table, so it doesn't need any relocations
+    codegen::pushLinker(".p2align 2\n", codegen::Section::ReadonlyData);
+    pushLabel(table, codegen::Section::ReadonlyData);
+    size_t next = 0;
+    for (int64_t value = cases.front().value; value <= cases.back().value; value++) {
+      std::string target = noMatch;
+      if (cases[next].value == value) target = cases[next++].label;
+      codegen::push(Instr{.var = DataSectionInstr{.bytesToDefine = DataSize::Dword, .what = target + " - " + table}, .type = InstrType::DB},
+                    codegen::Section::ReadonlyData);
+    }
+    return;
+  }
+
+  // Split it in half. If the middle is a single case, the same compare checks for it too
+  size_t mid = from + (to - from) / 2;
+  std::string lower = ".Lmatch_low" + std::to_string(codegen::matchLabelCount++);
+  const MatchCluster &middle = clusters[mid];
+  pushCompare("%rax", middle.cases[0].value);
+  if (!middle.isTable()) pushJump(JumpCondition::Equal, middle.cases[0].label);
+  pushJump(JumpCondition::Less, lower);
+  if (!middle.isTable() && mid + 1 == to) pushJump(JumpCondition::Unconditioned, noMatch);
+  else dispatchMatch(clusters, middle.isTable() ? mid : mid + 1, to, noMatch);
+  pushLabel(lower);
+  dispatchMatch(clusters, from, mid, noMatch);
+}
+
+// A match on string literals doesn't strcmp its way down the cases either. It goes by the length first,
+// then by whichever byte tells the cases of that length apart, and then there's only one case it could
+// be: a couple of compares against immediates make sure. Every level is an integer match like the above.
+struct StringCase {
+  std::string bytes;
+  std::string label;
+};
+
+// The bytes the assembler makes out of a literal's .asciz. False if it has an escape we don't know,
+// or a \0 (that would cut it short for everyone else)
+static bool literalBytes(const std::string &literal, std::string &bytes) {
+  if (literal.size() < 2 || literal.front() != '"' || literal.back() != '"') return false;
+  std::string text = literal.substr(1, literal.size() - 2);
+  bytes.clear();
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] != '\\') {
+      bytes += text[i];
+      continue;
+    }
+    if (++i == text.size()) return false;
+    switch (text[i]) {
+      case 'n': bytes += '\n'; break;
+      case 't': bytes += '\t'; break;
+      case 'r': bytes += '\r'; break;
+      case '\\': case '"': case '\'': bytes += text[i]; break;
+      default: {
+        // \033 and friends: up to 3 octal digits
+        if (text[i] < '0' || text[i] > '7') return false;
+        int value = 0;
+        for (int digits = 0; digits < 3 && i < text.size() && text[i] >= '0' && text[i] <= '7'; digits++)
+          value = value * 8 + (text[i++] - '0');
+        i--;
+        bytes += static_cast<char>(value);
+      }
+    }
+  }
+  return bytes.find('\0') == std::string::npos;
+}
+
+// %rsi is the string, and it is exactly as long as the case. 8 bytes at a time, and the last few overlap the
+// ones before them instead of reading past the end
+static void confirmString(const StringCase &match, const std::string &noMatch) {
+  size_t length = match.bytes.size();
+  size_t chunk = length >= 8 ? 8 : length >= 4 ? 4 : length >= 2 ? 2 : 1;
+  for (size_t at = 0; at < length; at += chunk) {
+    at = std::min(at, length - chunk);
+    uint64_t raw = 0;
+    std::memcpy(&raw, match.bytes.data() + at, chunk);
+    std::string where = at == 0 ? "(%rsi)" : std::to_string(at) + "(%rsi)";
+    switch (chunk) {
+      case 8:
+        pushBinary("movabsq", "$" + std::to_string(static_cast<int64_t>(raw)), "%rax");
+        codegen::push(Instr{.var = CmpInstr{.lhs = where, .rhs = "%rax", .size = DataSize::Qword}, .type = InstrType::Cmp},
+                      codegen::Section::Main);
+        break;
+      case 4: pushCompare(where, static_cast<int32_t>(raw), DataSize::Dword); break;
+      case 2: pushCompare(where, static_cast<int16_t>(raw), DataSize::Word); break;
+      default: pushCompare(where, static_cast<int8_t>(raw), DataSize::Byte); break;
+    }
+    pushJump(JumpCondition::NotEqual, noMatch);
+  }
+  pushJump(JumpCondition::Unconditioned, match.label);
+}
+
+// Every case is `length` bytes long, and so is %rsi
+static void dispatchBytes(const std::vector<StringCase> &cases, size_t length, const std::string &noMatch) {
+  if (cases.size() == 1) return confirmString(cases[0], noMatch);
+  // The byte with the most different values splits them up the most
+  size_t best = 0, bestCount = 0;
+  for (size_t at = 0; at < length; at++) {
+    std::set<char> seen = {};
+    for (const StringCase &match : cases) seen.insert(match.bytes[at]);
+    if (seen.size() > bestCount) {
+      best = at;
+      bestCount = seen.size();
+    }
+  }
+  std::map<unsigned char, std::vector<StringCase>> groups = {};
+  for (const StringCase &match : cases) groups[static_cast<unsigned char>(match.bytes[best])].push_back(match);
+
+  std::vector<MatchCase> bytes = {};
+  for (auto &[byte, group] : groups) bytes.push_back({byte, ".Lmatch_byte" + std::to_string(codegen::matchLabelCount++)});
+  pushBinary("movzbq", best == 0 ? "(%rsi)" : std::to_string(best) + "(%rsi)", "%rax");
+  std::vector<MatchCluster> clusters = clusterMatch(bytes);
+  dispatchMatch(clusters, 0, clusters.size(), noMatch);
+  size_t i = 0;
+  for (auto &[byte, group] : groups) {
+    pushLabel(bytes[i++].label);
+    dispatchBytes(group, length, noMatch);
+  }
+}
+
+// %rsi is the string
+static void dispatchString(const std::vector<StringCase> &cases, const std::string &noMatch) {
+  // strlen, right here: scan for the \0 with %rcx counting down from -1
+  pushBinary("movq", "%rsi", "%rdi");
+  pushBinary("xorl", "%eax", "%eax");
+  pushBinary("movq", "$-1", "%rcx");
+  pushBinary("repne scasb", "");
+  pushBinary("notq", "%rcx");
+  codegen::push(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%rax", .src = "-1(%rcx)"}, .type = InstrType::Lea},
+                codegen::Section::Main);
+
+  std::map<size_t, std::vector<StringCase>> byLength = {};
+  for (const StringCase &match : cases) byLength[match.bytes.size()].push_back(match);
+  std::vector<MatchCase> lengths = {};
+  for (auto &[length, group] : byLength)
+    lengths.push_back({static_cast<int64_t>(length), ".Lmatch_length" + std::to_string(codegen::matchLabelCount++)});
+  std::vector<MatchCluster> clusters = clusterMatch(lengths);
+  dispatchMatch(clusters, 0, clusters.size(), noMatch);
+  size_t i = 0;
+  for (auto &[length, group] : byLength) {
+    pushLabel(lengths[i++].label);
+    dispatchBytes(group, length, noMatch);
+  }
+}
+
 void codegen::matchStmt(Node::Stmt *stmt) {
   MatchStmt *s = static_cast<MatchStmt *>(stmt);
   push(Instr{.var = Comment{.comment = "match statement"},
              .type = InstrType::Comment},
        Section::Main);
   pushDebug(s->line, stmt->file_id, s->pos);
+  countProfile(s, Profile::Reached);
   if (s->cases.size() == 0 && s->defaultCase != nullptr) {
     // Always jump to the default. What the hell are you using a switch for,
     // anyway?
@@ -1131,52 +1587,85 @@ void codegen::matchStmt(Node::Stmt *stmt) {
     return;
   }
 
-  // Evaluate the match expression
-  visitExpr(s->coverExpr);
-  // Pop the value somewhere where a comp can be made
-  popToRegister("%rax");
-
   std::string matchEndWhere =
       ".Lmatch_end" + std::to_string(conditionalCount + s->cases.size());
   std::string matchDefaultWhere =
       ".Lmatch_default" + std::to_string(conditionalCount + s->cases.size());
+  std::string noMatchWhere = s->defaultCase == nullptr ? matchEndWhere : matchDefaultWhere;
 
-  // Go through each case and evaluate the condition.
+  // String literals get matched by what's in them, not by where they are
+  std::vector<StringCase> strings = {};
+  std::set<std::string> seen = {};
   for (size_t i = 0; i < s->cases.size(); i++) {
-    std::pair<Node::Expr *, Node::Stmt *> matchCase = s->cases[i];
-    visitExpr(matchCase.first);
-    // We can optimize a little further and remove the previous push and compare
-    // to its value directly!
-    PushInstr prevPush =
-        std::get<PushInstr>(text_section[text_section.size() - 1].var);
-    text_section.pop_back();
-
-    push(Instr{.var = CmpInstr{.lhs = "%rax",
-                               .rhs = prevPush.what,
-                               .size = DataSize::Qword},
-               .type = InstrType::Cmp},
-         Section::Main);
-    // Jump if equal to the case
-    push(Instr{.var = JumpInstr{.op = JumpCondition::Equal,
-                                .label = ".Lmatch_case" +
-                                         std::to_string(conditionalCount + i)},
-               .type = InstrType::Jmp},
-         Section::Main);
-  };
+    std::string bytes;
+    Node::Expr *caseExpr = s->cases[i].first;
+    if (caseExpr->kind != ND_STRING || !literalBytes(static_cast<StringExpr *>(caseExpr)->value, bytes)) {
+      strings.clear();
+      break;
+    }
+    // The first case of a string wins, like it would if they were tried in order
+    if (seen.insert(bytes).second) strings.push_back({bytes, ".Lmatch_case" + std::to_string(conditionalCount + i)});
+  }
 
-  // If there is a default case, jump to it. We have clearly gotten this far and
-  // not found a match.
-  if (s->defaultCase == nullptr) {
-    // Jump to the end of the match statement. One will always be added later.
-    push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                                .label = matchEndWhere},
-               .type = InstrType::Jmp},
-         Section::Main);
+  // Evaluate the match expression
+  visitExpr(s->coverExpr);
+  if (!strings.empty()) {
+    popToRegister("%rsi");
+    dispatchString(strings, noMatchWhere);
   } else {
-    push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
-                                .label = matchDefaultWhere},
-               .type = InstrType::Jmp},
-         Section::Main);
+    // Pop the value somewhere where a comp can be made
+    popToRegister("%rax");
+
+    // Go through each case and see what it compares against.
+    std::vector<Operand> values = {};
+    for (size_t i = 0; i < s->cases.size(); i++) {
+      visitExpr(s->cases[i].first);
+      // We can optimize a little further and remove the previous push and compare
+      // to its value directly!
+      PushInstr prevPush =
+          std::get<PushInstr>(text_section[text_section.size() - 1].var);
+      text_section.pop_back();
+      values.push_back(prevPush.what);
+    }
+
+    std::vector<int64_t> weights = {};
+    int64_t reached = Profile::count(s, Profile::Reached);
+    if (reached > 0)
+      for (size_t i = 0; i < s->cases.size(); i++) weights.push_back(Profile::count(s, Profile::caseAt(i)));
+    std::vector<MatchCase> constants = {};
+    if (PassManager::level != OptLevel::O0) constants = matchConstants(values, conditionalCount, weights);
+    if (!constants.empty()) {
+      std::vector<MatchCluster> clusters = clusterMatch(constants);
+      // One case that gets most of the runs doesn't have to wait for the tree or the table, it's checked first
+      auto hottest = std::max_element(constants.begin(), constants.end(),
+                                      [](const MatchCase &a, const MatchCase &b) { return a.weight < b.weight; });
+      if (!isLinearMatch(clusters, 0, clusters.size()) && hottest->weight * 2 > reached) {
+        pushCompare("%rax", hottest->value);
+        pushJump(JumpCondition::Equal, hottest->label);
+      }
+      dispatchMatch(clusters, 0, clusters.size(), noMatchWhere);
+    } else {
+      for (size_t i = 0; i < values.size(); i++) {
+        push(Instr{.var = CmpInstr{.lhs = "%rax",
+                                   .rhs = values[i],
+                                   .size = DataSize::Qword},
+                   .type = InstrType::Cmp},
+             Section::Main);
+        // Jump if equal to the case
+        push(Instr{.var = JumpInstr{.op = JumpCondition::Equal,
+                                    .label = ".Lmatch_case" +
+                                             std::to_string(conditionalCount + i)},
+                   .type = InstrType::Jmp},
+             Section::Main);
+      }
+
+      // If there is a default case, jump to it. We have clearly gotten this far and
+      // not found a match. Otherwise, jump to the end of the match statement. One will always be added later.
+      push(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned,
+                                  .label = noMatchWhere},
+                 .type = InstrType::Jmp},
+           Section::Main);
+    }
   }
 
   // Evaluate each case's label and, of course, statements.
@@ -1186,6 +1675,7 @@ void codegen::matchStmt(Node::Stmt *stmt) {
                                     std::to_string(conditionalCount + i)},
                .type = InstrType::Label},
          Section::Main);
+    countProfile(s, Profile::caseAt(i));
     dwarf::nextBlockDIE = true;
     visitStmt(matchCase.second);
     // Only jump to the end if there is a break. Otherwise, fall through!
@@ -3,8 +3,10 @@
 #include "gen.hpp"
 #include "optimizer/compiler.hpp"
 #include "optimizer/instr.hpp"
+#include "optimizer/profile.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 #include <filesystem>
@@ -102,42 +104,52 @@ JumpCondition codegen::getJumpCondition(const std::string &op) {
   exit(-1);
 }
 
-int codegen::getExpressionDepth(Node::Expr *e) {
-  if (e->kind != NodeKind::ND_BINARY)
-    return 1;
-  BinaryExpr *expr = static_cast<BinaryExpr *>(e);
-  int lhsDepth = 1;
-  if (expr->lhs->kind == NodeKind::ND_BINARY) {
-    lhsDepth += getExpressionDepth(static_cast<BinaryExpr *>(expr->lhs));
-  } else if (expr->lhs->kind == NodeKind::ND_GROUP) {
-    GroupExpr *group = static_cast<GroupExpr *>(expr->lhs);
-    if (group->expr->kind == NodeKind::ND_BINARY) {
-      lhsDepth += getExpressionDepth(static_cast<BinaryExpr *>(group->expr));
+// Sethi-Ullman numbering: how many registers it takes to evaluate `e` without spilling anything.
+// A leaf takes one, and a binary takes one more than its children only if they tie (otherwise
+// the needier side goes first and the other one fits in whatever it left over).
+// Anything that calls something (or we just don't want to think about) gets `clobbersAll`,
+// because it is going to trash every caller-saved register anyways.
+// Cached on the node, so asking at every level of a deep expression doesn't go quadratic.
+static constexpr int clobbersAll = 1 << 16;
+
+int codegen::registerNeed(Node::Expr *e) {
+  if (e->registerNeed) return e->registerNeed;
+  int need = clobbersAll;
+  switch (e->kind) {
+    case ND_INT:
+    case ND_FLOAT:
+    case ND_CHAR:
+    case ND_BOOL:
+    case ND_IDENT:
+      need = 1;
+      break;
+    case ND_GROUP:
+      need = registerNeed(static_cast<GroupExpr *>(e)->expr);
+      break;
+    case ND_UNARY:
+      need = registerNeed(static_cast<UnaryExpr *>(e)->expr);
+      break;
+    case ND_BINARY: {
+      BinaryExpr *bin = static_cast<BinaryExpr *>(e);
+      int lhs = registerNeed(bin->lhs);
+      int rhs = registerNeed(bin->rhs);
+      need = std::min(lhs == rhs ? lhs + 1 : std::max(lhs, rhs), clobbersAll);
+      break;
     }
+    default:
+      break;
   }
-  // check for rhs and see if its greater
-  int rhsDepth = 1;
-  if (expr->rhs->kind == NodeKind::ND_BINARY) {
-    rhsDepth += getExpressionDepth(static_cast<BinaryExpr *>(expr->rhs));
-  } else if (expr->rhs->kind == NodeKind::ND_GROUP) {
-    GroupExpr *group = static_cast<GroupExpr *>(expr->rhs);
-    if (group->expr->kind == NodeKind::ND_BINARY) {
-      rhsDepth += getExpressionDepth(static_cast<BinaryExpr *>(group->expr));
-    }
-  }
-  return lhsDepth > rhsDepth ? lhsDepth : rhsDepth;
+  return e->registerNeed = need;
 }
 
 JumpCondition codegen::processComparison(Node::Expr *cond) {
   // Evaluate the expression. Return the jump of condition of when the
   // comparison is TRUE
-  Node::Expr *eval = CompileOptimizer::optimizeExpr(cond);
+  Node::Expr *eval = cond;
   if (cond->kind == ND_BINARY) {
     BinaryExpr *bin = static_cast<BinaryExpr *>(eval);
     if (boolOperations.find(bin->op) != boolOperations.end()) {
       // we can do a little bit of optimizing here
-      int lhsDepth = getExpressionDepth(bin->lhs);
-      int rhsDepth = getExpressionDepth(bin->rhs);
       bool isFloat = bin->lhs->asmType->kind == ND_SYMBOL_TYPE &&
                      getUnderlying(bin->lhs->asmType) == "float";
       bool isDouble = bin->lhs->asmType->kind == ND_SYMBOL_TYPE &&
@@ -166,7 +178,7 @@ JumpCondition codegen::processComparison(Node::Expr *cond) {
       default:
         break; // It's already OK
       }
-      handleBinaryExprs(lhsDepth, rhsDepth, lhsReg, rhsReg, bin->lhs, bin->rhs);
+      handleBinaryExprs(lhsReg, rhsReg, bin->lhs, bin->rhs);
       // perform the compare
       if (isFloat || isDouble) {
         pushLinker("ucomiss %xmm1, %xmm0\n\t", Section::Main);
@@ -184,9 +196,15 @@ JumpCondition codegen::processComparison(Node::Expr *cond) {
   return JumpCondition::NotZero; // If it is not zero, it is rue
 }
 
-void codegen::handleBinaryExprs(int lhsDepth, int rhsDepth, std::string lhsReg,
-                                std::string rhsReg, Node::Expr *lhs,
-                                Node::Expr *rhs) {
+// Nothing a binary operand (without calls in it) is evaluated with touches these, so one of them can hold
+// the side that went first while the other side is being worked out. {64, 32, 16, 8 bit}
+static const std::vector<std::array<std::string, 4>> heldGprs = {
+  {"%r8", "%r8d", "%r8w", "%r8b"}, {"%r9", "%r9d", "%r9w", "%r9b"},
+  {"%r10", "%r10d", "%r10w", "%r10b"}, {"%r11", "%r11d", "%r11w", "%r11b"},
+};
+static const std::vector<std::string> heldXmms = {"%xmm8", "%xmm9", "%xmm10", "%xmm11"};
+
+void codegen::handleBinaryExprs(std::string lhsReg, std::string rhsReg, Node::Expr *lhs, Node::Expr *rhs) {
   // you cant add an int to a float so they will both be float here
   bool isFloat = lhs->asmType->kind == ND_SYMBOL_TYPE &&
                  (getUnderlying(lhs->asmType) == "float" || 
@@ -197,41 +215,149 @@ void codegen::handleBinaryExprs(int lhsDepth, int rhsDepth, std::string lhsReg,
     lhsSize = intDataToSizeFloat(getByteSizeOfType(lhs->asmType));
     rhsSize = intDataToSizeFloat(getByteSizeOfType(rhs->asmType));
   }
-  // if (lhsDepth <= 1 && rhsDepth <= 1) {
-  //   // If both are depth 1, we can just load them into registers
-  //   visitExpr(lhs);
-  //   popToRegister(lhsReg, lhsSize);
-  //   visitExpr(rhs);
-  //   popToRegister(rhsReg, rhsSize);
-  //   return;
-  // }
-  if (lhsDepth > rhsDepth) {
-    visitExpr(lhs);
-    push(Instr{.var = PopInstr{.where = std::to_string(-variableCount) + "(%rbp)", .whereSize = lhsSize}, .type = InstrType::Pop}, Section::Main);
-    visitExpr(rhs);
-    push(Instr{.var = PopInstr{.where = rhsReg, .whereSize = lhsSize}, .type = InstrType::Pop}, Section::Main);
-    moveRegister(lhsReg, std::to_string(-variableCount) + "(%rbp)", lhsSize, lhsSize);
+  // The needier side goes first (rhs on a tie, like it always has), because then the
+  // other side can be done with one register less
+  bool isLhsFirst = registerNeed(lhs) > registerNeed(rhs);
+  Node::Expr *first = isLhsFirst ? lhs : rhs;
+  Node::Expr *second = isLhsFirst ? rhs : lhs;
+  std::string firstReg = isLhsFirst ? lhsReg : rhsReg;
+  std::string secondReg = isLhsFirst ? rhsReg : lhsReg;
+  DataSize firstSize = isLhsFirst ? lhsSize : rhsSize;
+
+  visitExpr(first);
+  // Hold onto it in a register if the second side can't trash it, otherwise in a stack slot
+  // of its own (so that a binary inside the second side doesn't put its own stuff there)
+  std::string held;
+  if (registerNeed(second) < clobbersAll && heldOperands < heldXmms.size()) {
+    int width = firstSize == DataSize::Byte ? 3 : firstSize == DataSize::Word ? 2 : firstSize == DataSize::Dword ? 1 : 0;
+    held = isFloat ? heldXmms[heldOperands] : heldGprs[heldOperands][width];
+    heldOperands++;
   } else {
-    visitExpr(rhs);
-    push(Instr{.var = PopInstr{.where = std::to_string(-variableCount) + "(%rbp)", .whereSize = rhsSize}, .type = InstrType::Pop}, Section::Main);
-    visitExpr(lhs);
-    push(Instr{.var = PopInstr{.where = lhsReg, .whereSize = lhsSize}, .type = InstrType::Pop}, Section::Main);
-    moveRegister(rhsReg, std::to_string(-variableCount) + "(%rbp)", rhsSize, rhsSize);
-  }
+    held = std::to_string(-variableCount) + "(%rbp)";
+    variableCount += 8;
+  }
+  push(Instr{.var = PopInstr{.where = held, .whereSize = firstSize}, .type = InstrType::Pop}, Section::Main);
+  visitExpr(second);
+  push(Instr{.var = PopInstr{.where = secondReg, .whereSize = lhsSize}, .type = InstrType::Pop}, Section::Main);
+  moveRegister(firstReg, held, firstSize, firstSize);
+  if (held[0] == '%') heldOperands--;
+  else releaseSlots(variableCount - 8);
 }
 
 void codegen::handleExitSyscall() {
+  // The counts only make it to the file if somebody writes them there before we go
+  if (Profile::mode == Profile::Mode::Generate)
+    push(Instr{.var = CallInstr{.name = "native_zprof_write"}, .type = InstrType::Call}, Section::Main);
   moveRegister("%rax", "$60", DataSize::Qword, DataSize::Qword);
   push(Instr{.var = Syscall{.name = "SYS_EXIT"}, .type = InstrType::Syscall},
        Section::Main);
 }
 
+void codegen::countProfile(Node::Stmt *stmt, size_t point) {
+  int64_t counter = Profile::counter(stmt, point);
+  if (counter == -1) return;
+  push(Instr{.var = BinaryInstr{.op = "incq", .src = Profile::address(counter), .dst = {}}, .type = InstrType::Binary},
+       Section::Main);
+}
+
 void codegen::handleReturnCleanup() {
-  popToRegister("%rbp");
+  for (auto &[reg, where] : savedRegisters) moveRegister(reg, where, DataSize::Qword, DataSize::Qword);
+  // %rsp is down below the locals, the prologue reserved them
+  push(Instr{.var = BinaryInstr{.op = "leave", .src = {}, .dst = {}}, .type = InstrType::Binary}, Section::Main);
   pushLinker(".cfi_def_cfa %rsp, 8\n\t", Section::Main);
   push(Instr{.var = Ret{}, .type = InstrType::Ret}, Section::Main);
 }
 
+void codegen::releaseSlots(int64_t to) {
+  frameSize = std::max(frameSize, variableCount);
+  variableCount = to;
+}
+
+codegen::CallArguments codegen::passArguments(const std::vector<Node::Expr *> &args, Node::Expr *self, bool isForeign) {
+  std::vector<Node::Expr *> all = args;
+  if (self != nullptr) all.insert(all.begin(), self);
+  CallArguments result;
+  result.slotsFrom = variableCount;
+
+  // Where everything goes. Empty is the stack, once there are no registers of its kind left
+  std::vector<std::string> where(all.size());
+  std::vector<DataSize> sizes(all.size(), DataSize::Qword);
+  size_t intCount = 0;
+  size_t stackCount = 0;
+  for (size_t i = 0; i < all.size(); i++) {
+    Node::Type *type = all[i]->asmType;
+    bool isFloat = type->kind == ND_SYMBOL_TYPE && (getUnderlying(type) == "float" || getUnderlying(type) == "double");
+    if (isFloat) sizes[i] = intDataToSizeFloat(getByteSizeOfType(type));
+    if (isFloat && (size_t)result.floatCount < floatArgOrder.size()) where[i] = floatArgOrder[result.floatCount++];
+    else if (!isFloat && intCount < intArgOrder.size()) where[i] = intArgOrder[intCount++];
+    else stackCount++;
+  }
+
+  // Evaluate all of them before any goes into its register, or an argument that calls something
+  // would trash the ones before it
+  for (Node::Expr *arg : all) {
+    visitExpr(arg);
+    // Structs over 16 bytes go by address. If we got the struct itself, pass where it is instead
+    if (arg->asmType->kind != ND_SYMBOL_TYPE || !structByteSizes.contains(getUnderlying(arg->asmType)) ||
+        structByteSizes[getUnderlying(arg->asmType)].first <= 16)
+      continue;
+    PushInstr *pushed = std::get_if<PushInstr>(&text_section.back().var);
+    if (pushed == nullptr || !pushed->what.isMemory()) continue;
+    Operand address = pushed->what;
+    text_section.pop_back();
+    push(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%rax", .src = address}, .type = InstrType::Lea},
+         Section::Main);
+    pushRegister("%rax");
+  }
+
+  // Last one first. The ones going on the stack wait in a slot until the registers are done
+  std::vector<std::string> spilled;
+  for (size_t i = all.size(); i-- > 0;) {
+    if (!where[i].empty()) {
+      popToRegister(where[i], sizes[i]);
+      continue;
+    }
+    std::string slot = std::to_string(-variableCount) + "(%rbp)";
+    variableCount += 8;
+    popToRegister(slot, sizes[i]);
+    spilled.push_back(slot);
+  }
+
+  if (isForeign) {
+    // C expects %rsp on a 16 byte boundary, and whatever we're in the middle of might have pushed something
+    result.savedRsp = std::to_string(-variableCount) + "(%rbp)";
+    variableCount += 8;
+    moveRegister(result.savedRsp, "%rsp", DataSize::Qword, DataSize::Qword);
+    push(Instr{.var = BinaryInstr{.op = "andq", .src = "$-16", .dst = "%rsp"}, .type = InstrType::Binary},
+         Section::Main);
+  }
+  // The first stack argument ends up right at %rsp, and that has to stay aligned
+  if (spilled.size() % 2) {
+    push(Instr{.var = SubInstr{.lhs = "%rsp", .rhs = "$8", .size = DataSize::Qword}, .type = InstrType::Sub},
+         Section::Main);
+    result.stackBytes += 8;
+  }
+  for (const std::string &slot : spilled) {
+    push(Instr{.var = PushInstr{.what = slot, .whatSize = DataSize::Qword}, .type = InstrType::Push}, Section::Main);
+    result.stackBytes += 8;
+  }
+  return result;
+}
+
+void codegen::callFunction(const std::string &name, const CallArguments &args) {
+  // Variadic C functions (printf) find out how many vector registers they got in %al
+  if (!args.savedRsp.empty())
+    moveRegister("%eax", "$" + std::to_string(args.floatCount), DataSize::Dword, DataSize::Dword);
+  push(Instr{.var = CallInstr{.name = name}, .type = InstrType::Call, .optimize = false}, Section::Main);
+  if (!args.savedRsp.empty())
+    moveRegister("%rsp", args.savedRsp, DataSize::Qword, DataSize::Qword);
+  else if (args.stackBytes)
+    push(Instr{.var = AddInstr{.lhs = "%rsp", .rhs = "$" + std::to_string(args.stackBytes), .size = DataSize::Qword},
+               .type = InstrType::Add},
+         Section::Main);
+  releaseSlots(args.slotsFrom);
+}
+
 size_t codegen::convertFloatToInt(std::string input) {
   union {
     double f; // 64-bit float
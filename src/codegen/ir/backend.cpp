@@ -0,0 +1,655 @@
+#include "backend.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
+#include "../gen.hpp"
+#include "../optimizer/passes.hpp"
+#include "../optimizer/profile.hpp"
+#include "../optimizer/strength.hpp"
+#include "select.hpp"
+
+namespace ir {
+
+static bool isRegister(const std::string &where) { return where[0] == '%'; }
+static bool isImmediate(const std::string &where) { return where[0] == '$'; }
+static bool isMemory(const std::string &where) { return !isRegister(where) && !isImmediate(where); }
+static bool fitsInImmediate(long long imm) { return imm >= INT_MIN && imm <= INT_MAX; }
+static Cond inverse(Cond cond) {
+  const Cond inverses[] = {Cond::Ne, Cond::Eq, Cond::Ge, Cond::Gt, Cond::Le, Cond::Lt};
+  return inverses[(int)cond];
+}
+
+// The 32, 16 and 8 bit halves (and quarters, and eighths) of every register we can end up working in
+static const std::unordered_map<std::string, std::vector<std::string>> subRegisters = {
+  {"%rax", {"%eax", "%ax", "%al"}},       {"%rbx", {"%ebx", "%bx", "%bl"}},       {"%rcx", {"%ecx", "%cx", "%cl"}},
+  {"%rdx", {"%edx", "%dx", "%dl"}},       {"%rsi", {"%esi", "%si", "%sil"}},      {"%rdi", {"%edi", "%di", "%dil"}},
+  {"%r8", {"%r8d", "%r8w", "%r8b"}},      {"%r9", {"%r9d", "%r9w", "%r9b"}},      {"%r10", {"%r10d", "%r10w", "%r10b"}},
+  {"%r11", {"%r11d", "%r11w", "%r11b"}},  {"%r12", {"%r12d", "%r12w", "%r12b"}},  {"%r13", {"%r13d", "%r13w", "%r13b"}},
+  {"%r14", {"%r14d", "%r14w", "%r14b"}},  {"%r15", {"%r15d", "%r15w", "%r15b"}},
+};
+
+void Backend::emit(Function &function) {
+  fn = &function;
+  splitCriticalEdges();
+  Select::run(*fn);
+
+  std::vector<int> order = layout();
+  allocation = RegAlloc::run(*fn, order, Select::coveredBy);
+
+  prologue();
+  Alignment loopAlign = PassManager::alignsCode() ? Alignment::Loop : Alignment::None;
+  for (size_t i = 0; i < order.size(); i++) {
+    if (i > 0)
+      out(Instr{.var = Label{.name = label(order[i]), .align = isLoopTop[order[i]] ? loopAlign : Alignment::None},
+                .type = InstrType::Label});
+    block(order[i], i + 1 < order.size() ? order[i + 1] : -1);
+  }
+
+  codegen::push(Instr{.var = LinkerDirective{.value = ".cfi_endproc\n"}, .type = InstrType::Linker}, codegen::Section::Main);
+  codegen::push(Instr{.var = LinkerDirective{.value = ".size " + fn->name + ", .-" + fn->name + "\n\t"},
+                      .type = InstrType::Linker},
+                codegen::Section::Main);
+}
+
+// An edge from a block with two ways out into a block with phis has nowhere to put its phi copies:
+// not at the end of the branching block (the other way out would get them too), and not at the
+// start of the target (the other preds would get them too). So it gets a block of its own.
+void Backend::splitCriticalEdges() {
+  size_t count = fn->blocks.size();
+  for (int b = 0; b < (int)count; b++) {
+    if (fn->blocks[b].isDead) continue;
+    int term = fn->terminator(b);
+    if (term == -1 || fn->insts[term].op != Op::Branch) continue;
+    for (int i = 0; i < 2; i++) {
+      int target = fn->insts[term].targets[i];
+      const std::vector<int> &insts = fn->blocks[target].insts;
+      if (insts.empty() || fn->insts[insts[0]].op != Op::Phi) continue;
+      int edge = fn->addBlock();
+      fn->append(edge, {.op = Op::Jump, .targets = {target}});
+      fn->blocks[edge].preds = {b};
+      std::vector<int> &preds = fn->blocks[target].preds;
+      *std::find(preds.begin(), preds.end(), b) = edge; // same spot, so the phi operands still line up
+      fn->insts[term].targets[i] = edge;
+    }
+  }
+}
+
+// Which order the blocks go out in. Loops come out with their test at the bottom: the header (the test)
+// moves below the latch, so getting in costs one jmp and every iteration after that is one taken jcc
+// instead of a jmp back up plus a jcc out. The top of every loop gets aligned, and a branch prefers to
+// fall through into whatever stays in the loop, and away from returns out of the middle of a loop
+// (which happen once, while the loop happens a lot). Those go all the way to the end.
+// With -profile-use, the branch falls through into whichever way ran more, and blocks that never ran go to the end too.
+std::vector<int> Backend::layout() {
+  size_t count = fn->blocks.size();
+  std::vector<int> order = fn->reversePostorder();
+  std::vector<int> position(count, -1);
+  for (size_t i = 0; i < order.size(); i++) position[order[i]] = (int)i;
+
+  // Each header's latch that comes last, and which blocks are in its loop
+  std::vector<int> latch(count, -1);
+  std::vector<std::vector<bool>> loops(count); // by header
+  std::vector<bool> isInLoop(count, false);
+  for (const Loop &loop : fn->loops()) {
+    for (int pred : loop.latches)
+      if (latch[loop.header] == -1 || position[pred] > position[latch[loop.header]]) latch[loop.header] = pred;
+    loops[loop.header] = loop.contains;
+    for (size_t b = 0; b < count; b++)
+      if (loop.contains[b]) isInLoop[b] = true;
+  }
+
+  std::vector<bool> isCold(count, false);
+  for (int b : order) {
+    // With a profile, whatever never ran while the function did
+    if (fn->blocks[0].count > 0 && fn->blocks[b].count == 0) {
+      isCold[b] = true;
+      continue;
+    }
+    int term = fn->terminator(b);
+    if (term == -1 || fn->insts[term].op != Op::Return || isInLoop[b] || fn->blocks[b].preds.empty()) continue;
+    isCold[b] = std::all_of(fn->blocks[b].preds.begin(), fn->blocks[b].preds.end(),
+                            [&](int pred) { return isInLoop[pred] && latch[pred] == -1; });
+  }
+
+  std::vector<int> preferred(count, -1);
+  for (int b : order) {
+    int term = fn->terminator(b);
+    if (term == -1 || fn->insts[term].op != Op::Branch) continue;
+    int a = fn->insts[term].targets[0], c = fn->insts[term].targets[1];
+    auto staysIn = [&](int target) {
+      for (int header : order)
+        if (!loops[header].empty() && loops[header][b] && !loops[header][target]) return false;
+      return true;
+    };
+    long long countA = fn->blocks[a].count, countC = fn->blocks[c].count;
+    if (staysIn(a) != staysIn(c)) preferred[b] = staysIn(a) ? a : c;
+    else if (isCold[a] != isCold[c]) preferred[b] = isCold[a] ? c : a;
+    else if (countA != -1 && countC != -1 && countA != countC) preferred[b] = countA > countC ? a : c;
+  }
+  order = fn->reversePostorder(preferred);
+  std::stable_partition(order.begin(), order.end(), [&](int b) { return !isCold[b]; });
+
+  isLoopTop.assign(count, false);
+  isRotated.assign(count, false);
+  for (int header : std::vector<int>(order)) {
+    if (latch[header] == -1 || header == order[0]) continue;
+    int term = fn->terminator(header), latchTerm = fn->terminator(latch[header]);
+    const Inst &branch = fn->insts[term];
+    // (A loop whose body never ran keeps its test where it is, rather than follow the body out to the cold end)
+    bool isRotatable = branch.op == Op::Branch && fn->insts[latchTerm].op == Op::Jump &&
+                       loops[header][branch.targets[0]] != loops[header][branch.targets[1]] && latch[header] != header &&
+                       isCold[latch[header]] == isCold[header];
+    if (!isRotatable) {
+      isLoopTop[header] = true;
+      continue;
+    }
+    isLoopTop[loops[header][branch.targets[0]] ? branch.targets[0] : branch.targets[1]] = true;
+    isRotated[header] = true;
+    order.erase(std::find(order.begin(), order.end(), header));
+    order.insert(std::find(order.begin(), order.end(), latch[header]) + 1, header);
+  }
+  return order;
+}
+
+// Jumping into a loop whose test is at the bottom. If the test only looks at constants coming in
+// from `from` (`i < 10` on the way into `for i = 0`), we already know how it goes and can skip it
+int Backend::threadJump(int from, int to) {
+  if (!isRotated[to]) return to;
+  const Block &header = fn->blocks[to];
+  int term = fn->terminator(to);
+  int cond = fn->insts[term].args[0];
+  long index = std::find(header.preds.begin(), header.preds.end(), from) - header.preds.begin();
+  // Nothing but the phis, the compare and the branch, or skipping it would skip something else too
+  for (int id : header.insts)
+    if (fn->insts[id].op != Op::Phi && !fn->isConst(id) && id != term && id != cond) return to;
+  if (fn->insts[cond].op != Op::Cmp || fn->insts[cond].block != to || Select::coveredBy[cond] == -1) return to;
+
+  Inst probe = fn->insts[cond];
+  for (int &arg : probe.args) {
+    if (fn->insts[arg].op == Op::Phi && fn->insts[arg].block == to) arg = fn->insts[arg].args[index];
+    if (!fn->isConst(arg)) return to;
+  }
+  long long a = fn->insts[probe.args[0]].imm, b = fn->insts[probe.args[1]].imm;
+  unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+  bool isTrue = false;
+  switch (probe.cond) {
+    case Cond::Eq: isTrue = a == b; break;
+    case Cond::Ne: isTrue = a != b; break;
+    case Cond::Lt: isTrue = probe.isSigned ? a < b : ua < ub; break;
+    case Cond::Le: isTrue = probe.isSigned ? a <= b : ua <= ub; break;
+    case Cond::Gt: isTrue = probe.isSigned ? a > b : ua > ub; break;
+    case Cond::Ge: isTrue = probe.isSigned ? a >= b : ua >= ub; break;
+  }
+  return fn->insts[term].targets[isTrue ? 0 : 1];
+}
+
+void Backend::prologue() {
+  const std::string &name = fn->name;
+  codegen::pushLinker("\n.type " + name + ", @function", codegen::Section::Main);
+  codegen::pushLinker("\n.globl " + name + "\n", codegen::Section::Main);
+  out(Instr{.var = Label{.name = name, .align = PassManager::alignsCode() ? Alignment::Function : Alignment::None},
+            .type = InstrType::Label});
+  codegen::pushLinker(".cfi_startproc\n\t", codegen::Section::Main);
+  codegen::pushLinker("endbr64\n\t", codegen::Section::Main);
+  out(Instr{.var = PushInstr{.what = "%rbp", .whatSize = DataSize::Qword}, .type = InstrType::Push});
+  codegen::pushLinker(".cfi_def_cfa_offset 16\n\t.cfi_offset %rbp, -16\n\t", codegen::Section::Main);
+  out(Instr{.var = MovInstr{.dest = "%rbp", .src = "%rsp"}, .type = InstrType::Mov});
+  codegen::pushLinker(".cfi_def_cfa_register %rbp\n\t", codegen::Section::Main);
+
+  if (allocation.frameSize > 0) op("subq", "$" + std::to_string(allocation.frameSize), "%rsp");
+  // main never returns (it exits), so whoever called it won't miss their registers
+  if (!fn->isEntryPoint)
+    for (auto &[reg, where] : allocation.saved) move(where, reg);
+  // The params come in through the argument registers, and may have been handed each other's registers
+  Moves params;
+  for (int id : fn->blocks[0].insts)
+    if (fn->insts[id].op == Op::Param && allocation.locations.contains(id))
+      params.push_back({location(id), codegen::intArgOrder[fn->insts[id].imm]});
+  parallelMove(params);
+}
+
+void Backend::block(int block, int next) {
+  std::vector<int> insts = fn->blocks[block].insts;
+  for (size_t i = 0; i < insts.size(); i++) {
+    int id = insts[i];
+    const Inst &inst = fn->insts[id];
+    if (inst.op == Op::Call && isTailCall(id, insts, i + 1)) {
+      tailCall(inst, next == -1);
+      return;
+    }
+    switch (inst.op) {
+      case Op::Jump:
+        phiCopies(block, inst.targets[0]);
+        jumpTo(threadJump(block, inst.targets[0]), next);
+        break;
+      case Op::Branch: branch(inst, next); break;
+      case Op::Return: ret(inst, next == -1); break;
+      case Op::Count: op("incq", Profile::address(inst.imm)); break;
+      default: Backend::inst(id); break;
+    }
+  }
+}
+
+void Backend::inst(int id) {
+  const Inst &inst = fn->insts[id];
+  // No code for these: constants are used right where they are needed, params were moved by the
+  // prologue, phis get written by their preds, and covered values by whoever covered them
+  if (inst.op == Op::Const || inst.op == Op::Param || inst.op == Op::Phi || Select::coveredBy[id] != -1) return;
+  // Values nobody reads never got a location (a call whose result is ignored still has to happen though)
+  if (inst.op != Op::Call && !allocation.locations.contains(id)) return;
+
+  std::string result = inst.hasValue() && allocation.locations.contains(id) ? location(id) : "";
+  // Work right in the result's register when there is one
+  std::string work = !result.empty() && isRegister(result) ? result : "%rax";
+
+  switch (inst.op) {
+    case Op::Copy:
+    case Op::Convert:
+      move(work, location(inst.args[0]));
+      break;
+    case Op::Mul:
+    case Op::Add:
+    case Op::Sub:
+    case Op::And:
+    case Op::Or:
+    case Op::Xor: {
+      if (inst.op == Op::Mul ? reduce(inst, work) : add(id, work)) break;
+      const char *names[] = {"addq", "subq", "imulq", "andq", "orq", "xorq"};
+      const Op ops[] = {Op::Add, Op::Sub, Op::Mul, Op::And, Op::Or, Op::Xor};
+      std::string rhs = source(inst.args[1]);
+      if (work == rhs) work = "%rax"; // `b = a - b` can't start by overwriting b
+      move(work, location(inst.args[0]));
+      op(names[std::find(std::begin(ops), std::end(ops), inst.op) - std::begin(ops)], rhs, work);
+      break;
+    }
+    case Op::Shl:
+    case Op::Shr: {
+      std::string count = "%cl";
+      if (fn->isConst(inst.args[1])) count = "$" + std::to_string(fn->insts[inst.args[1]].imm & 63);
+      else if (work == "%rcx" || work == location(inst.args[1])) work = "%rax";
+      move(work, location(inst.args[0]));
+      if (count == "%cl") move("%rcx", location(inst.args[1]));
+      op(inst.op == Op::Shl ? "shlq" : "shrq", count, work);
+      break;
+    }
+    case Op::Div:
+    case Op::Mod: {
+      work = "%rax";
+      move("%rax", location(inst.args[0]));
+      if (fn->isConst(inst.args[1]) && StrengthReduce::divide(fn->insts[inst.args[1]].imm, inst.type.bytes, inst.isSigned,
+                                                             inst.op == Op::Mod, Reg::R11, out))
+        break;
+      std::string divisor = location(inst.args[1]);
+      if (isImmediate(divisor) || divisor == "%rdx") { // div can't take an immediate, and %rdx is about to go
+        move("%r11", divisor);
+        divisor = "%r11";
+      }
+      if (inst.isSigned) {
+        op("cqto");
+        op("idivq", divisor);
+      } else {
+        op("xorl", "%edx", "%edx");
+        op("divq", divisor);
+      }
+      if (inst.op == Op::Mod) work = "%rdx";
+      break;
+    }
+    case Op::Neg:
+    case Op::Not:
+      move(work, location(inst.args[0]));
+      op(inst.op == Op::Neg ? "negq" : "notq", work);
+      break;
+    case Op::Cmp: {
+      const char *signedSet[] = {"sete", "setne", "setl", "setle", "setg", "setge"};
+      const char *unsignedSet[] = {"sete", "setne", "setb", "setbe", "seta", "setae"};
+      // setcc only writes the bottom byte. Clearing the rest before the compare beats zero extending after it,
+      // even if it has to happen in %rax because the compare still needs `work`
+      std::string clear = work;
+      if (clear == location(inst.args[0]) || clear == location(inst.args[1])) clear = "%rax";
+      Cost clearing = Costs::of({Pattern::XorZero, Pattern::Setcc}) + (clear != work ? Costs::of(Pattern::Mov) : Cost{});
+      bool isCleared = compare(inst.args[0], inst.args[1],
+                               Costs::isCheaper(clearing, Costs::of({Pattern::Setcc, Pattern::Movzx})) ? clear : "");
+      if (isCleared) work = clear;
+      op((inst.isSigned ? signedSet : unsignedSet)[(int)inst.cond], subRegisters.at(work)[2]);
+      if (!isCleared) break;
+      move(result, work);
+      return;
+    }
+    case Op::Select:
+      select(inst, work);
+      move(result, work);
+      return;
+    case Op::Call: {
+      Moves args;
+      for (size_t i = 0; i < inst.args.size(); i++) args.push_back({codegen::intArgOrder[i], location(inst.args[i])});
+      parallelMove(args);
+      out(Instr{.var = CallInstr{.name = inst.callee}, .type = InstrType::Call});
+      if (result.empty()) return;
+      work = "%rax";
+      break;
+    }
+    default: return;
+  }
+  extend(inst.type, work);
+  move(result, work);
+}
+
+// A multiply by a constant, as shifts and leas. %r11 is free for the taking while we're at it
+bool Backend::reduce(const Inst &inst, const std::string &work) {
+  int constant = fn->isConst(inst.args[1]) ? 1 : fn->isConst(inst.args[0]) ? 0 : -1;
+  if (constant == -1) return false;
+  std::string from = location(inst.args[1 - constant]);
+  std::vector<Instr> code;
+  if (!StrengthReduce::multiply(Operand(work).reg, fn->insts[inst.args[constant]].imm, inst.type.bytes, Reg::R11,
+                                [&](Instr instr) { code.push_back(instr); }))
+    return false;
+  move(work, from);
+  for (Instr &instr : code) out(instr);
+  return true;
+}
+
+// Add and Sub, when instruction selection (or where things ended up) has something better than mov + add
+bool Backend::add(int id, const std::string &work) {
+  const Inst &inst = fn->insts[id];
+  if (inst.op != Op::Add && inst.op != Op::Sub) return false;
+  auto lea = [&](const std::string &address) {
+    out(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = work, .src = address}, .type = InstrType::Lea});
+  };
+  Cost leaCost = Costs::of(Pattern::Lea);
+
+  auto found = Select::addresses.find(id);
+  if (found != Select::addresses.end()) {
+    const Select::Address &address = found->second;
+    std::string base = address.base == -1 ? "" : inRegister(address.base, "%rax");
+    std::string index = address.index == -1 ? "" : "," + inRegister(address.index, "%r11");
+    if (address.scale > 1) index += "," + std::to_string(address.scale);
+    long long disp = address.isSplit ? 0 : address.disp;
+    lea((disp != 0 ? std::to_string(disp) : "") + "(" + base + index + ")");
+    if (address.isSplit) addConstant(work, address.disp);
+    return true;
+  }
+
+  // `x + 5` or `x - 5`: an lea straight into wherever it goes, or an inc or dec
+  int constant = fn->isConst(inst.args[1]) ? 1 : inst.op == Op::Add && fn->isConst(inst.args[0]) ? 0 : -1;
+  if (constant != -1) {
+    long long imm = fn->insts[inst.args[constant]].imm;
+    if (!fitsInImmediate(imm) || (inst.op == Op::Sub && imm == INT_MIN)) return false;
+    if (inst.op == Op::Sub) imm = -imm;
+    std::string from = location(inst.args[1 - constant]);
+    if (from != work && isRegister(from) && Costs::isCheaper(leaCost, Costs::of({Pattern::Mov, Pattern::AluImm}))) {
+      lea(std::to_string(imm) + "(" + from + ")");
+      return true;
+    }
+    move(work, from);
+    addConstant(work, imm);
+    return true;
+  }
+
+  // `x + y` into a third register
+  std::string lhs = location(inst.args[0]), rhs = location(inst.args[1]);
+  if (inst.op == Op::Add && isRegister(lhs) && isRegister(rhs) && work != lhs && work != rhs &&
+      Costs::isCheaper(leaCost, Costs::of({Pattern::Mov, Pattern::Alu}))) {
+    lea("(" + lhs + "," + rhs + ")");
+    return true;
+  }
+  return false;
+}
+
+void Backend::addConstant(const std::string &reg, long long value) {
+  if (value == 0) return;
+  if ((value == 1 || value == -1) && Costs::isCheaper(Costs::of(Pattern::Inc), Costs::of(Pattern::AluImm)))
+    op(value == 1 ? "incq" : "decq", reg);
+  else
+    op("addq", "$" + std::to_string(value), reg);
+}
+
+// args[0] ? args[1] : args[2], with a cmov
+void Backend::select(const Inst &inst, const std::string &work) {
+  const char *signedSuffix[] = {"e", "ne", "l", "le", "g", "ge"};
+  const char *unsignedSuffix[] = {"e", "ne", "b", "be", "a", "ae"};
+  int cond = inst.args[0];
+  Cond when = Cond::Ne;
+  bool isSigned = true;
+  if (Select::coveredBy[cond] != -1) {
+    const Inst &cmp = fn->insts[cond];
+    compare(cmp.args[0], cmp.args[1]);
+    when = cmp.cond;
+    isSigned = cmp.isSigned;
+  } else {
+    std::string where = location(cond);
+    if (isImmediate(where)) {
+      move("%rax", where);
+      where = "%rax";
+    }
+    if (isMemory(where)) out(Instr{.var = CmpInstr{.lhs = where, .rhs = "$0", .size = DataSize::Qword}, .type = InstrType::Cmp});
+    else op("testq", where, where);
+  }
+
+  // From here on the flags are spoken for, so no xor'ing anything
+  std::string ifTrue = location(inst.args[1]), ifFalse = location(inst.args[2]);
+  if (ifTrue == work) { // it would be gone before the cmov got to it
+    std::swap(ifTrue, ifFalse);
+    when = inverse(when);
+  }
+  move(work, ifFalse, true);
+  if (isImmediate(ifTrue)) { // cmov doesn't take immediates
+    move("%r11", ifTrue, true);
+    ifTrue = "%r11";
+  }
+  op(std::string("cmov") + (isSigned ? signedSuffix : unsignedSuffix)[(int)when], ifTrue, work);
+}
+
+// Sets the flags for `lhs <cond> rhs`. `zeroFirst` gets cleared before that if it isn't in the way,
+// and then it returns true
+bool Backend::compare(int lhs, int rhs, const std::string &zeroFirst) {
+  std::string right = source(rhs);
+  std::string left = location(lhs);
+  // cmp wants its left side somewhere it could write to, and can't have memory on both sides
+  if (isImmediate(left) || (isMemory(left) && isMemory(right))) {
+    move("%rax", left);
+    left = "%rax";
+  }
+  bool isCleared = !zeroFirst.empty() && zeroFirst != left && zeroFirst != right;
+  if (isCleared) op("xorl", subRegisters.at(zeroFirst)[0], subRegisters.at(zeroFirst)[0]);
+  if (right == "$0" && isRegister(left) && Costs::isCheaper(Costs::of(Pattern::Test), Costs::of(Pattern::CmpImm))) {
+    op("testq", left, left);
+    return isCleared;
+  }
+  out(Instr{.var = CmpInstr{.lhs = left, .rhs = right, .size = DataSize::Qword}, .type = InstrType::Cmp});
+  return isCleared;
+}
+
+void Backend::branch(const Inst &inst, int next) {
+  int cond = inst.args[0];
+  int ifTrue = inst.targets[0], ifFalse = inst.targets[1];
+  JumpCondition jump = JumpCondition::NotZero;
+  if (Select::coveredBy[cond] != -1) {
+    const Inst &cmp = fn->insts[cond];
+    const JumpCondition conds[] = {JumpCondition::Equal, JumpCondition::NotEqual, JumpCondition::Less,
+                                   JumpCondition::LessEqual, JumpCondition::Greater, JumpCondition::GreaterEqual};
+    compare(cmp.args[0], cmp.args[1]);
+    jump = conds[(int)cmp.cond];
+  } else {
+    std::string where = location(cond);
+    if (isMemory(where)) {
+      out(Instr{.var = CmpInstr{.lhs = where, .rhs = "$0", .size = DataSize::Qword}, .type = InstrType::Cmp});
+    } else {
+      if (isImmediate(where)) {
+        move("%rax", where);
+        where = "%rax";
+      }
+      op("testq", where, where);
+    }
+  }
+
+  if (ifTrue == next) {
+    // Falling through into the true side, so jump away on the opposite condition
+    const std::unordered_map<JumpCondition, JumpCondition> inverse = {
+      {JumpCondition::Equal, JumpCondition::NotEqual}, {JumpCondition::NotEqual, JumpCondition::Equal},
+      {JumpCondition::Less, JumpCondition::GreaterEqual}, {JumpCondition::GreaterEqual, JumpCondition::Less},
+      {JumpCondition::Greater, JumpCondition::LessEqual}, {JumpCondition::LessEqual, JumpCondition::Greater},
+      {JumpCondition::NotZero, JumpCondition::Zero},
+    };
+    out(Instr{.var = JumpInstr{.op = inverse.at(jump), .label = label(ifFalse)}, .type = InstrType::Jmp});
+    return;
+  }
+  out(Instr{.var = JumpInstr{.op = jump, .label = label(ifTrue)}, .type = InstrType::Jmp});
+  jumpTo(ifFalse, next);
+}
+
+// Nothing but constants between the call and a return of whatever it returned (or of nothing at all).
+// main's return is an exit, that one has to stay a call
+bool Backend::isTailCall(int call, const std::vector<int> &insts, size_t from) {
+  if (fn->isEntryPoint) return false;
+  for (size_t i = from; i < insts.size(); i++) {
+    const Inst &inst = fn->insts[insts[i]];
+    if (inst.op == Op::Const) continue;
+    return inst.op == Op::Return && (inst.args.empty() || inst.args[0] == call);
+  }
+  return false;
+}
+
+// A call that our caller gets the result of anyway: the callee can return straight to them
+void Backend::tailCall(const Inst &inst, bool isLast) {
+  Moves args;
+  for (size_t i = 0; i < inst.args.size(); i++) args.push_back({codegen::intArgOrder[i], location(inst.args[i])});
+  parallelMove(args);
+  for (auto &[reg, where] : allocation.saved) move(reg, where);
+  if (!isLast) codegen::pushLinker(".cfi_remember_state\n\t", codegen::Section::Main);
+  op("leave");
+  codegen::pushLinker(".cfi_def_cfa %rsp, 8\n\t", codegen::Section::Main);
+  out(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned, .label = inst.callee}, .type = InstrType::Jmp});
+  if (!isLast) codegen::pushLinker(".cfi_restore_state\n\t", codegen::Section::Main);
+}
+
+void Backend::ret(const Inst &inst, bool isLast) {
+  if (fn->isEntryPoint && !inst.args.empty()) {
+    // Returning from main means exiting, with the return value as the exit code
+    if (Profile::mode == Profile::Mode::Generate)
+      out(Instr{.var = CallInstr{.name = "native_zprof_write"}, .type = InstrType::Call});
+    move("%rdi", location(inst.args[0]));
+    out(Instr{.var = MovInstr{.dest = "%rax", .src = "$60"}, .type = InstrType::Mov});
+    out(Instr{.var = Syscall{.name = "SYS_EXIT"}, .type = InstrType::Syscall});
+    return;
+  }
+  if (!inst.args.empty()) move("%rax", location(inst.args[0]));
+  for (auto &[reg, where] : allocation.saved) move(reg, where);
+  // More code follows this ret, and that code still has a frame
+  if (!isLast) codegen::pushLinker(".cfi_remember_state\n\t", codegen::Section::Main);
+  op("leave");
+  codegen::pushLinker(".cfi_def_cfa %rsp, 8\n\t", codegen::Section::Main);
+  out(Instr{.var = Ret{.fromWhere = fn->name}, .type = InstrType::Ret});
+  if (!isLast) codegen::pushLinker(".cfi_restore_state\n\t", codegen::Section::Main);
+}
+
+void Backend::phiCopies(int from, int to) {
+  const Block &target = fn->blocks[to];
+  long index = std::find(target.preds.begin(), target.preds.end(), from) - target.preds.begin();
+  Moves moves;
+  for (int id : target.insts)
+    if (fn->insts[id].op == Op::Phi && allocation.locations.contains(id))
+      moves.push_back({location(id), location(fn->insts[id].args[index])});
+  parallelMove(moves);
+}
+
+// All of `moves` happen at the same time, so `a, b = b, a` has to go through a temporary instead
+// of clobbering `a` first. Phi copies need this, and so do call arguments and incoming params.
+void Backend::parallelMove(Moves moves) {
+  std::erase_if(moves, [](const std::pair<std::string, std::string> &m) { return m.first == m.second; });
+  while (!moves.empty()) {
+    // Anything that nobody still needs to read can be written right away
+    auto ready = std::find_if(moves.begin(), moves.end(), [&](const std::pair<std::string, std::string> &m) {
+      return std::none_of(moves.begin(), moves.end(),
+                          [&](const std::pair<std::string, std::string> &other) { return other.second == m.first; });
+    });
+    if (ready != moves.end()) {
+      move(ready->first, ready->second);
+      moves.erase(ready);
+      continue;
+    }
+    // Everything left is a cycle. Save one of them, and the rest untangles itself
+    std::string saved = moves.front().first;
+    move("%r11", saved);
+    for (std::pair<std::string, std::string> &m : moves)
+      if (m.second == saved) m.second = "%r11";
+  }
+}
+
+void Backend::jumpTo(int block, int next) {
+  if (block == next) return; // just fall through
+  out(Instr{.var = JumpInstr{.op = JumpCondition::Unconditioned, .label = label(block)}, .type = InstrType::Jmp});
+}
+
+std::string Backend::location(int value) {
+  if (fn->isConst(value)) return "$" + std::to_string(fn->insts[value].imm);
+  return allocation.locations.at(value);
+}
+
+std::string Backend::source(int value) {
+  std::string where = location(value);
+  if (isImmediate(where) && !fitsInImmediate(fn->insts[value].imm)) {
+    move("%r11", where);
+    return "%r11";
+  }
+  return where;
+}
+
+std::string Backend::inRegister(int value, const std::string &scratch) {
+  std::string where = location(value);
+  if (isRegister(where)) return where;
+  move(scratch, where);
+  return scratch;
+}
+
+std::string Backend::label(int block) {
+  return ".L" + fn->name + "_bb" + std::to_string(block);
+}
+
+void Backend::move(const std::string &to, const std::string &from, bool keepFlags) {
+  if (to == from) return;
+  if (from == "$0" && isRegister(to) && !keepFlags &&
+      Costs::isCheaper(Costs::of(Pattern::XorZero), Costs::of(Pattern::MovImm))) {
+    op("xorl", subRegisters.at(to)[0], subRegisters.at(to)[0]);
+    return;
+  }
+  if (isImmediate(from) && !fitsInImmediate(std::stoll(from.substr(1)))) {
+    // Only a mov into a register can take all 64 bits
+    op("movabsq", from, isRegister(to) ? to : "%rax");
+    if (!isRegister(to)) move(to, "%rax");
+    return;
+  }
+  if (isMemory(to) && isMemory(from)) { // there is no memory to memory mov
+    move("%rax", from);
+    move(to, "%rax");
+    return;
+  }
+  out(Instr{.var = MovInstr{.dest = to, .src = from}, .type = InstrType::Mov});
+}
+
+void Backend::extend(Type type, const std::string &reg) {
+  const std::vector<std::string> &sub = subRegisters.at(reg);
+  switch (type.bytes) {
+    case 1: op(type.isSigned ? "movsbq" : "movzbq", sub[2], reg); break;
+    case 2: op(type.isSigned ? "movswq" : "movzwq", sub[1], reg); break;
+    case 4:
+      if (type.isSigned) op("movslq", sub[0], reg);
+      else op("movl", sub[0], sub[0]); // writing a 32 bit register clears the top half
+      break;
+    default: break;
+  }
+}
+
+void Backend::op(const std::string &op, const std::string &src, const std::string &dst) {
+  out(Instr{.var = BinaryInstr{.op = op, .src = src, .dst = dst}, .type = InstrType::Binary});
+}
+
+// The peephole optimizer's pair rules were written for stack machine code, and some of them
+// (like dropping both halves of `mov a, b; mov b, a`) are only right there. Keep it away from this.
+void Backend::out(Instr instr) {
+  instr.optimize = false;
+  codegen::push(instr, codegen::Section::Main);
+}
+
+} // namespace ir
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../optimizer/instr.hpp"
+#include "ir.hpp"
+#include "regalloc.hpp"
+
+namespace ir {
+
+// Lowers an ir::Function to x86 `Instr`s in the text section.
+// Select decides which patterns cover which values, RegAlloc decides where every value lives (a register,
+// or a stack slot if it ran out), and the backend works straight on those. %rax and %r11 are its own scratch registers.
+class Backend {
+public:
+  static void emit(Function &fn);
+
+private:
+  using Moves = std::vector<std::pair<std::string, std::string>>; // where <- what
+
+  static void splitCriticalEdges();
+  static std::vector<int> layout();
+  static int threadJump(int from, int to);
+  static void prologue();
+  static void block(int block, int next);
+  static void inst(int id);
+  static bool reduce(const Inst &inst, const std::string &work);
+  static bool add(int id, const std::string &work);
+  static void addConstant(const std::string &reg, long long value);
+  static void select(const Inst &inst, const std::string &work);
+  static bool compare(int lhs, int rhs, const std::string &zeroFirst = "");
+  static void branch(const Inst &inst, int next);
+  static void ret(const Inst &inst, bool isLast);
+  static bool isTailCall(int call, const std::vector<int> &insts, size_t from);
+  static void tailCall(const Inst &inst, bool isLast);
+  static void phiCopies(int from, int to);
+  static void parallelMove(Moves moves);
+  static void jumpTo(int block, int next);
+
+  static std::string location(int value); // register, stack slot or "$immediate"
+  static std::string source(int value);   // same, but huge constants get put in %r11 first
+  static std::string inRegister(int value, const std::string &scratch);
+  static std::string label(int block);
+  static void move(const std::string &to, const std::string &from, bool keepFlags = false);
+  static void extend(Type type, const std::string &reg); // back to a proper value of `type`
+
+  static void op(const std::string &op, const std::string &src = "", const std::string &dst = "");
+  static void out(Instr instr);
+
+  static inline Function *fn = nullptr;
+  static inline Allocation allocation = {};
+  static inline std::vector<bool> isLoopTop = {}; // gets aligned
+  static inline std::vector<bool> isRotated = {}; // a loop header that was moved below its loop
+};
+
+} // namespace ir
@@ -0,0 +1,563 @@
+#include "builder.hpp"
+
+#include <algorithm>
+
+#include "../gen.hpp"
+#include "../optimizer/profile.hpp"
+
+namespace ir {
+
+void Builder::collect(Node::Stmt *program) {
+  functions.clear();
+  if (program->kind != ND_PROGRAM) return;
+  for (Node::Stmt *stmt : static_cast<ProgramStmt *>(program)->stmt) {
+    if (stmt->kind != ND_CONST_STMT) continue;
+    Node::Stmt *value = static_cast<ConstStmt *>(stmt)->value;
+    if (value->kind == ND_FN_STMT) functions[static_cast<FnStmt *>(value)->name] = static_cast<FnStmt *>(value);
+  }
+}
+
+Function *Builder::build(FnStmt *stmt, const std::string &label, bool isEntryPoint) {
+  if (!stmt->typenames.empty() || stmt->params.size() > codegen::intArgOrder.size()) return nullptr;
+
+  fn = new Function{.name = label, .isEntryPoint = isEntryPoint};
+  scopes = {{}};
+  variableTypes.clear();
+  definitions.clear();
+  sealed.clear();
+  incompletePhis.clear();
+  replacedBy.clear();
+  loops.clear();
+
+  try {
+    if (codegen::getUnderlying(stmt->returnType) != "void") fn->returnType = typeOrBail(stmt->returnType);
+    current = newBlock();
+    sealed[current] = true; // nothing jumps to the entry
+    for (size_t i = 0; i < stmt->params.size(); i++) {
+      Type type = typeOrBail(stmt->params[i].second);
+      fn->params.push_back(type);
+      declare(stmt->params[i].first->name, type, emit({.op = Op::Param, .type = type, .imm = (long long)i}));
+    }
+    instrument(stmt, Profile::Entry);
+    fn->blocks[current].count = Profile::count(stmt, Profile::Entry);
+    Builder::stmt(stmt->block);
+    // Fell off the end of the function
+    if (fn->terminator(current) == -1) {
+      if (fn->returnType.bytes == 0 || isEntryPoint) emit({.op = Op::Return});
+      else emit({.op = Op::Return, .args = {constant(0, fn->returnType)}});
+    }
+  } catch (Unsupported &) {
+    delete fn;
+    fn = nullptr;
+    return nullptr;
+  }
+
+  // Point everything at what the trivial phis turned out to be
+  for (Inst &inst : fn->insts)
+    for (int &arg : inst.args) arg = resolve(arg);
+  return fn;
+}
+
+// ---------------------------------------------------------------------------
+// Types
+// ---------------------------------------------------------------------------
+
+bool Builder::typeOf(Node::Type *type, Type &out) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return false;
+  SymbolType *sym = static_cast<SymbolType *>(type);
+  if (sym->name == "bool") {
+    out = boolType;
+    return true;
+  }
+  if (sym->name == "$") { // a literal that never got told what it is
+    out = {.bytes = 8, .isSigned = sym->signedness == SymbolType::Signedness::SIGNED};
+    return true;
+  }
+  if (sym->name != "int" && sym->name != "short" && sym->name != "char" && sym->name != "long") return false;
+  out = {.bytes = codegen::typeSizes[sym->name], .isSigned = sym->signedness == SymbolType::Signedness::SIGNED};
+  return true;
+}
+
+Type Builder::typeOrBail(Node::Type *type) {
+  Type out;
+  if (!typeOf(type, out)) throw Unsupported{};
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+// Statements
+// ---------------------------------------------------------------------------
+
+void Builder::stmt(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_BLOCK_STMT:
+      scopes.emplace_back();
+      for (Node::Stmt *s : static_cast<BlockStmt *>(stmt)->stmts) Builder::stmt(s);
+      scopes.pop_back();
+      return;
+    case ND_VAR_STMT: {
+      VarStmt *s = static_cast<VarStmt *>(stmt);
+      Type type = typeOrBail(s->type);
+      int value = s->expr != nullptr ? convert(expr(s->expr), type) : constant(0, type);
+      declare(s->name, type, value);
+      return;
+    }
+    case ND_EXPR_STMT:
+      expr(static_cast<ExprStmt *>(stmt)->expr);
+      return;
+    case ND_RETURN_STMT: {
+      ReturnStmt *s = static_cast<ReturnStmt *>(stmt);
+      // The backend turns a call right before a return into a jump, for @tailcall that's not up for debate.
+      // If it isn't going to happen here, codegen will say why
+      if (s->isTailCall && fn->isEntryPoint) throw Unsupported{};
+      if (s->expr != nullptr && fn->returnType.bytes != 0) {
+        int value = convert(expr(s->expr), fn->returnType);
+        if (s->isTailCall && s->expr->kind == ND_CALL && fn->insts[value].op != Op::Call) throw Unsupported{};
+        emit({.op = Op::Return, .args = {value}});
+      }
+      else if (s->expr != nullptr) throw Unsupported{}; // returning something from a void function?
+      else emit({.op = Op::Return});
+      startBlock(newBlock()); // anything after this is unreachable
+      seal(current);
+      return;
+    }
+    case ND_IF_STMT: {
+      IfStmt *s = static_cast<IfStmt *>(stmt);
+      int thenBlock = newBlock();
+      int elseBlock = s->elseStmt != nullptr ? newBlock() : -1;
+      int merge = newBlock();
+      long long reached = Profile::count(s, Profile::Reached), taken = Profile::count(s, Profile::Taken);
+      fn->blocks[thenBlock].count = taken;
+      if (elseBlock != -1) fn->blocks[elseBlock].count = reached == -1 ? -1 : reached - taken;
+      fn->blocks[merge].count = reached;
+      instrument(s, Profile::Reached);
+      condition(s->condition, thenBlock, elseBlock != -1 ? elseBlock : merge);
+      seal(thenBlock);
+      startBlock(thenBlock);
+      instrument(s, Profile::Taken);
+      Builder::stmt(s->thenStmt);
+      jump(merge);
+      if (elseBlock != -1) {
+        seal(elseBlock);
+        startBlock(elseBlock);
+        Builder::stmt(s->elseStmt);
+        jump(merge);
+      }
+      seal(merge);
+      startBlock(merge);
+      return;
+    }
+    case ND_WHILE_STMT: {
+      WhileStmt *s = static_cast<WhileStmt *>(stmt);
+      loop(s, s->condition, s->optional, s->block);
+      return;
+    }
+    case ND_FOR_STMT: {
+      ForStmt *s = static_cast<ForStmt *>(stmt);
+      if (s->forLoop->kind != ND_ASSIGN) throw Unsupported{};
+      AssignmentExpr *init = static_cast<AssignmentExpr *>(s->forLoop);
+      if (init->assignee->kind != ND_IDENT || init->op != "=") throw Unsupported{};
+      IdentExpr *var = static_cast<IdentExpr *>(init->assignee);
+      scopes.emplace_back(); // the loop variable only lives as long as the loop
+      Type type = typeOrBail(var->asmType);
+      declare(var->name, type, convert(expr(init->rhs), type));
+      loop(s, s->condition, s->optional, s->block);
+      scopes.pop_back();
+      return;
+    }
+    case ND_BREAK_STMT:
+    case ND_CONTINUE_STMT:
+      if (loops.empty()) throw Unsupported{};
+      jump(stmt->kind == ND_BREAK_STMT ? loops.back().breakTo : loops.back().continueTo);
+      startBlock(newBlock());
+      seal(current);
+      return;
+    default:
+      throw Unsupported{}; // output, match, structs, nested functions...
+  }
+}
+
+//   header: if (cond) goto body else goto exit
+//   body:   ...; goto latch      (continue -> latch, break -> exit)
+//   latch:  step; goto header
+void Builder::loop(Node::Stmt *stmt, Node::Expr *cond, Node::Expr *step, Node::Stmt *body) {
+  int header = newBlock();
+  int bodyBlock = newBlock();
+  int latch = newBlock();
+  int exit = newBlock();
+  long long reached = Profile::count(stmt, Profile::Reached), trips = Profile::count(stmt, Profile::Taken);
+  fn->blocks[header].count = reached == -1 ? -1 : reached + trips;
+  fn->blocks[bodyBlock].count = fn->blocks[latch].count = trips;
+  fn->blocks[exit].count = reached;
+  instrument(stmt, Profile::Reached);
+  jump(header);
+  startBlock(header); // not sealed, the back edge isn't there yet
+  condition(cond, bodyBlock, exit);
+  seal(bodyBlock);
+  startBlock(bodyBlock);
+  instrument(stmt, Profile::Taken);
+  loops.push_back({.continueTo = latch, .breakTo = exit});
+  Builder::stmt(body);
+  loops.pop_back();
+  jump(latch);
+  seal(latch);
+  startBlock(latch);
+  if (step != nullptr) expr(step);
+  jump(header);
+  seal(header);
+  seal(exit);
+  startBlock(exit);
+}
+
+// ---------------------------------------------------------------------------
+// Expressions
+// ---------------------------------------------------------------------------
+
+int Builder::expr(Node::Expr *expr) {
+  switch (expr->kind) {
+    case ND_INT: {
+      Type type = {.bytes = 8, .isSigned = true};
+      typeOf(expr->asmType, type);
+      return constant(static_cast<IntExpr *>(expr)->value, type);
+    }
+    case ND_BOOL: return constant(static_cast<BoolExpr *>(expr)->value, boolType);
+    case ND_CHAR: {
+      Type type = {.bytes = 1, .isSigned = false};
+      typeOf(expr->asmType, type);
+      return constant(static_cast<CharExpr *>(expr)->value, type);
+    }
+    case ND_GROUP: return Builder::expr(static_cast<GroupExpr *>(expr)->expr);
+    case ND_IDENT: {
+      int var = lookup(static_cast<IdentExpr *>(expr)->name);
+      if (var == -1) throw Unsupported{}; // a global, or a function used as a value
+      return readVariable(var, current);
+    }
+    case ND_UNARY: {
+      UnaryExpr *e = static_cast<UnaryExpr *>(expr);
+      if (e->op == "!") return boolValue(expr);
+      Type type = typeOrBail(expr->asmType);
+      if (type == boolType) throw Unsupported{};
+      int operand = Builder::expr(e->expr);
+      if (e->op == "-") return emit({.op = Op::Neg, .type = type, .args = {operand}});
+      if (e->op == "~") return emit({.op = Op::Not, .type = type, .args = {operand}});
+      throw Unsupported{};
+    }
+    case ND_PREFIX:
+    case ND_POSTFIX: {
+      bool isPrefix = expr->kind == ND_PREFIX;
+      Node::Expr *target = isPrefix ? static_cast<PrefixExpr *>(expr)->expr : static_cast<PostfixExpr *>(expr)->expr;
+      const std::string &op = isPrefix ? static_cast<PrefixExpr *>(expr)->op : static_cast<PostfixExpr *>(expr)->op;
+      if (op != "++" && op != "--") throw Unsupported{};
+      int old = Builder::expr(target);
+      Type type = fn->insts[old].type;
+      if (type == boolType) throw Unsupported{};
+      int updated = emit({.op = op == "++" ? Op::Add : Op::Sub, .type = type, .args = {old, constant(1, type)}});
+      assign(target, updated);
+      return isPrefix ? updated : old;
+    }
+    case ND_CAST: {
+      CastExpr *e = static_cast<CastExpr *>(expr);
+      Type to = typeOrBail(e->castee_type);
+      if (to == boolType) throw Unsupported{};
+      return convert(Builder::expr(e->castee), to);
+    }
+    case ND_TERNARY: {
+      TernaryExpr *e = static_cast<TernaryExpr *>(expr);
+      Type type = typeOrBail(expr->asmType);
+      int thenBlock = newBlock(), elseBlock = newBlock(), merge = newBlock();
+      condition(e->condition, thenBlock, elseBlock);
+      seal(thenBlock);
+      seal(elseBlock);
+      startBlock(thenBlock);
+      int thenValue = convert(Builder::expr(e->lhs), type);
+      jump(merge);
+      startBlock(elseBlock);
+      int elseValue = convert(Builder::expr(e->rhs), type);
+      jump(merge);
+      seal(merge);
+      startBlock(merge);
+      // Both arms jumped here in order, so the operands line up with the preds
+      int phi = fn->addPhi(merge, type);
+      fn->insts[phi].args = {thenValue, elseValue};
+      return phi;
+    }
+    case ND_ASSIGN: {
+      AssignmentExpr *e = static_cast<AssignmentExpr *>(expr);
+      if (e->op == "=") return assign(e->assignee, Builder::expr(e->rhs));
+      if (e->op != "+=" && e->op != "-=" && e->op != "*=" && e->op != "/=") throw Unsupported{};
+      int old = Builder::expr(e->assignee);
+      int rhs = Builder::expr(e->rhs);
+      Type type = fn->insts[old].type;
+      if (type == boolType) throw Unsupported{};
+      bool isSignedOp = type.isSigned || fn->insts[rhs].type.isSigned;
+      return assign(e->assignee, arithmetic(e->op.substr(0, 1), old, rhs, type, isSignedOp));
+    }
+    case ND_BINARY: return binary(static_cast<BinaryExpr *>(expr));
+    case ND_CALL: return call(static_cast<CallExpr *>(expr));
+    default:
+      throw Unsupported{}; // floats, strings, pointers, arrays, structs, memory...
+  }
+}
+
+int Builder::binary(BinaryExpr *expr) {
+  const std::string &op = expr->op;
+  if (op == "&&" || op == "||") return boolValue(expr);
+
+  if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") {
+    int lhs = Builder::expr(expr->lhs);
+    int rhs = Builder::expr(expr->rhs);
+    // Compared at the wider of the two widths, and always as signed- the same thing the stack machine does
+    int width = std::max(fn->insts[lhs].type.bytes, fn->insts[rhs].type.bytes);
+    Type compareAs = {.bytes = width, .isSigned = true};
+    Cond cond = op == "==" ? Cond::Eq : op == "!=" ? Cond::Ne : op == "<" ? Cond::Lt
+              : op == ">" ? Cond::Gt : op == "<=" ? Cond::Le : Cond::Ge;
+    return emit({.op = Op::Cmp, .type = boolType, .args = {convert(lhs, compareAs), convert(rhs, compareAs)}, .cond = cond});
+  }
+
+  Type type = typeOrBail(expr->asmType);
+  if (type == boolType) throw Unsupported{};
+  int lhs = Builder::expr(expr->lhs);
+  int rhs = Builder::expr(expr->rhs);
+  Type lhsType, rhsType;
+  bool isSignedOp = (typeOf(expr->lhs->asmType, lhsType) && lhsType.isSigned) ||
+                    (typeOf(expr->rhs->asmType, rhsType) && rhsType.isSigned);
+  return arithmetic(op, lhs, rhs, type, isSignedOp);
+}
+
+int Builder::arithmetic(const std::string &op, int lhs, int rhs, Type type, bool isSignedOp) {
+  // The low bits of these only ever depend on the low bits of the operands, so no need to convert anything first
+  if (op == "+") return emit({.op = Op::Add, .type = type, .args = {lhs, rhs}});
+  if (op == "-") return emit({.op = Op::Sub, .type = type, .args = {lhs, rhs}});
+  if (op == "*") return emit({.op = Op::Mul, .type = type, .args = {lhs, rhs}});
+  if (op == "&") return emit({.op = Op::And, .type = type, .args = {lhs, rhs}});
+  if (op == "|") return emit({.op = Op::Or, .type = type, .args = {lhs, rhs}});
+  if (op == "^") return emit({.op = Op::Xor, .type = type, .args = {lhs, rhs}});
+  if (op == "<<" || op == ">>") {
+    // The cpu masks the count to 6 bits for 64-bit operands, 5 bits for everything smaller
+    Type countType = fn->insts[rhs].type;
+    int count = emit({.op = Op::And, .type = countType, .args = {rhs, constant(type.bytes == 8 ? 63 : 31, countType)}});
+    if (op == "<<") return emit({.op = Op::Shl, .type = type, .args = {lhs, count}});
+    // The stack machine always emits shr, so this is a logical shift no matter the signedness
+    return emit({.op = Op::Shr, .type = type, .args = {convert(lhs, {.bytes = type.bytes, .isSigned = false}), count}});
+  }
+  if (op == "/" || op == "%") {
+    Type operandType = {.bytes = type.bytes, .isSigned = isSignedOp};
+    return emit({.op = op == "/" ? Op::Div : Op::Mod, .type = type,
+                 .args = {convert(lhs, operandType), convert(rhs, operandType)}, .isSigned = isSignedOp});
+  }
+  throw Unsupported{};
+}
+
+int Builder::call(CallExpr *expr) {
+  if (expr->callee->kind != ND_IDENT) throw Unsupported{}; // methods
+  const std::string &name = static_cast<IdentExpr *>(expr->callee)->name;
+  if (lookup(name) != -1 || !functions.contains(name)) throw Unsupported{};
+  FnStmt *callee = functions[name];
+  if (!callee->typenames.empty() || callee->params.size() != expr->args.size()) throw Unsupported{};
+  if (expr->args.size() > codegen::intArgOrder.size()) throw Unsupported{}; // the rest go on the stack, codegen does that
+
+  Inst call = {.op = Op::Call, .type = {.bytes = 0}, .callee = "usr_" + name};
+  if (codegen::getUnderlying(callee->returnType) != "void") call.type = typeOrBail(callee->returnType);
+  for (size_t i = 0; i < expr->args.size(); i++)
+    call.args.push_back(convert(Builder::expr(expr->args[i]), typeOrBail(callee->params[i].second)));
+  return emit(call);
+}
+
+int Builder::assign(Node::Expr *target, int value) {
+  while (target->kind == ND_GROUP) target = static_cast<GroupExpr *>(target)->expr;
+  if (target->kind != ND_IDENT) throw Unsupported{}; // array elements, struct fields, derefs
+  int var = lookup(static_cast<IdentExpr *>(target)->name);
+  if (var == -1) throw Unsupported{}; // globals
+  value = convert(value, variableTypes[var]);
+  writeVariable(var, current, value);
+  return value;
+}
+
+int Builder::boolValue(Node::Expr *expr) {
+  int ifTrue = newBlock(), ifFalse = newBlock(), merge = newBlock();
+  condition(expr, ifTrue, ifFalse);
+  seal(ifTrue);
+  seal(ifFalse);
+  startBlock(ifTrue);
+  int one = constant(1, boolType);
+  jump(merge);
+  startBlock(ifFalse);
+  int zero = constant(0, boolType);
+  jump(merge);
+  seal(merge);
+  startBlock(merge);
+  int phi = fn->addPhi(merge, boolType);
+  fn->insts[phi].args = {one, zero};
+  return phi;
+}
+
+// Jumps straight to `ifTrue`/`ifFalse` instead of making a bool first. That's what makes && and || short circuit
+void Builder::condition(Node::Expr *expr, int ifTrue, int ifFalse) {
+  switch (expr->kind) {
+    case ND_GROUP: return condition(static_cast<GroupExpr *>(expr)->expr, ifTrue, ifFalse);
+    case ND_BOOL: return jump(static_cast<BoolExpr *>(expr)->value ? ifTrue : ifFalse);
+    case ND_UNARY: {
+      UnaryExpr *e = static_cast<UnaryExpr *>(expr);
+      if (e->op == "!") return condition(e->expr, ifFalse, ifTrue);
+      break;
+    }
+    case ND_BINARY: {
+      BinaryExpr *e = static_cast<BinaryExpr *>(expr);
+      if (e->op != "&&" && e->op != "||") break;
+      int rhs = newBlock();
+      if (e->op == "&&") condition(e->lhs, rhs, ifFalse);
+      else condition(e->lhs, ifTrue, rhs);
+      seal(rhs);
+      startBlock(rhs);
+      return condition(e->rhs, ifTrue, ifFalse);
+    }
+    default: break;
+  }
+  branch(truthy(Builder::expr(expr)), ifTrue, ifFalse);
+}
+
+int Builder::truthy(int value) {
+  if (fn->insts[value].type == boolType) return value;
+  return emit({.op = Op::Cmp, .type = boolType, .args = {value, constant(0, fn->insts[value].type)}, .cond = Cond::Ne});
+}
+
+// ---------------------------------------------------------------------------
+// Emitting
+// ---------------------------------------------------------------------------
+
+int Builder::emit(Inst inst) {
+  return fn->append(current, inst);
+}
+
+int Builder::constant(long long value, Type type) {
+  return emit({.op = Op::Const, .type = type, .imm = normalize(value, type)});
+}
+
+int Builder::convert(int value, Type to) {
+  const Inst &inst = fn->insts[value];
+  if (inst.type == to) return value;
+  if (inst.op == Op::Const) return constant(inst.imm, to);
+  return emit({.op = Op::Convert, .type = to, .args = {value}});
+}
+
+void Builder::jump(int target) {
+  emit({.op = Op::Jump, .targets = {target}});
+  fn->blocks[target].preds.push_back(current);
+}
+
+void Builder::branch(int cond, int ifTrue, int ifFalse) {
+  emit({.op = Op::Branch, .args = {cond}, .targets = {ifTrue, ifFalse}});
+  fn->blocks[ifTrue].preds.push_back(current);
+  fn->blocks[ifFalse].preds.push_back(current);
+}
+
+int Builder::newBlock() {
+  sealed.push_back(false);
+  return fn->addBlock();
+}
+
+void Builder::startBlock(int block) {
+  current = block;
+}
+
+void Builder::instrument(Node::Stmt *stmt, size_t point) {
+  int64_t counter = Profile::counter(stmt, point);
+  if (counter != -1) emit({.op = Op::Count, .imm = counter});
+}
+
+// ---------------------------------------------------------------------------
+// SSA construction
+// ---------------------------------------------------------------------------
+
+int Builder::declare(const std::string &name, Type type, int value) {
+  int var = (int)variableTypes.size();
+  variableTypes.push_back(type);
+  definitions.emplace_back();
+  scopes.back()[name] = var;
+  writeVariable(var, current, value);
+  return var;
+}
+
+int Builder::lookup(const std::string &name) {
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+    auto it = scope->find(name);
+    if (it != scope->end()) return it->second;
+  }
+  return -1;
+}
+
+void Builder::writeVariable(int var, int block, int value) {
+  definitions[var][block] = value;
+}
+
+int Builder::readVariable(int var, int block) {
+  auto it = definitions[var].find(block);
+  if (it != definitions[var].end()) return resolve(it->second);
+  return readVariableRecursive(var, block);
+}
+
+int Builder::readVariableRecursive(int var, int block) {
+  int value;
+  const std::vector<int> &preds = fn->blocks[block].preds;
+  if (!sealed[block]) {
+    // We don't know every way in yet, so leave a phi here and fill it in when the block gets sealed
+    value = fn->addPhi(block, variableTypes[var]);
+    incompletePhis[block].push_back({var, value});
+  } else if (preds.empty()) {
+    // Unreachable (or read before it was ever written)- any value will do
+    bool isTerminated = fn->terminator(block) != -1;
+    value = fn->append(block, {.op = Op::Const, .type = variableTypes[var]});
+    if (isTerminated) std::swap(fn->blocks[block].insts.back(), fn->blocks[block].insts[fn->blocks[block].insts.size() - 2]);
+  } else if (preds.size() == 1) {
+    value = readVariable(var, preds[0]);
+  } else {
+    // Break cycles (loops) with an operandless phi first
+    value = fn->addPhi(block, variableTypes[var]);
+    writeVariable(var, block, value);
+    value = addPhiOperands(var, value);
+  }
+  writeVariable(var, block, value);
+  return value;
+}
+
+int Builder::addPhiOperands(int var, int phi) {
+  // Copy the preds, reading a variable can add phis (but never preds) elsewhere
+  std::vector<int> preds = fn->blocks[fn->insts[phi].block].preds;
+  for (int pred : preds) {
+    int operand = readVariable(var, pred);
+    fn->insts[phi].args.push_back(operand);
+  }
+  return tryRemoveTrivialPhi(phi);
+}
+
+// A phi whose operands are all the same value (or itself) is just that value
+int Builder::tryRemoveTrivialPhi(int phi) {
+  int same = -1;
+  for (int operand : fn->insts[phi].args) {
+    operand = resolve(operand);
+    if (operand == same || operand == phi) continue;
+    if (same != -1) return phi; // merges at least two different values, it's a real phi
+    same = operand;
+  }
+  if (same == -1) return phi; // only ever refers to itself- unreachable, leave it for dead code elimination
+  replacedBy[phi] = same;
+  fn->remove(phi);
+  // Phis that used this one might be trivial now too. The IR passes clean those up later
+  return same;
+}
+
+void Builder::seal(int block) {
+  if (sealed[block]) return;
+  std::vector<std::pair<int, int>> pending = std::move(incompletePhis[block]);
+  incompletePhis.erase(block);
+  for (auto &[var, phi] : pending) addPhiOperands(var, phi);
+  sealed[block] = true;
+}
+
+int Builder::resolve(int value) {
+  for (auto it = replacedBy.find(value); it != replacedBy.end(); it = replacedBy.find(value))
+    value = it->second;
+  return value;
+}
+
+} // namespace ir
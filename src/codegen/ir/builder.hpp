@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+#include "../../ast/types.hpp"
+#include "ir.hpp"
+
+namespace ir {
+
+// Lowers a typed FnStmt into SSA form.
+// SSA is built on the fly while walking the AST, following "Simple and Efficient Construction of
+// Static Single Assignment Form" (Braun et al.): every variable read looks backwards through the
+// predecessors for its last write, and phis only show up where two different writes meet.
+// Blocks get "sealed" once all of their predecessors are known (a loop header only after its back edge).
+class Builder {
+public:
+  static void collect(Node::Stmt *program); // remembers the top level functions, so calls can be typed
+  // nullptr if `fn` uses anything the IR can't express yet (floats, strings, pointers, structs, printing...)
+  static Function *build(FnStmt *fn, const std::string &label, bool isEntryPoint);
+
+private:
+  struct Unsupported {}; // thrown to give up on the whole function
+  struct Loop {
+    int continueTo;
+    int breakTo;
+  };
+
+  static bool typeOf(Node::Type *type, Type &out);
+  static Type typeOrBail(Node::Type *type);
+
+  static void stmt(Node::Stmt *stmt);
+  static void loop(Node::Stmt *stmt, Node::Expr *cond, Node::Expr *step, Node::Stmt *body);
+  static int expr(Node::Expr *expr);
+  static int binary(BinaryExpr *expr);
+  static int arithmetic(const std::string &op, int lhs, int rhs, Type type, bool isSignedOp);
+  static int call(CallExpr *expr);
+  static int assign(Node::Expr *target, int value);
+  static int boolValue(Node::Expr *expr); // `a && b` as a value instead of a jump
+  static void condition(Node::Expr *expr, int ifTrue, int ifFalse);
+  static int truthy(int value);
+
+  // Emitting into the current block
+  static int emit(Inst inst);
+  static int constant(long long value, Type type);
+  static int convert(int value, Type to);
+  static void jump(int target);
+  static void branch(int cond, int ifTrue, int ifFalse);
+  static int newBlock();
+  static void startBlock(int block);
+  static void instrument(Node::Stmt *stmt, size_t point); // bumps its -profile-generate counter right here
+
+  // SSA construction
+  static int declare(const std::string &name, Type type, int value);
+  static int lookup(const std::string &name);
+  static void writeVariable(int var, int block, int value);
+  static int readVariable(int var, int block);
+  static int readVariableRecursive(int var, int block);
+  static int addPhiOperands(int var, int phi);
+  static int tryRemoveTrivialPhi(int phi);
+  static void seal(int block);
+  static int resolve(int value);
+
+  static inline std::unordered_map<std::string, FnStmt *> functions = {};
+  static inline Function *fn = nullptr;
+  static inline int current = 0; // block we are emitting into
+  static inline std::vector<std::unordered_map<std::string, int>> scopes = {}; // name -> variable
+  static inline std::vector<Type> variableTypes = {};
+  static inline std::vector<std::unordered_map<int, int>> definitions = {}; // variable -> block -> value
+  static inline std::vector<bool> sealed = {};
+  static inline std::unordered_map<int, std::vector<std::pair<int, int>>> incompletePhis = {}; // block -> (variable, phi)
+  static inline std::unordered_map<int, int> replacedBy = {}; // trivial phi -> what it turned out to be
+  static inline std::vector<Loop> loops = {};
+};
+
+} // namespace ir
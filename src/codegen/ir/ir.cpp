@@ -0,0 +1,252 @@
+#include "ir.hpp"
+
+#include <algorithm>
+
+namespace ir {
+
+long long normalize(long long value, Type type) {
+  if (type.bytes <= 0 || type.bytes >= 8) return value;
+  int bits = type.bytes * 8;
+  unsigned long long mask = (1ULL << bits) - 1;
+  unsigned long long v = (unsigned long long)value & mask;
+  if (type.isSigned && (v >> (bits - 1)) & 1) v |= ~mask;
+  return (long long)v;
+}
+
+int Function::addBlock() {
+  blocks.emplace_back();
+  return (int)blocks.size() - 1;
+}
+
+int Function::append(int block, Inst inst) {
+  inst.block = block;
+  insts.push_back(inst);
+  int id = (int)insts.size() - 1;
+  blocks[block].insts.push_back(id);
+  return id;
+}
+
+int Function::addPhi(int block, Type type) {
+  Inst phi = {.op = Op::Phi, .type = type, .block = block};
+  insts.push_back(phi);
+  int id = (int)insts.size() - 1;
+  blocks[block].insts.insert(blocks[block].insts.begin(), id);
+  return id;
+}
+
+void Function::remove(int value) {
+  Inst &inst = insts[value];
+  if (inst.isDead) return;
+  inst.isDead = true;
+  std::vector<int> &list = blocks[inst.block].insts;
+  list.erase(std::remove(list.begin(), list.end(), value), list.end());
+}
+
+int Function::terminator(int block) const {
+  const std::vector<int> &list = blocks[block].insts;
+  if (list.empty() || !insts[list.back()].isTerminator()) return -1;
+  return list.back();
+}
+
+std::vector<int> Function::succs(int block) const {
+  int term = terminator(block);
+  if (term == -1) return {};
+  return insts[term].targets;
+}
+
+void Function::replaceAllUses(int from, int to) {
+  for (Inst &inst : insts) {
+    if (inst.isDead) continue;
+    for (int &arg : inst.args)
+      if (arg == from) arg = to;
+  }
+}
+
+void Function::replaceTarget(int block, int from, int to) {
+  int term = terminator(block);
+  if (term == -1) return;
+  for (int &target : insts[term].targets)
+    if (target == from) target = to;
+}
+
+void Function::removePred(int block, int pred) {
+  Block &b = blocks[block];
+  for (size_t i = 0; i < b.preds.size(); i++) {
+    if (b.preds[i] != pred) continue;
+    b.preds.erase(b.preds.begin() + (long)i);
+    for (int id : b.insts)
+      if (insts[id].op == Op::Phi) insts[id].args.erase(insts[id].args.begin() + (long)i);
+    return; // one edge at a time- a Branch with both sides going to the same block has two
+  }
+}
+
+std::vector<int> Function::reversePostorder(const std::vector<int> &preferred) const {
+  std::vector<int> order;
+  std::vector<bool> seen(blocks.size(), false);
+  // Iterative DFS, recursion would be asking for trouble on long if-else chains
+  std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+  seen[0] = true;
+  while (!stack.empty()) {
+    auto &[block, next] = stack.back();
+    std::vector<int> out = succs(block);
+    // Whoever gets visited last finishes last, which puts it first in the reverse
+    if (!preferred.empty() && preferred[block] != -1) {
+      auto it = std::find(out.begin(), out.end(), preferred[block]);
+      if (it != out.end()) std::rotate(it, it + 1, out.end());
+    }
+    if (next < out.size()) {
+      int succ = out[next++];
+      if (!seen[succ]) {
+        seen[succ] = true;
+        stack.push_back({succ, 0});
+      }
+      continue;
+    }
+    order.push_back(block);
+    stack.pop_back();
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// "A Simple, Fast Dominance Algorithm" (Cooper, Harvey & Kennedy): keep walking the blocks in
+// reverse postorder, meeting the dominators of all the predecessors, until nothing changes.
+std::vector<int> Function::dominators() const {
+  std::vector<int> order = reversePostorder();
+  std::vector<int> position(blocks.size(), -1);
+  for (size_t i = 0; i < order.size(); i++) position[order[i]] = (int)i;
+
+  std::vector<int> idom(blocks.size(), -1);
+  idom[0] = 0;
+  auto meet = [&](int a, int b) {
+    while (a != b) {
+      while (position[a] > position[b]) a = idom[a];
+      while (position[b] > position[a]) b = idom[b];
+    }
+    return a;
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); i++) {
+      int block = order[i], dom = -1;
+      for (int pred : blocks[block].preds) {
+        if (position[pred] == -1 || idom[pred] == -1) continue; // unreachable, or not there yet
+        dom = dom == -1 ? pred : meet(pred, dom);
+      }
+      if (dom != idom[block]) {
+        idom[block] = dom;
+        changed = true;
+      }
+    }
+  }
+  idom[0] = -1;
+  return idom;
+}
+
+static const char *opName(Op op) {
+  switch (op) {
+    case Op::Const: return "const";
+    case Op::Param: return "param";
+    case Op::Copy: return "copy";
+    case Op::Add: return "add";
+    case Op::Sub: return "sub";
+    case Op::Mul: return "mul";
+    case Op::Div: return "div";
+    case Op::Mod: return "mod";
+    case Op::And: return "and";
+    case Op::Or: return "or";
+    case Op::Xor: return "xor";
+    case Op::Shl: return "shl";
+    case Op::Shr: return "shr";
+    case Op::Neg: return "neg";
+    case Op::Not: return "not";
+    case Op::Cmp: return "cmp";
+    case Op::Convert: return "convert";
+    case Op::Call: return "call";
+    case Op::Select: return "select";
+    case Op::Phi: return "phi";
+    case Op::Count: return "count";
+    case Op::Jump: return "jump";
+    case Op::Branch: return "branch";
+    case Op::Return: return "return";
+  }
+  return "?";
+}
+
+static const char *condName(Cond cond) {
+  switch (cond) {
+    case Cond::Eq: return "eq";
+    case Cond::Ne: return "ne";
+    case Cond::Lt: return "lt";
+    case Cond::Le: return "le";
+    case Cond::Gt: return "gt";
+    case Cond::Ge: return "ge";
+  }
+  return "?";
+}
+
+std::vector<Loop> Function::loops() const {
+  std::vector<int> idom = dominators();
+  auto isReachable = [&](int block) { return block == 0 || idom[block] != -1; };
+  auto dominates = [&](int a, int b) {
+    while (b != -1 && b != a) b = idom[b];
+    return b == a;
+  };
+
+  std::vector<Loop> result;
+  for (int header : reversePostorder()) {
+    Loop loop = {.header = header};
+    for (int pred : blocks[header].preds)
+      if (isReachable(pred) && dominates(header, pred)) loop.latches.push_back(pred);
+    if (loop.latches.empty()) continue;
+
+    loop.contains.assign(blocks.size(), false);
+    loop.contains[header] = true;
+    std::vector<int> work = loop.latches;
+    while (!work.empty()) {
+      int block = work.back();
+      work.pop_back();
+      if (loop.contains[block]) continue;
+      loop.contains[block] = true;
+      for (int pred : blocks[block].preds)
+        if (isReachable(pred)) work.push_back(pred);
+    }
+
+    std::vector<int> outside;
+    for (int pred : blocks[header].preds)
+      if (!loop.contains[pred] && isReachable(pred)) outside.push_back(pred);
+    int term = outside.size() == 1 ? terminator(outside[0]) : -1;
+    if (term != -1 && insts[term].op == Op::Jump) loop.preheader = outside[0];
+    result.push_back(std::move(loop));
+  }
+  return result;
+}
+
+void Function::print(std::ostream &out) const {
+  out << "fn " << name << " {\n";
+  for (int b : reversePostorder()) {
+    out << "bb" << b << ":";
+    if (!blocks[b].preds.empty()) {
+      out << " ; preds";
+      for (int pred : blocks[b].preds) out << " bb" << pred;
+    }
+    if (blocks[b].count != -1) out << " ; ran " << blocks[b].count;
+    out << "\n";
+    for (int id : blocks[b].insts) {
+      const Inst &inst = insts[id];
+      out << "  ";
+      if (inst.hasValue()) out << "%" << id << ": " << (inst.type.isSigned ? "i" : "u") << inst.type.bytes * 8 << " = ";
+      out << opName(inst.op);
+      if (inst.op == Op::Cmp) out << " " << condName(inst.cond);
+      if ((inst.op == Op::Div || inst.op == Op::Mod) && !inst.isSigned) out << " unsigned";
+      if (inst.op == Op::Const || inst.op == Op::Param || inst.op == Op::Count) out << " " << inst.imm;
+      if (inst.op == Op::Call) out << " " << inst.callee;
+      for (int arg : inst.args) out << " %" << arg;
+      for (int target : inst.targets) out << " bb" << target;
+      out << "\n";
+    }
+  }
+  out << "}\n";
+}
+
+} // namespace ir
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The mid-level IR: typed SSA values in basic blocks, with an explicit control flow graph.
+// It sits between the typed AST and the x86 `Instr`s:
+//
+//   AST --(ir::Builder)--> ir::Function --(IR passes)--> ir::Function --(ir::Backend)--> Instr
+//
+// The stack machine in gen_expr.cpp/gen_stmt.cpp pushes every value and pops it right back,
+// which hides where values come from and where they go. Here every value is defined exactly once
+// and every use points straight at its definition, so things like "is this a constant?",
+// "does anybody use this?" or "where are the loops?" are easy questions to answer.
+//
+// For now the IR only covers functions that work on integers and bools (params, locals, math,
+// if/loop/break/continue, calls to other functions). Everything else still goes through the stack machine.
+namespace ir {
+
+// Every value is an integer of some width. Bools are 1 byte, always 0 or 1.
+// Values are always kept sign (or zero) extended to 64 bits, so the backend can do all the math at 64 bits.
+struct Type {
+  int bytes = 8;
+  bool isSigned = false;
+
+  bool operator==(const Type &other) const = default;
+};
+
+inline const Type boolType = {.bytes = 1, .isSigned = false};
+
+enum class Op {
+  Const,   // imm
+  Param,   // imm is the index of the parameter
+  Copy,    // args[0]
+  Add,
+  Sub,
+  Mul,
+  Div,     // isSigned picks idiv or div
+  Mod,
+  And,
+  Or,
+  Xor,
+  Shl,
+  Shr,     // logical, just like the stack machine's `>>`
+  Neg,
+  Not,     // bitwise ~
+  Cmp,     // args[0] <cond> args[1], gives a bool
+  Convert, // args[0], truncated and extended to `type`
+  Call,    // callee(args...)
+  Select,  // args[0] ? args[1] : args[2]. Only instruction selection makes these (see select.hpp)
+  Phi,     // args[i] comes in from block->preds[i]
+  Count,   // bumps -profile-generate counter imm (see optimizer/profile.hpp). No value
+
+  // Terminators- exactly one at the end of every block
+  Jump,    // targets[0]
+  Branch,  // args[0] ? targets[0] : targets[1]
+  Return,  // args[0], if the function returns something
+};
+
+enum class Cond { Eq, Ne, Lt, Le, Gt, Ge };
+
+struct Inst {
+  Op op = Op::Const;
+  Type type = {};
+  std::vector<int> args = {};    // value ids
+  std::vector<int> targets = {}; // block ids, for Jump and Branch
+  long long imm = 0;
+  Cond cond = Cond::Eq;
+  bool isSigned = true;     // Div, Mod and Cmp
+  std::string callee = "";       // the assembly label, for Call
+  int block = -1;
+  bool isDead = false;      // removed. The id stays, so nothing else has to be renumbered
+
+  bool isTerminator() const { return op == Op::Jump || op == Op::Branch || op == Op::Return; }
+  bool hasSideEffects() const { return isTerminator() || op == Op::Call || op == Op::Count; }
+  bool hasValue() const { return !isTerminator() && op != Op::Count && !(op == Op::Call && type.bytes == 0); }
+};
+
+struct Block {
+  std::vector<int> insts = {}; // phis first, the terminator last
+  std::vector<int> preds = {};
+  bool isDead = false;
+  long long count = -1; // times it ran, from -profile-use. -1 if we don't know
+};
+
+// A natural loop: everything that can get back to the header without going through it first
+struct Loop {
+  int header = -1;
+  std::vector<int> latches = {};   // the blocks with a back edge to the header
+  std::vector<bool> contains = {}; // by block id
+  int preheader = -1;              // the only way in from outside, if that is a plain jump. -1 if there isn't one
+};
+
+struct Function {
+  std::string name = "";    // the assembly label
+  bool isEntryPoint = false;
+  std::vector<Type> params = {};
+  Type returnType = {.bytes = 0}; // 0 bytes: void
+  std::vector<Inst> insts = {};  // indexed by value id
+  std::vector<Block> blocks = {}; // blocks[0] is the entry
+
+  int addBlock();
+  // Appends to the end of `block` (before nothing- callers make sure the terminator comes last)
+  int append(int block, Inst inst);
+  // Puts a phi at the top of `block`
+  int addPhi(int block, Type type);
+  void remove(int value);
+
+  int terminator(int block) const;
+  std::vector<int> succs(int block) const;
+  void replaceAllUses(int from, int to);
+  void replaceTarget(int block, int from, int to); // in the terminator of `block`
+  void removePred(int block, int pred);            // and the matching phi operands
+  // `preferred[b]` is the successor of b that should come right after it, if it can (-1 for don't care)
+  std::vector<int> reversePostorder(const std::vector<int> &preferred = {}) const;
+  // The immediate dominator of every block: the last block every path from the entry has to go through
+  // to get there. -1 for the entry itself and for blocks nobody can reach.
+  std::vector<int> dominators() const;
+  // Outer loops come before the loops inside of them
+  std::vector<Loop> loops() const;
+  bool isConst(int value) const { return insts[value].op == Op::Const; }
+
+  void print(std::ostream &out) const;
+};
+
+// Shared by constant folding and the backend, so they can never disagree on what a value looks like
+long long normalize(long long value, Type type);
+
+} // namespace ir
@@ -0,0 +1,230 @@
+#include "opt.hpp"
+
+#include <algorithm>
+
+namespace ir {
+
+// Puts `inst` at the end of `block`, but still before its terminator
+static int insertBeforeEnd(Function &fn, int block, Inst inst) {
+  int id = fn.append(block, inst);
+  std::vector<int> &list = fn.blocks[block].insts;
+  list.pop_back();
+  list.insert(list.end() - 1, id);
+  return id;
+}
+
+static int constant(Function &fn, int block, long long value, Type type) {
+  return insertBeforeEnd(fn, block, {.op = Op::Const, .type = type, .imm = normalize(value, type)});
+}
+
+// Math that can't trap, so doing it once up front (even if the loop never runs) is always fine.
+// A compare stays where it is: whatever branches on it wants the flags right there
+static bool isHoistable(const Function &fn, const Inst &inst) {
+  switch (inst.op) {
+    case Op::Copy:
+    case Op::Add:
+    case Op::Sub:
+    case Op::Mul:
+    case Op::And:
+    case Op::Or:
+    case Op::Xor:
+    case Op::Shl:
+    case Op::Shr:
+    case Op::Neg:
+    case Op::Not:
+    case Op::Convert: return true;
+    case Op::Div:
+    case Op::Mod: {
+      const Inst &by = fn.insts[inst.args[1]];
+      return by.op == Op::Const && by.imm != 0 && by.imm != -1;
+    }
+    default: return false;
+  }
+}
+
+size_t Passes::hoistInvariants(Function &fn) {
+  size_t changes = 0;
+  std::vector<Loop> loops = fn.loops();
+  std::vector<int> order = fn.reversePostorder();
+  // Inner loops first, so whatever they hoist into their preheader (which is in the outer loop) gets another shot
+  for (auto loop = loops.rbegin(); loop != loops.rend(); loop++) {
+    if (loop->preheader == -1) continue;
+    auto isInvariant = [&](int value) { return fn.isConst(value) || !loop->contains[fn.insts[value].block]; };
+    // In reverse postorder, so by the time we get to something, whatever it uses already had its chance to move
+    for (int block : order) {
+      if (!loop->contains[block]) continue;
+      std::vector<int> list = fn.blocks[block].insts;
+      for (int id : list) {
+        const Inst &inst = fn.insts[id];
+        if (!isHoistable(fn, inst) || !std::all_of(inst.args.begin(), inst.args.end(), isInvariant)) continue;
+        std::vector<int> &from = fn.blocks[block].insts;
+        from.erase(std::find(from.begin(), from.end(), id));
+        std::vector<int> &to = fn.blocks[loop->preheader].insts;
+        to.insert(to.end() - 1, id);
+        fn.insts[id].block = loop->preheader;
+        changes++;
+      }
+    }
+  }
+  return changes;
+}
+
+// A basic induction variable: a phi in the header that goes up (or down) by the same constant every time around
+struct Induction {
+  int phi = -1;
+  int init = -1; // comes in from the preheader
+  int next = -1; // phi + step, goes back around from the latch
+  long long step = 0;
+};
+
+static bool induction(const Function &fn, const Loop &loop, int value, Induction &out) {
+  const Inst &phi = fn.insts[value];
+  const Block &header = fn.blocks[loop.header];
+  if (phi.op != Op::Phi || phi.block != loop.header || header.preds.size() != 2 || loop.latches.size() != 1) return false;
+  int fromPre = header.preds[0] == loop.preheader ? 0 : 1;
+  if (header.preds[fromPre] != loop.preheader) return false;
+  int next = phi.args[1 - fromPre];
+  const Inst &add = fn.insts[next];
+  if (add.type != phi.type || (add.op != Op::Add && add.op != Op::Sub)) return false;
+  int other;
+  if (add.args[0] == value) other = add.args[1];
+  else if (add.op == Op::Add && add.args[1] == value) other = add.args[0];
+  else return false;
+  if (!fn.isConst(other)) return false;
+  out = {.phi = value, .init = phi.args[fromPre], .next = next,
+         .step = add.op == Op::Add ? fn.insts[other].imm : -fn.insts[other].imm};
+  return true;
+}
+
+// Doing `scale` with a shift or one lea is as cheap as the add that would replace it
+static bool isCheapScale(long long scale) {
+  if (scale <= 0) return false;
+  while (scale % 2 == 0) scale /= 2;
+  return scale == 1 || scale == 3 || scale == 5 || scale == 9;
+}
+
+__extension__ typedef __int128 int128; // see optimizer/strength.hpp
+
+// Does `i < bound` still mean the same thing as `i * scale + offset < bound * scale + offset`? Only if nothing
+// along the way overflows, which we can only tell when everything is a constant. Returns the new bound
+static bool rewrittenBound(const Induction &iv, long long init, long long bound, Cond cond, long long scale,
+                           long long offset, Type type, long long &out) {
+  if (iv.step <= 0 || scale <= 0) return false;
+  int128 last = init; // the value the loop leaves with
+  if (cond == Cond::Lt && init < bound) last = init + ((int128)bound - init + iv.step - 1) / iv.step * iv.step;
+  else if (cond == Cond::Le && init <= bound) last = init + (((int128)bound - init) / iv.step + 1) * iv.step;
+  else if (cond == Cond::Ne && init <= bound && ((int128)bound - init) % iv.step == 0) last = bound;
+  else if (cond != Cond::Lt && cond != Cond::Le) return false;
+
+  // The compare is a signed one. Narrow unsigned values are zero extended, so they never look negative to it
+  int bits = type.bytes * 8;
+  int128 min = -((int128)1 << (bits - 1)), max = ((int128)1 << (bits - 1)) - 1;
+  if (!type.isSigned && bits < 64) {
+    min = 0;
+    max = ((int128)1 << bits) - 1;
+  }
+  int128 low = (int128)init * scale + offset, high = last * scale + offset;
+  int128 newBound = (int128)bound * scale + offset;
+  if (last > max || low < min || high > max || newBound < min || newBound > max) return false;
+  out = (long long)newBound;
+  return true;
+}
+
+// Operator strength reduction: `i * c` (plus or minus some invariants) gets a phi of its own that starts out at
+// `init * c` and goes up by `step * c` every time around, so the multiply turns into an add. `a[i]`-style
+// `base + i * size` is the same thing. If that leaves the counter with nothing to do but be compared against
+// a constant bound, the compare moves over to the new phi too, and the counter goes away.
+size_t Passes::reduceInductions(Function &fn) {
+  std::vector<int> uses(fn.insts.size(), 0);
+  for (const Block &block : fn.blocks) {
+    if (block.isDead) continue;
+    for (int id : block.insts)
+      for (int arg : fn.insts[id].args) uses[arg]++;
+  }
+
+  size_t changes = 0;
+  std::vector<Loop> loops = fn.loops();
+  std::vector<int> order = fn.reversePostorder();
+  for (auto loop = loops.rbegin(); loop != loops.rend(); loop++) {
+    if (loop->preheader == -1) continue;
+    int pre = loop->preheader, latch = loop->latches[0];
+    auto isInvariant = [&](int value) { return fn.isConst(value) || !loop->contains[fn.insts[value].block]; };
+
+    for (int block : order) {
+      if (!loop->contains[block]) continue;
+      std::vector<int> list = fn.blocks[block].insts;
+      for (int id : list) {
+        const Inst &mul = fn.insts[id];
+        if (mul.isDead || (mul.op != Op::Mul && mul.op != Op::Shl)) continue;
+        Induction iv;
+        int ivSide = induction(fn, *loop, mul.args[0], iv) ? 0 : mul.op == Op::Mul && induction(fn, *loop, mul.args[1], iv) ? 1 : -1;
+        int by = ivSide == -1 ? -1 : mul.args[1 - ivSide];
+        if (ivSide == -1 || !isInvariant(by) || mul.type != fn.insts[iv.phi].type) continue;
+        if (mul.op == Op::Shl && (!fn.isConst(by) || fn.insts[by].imm < 0 || fn.insts[by].imm >= 63)) continue;
+        Type type = mul.type;
+        bool isConstScale = fn.isConst(by);
+        long long scale = !isConstScale ? 0 : mul.op == Op::Shl ? 1LL << fn.insts[by].imm : fn.insts[by].imm;
+
+        // Whatever gets added to (or taken from) it on the way, as long as it's invariant and nobody else wants the in-betweens
+        int root = id;
+        std::vector<std::pair<bool, int>> offsets; // (is it subtracted, what)
+        for (;;) {
+          if (uses[root] != 1) break;
+          int user = -1;
+          for (int b : order)
+            if (loop->contains[b])
+              for (int u : fn.blocks[b].insts)
+                if (std::count(fn.insts[u].args.begin(), fn.insts[u].args.end(), root)) user = u;
+          if (user == -1) break;
+          const Inst &add = fn.insts[user];
+          if (add.type != type || (add.op != Op::Add && add.op != Op::Sub)) break;
+          int other = add.args[0] == root ? add.args[1] : add.args[0];
+          if (!isInvariant(other) || (add.op == Op::Sub && add.args[1] == root)) break;
+          offsets.push_back({add.op == Op::Sub, other});
+          root = user;
+        }
+
+        // The counter is done for if all it has left is its own increment, this, and the test that stays in the loop
+        int test = -1, exit = fn.terminator(loop->header);
+        const Inst &branch = fn.insts[exit];
+        if (branch.op == Op::Branch && loop->contains[branch.targets[0]] && !loop->contains[branch.targets[1]] &&
+            fn.insts[branch.args[0]].op == Op::Cmp && fn.insts[branch.args[0]].args[0] == iv.phi)
+          test = branch.args[0];
+        bool isCounterOnlyHere = test != -1 && uses[iv.phi] == 3 && uses[iv.next] == 1 && uses[test] == 1 &&
+                                 fn.isConst(fn.insts[test].args[1]) && fn.isConst(iv.init) && fn.insts[test].isSigned;
+        long long newBound = 0, offset = 0;
+        bool isConstOffset = std::all_of(offsets.begin(), offsets.end(), [&](auto &o) { return fn.isConst(o.second); });
+        for (auto &[isSub, what] : offsets)
+          if (fn.isConst(what)) offset += isSub ? -fn.insts[what].imm : fn.insts[what].imm;
+        bool canRetire = isCounterOnlyHere && isConstScale && isConstOffset &&
+                         rewrittenBound(iv, fn.insts[iv.init].imm, fn.insts[fn.insts[test].args[1]].imm,
+                                        fn.insts[test].cond, scale, offset, type, newBound);
+        if (isConstScale && isCheapScale(scale) && !canRetire) continue;
+
+        // start = init * by (+ offsets), in the preheader. The step goes up by as much as the multiply would
+        int start = insertBeforeEnd(fn, pre, {.op = mul.op, .type = type, .args = {iv.init, by}});
+        for (auto &[isSub, what] : offsets)
+          start = insertBeforeEnd(fn, pre, {.op = isSub ? Op::Sub : Op::Add, .type = type, .args = {start, what}});
+        int step = isConstScale ? constant(fn, pre, iv.step * scale, type)
+                                : insertBeforeEnd(fn, pre, {.op = Op::Mul, .type = type,
+                                                            .args = {constant(fn, pre, iv.step, type), by}});
+        int phi = fn.addPhi(loop->header, type);
+        int next = insertBeforeEnd(fn, latch, {.op = Op::Add, .type = type, .args = {phi, step}});
+        const std::vector<int> &preds = fn.blocks[loop->header].preds;
+        fn.insts[phi].args = {preds[0] == pre ? start : next, preds[0] == pre ? next : start};
+        replace(fn, root, phi);
+        uses.resize(fn.insts.size(), 0);
+        changes++;
+
+        if (canRetire) {
+          int bound = constant(fn, pre, newBound, type);
+          fn.insts[test].args = {phi, bound};
+          uses[iv.phi]--;
+        }
+      }
+    }
+  }
+  return changes;
+}
+
+} // namespace ir
@@ -0,0 +1,339 @@
+#include "opt.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <tuple>
+
+namespace ir {
+
+// Does every value of type `from` already look exactly like the same value in type `to`?
+static bool fits(Type from, Type to) {
+  if (to.bytes == 8 || from == to) return true;
+  if (to.bytes > from.bytes) return !from.isSigned || to.isSigned;
+  return false;
+}
+
+void Passes::replace(Function &fn, int value, int with) {
+  fn.replaceAllUses(value, with);
+  fn.remove(value);
+}
+
+void Passes::makeConst(Inst &inst, long long value) {
+  inst.op = Op::Const;
+  inst.imm = normalize(value, inst.type);
+  inst.args.clear();
+}
+
+int Passes::identity(const Function &fn, const Inst &inst) {
+  auto passThrough = [&](int value) { return fits(fn.insts[value].type, inst.type) ? value : -1; };
+  auto isConst = [&](size_t i, long long value) {
+    return i < inst.args.size() && fn.isConst(inst.args[i]) && fn.insts[inst.args[i]].imm == value;
+  };
+
+  switch (inst.op) {
+    case Op::Copy: return inst.args[0];
+    case Op::Convert: return passThrough(inst.args[0]);
+    case Op::Add:
+    case Op::Or:
+    case Op::Xor:
+      if (isConst(1, 0)) return passThrough(inst.args[0]);
+      if (isConst(0, 0)) return passThrough(inst.args[1]);
+      if (inst.op == Op::Or && inst.args[0] == inst.args[1]) return passThrough(inst.args[0]);
+      return -1;
+    case Op::Sub:
+    case Op::Shl:
+    case Op::Shr:
+      return isConst(1, 0) ? passThrough(inst.args[0]) : -1;
+    case Op::Mul:
+      if (isConst(1, 1)) return passThrough(inst.args[0]);
+      if (isConst(0, 1)) return passThrough(inst.args[1]);
+      return -1;
+    case Op::Div:
+      return isConst(1, 1) ? passThrough(inst.args[0]) : -1;
+    case Op::And:
+      return inst.args[0] == inst.args[1] ? passThrough(inst.args[0]) : -1;
+    default: return -1;
+  }
+}
+
+bool Passes::evaluate(const Function &fn, const Inst &inst, long long &out) {
+  auto isZero = [&](int value) { return fn.isConst(value) && fn.insts[value].imm == 0; };
+  // Anything times (or and) zero is zero, whatever the other side is
+  if ((inst.op == Op::Mul || inst.op == Op::And) && (isZero(inst.args[0]) || isZero(inst.args[1]))) {
+    out = 0;
+    return true;
+  }
+  for (int arg : inst.args)
+    if (!fn.isConst(arg)) return false;
+
+  long long a = inst.args.size() > 0 ? fn.insts[inst.args[0]].imm : 0;
+  long long b = inst.args.size() > 1 ? fn.insts[inst.args[1]].imm : 0;
+  unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+  switch (inst.op) {
+    case Op::Convert: out = a; break;
+    case Op::Neg: out = (long long)(0 - ua); break;
+    case Op::Not: out = ~a; break;
+    case Op::Add: out = (long long)(ua + ub); break;
+    case Op::Sub: out = (long long)(ua - ub); break;
+    case Op::Mul: out = (long long)(ua * ub); break;
+    case Op::And: out = a & b; break;
+    case Op::Or: out = a | b; break;
+    case Op::Xor: out = a ^ b; break;
+    case Op::Shl: out = (long long)(ua << (b & 63)); break;
+    case Op::Shr: out = (long long)(ua >> (b & 63)); break;
+    case Op::Div:
+    case Op::Mod:
+      // Leave the crash to runtime, where it belongs
+      if (b == 0 || (inst.isSigned && a == LLONG_MIN && b == -1)) return false;
+      if (inst.isSigned) out = inst.op == Op::Div ? a / b : a % b;
+      else out = (long long)(inst.op == Op::Div ? ua / ub : ua % ub);
+      break;
+    case Op::Cmp:
+      switch (inst.cond) {
+        case Cond::Eq: out = a == b; break;
+        case Cond::Ne: out = a != b; break;
+        case Cond::Lt: out = inst.isSigned ? a < b : ua < ub; break;
+        case Cond::Le: out = inst.isSigned ? a <= b : ua <= ub; break;
+        case Cond::Gt: out = inst.isSigned ? a > b : ua > ub; break;
+        case Cond::Ge: out = inst.isSigned ? a >= b : ua >= ub; break;
+      }
+      break;
+    default: return false; // params, calls, phis...
+  }
+  return true;
+}
+
+size_t Passes::fold(Function &fn) {
+  size_t changes = 0;
+  for (int b = 0; b < (int)fn.blocks.size(); b++) {
+    if (fn.blocks[b].isDead) continue;
+    std::vector<int> list = fn.blocks[b].insts; // replacing things removes them from the real list
+    for (int id : list) {
+      Inst &inst = fn.insts[id];
+      if (inst.isDead) continue;
+
+      if (inst.op == Op::Branch) {
+        int taken;
+        if (inst.targets[0] == inst.targets[1]) taken = 0;
+        else if (fn.isConst(inst.args[0])) taken = fn.insts[inst.args[0]].imm != 0 ? 0 : 1;
+        else continue;
+        fn.removePred(inst.targets[1 - taken], b);
+        inst.op = Op::Jump;
+        inst.args.clear();
+        inst.targets = {inst.targets[taken]};
+        changes++;
+        continue;
+      }
+
+      if (inst.op == Op::Phi) {
+        int same = -1;
+        bool trivial = true;
+        for (int arg : inst.args) {
+          if (arg == id || arg == same) continue;
+          if (same != -1) trivial = false;
+          same = arg;
+        }
+        if (trivial && same != -1) {
+          replace(fn, id, same);
+          changes++;
+        }
+        continue;
+      }
+
+      int with = identity(fn, inst);
+      if (with != -1) {
+        replace(fn, id, with);
+        changes++;
+        continue;
+      }
+      long long value;
+      if (inst.op != Op::Const && evaluate(fn, inst, value)) {
+        makeConst(inst, value);
+        changes++;
+      }
+    }
+  }
+  return changes;
+}
+
+size_t Passes::deadCode(Function &fn) {
+  std::vector<bool> live(fn.insts.size(), false);
+  std::vector<int> worklist;
+  for (const Block &block : fn.blocks) {
+    if (block.isDead) continue;
+    for (int id : block.insts)
+      if (fn.insts[id].hasSideEffects()) {
+        live[id] = true;
+        worklist.push_back(id);
+      }
+  }
+  while (!worklist.empty()) {
+    int id = worklist.back();
+    worklist.pop_back();
+    for (int arg : fn.insts[id].args)
+      if (!live[arg]) {
+        live[arg] = true;
+        worklist.push_back(arg);
+      }
+  }
+
+  size_t changes = 0;
+  for (Block &block : fn.blocks) {
+    if (block.isDead) continue;
+    std::vector<int> list = block.insts;
+    for (int id : list)
+      if (!live[id]) {
+        fn.remove(id);
+        changes++;
+      }
+  }
+  return changes;
+}
+
+bool Passes::isCommutative(const Inst &inst) {
+  switch (inst.op) {
+    case Op::Add:
+    case Op::Mul:
+    case Op::And:
+    case Op::Or:
+    case Op::Xor: return true;
+    case Op::Cmp: return inst.cond == Cond::Eq || inst.cond == Cond::Ne;
+    default: return false;
+  }
+}
+
+size_t Passes::valueNumbering(Function &fn) {
+  // Everything that makes two instructions compute the same thing. Phis are only the same
+  // as other phis in the same block (the block goes in `imm`)
+  using Key = std::tuple<Op, int, bool, std::vector<int>, long long, Cond, bool>;
+  std::map<Key, int> available;
+  // Two constants with the same value are the same argument, even though they are two different instructions
+  std::map<std::tuple<long long, int, bool>, int> constants;
+  auto number = [&](int value) {
+    const Inst &inst = fn.insts[value];
+    if (inst.op != Op::Const) return value;
+    return constants.try_emplace({inst.imm, inst.type.bytes, inst.type.isSigned}, value).first->second;
+  };
+
+  std::vector<int> idom = fn.dominators();
+  std::vector<std::vector<int>> children(fn.blocks.size());
+  for (int block : fn.reversePostorder())
+    if (idom[block] != -1) children[idom[block]].push_back(block);
+
+  size_t changes = 0;
+  // Walk down the dominator tree. Whatever a block computes is available to everything below it,
+  // and stops being available once we are back out of it
+  std::vector<std::pair<int, std::vector<Key>>> stack = {{0, {}}};
+  std::vector<size_t> nextChild = {0};
+  for (bool isNew = true; !stack.empty();) {
+    if (isNew) {
+      auto &[block, added] = stack.back();
+      std::vector<int> list = fn.blocks[block].insts; // replacing things removes them from the real list
+      for (int id : list) {
+        const Inst &inst = fn.insts[id];
+        // Constants cost nothing to make again, but a lot to keep around in a register
+        if (inst.isDead || !inst.hasValue() || inst.op == Op::Const || inst.op == Op::Call || inst.op == Op::Copy) continue;
+        std::vector<int> args = inst.args;
+        for (int &arg : args) arg = number(arg);
+        if (isCommutative(inst)) std::sort(args.begin(), args.end());
+        Key key = {inst.op, inst.type.bytes, inst.type.isSigned, args, inst.op == Op::Phi ? inst.block : inst.imm,
+                   inst.cond, inst.isSigned};
+        auto [it, isFirst] = available.try_emplace(key, id);
+        if (isFirst) {
+          added.push_back(key);
+        } else {
+          replace(fn, id, it->second);
+          changes++;
+        }
+      }
+    }
+    auto &[block, added] = stack.back();
+    if (nextChild.back() < children[block].size()) {
+      int child = children[block][nextChild.back()++];
+      stack.push_back({child, {}});
+      nextChild.push_back(0);
+      isNew = true;
+      continue;
+    }
+    for (const Key &key : added) available.erase(key);
+    stack.pop_back();
+    nextChild.pop_back();
+    isNew = false;
+  }
+  return changes;
+}
+
+void Passes::removeBlock(Function &fn, int block) {
+  for (int succ : fn.succs(block))
+    if (!fn.blocks[succ].isDead) fn.removePred(succ, block);
+  for (int id : fn.blocks[block].insts) fn.insts[id].isDead = true;
+  fn.blocks[block].insts.clear();
+  fn.blocks[block].preds.clear();
+  fn.blocks[block].isDead = true;
+}
+
+size_t Passes::simplifyCfg(Function &fn) {
+  size_t changes = 0;
+
+  // Unreachable blocks
+  std::vector<bool> reachable(fn.blocks.size(), false);
+  for (int block : fn.reversePostorder()) reachable[block] = true;
+  for (int b = 0; b < (int)fn.blocks.size(); b++)
+    if (!fn.blocks[b].isDead && !reachable[b]) {
+      removeBlock(fn, b);
+      changes++;
+    }
+
+  // A block that always jumps to a block nobody else jumps to- they might as well be one block
+  for (int b = 0; b < (int)fn.blocks.size(); b++) {
+    if (fn.blocks[b].isDead) continue;
+    for (;;) {
+      int term = fn.terminator(b);
+      if (term == -1 || fn.insts[term].op != Op::Jump) break;
+      int succ = fn.insts[term].targets[0];
+      if (succ == b || succ == 0 || fn.blocks[succ].preds.size() != 1) break;
+
+      std::vector<int> list = fn.blocks[succ].insts;
+      for (int id : list)
+        if (fn.insts[id].op == Op::Phi) replace(fn, id, fn.insts[id].args[0]);
+      fn.remove(term);
+      for (int id : fn.blocks[succ].insts) {
+        fn.insts[id].block = b;
+        fn.blocks[b].insts.push_back(id);
+      }
+      if (fn.blocks[b].count == -1) fn.blocks[b].count = fn.blocks[succ].count;
+      fn.blocks[succ].insts.clear();
+      fn.blocks[succ].preds.clear();
+      fn.blocks[succ].isDead = true;
+      for (int next : fn.succs(b))
+        for (int &pred : fn.blocks[next].preds)
+          if (pred == succ) pred = b;
+      changes++;
+    }
+  }
+
+  // Blocks that do nothing but jump somewhere else. Everybody can just go there directly
+  // (as long as there are no phis there, which would have to tell the two apart)
+  for (int b = 1; b < (int)fn.blocks.size(); b++) {
+    Block &block = fn.blocks[b];
+    if (block.isDead || block.insts.size() != 1 || fn.insts[block.insts[0]].op != Op::Jump) continue;
+    int target = fn.insts[block.insts[0]].targets[0];
+    if (target == b) continue; // `loop (true) {}`, nowhere better to go
+    const Block &to = fn.blocks[target];
+    if (!to.insts.empty() && fn.insts[to.insts[0]].op == Op::Phi) continue;
+
+    std::vector<int> preds = block.preds;
+    for (int pred : preds) fn.replaceTarget(pred, b, target);
+    std::vector<int> &targetPreds = fn.blocks[target].preds;
+    targetPreds.erase(std::find(targetPreds.begin(), targetPreds.end(), b));
+    targetPreds.insert(targetPreds.end(), preds.begin(), preds.end());
+    fn.remove(block.insts[0]);
+    block.preds.clear();
+    block.isDead = true;
+    changes++;
+  }
+  return changes;
+}
+
+} // namespace ir
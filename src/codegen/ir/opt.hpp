@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ir.hpp"
+
+namespace ir {
+
+// The passes that run on the IR. Each one returns how many things it changed,
+// so the pass manager knows when to stop running them in circles.
+class Passes {
+public:
+  // Folds constants (math, compares, branches on constants), trivial identities like `x + 0`,
+  // copies, conversions that don't convert anything and phis that only ever see one value.
+  static size_t fold(Function &fn);
+  // Unreachable blocks, blocks that could just be one block, and blocks that only jump somewhere else.
+  static size_t simplifyCfg(Function &fn);
+  // Values nobody uses (in the end) by anything with a side effect.
+  static size_t deadCode(Function &fn);
+  // The same computation twice, where the first one dominates the second: the second one just uses the first.
+  static size_t valueNumbering(Function &fn);
+  // Math that comes out the same every time around a loop gets done once, in the loop's preheader (see loops.cpp).
+  static size_t hoistInvariants(Function &fn);
+  // Multiplying the loop counter turns into adding to a second counter, and the first one goes away if it can.
+  static size_t reduceInductions(Function &fn);
+
+private:
+  static bool evaluate(const Function &fn, const Inst &inst, long long &out);
+  static int identity(const Function &fn, const Inst &inst); // -1 if there isn't one
+  static void makeConst(Inst &inst, long long value);
+  static void replace(Function &fn, int value, int with);
+  static void removeBlock(Function &fn, int block);
+  static bool isCommutative(const Inst &inst);
+};
+
+} // namespace ir
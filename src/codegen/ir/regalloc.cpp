@@ -0,0 +1,198 @@
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <set>
+
+namespace ir {
+
+// In the order we'd like to hand them out: caller saved ones first (they're free as long as nothing
+// gets called), then the callee saved ones that survive calls into the stack machine, then the rest.
+static const std::string registers[] = {"%rsi", "%rdi", "%r8",  "%r9",  "%r10", "%rcx",
+                                        "%rdx", "%r12", "%r15", "%rbx", "%r13", "%r14"};
+static constexpr int registerCount = sizeof(registers) / sizeof(registers[0]);
+static constexpr unsigned bit(int reg) { return 1u << reg; }
+static constexpr unsigned rcx = bit(5), rdx = bit(6);
+static constexpr unsigned callerSaved = bit(0) | bit(1) | bit(2) | bit(3) | bit(4) | rcx | rdx;
+static constexpr unsigned calleeSaved = bit(7) | bit(8) | bit(9) | bit(10) | bit(11);
+static constexpr unsigned trashedByCalls = callerSaved | bit(9) | bit(10) | bit(11); // see regalloc.hpp
+
+Allocation RegAlloc::run(const Function &function, const std::vector<int> &order, const std::vector<int> &coveredBy) {
+  fn = &function;
+  liveness(order);
+  buildIntervals(order, coveredBy);
+  scan();
+
+  Allocation result;
+  unsigned used = 0;
+  for (auto &[value, interval] : intervals)
+    if (interval.reg != -1) {
+      result.locations[value] = registers[interval.reg];
+      used |= bit(interval.reg);
+    }
+  long long frame = 0;
+  for (int reg = 0; reg < registerCount; reg++)
+    if (used & calleeSaved & bit(reg)) {
+      frame += 8;
+      result.saved.push_back({registers[reg], std::to_string(-frame) + "(%rbp)"});
+    }
+  // Sorted, so the same program always gets the same slots
+  std::sort(spilled.begin(), spilled.end(), [](Interval *a, Interval *b) { return a->value < b->value; });
+  for (Interval *interval : spilled) {
+    frame += 8;
+    result.locations[interval->value] = std::to_string(-frame) + "(%rbp)";
+  }
+  result.frameSize = (frame + 15) / 16 * 16;
+  return result;
+}
+
+// Which values are alive going into and coming out of every block. The usual backwards dataflow,
+// repeated until nothing changes (loops need more than one round). Phis are special: their operands
+// are alive at the end of the matching pred, not at the start of the phi's own block.
+void RegAlloc::liveness(const std::vector<int> &order) {
+  size_t blockCount = fn->blocks.size();
+  std::vector<std::set<int>> uses(blockCount), defs(blockCount);
+  for (int b : order)
+    for (int id : fn->blocks[b].insts) {
+      const Inst &inst = fn->insts[id];
+      if (inst.op != Op::Phi)
+        for (int arg : inst.args)
+          if (!fn->isConst(arg) && !defs[b].contains(arg)) uses[b].insert(arg);
+      if (inst.hasValue()) defs[b].insert(id);
+    }
+
+  std::vector<std::set<int>> in(blockCount), out(blockCount);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto it = order.rbegin(); it != order.rend(); it++) {
+      int b = *it;
+      std::set<int> live;
+      for (int succ : fn->succs(b)) {
+        const Block &block = fn->blocks[succ];
+        long index = std::find(block.preds.begin(), block.preds.end(), b) - block.preds.begin();
+        for (int value : in[succ])
+          if (fn->insts[value].op != Op::Phi || fn->insts[value].block != succ) live.insert(value);
+        for (int id : block.insts)
+          if (fn->insts[id].op == Op::Phi && !fn->isConst(fn->insts[id].args[index])) live.insert(fn->insts[id].args[index]);
+      }
+      std::set<int> liveIn = uses[b];
+      for (int value : live)
+        if (!defs[b].contains(value)) liveIn.insert(value);
+      for (int id : fn->blocks[b].insts)
+        if (fn->insts[id].op == Op::Phi) liveIn.insert(id);
+      if (live != out[b] || liveIn != in[b]) {
+        out[b] = std::move(live);
+        in[b] = std::move(liveIn);
+        changed = true;
+      }
+    }
+  }
+
+  liveIn.assign(blockCount, {});
+  liveOut.assign(blockCount, {});
+  for (size_t b = 0; b < blockCount; b++) {
+    liveIn[b].assign(in[b].begin(), in[b].end());
+    liveOut[b].assign(out[b].begin(), out[b].end());
+  }
+}
+
+void RegAlloc::buildIntervals(const std::vector<int> &order, const std::vector<int> &coveredBy) {
+  intervals.clear();
+  clobbers.clear();
+  blockStart.assign(fn->blocks.size(), 0);
+  blockEnd.assign(fn->blocks.size(), 0);
+
+  auto extend = [](int value, int position) {
+    auto [it, isNew] = intervals.try_emplace(value, Interval{.value = value, .start = position, .end = position});
+    if (isNew) return;
+    it->second.start = std::min(it->second.start, position);
+    it->second.end = std::max(it->second.end, position);
+  };
+
+  // A value that got covered by somebody else's pattern doesn't happen where it is, but where that somebody is
+  std::vector<int> positions(fn->insts.size(), 0);
+  int position = 0;
+  for (int b : order)
+    for (int id : fn->blocks[b].insts) positions[id] = position++;
+
+  position = 0;
+  for (int b : order) {
+    blockStart[b] = position;
+    for (int id : fn->blocks[b].insts) {
+      const Inst &inst = fn->insts[id];
+      bool isCovered = coveredBy[id] != -1;
+      if (inst.hasValue() && inst.op != Op::Const && !isCovered) extend(id, inst.op == Op::Param ? -1 : position); // params are there before anything happens
+      if (inst.op != Op::Phi)
+        for (int arg : inst.args)
+          if (!fn->isConst(arg) && coveredBy[arg] == -1) extend(arg, isCovered ? positions[coveredBy[id]] : position);
+
+      if (inst.op == Op::Call) clobbers.push_back({position, trashedByCalls});
+      if (inst.op == Op::Div || inst.op == Op::Mod) clobbers.push_back({position, rdx});
+      if ((inst.op == Op::Shl || inst.op == Op::Shr) && !fn->isConst(inst.args[1])) clobbers.push_back({position, rcx});
+      position++;
+    }
+    blockEnd[b] = position - 1;
+  }
+
+  for (int b : order) {
+    for (int value : liveIn[b]) extend(value, blockStart[b]);
+    for (int value : liveOut[b]) extend(value, blockEnd[b]);
+    // A phi gets written at the end of each of its preds, so it has to be alive there too
+    for (int id : fn->blocks[b].insts)
+      if (fn->insts[id].op == Op::Phi)
+        for (int pred : fn->blocks[b].preds) extend(id, blockEnd[pred]);
+  }
+}
+
+// Registers something trashes while `interval` is alive. Something that happens right where the
+// interval starts or ends is fine: operands are all read before the result gets written.
+unsigned RegAlloc::clobberedDuring(const Interval &interval) {
+  unsigned mask = 0;
+  for (auto &[position, regs] : clobbers)
+    if (interval.start < position && position < interval.end) mask |= regs;
+  return mask;
+}
+
+void RegAlloc::scan() {
+  spilled.clear();
+  std::vector<Interval *> sorted;
+  for (auto &[value, interval] : intervals) sorted.push_back(&interval);
+  std::sort(sorted.begin(), sorted.end(), [](Interval *a, Interval *b) {
+    return a->start != b->start ? a->start < b->start : a->value < b->value;
+  });
+
+  std::vector<Interval *> active;
+  for (Interval *current : sorted) {
+    // Whatever ended by now gives its register back
+    std::erase_if(active, [&](Interval *interval) { return interval->end <= current->start; });
+
+    unsigned taken = clobberedDuring(*current);
+    for (Interval *interval : active) taken |= bit(interval->reg);
+    for (int reg = 0; reg < registerCount; reg++)
+      if (!(taken & bit(reg))) {
+        current->reg = reg;
+        break;
+      }
+    if (current->reg != -1) {
+      active.push_back(current);
+      continue;
+    }
+
+    // Out of registers. Whoever lives the longest goes to the stack, as long as its register is
+    // one `current` can actually use
+    unsigned unusable = clobberedDuring(*current);
+    Interval *victim = nullptr;
+    for (Interval *interval : active)
+      if (!(unusable & bit(interval->reg)) && (victim == nullptr || interval->end > victim->end)) victim = interval;
+    if (victim != nullptr && victim->end > current->end) {
+      current->reg = victim->reg;
+      victim->reg = -1;
+      spilled.push_back(victim);
+      std::erase(active, victim);
+      active.push_back(current);
+    } else {
+      spilled.push_back(current);
+    }
+  }
+}
+
+} // namespace ir
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+
+namespace ir {
+
+struct Allocation {
+  std::unordered_map<int, std::string> locations = {}; // value -> "%rbx" or "-24(%rbp)". Constants have none
+  std::vector<std::pair<std::string, std::string>> saved = {}; // callee saved register -> where the prologue keeps it
+  long long frameSize = 0; // bytes below %rbp, a multiple of 16
+};
+
+// Linear scan register allocation (Poletto & Sarkar) over the values of an ir::Function.
+// Every value gets one live interval from its first to its last position in the block layout,
+// and the intervals are handed registers in order of where they start. When there aren't enough
+// registers, whichever interval lives the longest goes to the stack for its whole life.
+//
+// %rax and %r11 are never handed out- the backend needs somewhere to compute things and to break
+// cycles of phi copies. Everything else but %rsp and %rbp is fair game, with a few rules:
+//  - Values that live across a call can't be in a caller saved register. Neither can they be in
+//    %rbx, %r13 or %r14: the stack machine uses those as scratch without saving them, and we don't
+//    know if the function we are calling went through the stack machine.
+//  - Values that live across a division can't be in %rdx, or across a variable shift in %rcx.
+//  - Callee saved registers cost a save in the prologue and a restore before every ret.
+class RegAlloc {
+public:
+  // `order` is the block layout, `coveredBy` who emits each value (see Select::coveredBy)
+  static Allocation run(const Function &fn, const std::vector<int> &order, const std::vector<int> &coveredBy);
+
+private:
+  struct Interval {
+    int value;
+    int start;
+    int end;
+    int reg = -1; // index into `registers`, -1 if it got spilled
+  };
+
+  static void liveness(const std::vector<int> &order);
+  static void buildIntervals(const std::vector<int> &order, const std::vector<int> &coveredBy);
+  static unsigned clobberedDuring(const Interval &interval);
+  static void scan();
+
+  static inline const Function *fn = nullptr;
+  static inline std::vector<std::vector<int>> liveIn = {}, liveOut = {}; // by block, sorted
+  static inline std::vector<int> blockStart = {}, blockEnd = {};
+  static inline std::unordered_map<int, Interval> intervals = {};
+  static inline std::vector<std::pair<int, unsigned>> clobbers = {}; // position -> registers it trashes
+  static inline std::vector<Interval *> spilled = {};
+};
+
+} // namespace ir
@@ -0,0 +1,274 @@
+#include "select.hpp"
+
+#include <algorithm>
+#include <climits>
+
+namespace ir {
+
+static bool fitsInImmediate(long long imm) { return imm >= INT_MIN && imm <= INT_MAX; }
+
+// Right before the terminator of `block`
+static int insertBeforeTerminator(Function &fn, int block, Inst inst) {
+  inst.block = block;
+  fn.insts.push_back(inst);
+  int id = (int)fn.insts.size() - 1;
+  std::vector<int> &list = fn.blocks[block].insts;
+  list.insert(list.end() - 1, id);
+  return id;
+}
+
+void Select::run(Function &function) {
+  fn = &function;
+  // Inner ifs first (postorder), since once they're cmovs the ones around them might be cheap enough too
+  for (bool changed = true; changed;) {
+    changed = false;
+    countUses();
+    std::vector<int> order = fn->reversePostorder();
+    for (auto it = order.rbegin(); it != order.rend(); it++) changed |= ifConvert(*it);
+  }
+
+  countUses();
+  coveredBy.assign(fn->insts.size(), -1);
+  addresses.clear();
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (fn->blocks[b].isDead) continue;
+    const std::vector<int> &list = fn->blocks[b].insts;
+    // Back to front, so the biggest tree gets a go before the smaller ones inside of it
+    for (auto it = list.rbegin(); it != list.rend(); it++) {
+      const Inst &inst = fn->insts[*it];
+      if (inst.op == Op::Branch || inst.op == Op::Select) {
+        // jcc only comes in signed flavors (see JumpCondition), cmov comes in both
+        const Inst &cond = fn->insts[inst.args[0]];
+        if (cond.op == Op::Cmp && cond.block == b && uses[inst.args[0]] == 1 && (cond.isSigned || inst.op == Op::Select))
+          coveredBy[inst.args[0]] = *it;
+      } else if ((inst.op == Op::Add || inst.op == Op::Sub) && coveredBy[*it] == -1) {
+        coverAddress(*it);
+      }
+    }
+  }
+}
+
+void Select::countUses() {
+  uses.assign(fn->insts.size(), 0);
+  for (const Inst &inst : fn->insts)
+    if (!inst.isDead)
+      for (int arg : inst.args) uses[arg]++;
+}
+
+// A block we'd just as well run no matter what: `from` is the only way in, there is nothing in it that
+// could trap or be seen from outside, and it ends by jumping (or returning) straight away
+bool Select::isCheapArm(int block, int from, Cost &cost) {
+  const Block &arm = fn->blocks[block];
+  if (block == 0 || arm.isDead || arm.preds.size() != 1 || arm.preds[0] != from) return false;
+  int term = fn->terminator(block);
+  if (term == -1 || fn->insts[term].op == Op::Branch) return false;
+  cost = {};
+  for (int id : arm.insts) {
+    const Inst &inst = fn->insts[id];
+    if (id == term) break;
+    switch (inst.op) {
+      case Op::Phi:
+      case Op::Param:
+      case Op::Call:
+      case Op::Count: // would count both arms
+      case Op::Div: // by zero, for all we know
+      case Op::Mod: return false;
+      default: break;
+    }
+    cost = cost + Select::cost(inst);
+  }
+  return true;
+}
+
+void Select::hoist(int arm, int into) {
+  std::vector<int> list = fn->blocks[arm].insts;
+  list.pop_back(); // the terminator stays, and dies with the block
+  for (int id : list) {
+    fn->insts[id].block = into;
+    std::vector<int> &to = fn->blocks[into].insts;
+    to.insert(to.end() - 1, id);
+  }
+  fn->blocks[arm].insts.erase(fn->blocks[arm].insts.begin(), fn->blocks[arm].insts.end() - 1);
+}
+
+// `block` branches into two cheap arms (or one, and straight into where the other one goes) that
+// meet up again right after, or that both return. Do both of them, and pick the result with cmovs
+bool Select::ifConvert(int block) {
+  if (fn->blocks[block].isDead) return false;
+  int term = fn->terminator(block);
+  if (term == -1 || fn->insts[term].op != Op::Branch) return false;
+  const std::vector<int> targets = fn->insts[term].targets;
+  if (targets[0] == targets[1] || targets[0] == block || targets[1] == block) return false;
+  // The profile says it always goes the same way, which the branch predictor will figure out too
+  if (fn->blocks[targets[0]].count == 0 || fn->blocks[targets[1]].count == 0) return false;
+
+  Cost arms[2] = {};
+  bool isArm[2];
+  int ends[2], preds[2]; // where each side goes after the arm, and who it comes in from there
+  for (int i = 0; i < 2; i++) {
+    isArm[i] = isCheapArm(targets[i], block, arms[i]);
+    const Inst *armTerm = isArm[i] ? &fn->insts[fn->terminator(targets[i])] : nullptr;
+    ends[i] = !isArm[i] ? targets[i] : armTerm->op == Op::Jump ? armTerm->targets[0] : -1;
+    preds[i] = isArm[i] ? targets[i] : block;
+  }
+  if ((!isArm[0] && !isArm[1]) || ends[0] != ends[1]) return false;
+  int cond = fn->insts[term].args[0];
+  int merge = ends[0];
+
+  // Which values have to be picked between: the phis where the two sides disagree, or the return value
+  std::vector<std::pair<int, int>> picks; // {if true, if false}
+  std::vector<Type> types;
+  std::vector<int> phis;
+  if (merge == -1) {
+    const Inst &returnTrue = fn->insts[fn->terminator(targets[0])], &returnFalse = fn->insts[fn->terminator(targets[1])];
+    if (returnTrue.args.size() != returnFalse.args.size()) return false;
+    if (!returnTrue.args.empty()) {
+      picks.push_back({returnTrue.args[0], returnFalse.args[0]});
+      types.push_back(fn->returnType);
+    }
+  } else {
+    const Block &to = fn->blocks[merge];
+    if (merge == 0 || merge == block) return false;
+    long indexTrue = std::find(to.preds.begin(), to.preds.end(), preds[0]) - to.preds.begin();
+    long indexFalse = std::find(to.preds.begin(), to.preds.end(), preds[1]) - to.preds.begin();
+    if (indexTrue == (long)to.preds.size() || indexFalse == (long)to.preds.size()) return false;
+    for (int id : to.insts)
+      if (fn->insts[id].op == Op::Phi) {
+        phis.push_back(id);
+        types.push_back(fn->insts[id].type);
+        picks.push_back({fn->insts[id].args[indexTrue], fn->insts[id].args[indexFalse]});
+      }
+  }
+  int selects = (int)std::count_if(picks.begin(), picks.end(), [](const std::pair<int, int> &p) { return p.first != p.second; });
+
+  // Both arms, and a cmov for every pick (a test first, unless the compare can set the flags for it) vs.
+  // a branch, a jump over the other arm, and a copy into every phi on both sides (but only one arm ever runs)
+  bool isFused = fn->insts[cond].op == Op::Cmp && fn->insts[cond].block == block && uses[cond] == 1 && selects == 1;
+  Cost perSelect = Costs::of({Pattern::Mov, Pattern::Cmov}) + (isFused ? Cost{} : Costs::of(Pattern::Test));
+  Cost converted = arms[0] + arms[1] + perSelect * selects;
+  Cost branchy = Costs::of({Pattern::Branch, Pattern::Jump}) + Costs::of(Pattern::Mov) * selects;
+  branchy.bytes += arms[0].bytes + arms[1].bytes + Costs::of(Pattern::Mov).bytes * selects;
+  branchy.cycles += std::max(arms[0].cycles, arms[1].cycles);
+  if (!Costs::isCheaper(converted, branchy)) return false;
+
+  for (int i = 0; i < 2; i++)
+    if (isArm[i]) hoist(targets[i], block);
+  std::vector<int> picked;
+  for (size_t i = 0; i < picks.size(); i++) {
+    auto [ifTrue, ifFalse] = picks[i];
+    if (ifTrue == ifFalse) picked.push_back(ifTrue);
+    else picked.push_back(insertBeforeTerminator(*fn, block, {.op = Op::Select, .type = types[i], .args = {cond, ifTrue, ifFalse}}));
+  }
+
+  Inst &branch = fn->insts[term];
+  branch.args.clear();
+  if (merge == -1) {
+    branch.op = Op::Return;
+    branch.targets.clear();
+    branch.args = picked;
+  } else {
+    for (int i = 0; i < 2; i++) fn->removePred(merge, preds[i]);
+    fn->blocks[merge].preds.push_back(block);
+    for (size_t i = 0; i < phis.size(); i++) fn->insts[phis[i]].args.push_back(picked[i]);
+    branch.op = Op::Jump;
+    branch.targets = {merge};
+  }
+  for (int i = 0; i < 2; i++) {
+    if (!isArm[i]) continue;
+    Block &arm = fn->blocks[targets[i]];
+    fn->insts[arm.insts.back()].isDead = true;
+    arm.insts.clear();
+    arm.preds.clear();
+    arm.isDead = true;
+  }
+  return true;
+}
+
+// `value` (an add, or a sub of a constant) as one lea, if that beats doing the adds and shifts one by one
+void Select::coverAddress(int value) {
+  const Inst &inst = fn->insts[value];
+  Terms terms;
+  if (inst.op == Op::Sub) {
+    if (!fn->isConst(inst.args[1]) || !fitsInImmediate(fn->insts[inst.args[1]].imm) ||
+        fn->insts[inst.args[1]].imm == INT_MIN)
+      return;
+    terms.disp = -fn->insts[inst.args[1]].imm;
+    if (!addTerm(inst.args[0], value, terms)) return;
+  } else if (!addTerm(inst.args[0], value, terms) || !addTerm(inst.args[1], value, terms)) {
+    return;
+  }
+  // A plain `a + b` or `a + 1` is up to the backend, it depends on where `a` and `b` end up
+  if (terms.covered.empty()) return;
+
+  Address address = {.index = terms.index, .scale = terms.scale, .disp = terms.disp};
+  if (terms.index == -1 && terms.plain.size() == 2) {
+    address.base = terms.plain[0];
+    address.index = terms.plain[1];
+  } else if (!terms.plain.empty()) {
+    address.base = terms.plain[0];
+  }
+  if (address.base == -1 && address.index == -1) return;
+
+  // The whole thing in one lea, the lea and then an add for the constant, or not bothering at all
+  bool isThreePart = address.base != -1 && address.index != -1 && address.disp != 0;
+  Cost whole = Costs::of(isThreePart ? Pattern::LeaSlow : Pattern::Lea);
+  Cost split = Costs::of({Pattern::Lea, Pattern::AluImm});
+  Cost separate = Costs::of(Pattern::Mov) + cost(inst);
+  for (int covered : terms.covered) separate = separate + cost(fn->insts[covered]);
+  address.isSplit = isThreePart && Costs::isCheaper(split, whole);
+  if (Costs::isCheaper(separate, address.isSplit ? split : whole)) return;
+
+  for (int covered : terms.covered) coveredBy[covered] = value;
+  addresses[value] = address;
+}
+
+bool Select::addTerm(int value, int root, Terms &terms) {
+  const Inst &inst = fn->insts[value];
+  if (inst.op == Op::Const) {
+    if (!fitsInImmediate(inst.imm) || !fitsInImmediate(terms.disp + inst.imm)) return false;
+    terms.disp += inst.imm;
+    return true;
+  }
+  if (isCoverable(value, root)) {
+    if (inst.op == Op::Add) {
+      terms.covered.push_back(value);
+      return addTerm(inst.args[0], root, terms) && addTerm(inst.args[1], root, terms);
+    }
+    long long by = fn->isConst(inst.args[1]) ? fn->insts[inst.args[1]].imm : 0;
+    int scale = inst.op == Op::Shl && by >= 1 && by <= 3 ? 1 << by : inst.op == Op::Mul && (by == 2 || by == 4 || by == 8) ? (int)by : 1;
+    if (scale > 1 && terms.index == -1) {
+      terms.covered.push_back(value);
+      terms.index = inst.args[0];
+      terms.scale = scale;
+      return terms.plain.size() <= 1;
+    }
+  }
+  terms.plain.push_back(value);
+  return terms.plain.size() + (terms.index != -1) <= 2;
+}
+
+// Only used by `root`, right there in the same block, and the same width as it (so that the bits
+// that the lea gets wrong up top get cut off the same way)
+bool Select::isCoverable(int value, int root) {
+  const Inst &inst = fn->insts[value];
+  if (inst.op != Op::Add && inst.op != Op::Shl && inst.op != Op::Mul) return false;
+  return uses[value] == 1 && coveredBy[value] == -1 && inst.block == fn->insts[root].block &&
+         inst.type.bytes == fn->insts[root].type.bytes;
+}
+
+// What `inst` costs on its own, the way the backend would do it
+Cost Select::cost(const Inst &inst) {
+  switch (inst.op) {
+    case Op::Const: return {};
+    case Op::Copy:
+    case Op::Convert: return Costs::of(Pattern::Mov);
+    case Op::Mul: return Costs::of(Pattern::Imul);
+    case Op::Shl:
+    case Op::Shr: return Costs::of(Pattern::Shift);
+    case Op::Cmp: return Costs::of({Pattern::CmpImm, Pattern::Setcc, Pattern::Movzx});
+    case Op::Select: return Costs::of({Pattern::Mov, Pattern::Cmov});
+    default: return Costs::of(Pattern::Alu);
+  }
+}
+
+} // namespace ir
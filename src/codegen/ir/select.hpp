@@ -0,0 +1,60 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "../optimizer/costs.hpp"
+#include "ir.hpp"
+
+namespace ir {
+
+// Instruction selection: which x86 instructions the values of an ir::Function turn into.
+// It runs right before register allocation, and covers little trees of values (a value, plus whatever
+// feeds it that nobody else needs) with whichever x86 pattern is cheapest according to optimizer/costs.hpp:
+//  - `a + b * 8 + 16` and friends are one lea, so the shift doesn't need a register (or an instruction) of its own
+//  - a compare that is only there to be branched on (or selected on) sets the flags for it right there
+//  - `if (c) { x = a; } else { x = b; }`, and `if (c) { return a; } return b;`, where both sides are cheap enough
+//    to just do anyways, becomes a Select (a cmov) instead of a branch
+// What's left depends on where things end up living, so the backend picks those once it knows:
+// inc/dec, lea instead of mov + add, test instead of cmp $0, and xor + setcc instead of setcc + movzx.
+class Select {
+public:
+  // base + index * scale + disp, for an lea. -1 if there is no base (or index)
+  struct Address {
+    int base = -1;
+    int index = -1;
+    int scale = 1;
+    long long disp = 0;
+    bool isSplit = false; // leave `disp` out of the lea and add it afterwards, three part leas are slow
+  };
+
+  static void run(Function &fn);
+
+  // Who emits each value: -1 if it gets emitted on its own, or the value whose pattern swallowed it
+  static inline std::vector<int> coveredBy = {};
+  static inline std::unordered_map<int, Address> addresses = {}; // the values that are one lea
+
+private:
+  // Everything `value` adds up, as far as one lea can see
+  struct Terms {
+    std::vector<int> plain = {};
+    int index = -1;
+    int scale = 1;
+    long long disp = 0;
+    std::vector<int> covered = {};
+  };
+
+  static bool ifConvert(int block);
+  static bool isCheapArm(int block, int from, Cost &cost);
+  static void hoist(int arm, int into);
+  static void coverAddress(int value);
+  static bool addTerm(int value, int root, Terms &terms);
+  static bool isCoverable(int value, int root);
+  static Cost cost(const Inst &inst);
+  static void countUses();
+
+  static inline Function *fn = nullptr;
+  static inline std::vector<int> uses = {};
+};
+
+} // namespace ir
@@ -0,0 +1,125 @@
+#include "callgraph.hpp"
+#include "../../ast/walk.hpp"
+
+size_t CallGraph::build(Node::Stmt *program) {
+  functions.clear();
+  methods.clear();
+  reachable.clear();
+  worklist.clear();
+  isComplete = true;
+
+  collect(program, "");
+  // Global variable initializers run no matter what, so whatever they touch is a root too
+  markUses(program);
+  reach("main");
+
+  while (!worklist.empty()) {
+    std::string name = worklist.back();
+    worklist.pop_back();
+    markUses(functions[name]->block);
+  }
+  return isComplete ? functions.size() - reachable.size() : 0;
+}
+
+void CallGraph::keepEverything() {
+  functions.clear();
+  methods.clear();
+  reachable.clear();
+  worklist.clear();
+  isComplete = false;
+}
+
+bool CallGraph::isReachable(const std::string &asmName) {
+  return !isComplete || reachable.contains(asmName);
+}
+
+bool CallGraph::isImportLive(ImportStmt *stmt) {
+  if (!isComplete) return true;
+  for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt->stmt)->stmt) {
+    if (s->kind == ND_CONST_STMT && static_cast<ConstStmt *>(s)->value->kind == ND_FN_STMT) {
+      if (reachable.contains("usr_" + static_cast<ConstStmt *>(s)->name)) return true;
+      continue;
+    }
+    if (s->kind == ND_IMPORT_STMT) {
+      if (isImportLive(static_cast<ImportStmt *>(s))) return true;
+      continue;
+    }
+    return true; // structs, enums, globals, @link... those matter even if nothing is called
+  }
+  return false;
+}
+
+void CallGraph::collect(Node::Stmt *stmt, const std::string &structName) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s, structName);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt, structName);
+      break;
+    case ND_CONST_STMT: {
+      ConstStmt *s = static_cast<ConstStmt *>(stmt);
+      if (s->value->kind == ND_STRUCT_STMT) collect(s->value, s->name);
+      else collect(s->value, structName);
+      break;
+    }
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *s : static_cast<StructStmt *>(stmt)->stmts) collect(s, structName);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      // Same naming as funcDecl
+      std::string asmName = structName != "" ? "usrstruct_" + structName + "_" + fn->name
+                          : fn->name == "main" ? "main" : "usr_" + fn->name;
+      functions[asmName] = fn;
+      if (structName != "") methods[fn->name].push_back(asmName);
+      // Nobody "calls" a template in a way we can see yet, so just keep them
+      if (fn->isTemplate) reach(asmName);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Only goes through the top level of a program (and its imports), looking at everything
+// that is NOT a function body. Function bodies are walked once they are reached.
+void CallGraph::markUses(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_FN_STMT:
+      return; // Walked from the worklist if (and only if) it's reachable
+    case ND_STRUCT_STMT:
+      return; // Only holds fields and methods
+    default:
+      break;
+  }
+  bool known = Walk::children(stmt, [](Node::Expr *&e) { markUses(e); },
+                              [](Node::Stmt *&s) { markUses(s); });
+  if (!known) isComplete = false;
+}
+
+void CallGraph::markUses(Node::Expr *expr) {
+  switch (expr->kind) {
+    case ND_IDENT:
+      // Direct calls AND functions used as values (their address escapes) both land here
+      reach("usr_" + static_cast<IdentExpr *>(expr)->name);
+      break;
+    case ND_MEMBER: {
+      // x.len() or x.len - we would need the struct type of x to be exact,
+      // so just keep every method with that name alive
+      MemberExpr *e = static_cast<MemberExpr *>(expr);
+      if (e->rhs->kind == ND_IDENT && methods.contains(static_cast<IdentExpr *>(e->rhs)->name))
+        for (const std::string &name : methods[static_cast<IdentExpr *>(e->rhs)->name]) reach(name);
+      break;
+    }
+    default:
+      break;
+  }
+  if (!Walk::children(expr, [](Node::Expr *&e) { markUses(e); })) isComplete = false;
+}
+
+void CallGraph::reach(const std::string &asmName) {
+  if (!functions.contains(asmName) || reachable.contains(asmName)) return;
+  reachable.insert(asmName);
+  worklist.push_back(asmName);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+
+// Whole-program call graph, rooted at main.
+// Anything main can't get to (directly, through a struct method, or by having its address taken)
+// never makes it into the assembly- no code, no string literals, no DWARF DIEs.
+// Importing one helper out of a std file shouldn't drag the whole file into the binary!
+class CallGraph {
+public:
+  // Returns how many functions are dead
+  static size_t build(Node::Stmt *program);
+  // -O0: don't even look, everything is reachable
+  static void keepEverything();
+  // Takes the assembly name of the function (main, usr_foo, usrstruct_Point_len)
+  static bool isReachable(const std::string &asmName);
+  // An import is dead if all it brings in is functions nobody calls
+  static bool isImportLive(ImportStmt *stmt);
+
+private:
+  static void collect(Node::Stmt *stmt, const std::string &structName);
+  static void markUses(Node::Stmt *stmt);
+  static void markUses(Node::Expr *expr);
+  static void reach(const std::string &asmName);
+
+  static inline std::unordered_map<std::string, FnStmt *> functions = {};         // asm name -> decl
+  static inline std::unordered_map<std::string, std::vector<std::string>> methods = {}; // method name -> asm names
+  static inline std::set<std::string> reachable = {};
+  static inline std::vector<std::string> worklist = {};
+  // If we ever walk into a node we don't understand, we can't prove anything is dead. Keep everything.
+  static inline bool isComplete = true;
+};
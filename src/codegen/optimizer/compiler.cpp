@@ -1,10 +1,74 @@
-// library for log2 function (you will see where this is used)
+// library for llrint and isfinite (you will see where this is used)
 #include <algorithm>
+#include <charconv>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
 #include "compiler.hpp"
 #include "../gen.hpp"
+#include "../../ast/walk.hpp"
 #include "../../typeChecker/type.hpp"
 
+// Reads an int or float literal the way the cpu would end up seeing it.
+// Float literals get rounded to their own precision first (that's what lands in .rodata),
+// and only then converted to whatever we are actually computing in.
+template <typename T>
+static T literalAs(Node::Expr *expr) {
+  if (expr->kind == ND_INT)
+    return (T)static_cast<IntExpr *>(expr)->value; // cvtsi2ss/cvtsi2sd: signed 64-bit in, one rounding out
+  FloatExpr *floating = static_cast<FloatExpr *>(expr);
+  if (CompileOptimizer::isDoubleType(floating->asmType))
+    return (T)std::strtod(floating->value.c_str(), nullptr);
+  return (T)std::strtof(floating->value.c_str(), nullptr);
+}
+
+bool CompileOptimizer::isFloatingType(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return false;
+  std::string name = static_cast<SymbolType *>(type)->name;
+  return name == "float" || name == "double";
+}
+
+bool CompileOptimizer::isDoubleType(Node::Type *type) {
+  return type != nullptr && type->kind == ND_SYMBOL_TYPE
+      && static_cast<SymbolType *>(type)->name == "double";
+}
+
+FloatExpr *CompileOptimizer::makeFloatLiteral(int line, int pos, size_t file, double value, bool isDouble) {
+  // to_chars gives the shortest string that reads back as the exact same bits,
+  // so nothing is lost between here and the .float/.double in the rodata section
+  char buf[64];
+  std::to_chars_result res = isDouble ? std::to_chars(buf, buf + sizeof(buf), value)
+                                      : std::to_chars(buf, buf + sizeof(buf), (float)value);
+  FloatExpr *result = new FloatExpr(line, pos, std::string(buf, res.ptr), file);
+  result->asmType = new SymbolType(isDouble ? "double" : "float");
+  return result;
+}
+
+size_t CompileOptimizer::foldTree(Node::Stmt *program) {
+  size_t changes = 0;
+  std::function<void(Node::Expr *&)> onExpr = [&](Node::Expr *&expr) {
+    Walk::children(expr, onExpr);
+    Node::Expr *folded = optimizeExpr(expr);
+    if (folded == expr) return;
+    expr = folded;
+    changes++;
+  };
+  std::function<void(Node::Stmt *&)> onStmt = [&](Node::Stmt *&stmt) {
+    Walk::children(stmt, onExpr, onStmt);
+    Node::Stmt *folded = optimizeStmt(stmt);
+    if (folded == stmt) return;
+    changes++;
+    // `if (false) {...}` with no else is just... nothing
+    if (folded == nullptr) {
+      IfStmt *s = static_cast<IfStmt *>(stmt);
+      folded = new BlockStmt(s->line, s->pos, {}, false, {}, stmt->file_id);
+    }
+    stmt = folded;
+  };
+  Walk::children(program, onExpr, onStmt);
+  return changes;
+}
+
 Node::Stmt *CompileOptimizer::optimizeStmt(Node::Stmt *stmt) {
   // May be one day used for optimizations such as...
   // If jumping (automatic switch statement maker)
@@ -60,11 +124,12 @@ Node::Expr *CompileOptimizer::optimizeCast(CastExpr *expr) {
     if (TypeChecker::isIntBasedType(expr->castee_type)) {
       return realCastFrom;
     }
-    if (expr->castee_type->kind == ND_SYMBOL_TYPE
-        && (TypeChecker::type_to_string(expr->castee_type) == "float"
-        || TypeChecker::type_to_string(expr->castee_type) == "double")) {
+    if (isFloatingType(expr->castee_type)) {
+      // cvtsi2ss/cvtsi2sd treat the source as a signed 64-bit int, so we do too
       IntExpr *temp = static_cast<IntExpr *>(realCastFrom);
-      return new FloatExpr(temp->line, temp->pos, std::to_string(temp->value), temp->file_id);
+      if (isDoubleType(expr->castee_type))
+        return makeFloatLiteral(temp->line, temp->pos, temp->file_id, literalAs<double>(temp), true);
+      return makeFloatLiteral(temp->line, temp->pos, temp->file_id, literalAs<float>(temp), false);
     }
     if (expr->castee_type->kind == ND_SYMBOL_TYPE
         && (TypeChecker::type_to_string(expr->castee_type) == "str")) {
@@ -74,21 +139,25 @@ Node::Expr *CompileOptimizer::optimizeCast(CastExpr *expr) {
     return expr;
   }
   if (realCastFrom->kind == ND_FLOAT) {
-    if (expr->castee_type->kind == ND_SYMBOL_TYPE
-        && (TypeChecker::type_to_string(expr->castee_type) == "float"
-        || TypeChecker::type_to_string(expr->castee_type) == "double")) {
-          return realCastFrom;
+    FloatExpr *temp = static_cast<FloatExpr *>(realCastFrom);
+    if (isFloatingType(expr->castee_type)) {
+      // float <-> double is still a real conversion (cvtss2sd/cvtsd2ss), so round it now
+      if (isDoubleType(expr->castee_type))
+        return makeFloatLiteral(temp->line, temp->pos, temp->file_id, literalAs<double>(temp), true);
+      return makeFloatLiteral(temp->line, temp->pos, temp->file_id, literalAs<float>(temp), false);
     }
     if (expr->castee_type->kind == ND_SYMBOL_TYPE
         && TypeChecker::type_to_string(expr->castee_type) == "str") {
-      FloatExpr *temp = static_cast<FloatExpr *>(realCastFrom);
       return new StringExpr(temp->line, temp->pos, temp->value, temp->file_id);  
     }
 
     if (TypeChecker::isIntBasedType(expr->castee_type)) {
-      FloatExpr *temp = static_cast<FloatExpr *>(realCastFrom);
-      std::string magicTrickery = temp->value.substr(0, temp->value.find('.'));
-      return new IntExpr(temp->line, temp->pos, std::stoll(magicTrickery), temp->file_id);
+      // At runtime this is a cvtss2si/cvtsd2si, which rounds with the default
+      // MXCSR mode (to nearest, ties to even). llrint does the exact same thing.
+      double value = literalAs<double>(temp);
+      if (!std::isfinite(value) || value >= 9223372036854775808.0 || value < -9223372036854775808.0)
+        return expr; // Let the cpu hand back its "integer indefinite" value
+      return new IntExpr(temp->line, temp->pos, std::llrint(value), temp->file_id);
     }
     return expr;
   }
@@ -131,6 +200,13 @@ Node::Expr *CompileOptimizer::optimizeUnary(UnaryExpr *expr) {
       return temp;
     } 
   }
+  if (operand->kind == ND_FLOAT && expr->op == "-") {
+    // Flipping the sign bit is always exact
+    FloatExpr *floating = static_cast<FloatExpr *>(operand);
+    bool isDouble = isDoubleType(floating->asmType);
+    return makeFloatLiteral(expr->line, expr->pos, expr->file_id,
+                            isDouble ? -literalAs<double>(floating) : -literalAs<float>(floating), isDouble);
+  }
   if (operand->kind == ND_BOOL) {
     bool value = static_cast<BoolExpr *>(operand)->value;
     if (expr->op == "!") { // logical not
@@ -167,6 +243,10 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
   Node::Expr *lhs = CompileOptimizer::optimizeExpr(expr->lhs); // If the lhs is a binExpr, that will be optimized too!!
   Node::Expr *rhs = CompileOptimizer::optimizeExpr(expr->rhs);
   std::string op = expr->op;
+  // Anything touching a float goes down its own path- none of the int tricks below (shifts, x + x -> x << 1) are legal there
+  if (isFloatingType(lhs->asmType) || isFloatingType(rhs->asmType)) {
+    return optimizeFloatBinary(expr, lhs, rhs);
+  }
   if (lhs->kind == ND_INT && rhs->kind == ND_INT) {
     long long lhsVal = static_cast<IntExpr *>(lhs)->value;
     long long rhsVal = static_cast<IntExpr *>(rhs)->value;
@@ -184,6 +264,9 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
       if (op == ">=") result = lhsVal >= rhsVal;
       return new BoolExpr(expr->line, expr->pos, result, expr->file_id);
     } else if (intOperations.contains(op)) {
+      // Leave the ones the cpu would trap on (or that are UB right here) to runtime
+      if ((op == "/" || op == "%") && (rhsVal == 0 || (lhsVal == LLONG_MIN && rhsVal == -1))) return expr;
+      if ((op == "<<" || op == ">>") && (rhsVal < 0 || rhsVal > 63)) return expr;
       long long result = 0;
       if (op == "+") result = lhsVal + rhsVal;
       if (op == "-") result = lhsVal - rhsVal;
@@ -193,68 +276,27 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
       if (op == "&") result = lhsVal & rhsVal;
       if (op == "|") result = lhsVal | rhsVal;
       if (op == "^") result = lhsVal ^ rhsVal;
-      if (op == "<<") result = lhsVal << rhsVal;
+      if (op == "<<") result = (long long)((unsigned long long)lhsVal << rhsVal);
       if (op == ">>") result = lhsVal >> rhsVal;
       return new IntExpr(expr->line, expr->pos, result, expr->file_id);
     }
   }
-  if (lhs->kind == ND_INT && op == "/") {
-    IntExpr *rhsExpr = static_cast<IntExpr *>(rhs);
-    long long rhsVal = rhsExpr->value;
-    double shiftAmount = log2((double)rhsVal); // If this number is a whole number, it is a true power of 2
-    
-    // Right shifting still works even with a negative number; so I removed that check!
-    if (shiftAmount == floor(shiftAmount)) {
-      BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, lhs, new IntExpr(rhsExpr->line, rhsExpr->pos, (long long)shiftAmount, rhsExpr->file_id), ">>", expr->file_id);
-      temp->asmType = lhs->asmType;
-      return temp;
-    }
-    // check the value of the lhs
-    // if it was 0, the answer is also 0
-    // 0 / 2 = 0
-    // 0 / 17 = 0
-    if (static_cast<IntExpr *>(lhs)->value == 0) {
-      return new IntExpr(expr->line, expr->pos, 0, expr->file_id);
-    }
-  }
+  // Multiplying (and dividing) by anything else that is constant gets turned into shifts and leas later on,
+  // once we know how wide it is and whether it is signed. See strength.hpp
   if (op == "*") {
     // check if either side was a useless calculation (0 * x, 1 * x)
-    if (lhs->kind == ND_INT) {
-      IntExpr *lhsExpr = static_cast<IntExpr *>(lhs);
-      long long lhsVal = lhsExpr->value;
-      if (lhsVal == 0) {
-        return new IntExpr(expr->line, expr->pos, 0, expr->file_id);
-      }
-      if (lhsVal == -1) {
-        return new UnaryExpr(expr->line, expr->pos, rhs, "-", expr->file_id);
-      }
-      if (lhsVal == 1) {
-        return rhs;
-      }
-      double shiftAmount = log2((double)lhsVal); // If this number is a whole number, it is a true power of 2
-      if (shiftAmount == floor(shiftAmount)) {
-        BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, rhs, new IntExpr(lhsExpr->line, lhsExpr->pos, (long long)shiftAmount, lhsExpr->file_id), "<<>>>>", expr->file_id);
-        temp->asmType = rhs->asmType;
-        return temp;
-      }
-    }
-    if (rhs->kind == ND_INT) {
-      IntExpr *rhsExpr = static_cast<IntExpr *>(rhs);
-      long long rhsVal = rhsExpr->value;
-      if (rhsVal == 0) {
+    Node::Expr *constant = rhs->kind == ND_INT ? rhs : lhs->kind == ND_INT ? lhs : nullptr;
+    Node::Expr *other = constant == rhs ? lhs : rhs;
+    if (constant != nullptr) {
+      long long value = static_cast<IntExpr *>(constant)->value;
+      if (value == 0) {
         return new IntExpr(expr->line, expr->pos, 0, expr->file_id);
       }
-      if (rhsVal == -1) {
-        return new UnaryExpr(expr->line, expr->pos, lhs, "-", expr->file_id);
+      if (value == -1) {
+        return new UnaryExpr(expr->line, expr->pos, other, "-", expr->file_id);
       }
-      if (rhsVal == 1) {
-        return lhs;
-      }
-      double shiftAmount = log2((double)rhsVal); // If this number is a whole number, it is a true power of 2
-      if (shiftAmount == floor(shiftAmount)) {
-        BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, rhs, new IntExpr(rhsExpr->line, rhsExpr->pos, (long long)shiftAmount, rhsExpr->file_id), "<<>>>>", expr->file_id);
-        temp->asmType = rhs->asmType;
-        return temp;
+      if (value == 1) {
+        return other;
       }
     }
   }
@@ -275,10 +317,9 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
   }
   if (op == "+" || op == "-") {
     // check if useless (one of the sides is 0)
-    if (lhs->kind == ND_INT) {
-      long long lhsVal = static_cast<IntExpr *>(lhs)->value;
-      if (lhsVal == 0) return rhs;
-    }
+    if (rhs->kind == ND_INT && static_cast<IntExpr *>(rhs)->value == 0) return lhs;
+    if (lhs->kind == ND_INT && static_cast<IntExpr *>(lhs)->value == 0)
+      return op == "+" ? rhs : new UnaryExpr(expr->line, expr->pos, rhs, "-", expr->file_id);
     // check if it is the same operation on both sides
     // x + x = 2x
     // x - x = 0
@@ -295,7 +336,9 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
             return temp;
           }
           // Just do a *2
-          return new BinaryExpr(expr->line, expr->pos, lhsIdent, new IntExpr(rhsIdent->line, rhsIdent->pos, 2, rhsIdent->file_id), "*", expr->file_id);
+          BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, lhsIdent, new IntExpr(rhsIdent->line, rhsIdent->pos, 2, rhsIdent->file_id), "*", expr->file_id);
+          temp->asmType = lhs->asmType;
+          return temp;
         }
       }
     }
@@ -304,67 +347,79 @@ Node::Expr *CompileOptimizer::optimizeBinary(BinaryExpr *expr) {
 
   // Check for MORE int literal math
   // Ex: x + 4 + 4 + 4 -> (((x + 4) + 4) + 4) which cant be analyzed
-  if (lhs->kind == ND_INT && rhs->kind == ND_BINARY) {
-    BinaryExpr *rhsBin = static_cast<BinaryExpr *>(rhs);
-    if (rhsBin->lhs->kind == ND_INT) {
-      long long lhsLhsVal = static_cast<IntExpr *>(lhs)->value;
-      long long rhsLhsVal = static_cast<IntExpr *>(rhsBin->lhs)->value;
-      long long result = 0;
-      // ex: 4 + x + 4 -> (4 + x) + 4 -> 8 + x
-      // ex: 4 - x + 4 -> (4 - x) + 4 -> x
-      if (op == "+") result = lhsLhsVal + rhsLhsVal;
-      if (op == "*") result = lhsLhsVal * rhsLhsVal;
-      if (op == "-") result = lhsLhsVal - rhsLhsVal;
-      BinaryExpr *temp =  new BinaryExpr(expr->line, expr->pos, new IntExpr(expr->line, expr->pos, result, expr->file_id), rhsBin->rhs, rhsBin->op, expr->file_id);
-      temp->asmType = rhs->asmType;
-      return temp;
-    }
-    // same thing, other side
-    if (rhsBin->rhs->kind == ND_INT) {
-      long long lhsRhsVal = static_cast<IntExpr *>(lhs)->value;
-      long long rhsRhsVal = static_cast<IntExpr *>(rhsBin->rhs)->value;
-      long long result = 0;
-      // ex: 4 + 4 + x -> (4 + 4) + x -> 8 + x
-      // ex: 4 + 4 - x -> (4 + 4) - x -> 8 - x
-      if (op == "+") result = lhsRhsVal + rhsRhsVal;
-      if (op == "*") result = lhsRhsVal * rhsRhsVal;
-      if (op == "-") result = lhsRhsVal - rhsRhsVal;
-      BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, rhsBin->lhs, new IntExpr(expr->line, expr->pos, result, expr->file_id), rhsBin->op, expr->file_id);
-      temp->asmType = rhs->asmType;
+  // Only for + and * (and only when both are the same op), since those don't care which way around they go
+  // and wrapping around doesn't change the answer. (x * 3) + 1 is NOT (3 + 1) * x!
+  if ((op == "+" || op == "*") && (lhs->kind == ND_INT) != (rhs->kind == ND_INT)) {
+    IntExpr *constant = static_cast<IntExpr *>(lhs->kind == ND_INT ? lhs : rhs);
+    Node::Expr *other = lhs->kind == ND_INT ? rhs : lhs;
+    BinaryExpr *inner = other->kind == ND_BINARY ? static_cast<BinaryExpr *>(other) : nullptr;
+    if (inner != nullptr && inner->op == op && (inner->lhs->kind == ND_INT) != (inner->rhs->kind == ND_INT)) {
+      // ex: 4 + (x + 4) -> x + 8
+      // ex: (4 * x) * 4 -> x * 16
+      long long innerVal = static_cast<IntExpr *>(inner->lhs->kind == ND_INT ? inner->lhs : inner->rhs)->value;
+      Node::Expr *rest = inner->lhs->kind == ND_INT ? inner->rhs : inner->lhs;
+      unsigned long long a = (unsigned long long)constant->value, b = (unsigned long long)innerVal;
+      long long result = (long long)(op == "+" ? a + b : a * b);
+      BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, rest, new IntExpr(expr->line, expr->pos, result, expr->file_id), op, expr->file_id);
+      temp->asmType = expr->asmType;
       return temp;
     }
   }
-  if (lhs->kind == ND_BINARY && rhs->kind == ND_INT) {
-    BinaryExpr *lhsBin = static_cast<BinaryExpr *>(lhs);
-    if (lhsBin->lhs->kind == ND_INT) {
-      long long lhsLhsVal = static_cast<IntExpr *>(lhsBin->lhs)->value;
-      long long rhsVal = static_cast<IntExpr *>(rhs)->value;
-      long long result = 0;
-      // ex: x + 4 + 4 -> (x + 4) + 4 -> x + 8
-      // ex: x - 4 + 4 -> (x - 4) + 4 -> x
-      if (op == "+") result = lhsLhsVal + rhsVal;
-      if (op == "*") result = lhsLhsVal * rhsVal;
-      if (op == "-") result = lhsLhsVal - rhsVal;
-      BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, new IntExpr(expr->line, expr->pos, result, expr->file_id), lhsBin->rhs, lhsBin->op, expr->file_id);
-      temp->asmType = lhs->asmType;
-      return temp;
-    }
-    // same thing, other side
-    if (lhsBin->rhs->kind == ND_INT) {
-      long long lhsRhsVal = static_cast<IntExpr *>(lhsBin->rhs)->value;
-      long long rhsVal = static_cast<IntExpr *>(rhs)->value;
-      long long result = 0;
-      // ex: 4 + x + 4 -> (4 + x) + 4 -> 8 + x
-      // ex: 4 - x + 4 -> (4 - x) + 4 -> 4 + 4
-      if (op == "+") result = lhsRhsVal + rhsVal;
-      if (op == "*") result = lhsRhsVal * rhsVal;
-      if (op == "-") result = lhsRhsVal - rhsVal;
-      BinaryExpr *temp = new BinaryExpr(expr->line, expr->pos, lhsBin->lhs, new IntExpr(expr->line, expr->pos, result, expr->file_id), lhsBin->op, expr->file_id);
-      temp->asmType = lhs->asmType;
-      return temp;
-    } 
-  }
   // We've made all the optimizations we can (for now)
 
   return expr;
-};
\ No newline at end of file
+};
+
+Node::Expr *CompileOptimizer::optimizeFloatBinary(BinaryExpr *expr, Node::Expr *lhs, Node::Expr *rhs) {
+  std::string op = expr->op;
+  bool lhsIsLiteral = lhs->kind == ND_FLOAT || lhs->kind == ND_INT;
+  bool rhsIsLiteral = rhs->kind == ND_FLOAT || rhs->kind == ND_INT;
+  if (!lhsIsLiteral || !rhsIsLiteral) {
+    // x * 1.0 and x / 1.0 are the only identities that are exact for every x (even -0.0 and NaN).
+    // x + 0.0 is NOT one of them: -0.0 + 0.0 = +0.0
+    if ((op == "*" || op == "/") && rhs->kind == ND_FLOAT && literalAs<double>(rhs) == 1.0
+        && isDoubleType(lhs->asmType) == isDoubleType(expr->asmType))
+      return lhs;
+    return expr;
+  }
+
+  // Mixed int/float math gets promoted, and a float mixed with a double gets promoted to the double
+  bool isDouble = isDoubleType(lhs->asmType) || isDoubleType(rhs->asmType);
+  if (boolOperations.contains(op)) {
+    if (op == "&&" || op == "||") return expr; // Not a thing for floats
+    double lhsVal = isDouble ? literalAs<double>(lhs) : literalAs<float>(lhs);
+    double rhsVal = isDouble ? literalAs<double>(rhs) : literalAs<float>(rhs);
+    bool result = false;
+    // Same as ucomiss/ucomisd: anything compared to NaN is unordered (false), except !=
+    if (op == "==") result = lhsVal == rhsVal;
+    if (op == "!=") result = lhsVal != rhsVal;
+    if (op == "<") result = lhsVal < rhsVal;
+    if (op == ">") result = lhsVal > rhsVal;
+    if (op == "<=") result = lhsVal <= rhsVal;
+    if (op == ">=") result = lhsVal >= rhsVal;
+    return new BoolExpr(expr->line, expr->pos, result, expr->file_id);
+  }
+  if (!floatOperations.contains(op)) return expr;
+
+  // Do the math at the precision the program asked for. A float op must round to a float
+  // right away (one rounding, like addss would), not be done in a double and rounded later.
+  double result = 0;
+  if (isDouble) {
+    double lhsVal = literalAs<double>(lhs), rhsVal = literalAs<double>(rhs);
+    if (op == "+") result = lhsVal + rhsVal;
+    if (op == "-") result = lhsVal - rhsVal;
+    if (op == "*") result = lhsVal * rhsVal;
+    if (op == "/") result = lhsVal / rhsVal;
+  } else {
+    float lhsVal = literalAs<float>(lhs), rhsVal = literalAs<float>(rhs);
+    float temp = 0;
+    if (op == "+") temp = lhsVal + rhsVal;
+    if (op == "-") temp = lhsVal - rhsVal;
+    if (op == "*") temp = lhsVal * rhsVal;
+    if (op == "/") temp = lhsVal / rhsVal;
+    result = temp;
+  }
+  // inf and NaN have no literal spelling the assembler will take, so those stay at runtime
+  if (!std::isfinite(result)) return expr;
+  return makeFloatLiteral(expr->line, expr->pos, expr->file_id, result, isDouble);
+}
@@ -1,6 +1,6 @@
 // Compiler-time optimizations
 // For example, in C, binary expressions on literals are automatically calculated
-// and an unsigned-int division of 2 is automatically converted to a right shift, along with the other powers.
+// and an unsigned-int division of 2 ends up as a right shift (that part happens in codegen, see strength.hpp).
 #include <set>
 
 #include "../../ast/expr.hpp"
@@ -15,15 +15,27 @@ public:
   static Node::Expr *optimizeBinary(BinaryExpr *expr);
   static Node::Expr *optimizeMember(MemberExpr *expr);
   static Node::Expr *optimizeCast(CastExpr *expr);
+  static Node::Expr *optimizeFloatBinary(BinaryExpr *expr, Node::Expr *lhs, Node::Expr *rhs);
+
+  static bool isFloatingType(Node::Type *type);
+  static bool isDoubleType(Node::Type *type);
+  static FloatExpr *makeFloatLiteral(int line, int pos, size_t file, double value, bool isDouble);
   
   static Node::Stmt *optimizeIfStmt(IfStmt *stmt);
   static Node::Stmt *optimizeStmt(Node::Stmt *stmt);
+
+  // Runs all of the above over every node of the program, in place (innermost first).
+  // Returns how many nodes got replaced, so the pass manager knows when to stop.
+  static size_t foldTree(Node::Stmt *program);
 };
 
 // Binary operations that can be optimized
 static inline std::set<std::string> intOperations = {
   {"+"}, {"-"}, {"*"}, {"/"}, {"%"}, {"&"}, {"|"}, {"^"}, {"<<"}, {">>"}
 };
+static inline std::set<std::string> floatOperations = {
+  {"+"}, {"-"}, {"*"}, {"/"}
+};
 static inline std::set<std::string> boolOperations = {
   {"&&"}, {"||"}, {"=="}, {"!="}, {"<"}, {">"}, {"<="}, {">="}
 };
\ No newline at end of file
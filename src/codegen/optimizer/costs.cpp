@@ -0,0 +1,42 @@
+#include "costs.hpp"
+#include "passes.hpp"
+
+// {bytes, cycles}, in the same order as Pattern. Bytes are for the 64 bit forms with a REX prefix and
+// small immediates/displacements, cycles are latencies off of the usual tables (Agner Fog's, mostly)
+static constexpr Cost table[] = {
+  {3, 0},  // Mov
+  {7, 1},  // MovImm
+  {3, 0},  // XorZero
+  {4, 4},  // Load
+  {4, 1},  // Store
+  {3, 1},  // Alu
+  {4, 1},  // AluImm
+  {4, 6},  // AluMemory
+  {3, 1},  // Inc
+  {4, 6},  // IncMemory
+  {4, 1},  // Shift
+  {4, 1},  // Lea
+  {5, 3},  // LeaSlow
+  {4, 3},  // Imul
+  {4, 1},  // CmpImm
+  {3, 1},  // Test
+  {3, 1},  // Setcc
+  {4, 1},  // Movzx
+  {4, 1},  // Cmov
+  {2, 4},  // Branch: one cycle, plus a quarter of a ~15 cycle misprediction
+  {2, 1},  // Jump
+};
+static_assert(sizeof(table) / sizeof(table[0]) == (size_t)Pattern::Jump + 1, "one cost for every pattern");
+
+Cost Costs::of(Pattern pattern) { return table[(size_t)pattern]; }
+
+Cost Costs::of(std::initializer_list<Pattern> patterns) {
+  Cost total;
+  for (Pattern pattern : patterns) total = total + of(pattern);
+  return total;
+}
+
+bool Costs::isCheaper(Cost a, Cost b) {
+  if (PassManager::level == OptLevel::Os) return a.bytes != b.bytes ? a.bytes < b.bytes : a.cycles < b.cycles;
+  return a.cycles != b.cycles ? a.cycles < b.cycles : a.bytes < b.bytes;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <initializer_list>
+
+// What an instruction costs us: how many bytes it takes up, and about how many cycles it adds to
+// the critical path on a recent x86-64 (register operands, everything in cache).
+// Instruction selection asks this instead of hardcoding "lea beats mov + add" all over both codegens.
+// -Os compares bytes first, everything else compares cycles first, and the other one breaks ties.
+struct Cost {
+  int bytes = 0;
+  int cycles = 0;
+
+  Cost operator+(const Cost &other) const { return {bytes + other.bytes, cycles + other.cycles}; }
+  Cost operator*(int times) const { return {bytes * times, cycles * times}; }
+};
+
+enum class Pattern {
+  Mov,       // movq %r, %r (register renaming makes these close to free)
+  MovImm,    // movq $imm32, %r
+  XorZero,   // xorl %r, %r. Also close to free, but it trashes the flags
+  Load,      // movq mem, %r
+  Store,     // movq %r, mem
+  Alu,       // addq %r, %r (and sub, and, or, xor)
+  AluImm,    // addq $imm, %r
+  AluMemory, // addq %r, mem: load, add and store in one
+  Inc,       // incq %r / decq %r
+  IncMemory, // incq mem
+  Shift,     // shlq $imm, %r
+  Lea,       // leaq d(%b), %r or (%b,%i,s), %r: one add's worth of work
+  LeaSlow,   // leaq d(%b,%i,s), %r: all three parts at once takes longer
+  Imul,      // imulq $imm, %r, %r
+  CmpImm,    // cmpq $imm, %r
+  Test,      // testq %r, %r
+  Setcc,     // setcc %r8
+  Movzx,     // movzbq %r8, %r
+  Cmov,      // cmovcc %r, %r
+  Branch,    // jcc, with its share of mispredictions (we have no idea which way it goes)
+  Jump,      // jmp
+};
+
+class Costs {
+public:
+  static Cost of(Pattern pattern);
+  static Cost of(std::initializer_list<Pattern> patterns);
+  // Is `a` better than `b` at the current -O level?
+  static bool isCheaper(Cost a, Cost b);
+};
@@ -0,0 +1,719 @@
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+
+#include "ctfe.hpp"
+#include "compiler.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+// Every parameter, local, loop variable and struct field name in the program, counted.
+// codegen never forgets a name once it's in the variable table, so an array we move to .rodata
+// needs a name nobody else will ever declare.
+static void countNames(Node::Stmt *stmt, std::unordered_map<std::string, int> &names) {
+  switch (stmt->kind) {
+    case ND_VAR_STMT: names[static_cast<VarStmt *>(stmt)->name]++; break;
+    case ND_FN_STMT:
+      for (auto &param : static_cast<FnStmt *>(stmt)->params) names[param.first->name]++;
+      break;
+    case ND_STRUCT_STMT:
+      for (auto &field : static_cast<StructStmt *>(stmt)->fields) names[field.first->name]++;
+      break;
+    case ND_FOR_STMT: {
+      ForStmt *s = static_cast<ForStmt *>(stmt);
+      if (s->forLoop->kind == ND_ASSIGN && static_cast<AssignmentExpr *>(s->forLoop)->assignee->kind == ND_IDENT)
+        names[static_cast<IdentExpr *>(static_cast<AssignmentExpr *>(s->forLoop)->assignee)->name]++;
+      break;
+    }
+    default:
+      break;
+  }
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { countNames(s, names); });
+}
+
+static std::unordered_map<std::string, int> nameCounts = {};
+
+size_t Ctfe::run(Node::Stmt *program) {
+  functions.clear();
+  structs.clear();
+  bodies.clear();
+  readonlyArrays.clear();
+  nameCounts.clear();
+  totalSteps = 0;
+  foldCount = 0;
+
+  collect(program, true);
+  countNames(program, nameCounts);
+  for (FnStmt *fn : bodies) {
+    std::unordered_map<std::string, int> names;
+    countNames(fn, names);
+    std::set<std::string> locals;
+    for (auto &pair : names) locals.insert(pair.first);
+    fold(fn->block, locals);
+    findReadonlyArrays(fn);
+  }
+  return foldCount + readonlyArrays.size();
+}
+
+Ctfe::ReadonlyArray *Ctfe::readonlyArray(VarStmt *stmt) {
+  auto it = readonlyArrays.find(stmt);
+  return it == readonlyArrays.end() ? nullptr : &it->second;
+}
+
+void Ctfe::collect(Node::Stmt *stmt, bool isTopLevel) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s, isTopLevel);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt, isTopLevel);
+      break;
+    case ND_CONST_STMT: {
+      ConstStmt *s = static_cast<ConstStmt *>(stmt);
+      if (s->value->kind == ND_STRUCT_STMT) {
+        StructStmt *st = static_cast<StructStmt *>(s->value);
+        if (!st->isTemplate) structs[s->name] = st;
+        collect(s->value, false);
+      } else if (s->value->kind == ND_FN_STMT) {
+        if (isTopLevel) functions[s->name] = static_cast<FnStmt *>(s->value);
+        collect(s->value, isTopLevel);
+      }
+      break;
+    }
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *s : static_cast<StructStmt *>(stmt)->stmts) collect(s, false);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      if (!fn->isTemplate && fn->block != nullptr) bodies.push_back(fn);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Folding calls in the program
+// ---------------------------------------------------------------------------
+
+void Ctfe::fold(Node::Stmt *stmt, const std::set<std::string> &locals) {
+  // `f(3);` on its own has no value to paste anywhere, only fold its arguments
+  if (stmt->kind == ND_EXPR_STMT && static_cast<ExprStmt *>(stmt)->expr->kind == ND_CALL) {
+    Walk::children(static_cast<ExprStmt *>(stmt)->expr, [&](Node::Expr *&e) { fold(e, locals); });
+    return;
+  }
+  Walk::children(stmt, [&](Node::Expr *&e) { fold(e, locals); },
+                 [&](Node::Stmt *&s) { fold(s, locals); });
+}
+
+void Ctfe::fold(Node::Expr *&expr, const std::set<std::string> &locals) {
+  // Innermost first, so f(g(2)) sees a literal by the time we get to f
+  Walk::children(expr, [&](Node::Expr *&e) { fold(e, locals); });
+  if (expr->kind != ND_CALL) return;
+  CallExpr *c = static_cast<CallExpr *>(expr);
+  if (c->callee->kind != ND_IDENT) return;
+  const std::string &name = static_cast<IdentExpr *>(c->callee)->name;
+  if (locals.contains(name) || !functions.contains(name)) return; // function pointer
+  Node::Expr *result = nullptr;
+  if (tryCall(c, result)) {
+    expr = result;
+    foldCount++;
+  }
+}
+
+bool Ctfe::tryCall(CallExpr *c, Node::Expr *&result) {
+  FnStmt *fn = functions[static_cast<IdentExpr *>(c->callee)->name];
+  if (fn->isTemplate || fn->isMain || fn->block == nullptr || fn->params.size() != c->args.size()) return false;
+  if (!isScalar(fn->returnType) || c->asmType == nullptr || !isScalar(c->asmType)) return false;
+  if (totalSteps >= totalBudget) return false;
+
+  steps = 0;
+  depth = 0;
+  try {
+    // No frame to look things up in- an argument that needs a variable is not a constant
+    Frame empty;
+    empty.scopes.emplace_back();
+    std::vector<Value> args;
+    for (Node::Expr *arg : c->args) args.push_back(eval(arg, empty));
+    Value value = convert(call(fn, args), c->asmType);
+    result = toLiteral(value, c);
+  } catch (Bail &) {
+    result = nullptr;
+  }
+  totalSteps += steps;
+  return result != nullptr;
+}
+
+Node::Expr *Ctfe::toLiteral(const Value &value, Node::Expr *at) {
+  CallExpr *c = static_cast<CallExpr *>(at);
+  Node::Type *type = at->asmType;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (value.kind == Value::Kind::Float) {
+    if (!std::isfinite(value.f)) return nullptr; // no literal spelling for those
+    return CompileOptimizer::makeFloatLiteral(c->line, c->pos, c->file_id, value.f, CompileOptimizer::isDoubleType(type));
+  }
+  if (value.kind == Value::Kind::Bool || name == "bool")
+    return new BoolExpr(c->line, c->pos, value.i != 0, c->file_id);
+  if (name == "char")
+    return new CharExpr(c->line, c->pos, (char)value.i, c->file_id);
+  // Anything wider than an imm32 can't be pushed or stored straight from an immediate
+  if (value.i < INT_MIN || value.i > INT_MAX) return nullptr;
+  IntExpr *literal = new IntExpr(c->line, c->pos, value.i, c->file_id);
+  literal->isUnsigned = value.i >= 0;
+  literal->asmType = type;
+  return literal;
+}
+
+// ---------------------------------------------------------------------------
+// Arrays that can live in .rodata
+// ---------------------------------------------------------------------------
+
+void Ctfe::findReadonlyArrays(FnStmt *fn) {
+  std::vector<VarStmt *> candidates;
+  std::function<void(Node::Stmt *)> find = [&](Node::Stmt *stmt) {
+    if (stmt->kind == ND_VAR_STMT) {
+      VarStmt *s = static_cast<VarStmt *>(stmt);
+      if (s->type != nullptr && s->type->kind == ND_ARRAY_TYPE && s->expr != nullptr && s->expr->kind == ND_ARRAY)
+        candidates.push_back(s);
+      return;
+    }
+    Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { find(s); });
+  };
+  find(fn->block);
+
+  for (VarStmt *s : candidates) {
+    ArrayType *at = static_cast<ArrayType *>(s->type);
+    ArrayExpr *init = static_cast<ArrayExpr *>(s->expr);
+    if (!isScalar(at->underlying) || at->constSize < 1 || (size_t)at->constSize > maxElements) continue;
+    if ((long long)init->elements.size() > at->constSize) continue;
+    int elementSize = codegen::typeSizes[static_cast<SymbolType *>(at->underlying)->name];
+    if (at->constSize * elementSize < readonlyMinBytes) continue;
+    if (nameCounts[s->name] != 1 || !onlyIndexed(fn->block, s->name)) continue;
+
+    ReadonlyArray array;
+    array.elementSize = elementSize;
+    array.isFloating = CompileOptimizer::isFloatingType(at->underlying);
+    bool ok = true;
+    try {
+      steps = 0;
+      Frame empty;
+      empty.scopes.emplace_back();
+      Value value = initial(init, at, empty);
+      for (Value &elem : value.elems) {
+        if (elem.kind == Value::Kind::Float) {
+          char buf[64];
+          std::to_chars_result res = elementSize == 8 ? std::to_chars(buf, buf + sizeof(buf), elem.f)
+                                                      : std::to_chars(buf, buf + sizeof(buf), (float)elem.f);
+          if (!std::isfinite(elem.f)) ok = false;
+          array.values.push_back(std::string(buf, res.ptr));
+        } else {
+          array.values.push_back(std::to_string(elem.i));
+        }
+      }
+    } catch (Bail &) {
+      ok = false;
+    }
+    if (!ok) continue;
+    array.label = "rodata_array" + std::to_string(readonlyArrays.size());
+    readonlyArrays[s] = array;
+  }
+}
+
+bool Ctfe::onlyIndexed(Node::Stmt *stmt, const std::string &name) {
+  bool ok = true;
+  Walk::children(stmt, [&](Node::Expr *&e) { ok = ok && onlyIndexed(e, name); },
+                 [&](Node::Stmt *&s) { ok = ok && onlyIndexed(s, name); });
+  return ok;
+}
+
+// True if `name` only ever shows up as `name[i]` being read
+bool Ctfe::onlyIndexed(Node::Expr *expr, const std::string &name) {
+  auto isElement = [&](Node::Expr *e) {
+    while (e->kind == ND_GROUP) e = static_cast<GroupExpr *>(e)->expr;
+    return e->kind == ND_INDEX && static_cast<IndexExpr *>(e)->lhs->kind == ND_IDENT &&
+           static_cast<IdentExpr *>(static_cast<IndexExpr *>(e)->lhs)->name == name;
+  };
+  switch (expr->kind) {
+    case ND_IDENT:
+      return static_cast<IdentExpr *>(expr)->name != name; // the array itself escaping somewhere
+    case ND_INDEX: {
+      IndexExpr *e = static_cast<IndexExpr *>(expr);
+      if (isElement(e)) return onlyIndexed(e->rhs, name);
+      break;
+    }
+    case ND_ASSIGN:
+      if (isElement(static_cast<AssignmentExpr *>(expr)->assignee)) return false;
+      break;
+    case ND_PREFIX:
+      if (isElement(static_cast<PrefixExpr *>(expr)->expr)) return false;
+      break;
+    case ND_POSTFIX:
+      if (isElement(static_cast<PostfixExpr *>(expr)->expr)) return false;
+      break;
+    case ND_ADDRESS:
+      if (isElement(static_cast<AddressExpr *>(expr)->right)) return false;
+      break;
+    default:
+      break;
+  }
+  bool ok = true;
+  if (!Walk::children(expr, [&](Node::Expr *&e) { ok = ok && onlyIndexed(e, name); })) return false;
+  return ok;
+}
+
+// ---------------------------------------------------------------------------
+// The interpreter
+// ---------------------------------------------------------------------------
+
+int Ctfe::intWidth(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return 0;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (name == "$") return 8; // a literal that never got told what it is
+  if (name != "int" && name != "short" && name != "char" && name != "long") return 0;
+  return codegen::typeSizes[name];
+}
+
+bool Ctfe::isSigned(Node::Type *type) {
+  return type != nullptr && type->kind == ND_SYMBOL_TYPE &&
+         static_cast<SymbolType *>(type)->signedness == SymbolType::Signedness::SIGNED;
+}
+
+bool Ctfe::isScalar(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return false;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  return intWidth(type) != 0 || name == "bool" || name == "float" || name == "double";
+}
+
+// Keep the bits the register of that width would keep, then extend back to 64 the way a load would
+static long long truncate(long long value, int width, bool isSigned) {
+  if (width <= 0 || width >= 8) return value; // 0: not a sized int (a bool, an untyped literal...)
+  int bits = width * 8;
+  unsigned long long mask = (1ULL << bits) - 1;
+  unsigned long long v = (unsigned long long)value & mask;
+  if (isSigned && (v >> (bits - 1)) & 1) v |= ~mask;
+  return (long long)v;
+}
+
+void Ctfe::step() {
+  if (++steps > stepBudget || totalSteps + steps > totalBudget) throw Bail{};
+}
+
+Ctfe::Value Ctfe::makeInt(long long value, Node::Type *type) {
+  Value v;
+  v.kind = Value::Kind::Int;
+  v.i = truncate(value, intWidth(type), isSigned(type));
+  v.type = type;
+  return v;
+}
+
+Ctfe::Value Ctfe::makeFloat(double value, Node::Type *type) {
+  Value v;
+  v.kind = Value::Kind::Float;
+  v.f = CompileOptimizer::isDoubleType(type) ? value : (double)(float)value;
+  v.type = type;
+  return v;
+}
+
+Ctfe::Value Ctfe::makeBool(bool value) {
+  Value v;
+  v.kind = Value::Kind::Bool;
+  v.i = value;
+  return v;
+}
+
+bool Ctfe::truthy(const Value &value) {
+  switch (value.kind) {
+    case Value::Kind::Int:
+    case Value::Kind::Bool: return value.i != 0;
+    case Value::Kind::Float: return value.f != 0;
+    default: throw Bail{};
+  }
+}
+
+void Ctfe::declare(Frame &frame, const std::string &name, Value value) {
+  frame.scopes.back()[name] = std::move(value);
+}
+
+Ctfe::Value Ctfe::zero(Node::Type *type) {
+  if (type == nullptr) throw Bail{};
+  if (type->kind == ND_ARRAY_TYPE) {
+    ArrayType *at = static_cast<ArrayType *>(type);
+    if (at->constSize < 1 || (size_t)at->constSize > maxElements) throw Bail{};
+    Value v;
+    v.kind = Value::Kind::Array;
+    v.type = type;
+    v.elems.assign(at->constSize, zero(at->underlying));
+    return v;
+  }
+  if (type->kind != ND_SYMBOL_TYPE) throw Bail{}; // pointers, function types...
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (structs.contains(name)) {
+    Value v;
+    v.kind = Value::Kind::Struct;
+    v.type = type;
+    for (auto &field : structs[name]->fields) v.fields[field.first->name] = zero(field.second);
+    return v;
+  }
+  if (name == "bool") return makeBool(false);
+  if (CompileOptimizer::isFloatingType(type)) return makeFloat(0, type);
+  if (intWidth(type) != 0) return makeInt(0, type);
+  throw Bail{}; // str, enums, templates
+}
+
+// What storing `value` into something of `type` leaves behind
+Ctfe::Value Ctfe::convert(const Value &value, Node::Type *type) {
+  if (type == nullptr) throw Bail{};
+  if (type->kind == ND_ARRAY_TYPE) {
+    if (value.kind != Value::Kind::Array) throw Bail{};
+    return value;
+  }
+  if (type->kind != ND_SYMBOL_TYPE) throw Bail{};
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (structs.contains(name)) {
+    if (value.kind != Value::Kind::Struct) throw Bail{};
+    return value;
+  }
+  if (CompileOptimizer::isFloatingType(type)) {
+    // The type checker lets some int <-> float mixes through, and codegen doesn't convert those
+    if (value.kind != Value::Kind::Float) throw Bail{};
+    return makeFloat(value.f, type);
+  }
+  if (value.kind != Value::Kind::Int && value.kind != Value::Kind::Bool) throw Bail{};
+  if (name == "bool") return makeBool(value.i & 0xff); // only the low byte gets stored
+  if (intWidth(type) == 0) throw Bail{};
+  return makeInt(value.i, type);
+}
+
+// A declaration's initializer. Array and struct literals only know what they are from the declaration.
+Ctfe::Value Ctfe::initial(Node::Expr *expr, Node::Type *type, Frame &frame) {
+  if (expr->kind == ND_ARRAY_AUTO_FILL) return zero(type);
+  if (expr->kind == ND_ARRAY && type != nullptr && type->kind == ND_ARRAY_TYPE) {
+    ArrayType *at = static_cast<ArrayType *>(type);
+    ArrayExpr *e = static_cast<ArrayExpr *>(expr);
+    Value v = zero(type); // anything not spelled out is 0
+    if ((long long)e->elements.size() > at->constSize) throw Bail{};
+    for (size_t i = 0; i < e->elements.size(); i++) v.elems[i] = initial(e->elements[i], at->underlying, frame);
+    return v;
+  }
+  if (expr->kind == ND_STRUCT && type != nullptr && type->kind == ND_SYMBOL_TYPE &&
+      structs.contains(static_cast<SymbolType *>(type)->name)) {
+    StructStmt *st = structs[static_cast<SymbolType *>(type)->name];
+    Value v = zero(type);
+    for (auto &pair : static_cast<StructExpr *>(expr)->values) {
+      auto field = std::find_if(st->fields.begin(), st->fields.end(),
+                                [&](auto &f) { return f.first->name == pair.first->name; });
+      if (field == st->fields.end()) throw Bail{};
+      v.fields[field->first->name] = initial(pair.second, field->second, frame);
+    }
+    return v;
+  }
+  return convert(eval(expr, frame), type);
+}
+
+Ctfe::Value Ctfe::call(FnStmt *fn, std::vector<Value> &args) {
+  if (++depth > maxDepth) throw Bail{};
+  if (fn->isTemplate || fn->block == nullptr || fn->params.size() != args.size()) throw Bail{};
+  for (auto &param : fn->params)
+    if (!isScalar(param.second)) throw Bail{}; // arrays and structs are passed by pointer
+
+  Frame frame;
+  frame.scopes.emplace_back();
+  for (size_t i = 0; i < args.size(); i++)
+    declare(frame, fn->params[i].first->name, convert(args[i], fn->params[i].second));
+
+  Flow flow = exec(fn->block, frame);
+  depth--;
+  if (codegen::getUnderlying(fn->returnType) == "void") return makeBool(false); // nobody looks at it
+  if (flow != Flow::Return) throw Bail{}; // fell off the end, whatever was in %rax is the answer
+  return convert(frame.ret, fn->returnType);
+}
+
+Ctfe::Flow Ctfe::exec(Node::Stmt *stmt, Frame &frame) {
+  step();
+  switch (stmt->kind) {
+    case ND_BLOCK_STMT: {
+      frame.scopes.emplace_back();
+      Flow flow = Flow::Normal;
+      for (Node::Stmt *s : static_cast<BlockStmt *>(stmt)->stmts) {
+        flow = exec(s, frame);
+        if (flow != Flow::Normal) break;
+      }
+      frame.scopes.pop_back();
+      return flow;
+    }
+    case ND_VAR_STMT: {
+      VarStmt *s = static_cast<VarStmt *>(stmt);
+      declare(frame, s->name, s->expr != nullptr ? initial(s->expr, s->type, frame) : zero(s->type));
+      return Flow::Normal;
+    }
+    case ND_EXPR_STMT:
+      eval(static_cast<ExprStmt *>(stmt)->expr, frame);
+      return Flow::Normal;
+    case ND_RETURN_STMT: {
+      ReturnStmt *s = static_cast<ReturnStmt *>(stmt);
+      if (s->expr != nullptr) frame.ret = eval(s->expr, frame);
+      return Flow::Return;
+    }
+    case ND_IF_STMT: {
+      IfStmt *s = static_cast<IfStmt *>(stmt);
+      if (truthy(eval(s->condition, frame))) return exec(s->thenStmt, frame);
+      if (s->elseStmt != nullptr) return exec(s->elseStmt, frame);
+      return Flow::Normal;
+    }
+    case ND_WHILE_STMT: {
+      WhileStmt *s = static_cast<WhileStmt *>(stmt);
+      while (truthy(eval(s->condition, frame))) {
+        Flow flow = exec(s->block, frame);
+        if (flow == Flow::Break) break;
+        if (flow == Flow::Return) return flow;
+        if (s->optional != nullptr) eval(s->optional, frame);
+      }
+      return Flow::Normal;
+    }
+    case ND_FOR_STMT: {
+      ForStmt *s = static_cast<ForStmt *>(stmt);
+      if (s->forLoop->kind != ND_ASSIGN) throw Bail{};
+      AssignmentExpr *init = static_cast<AssignmentExpr *>(s->forLoop);
+      if (init->assignee->kind != ND_IDENT || init->op != "=") throw Bail{};
+      IdentExpr *var = static_cast<IdentExpr *>(init->assignee);
+      frame.scopes.emplace_back();
+      declare(frame, var->name, convert(eval(init->rhs, frame), var->asmType));
+      Flow result = Flow::Normal;
+      while (truthy(eval(s->condition, frame))) {
+        Flow flow = exec(s->block, frame);
+        if (flow == Flow::Break) break;
+        if (flow == Flow::Return) {
+          result = flow;
+          break;
+        }
+        if (s->optional != nullptr) eval(s->optional, frame);
+      }
+      frame.scopes.pop_back();
+      return result;
+    }
+    case ND_BREAK_STMT: return Flow::Break;
+    case ND_CONTINUE_STMT: return Flow::Continue;
+    default:
+      throw Bail{}; // output, input, match, nested functions...
+  }
+}
+
+Ctfe::Value *Ctfe::lvalue(Node::Expr *expr, Frame &frame) {
+  switch (expr->kind) {
+    case ND_GROUP: return lvalue(static_cast<GroupExpr *>(expr)->expr, frame);
+    case ND_IDENT: {
+      const std::string &name = static_cast<IdentExpr *>(expr)->name;
+      for (auto scope = frame.scopes.rbegin(); scope != frame.scopes.rend(); scope++) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return &it->second;
+      }
+      throw Bail{}; // a global or a function- not ours to read
+    }
+    case ND_INDEX: {
+      IndexExpr *e = static_cast<IndexExpr *>(expr);
+      Value index = eval(e->rhs, frame);
+      Value *array = lvalue(e->lhs, frame);
+      if (array->kind != Value::Kind::Array || index.kind != Value::Kind::Int) throw Bail{};
+      if (index.i < 0 || index.i >= (long long)array->elems.size()) throw Bail{}; // that's a bug, let it happen at runtime
+      return &array->elems[index.i];
+    }
+    case ND_MEMBER: {
+      MemberExpr *e = static_cast<MemberExpr *>(expr);
+      if (e->rhs->kind != ND_IDENT) throw Bail{};
+      Value *object = lvalue(e->lhs, frame);
+      if (object->kind != Value::Kind::Struct) throw Bail{};
+      auto it = object->fields.find(static_cast<IdentExpr *>(e->rhs)->name);
+      if (it == object->fields.end()) throw Bail{};
+      return &it->second;
+    }
+    default:
+      throw Bail{};
+  }
+}
+
+Ctfe::Value Ctfe::eval(Node::Expr *expr, Frame &frame) {
+  step();
+  switch (expr->kind) {
+    case ND_INT: return makeInt(static_cast<IntExpr *>(expr)->value, expr->asmType);
+    case ND_FLOAT: {
+      FloatExpr *e = static_cast<FloatExpr *>(expr);
+      bool isDouble = CompileOptimizer::isDoubleType(e->asmType);
+      double value = isDouble ? std::strtod(e->value.c_str(), nullptr) : (double)std::strtof(e->value.c_str(), nullptr);
+      return makeFloat(value, e->asmType);
+    }
+    case ND_BOOL: return makeBool(static_cast<BoolExpr *>(expr)->value);
+    case ND_CHAR: return makeInt(static_cast<CharExpr *>(expr)->value, expr->asmType);
+    case ND_GROUP: return eval(static_cast<GroupExpr *>(expr)->expr, frame);
+    case ND_IDENT:
+    case ND_INDEX:
+    case ND_MEMBER:
+      return *lvalue(expr, frame);
+    case ND_ARRAY:
+    case ND_STRUCT:
+    case ND_ARRAY_AUTO_FILL:
+      return initial(expr, expr->asmType, frame);
+    case ND_UNARY: {
+      UnaryExpr *e = static_cast<UnaryExpr *>(expr);
+      Value v = eval(e->expr, frame);
+      if (e->op == "!") return makeBool(!truthy(v));
+      if (v.kind == Value::Kind::Float && e->op == "-") return makeFloat(-v.f, v.type);
+      if (v.kind != Value::Kind::Int) throw Bail{};
+      if (e->op == "-") return makeInt((long long)(0ULL - (unsigned long long)v.i), expr->asmType);
+      if (e->op == "~") return makeInt(~v.i, expr->asmType);
+      throw Bail{};
+    }
+    case ND_PREFIX:
+    case ND_POSTFIX: {
+      bool isPrefix = expr->kind == ND_PREFIX;
+      Node::Expr *target = isPrefix ? static_cast<PrefixExpr *>(expr)->expr : static_cast<PostfixExpr *>(expr)->expr;
+      const std::string &op = isPrefix ? static_cast<PrefixExpr *>(expr)->op : static_cast<PostfixExpr *>(expr)->op;
+      if (op != "++" && op != "--") throw Bail{};
+      Value *slot = lvalue(target, frame);
+      if (slot->kind != Value::Kind::Int) throw Bail{};
+      Value old = *slot;
+      long long delta = op == "++" ? 1 : -1;
+      *slot = makeInt((long long)((unsigned long long)old.i + delta), slot->type);
+      return isPrefix ? *slot : old;
+    }
+    case ND_CAST: {
+      CastExpr *e = static_cast<CastExpr *>(expr);
+      Value v = eval(e->castee, frame);
+      Node::Type *to = e->castee_type;
+      if (CompileOptimizer::isFloatingType(to)) {
+        if (v.kind == Value::Kind::Float) return makeFloat(v.f, to);
+        if (v.kind != Value::Kind::Int) throw Bail{};
+        // cvtsi2ss/cvtsi2sd: signed 64-bit in, one rounding out
+        return CompileOptimizer::isDoubleType(to) ? makeFloat((double)v.i, to) : makeFloat((float)v.i, to);
+      }
+      if (intWidth(to) == 0) throw Bail{};
+      if (v.kind == Value::Kind::Float) {
+        // cvtss2si/cvtsd2si round to nearest even, same as llrint
+        if (!std::isfinite(v.f) || v.f >= 9223372036854775808.0 || v.f < -9223372036854775808.0) throw Bail{};
+        return makeInt(std::llrint(v.f), to);
+      }
+      if (v.kind != Value::Kind::Int && v.kind != Value::Kind::Bool) throw Bail{};
+      return makeInt(v.i, to);
+    }
+    case ND_TERNARY: {
+      TernaryExpr *e = static_cast<TernaryExpr *>(expr);
+      return truthy(eval(e->condition, frame)) ? eval(e->lhs, frame) : eval(e->rhs, frame);
+    }
+    case ND_ASSIGN: {
+      AssignmentExpr *e = static_cast<AssignmentExpr *>(expr);
+      // codegen ignores the operator of `+=` and friends, and we would rather not fold that into a constant
+      if (e->op != "=") throw Bail{};
+      Value v = eval(e->rhs, frame);
+      // Nothing in an expression can declare a variable, so this pointer stays good until we store
+      Value *slot = lvalue(e->assignee, frame);
+      if (slot->kind == Value::Kind::Bool) {
+        if (v.kind != Value::Kind::Int && v.kind != Value::Kind::Bool) throw Bail{};
+        *slot = makeBool(v.i & 0xff);
+      } else {
+        *slot = convert(v, slot->type);
+      }
+      return *slot;
+    }
+    case ND_BINARY: return binary(static_cast<BinaryExpr *>(expr), frame);
+    case ND_CALL: {
+      CallExpr *e = static_cast<CallExpr *>(expr);
+      if (e->callee->kind != ND_IDENT) throw Bail{};
+      const std::string &name = static_cast<IdentExpr *>(e->callee)->name;
+      for (auto &scope : frame.scopes)
+        if (scope.contains(name)) throw Bail{}; // calling through a variable
+      if (!functions.contains(name)) throw Bail{};
+      std::vector<Value> args;
+      for (Node::Expr *arg : e->args) args.push_back(eval(arg, frame));
+      return call(functions[name], args);
+    }
+    default:
+      throw Bail{}; // strings, pointers, memory, sockets, syscalls...
+  }
+}
+
+Ctfe::Value Ctfe::binary(BinaryExpr *expr, Frame &frame) {
+  const std::string &op = expr->op;
+  if (op == "&&") return makeBool(truthy(eval(expr->lhs, frame)) && truthy(eval(expr->rhs, frame)));
+  if (op == "||") return makeBool(truthy(eval(expr->lhs, frame)) || truthy(eval(expr->rhs, frame)));
+
+  Value l = eval(expr->lhs, frame);
+  Value r = eval(expr->rhs, frame);
+  bool isFloating = l.kind == Value::Kind::Float || r.kind == Value::Kind::Float;
+  auto asDouble = [](const Value &v) {
+    if (v.kind == Value::Kind::Float) return v.f;
+    if (v.kind == Value::Kind::Int) return (double)v.i;
+    throw Bail{};
+  };
+  auto isNumber = [](const Value &v) {
+    return v.kind == Value::Kind::Int || v.kind == Value::Kind::Bool || v.kind == Value::Kind::Float;
+  };
+  if (!isNumber(l) || !isNumber(r)) throw Bail{};
+
+  if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") {
+    int cmp = 0;
+    if (isFloating) {
+      double a = asDouble(l), b = asDouble(r);
+      if (std::isnan(a) || std::isnan(b)) throw Bail{}; // every flag at once, let the cpu sort it out
+      cmp = a < b ? -1 : a > b ? 1 : 0;
+    } else {
+      // Compared at the wider of the two widths, and always as signed (setl/setg)
+      int lw = l.kind == Value::Kind::Bool ? 1 : intWidth(l.type) ? intWidth(l.type) : 8;
+      int rw = r.kind == Value::Kind::Bool ? 1 : intWidth(r.type) ? intWidth(r.type) : 8;
+      int width = std::max(lw, rw);
+      long long a = truncate(l.i, width, true), b = truncate(r.i, width, true);
+      cmp = a < b ? -1 : a > b ? 1 : 0;
+    }
+    if (op == "==") return makeBool(cmp == 0);
+    if (op == "!=") return makeBool(cmp != 0);
+    if (op == "<") return makeBool(cmp < 0);
+    if (op == ">") return makeBool(cmp > 0);
+    if (op == "<=") return makeBool(cmp <= 0);
+    return makeBool(cmp >= 0);
+  }
+
+  Node::Type *type = expr->asmType;
+  if (CompileOptimizer::isFloatingType(type)) {
+    bool isDouble = CompileOptimizer::isDoubleType(type);
+    // An int operand gets converted straight to the result's precision
+    auto operand = [&](const Value &v) { return v.kind == Value::Kind::Int && !isDouble ? (double)(float)v.i : asDouble(v); };
+    double a = operand(l), b = operand(r);
+    if (op == "+") return makeFloat(a + b, type);
+    if (op == "-") return makeFloat(a - b, type);
+    if (op == "*") return makeFloat(a * b, type);
+    if (op == "/") return makeFloat(a / b, type);
+    throw Bail{};
+  }
+
+  int width = intWidth(type);
+  if (width == 0 || isFloating) throw Bail{};
+  unsigned long long a = l.i, b = r.i;
+  if (op == "+") return makeInt((long long)(a + b), type);
+  if (op == "-") return makeInt((long long)(a - b), type);
+  if (op == "*") return makeInt((long long)(a * b), type);
+  if (op == "&") return makeInt((long long)(a & b), type);
+  if (op == "|") return makeInt((long long)(a | b), type);
+  if (op == "^") return makeInt((long long)(a ^ b), type);
+  if (op == "<<" || op == ">>") {
+    // The cpu masks the count to 6 bits for 64-bit operands, 5 bits for everything smaller
+    unsigned count = (unsigned)(b & (width == 8 ? 63 : 31));
+    if (op == "<<") return makeInt((long long)(a << count), type);
+    // codegen always emits shr, so this is a logical shift no matter the signedness
+    unsigned long long v = (unsigned long long)truncate(l.i, width, false);
+    return makeInt((long long)(v >> count), type);
+  }
+  if (op == "/" || op == "%") {
+    bool isSignedOp = isSigned(expr->lhs->asmType) || isSigned(expr->rhs->asmType);
+    if (isSignedOp) {
+      long long x = truncate(l.i, width, true), y = truncate(r.i, width, true);
+      if (y == 0 || (x == LLONG_MIN && y == -1)) throw Bail{}; // #DE
+      long long q = x / y;
+      if (truncate(q, width, true) != q) throw Bail{}; // doesn't fit the narrower idiv either
+      return makeInt(op == "/" ? q : x % y, type);
+    }
+    unsigned long long x = truncate(l.i, width, false), y = truncate(r.i, width, false);
+    if (y == 0) throw Bail{};
+    return makeInt((long long)(op == "/" ? x / y : x % y), type);
+  }
+  throw Bail{};
+}
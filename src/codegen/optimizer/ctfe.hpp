@@ -0,0 +1,99 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+#include "../../ast/types.hpp"
+
+// Compile-time function evaluation.
+// `have table: int = crc(0x04c11db7, 8);` or `fib(30)` don't need to run every time the program starts-
+// if every argument is a constant, we just run the function ourselves and paste the answer in.
+//
+// This is a tiny tree-walking interpreter over the typed AST. It knows int/float/bool/char math, locals,
+// if/while/for/break/continue, and local arrays and structs. Anything it does not know (pointers, strings,
+// globals, I/O, memory, match, methods...) makes it give up on that call, which then compiles like normal.
+// Every evaluation runs under a step budget, so `while true {}` just means "not constant".
+//
+// It also finds big local arrays that are initialized with constants and only ever read,
+// and moves them into .rodata instead of building them on the stack one element at a time.
+// Run this BEFORE the inliner, a folded call is even smaller than an inlined one!
+class Ctfe {
+public:
+  struct ReadonlyArray {
+    std::string label;
+    std::vector<std::string> values; // already formatted for the data directive
+    int elementSize = 8;
+    bool isFloating = false;
+  };
+
+  // Returns how many calls got folded plus how many arrays moved to .rodata
+  static size_t run(Node::Stmt *program);
+  // nullptr if this declaration still lives on the stack
+  static ReadonlyArray *readonlyArray(VarStmt *stmt);
+
+private:
+  struct Value {
+    enum class Kind { Int, Float, Bool, Array, Struct } kind = Kind::Int;
+    long long i = 0;
+    double f = 0;
+    std::vector<Value> elems;
+    std::map<std::string, Value> fields;
+    Node::Type *type = nullptr;
+  };
+  enum class Flow { Normal, Break, Continue, Return };
+  struct Frame {
+    std::deque<std::unordered_map<std::string, Value>> scopes;
+    Value ret;
+  };
+  struct Bail {}; // thrown whenever we hit something we can't (or shouldn't) evaluate
+
+  static void collect(Node::Stmt *stmt, bool isTopLevel);
+  static void fold(Node::Stmt *stmt, const std::set<std::string> &locals);
+  static void fold(Node::Expr *&expr, const std::set<std::string> &locals);
+  static bool tryCall(CallExpr *call, Node::Expr *&result);
+  static Node::Expr *toLiteral(const Value &value, Node::Expr *at);
+  static void findReadonlyArrays(FnStmt *fn);
+  static bool onlyIndexed(Node::Stmt *stmt, const std::string &name);
+  static bool onlyIndexed(Node::Expr *expr, const std::string &name);
+
+  // The interpreter
+  static Value call(FnStmt *fn, std::vector<Value> &args);
+  static Flow exec(Node::Stmt *stmt, Frame &frame);
+  static Value eval(Node::Expr *expr, Frame &frame);
+  static Value binary(BinaryExpr *expr, Frame &frame);
+  static Value *lvalue(Node::Expr *expr, Frame &frame);
+  static Value initial(Node::Expr *expr, Node::Type *type, Frame &frame);
+  static Value zero(Node::Type *type);
+  static Value convert(const Value &value, Node::Type *type);
+  static Value makeInt(long long value, Node::Type *type);
+  static Value makeFloat(double value, Node::Type *type);
+  static Value makeBool(bool value);
+  static bool truthy(const Value &value);
+  static void declare(Frame &frame, const std::string &name, Value value);
+  static void step();
+
+  static int intWidth(Node::Type *type); // 0 if this isn't an integer type we can do math on
+  static bool isSigned(Node::Type *type);
+  static bool isScalar(Node::Type *type);
+
+  static inline std::unordered_map<std::string, FnStmt *> functions = {};
+  static inline std::unordered_map<std::string, StructStmt *> structs = {};
+  static inline std::vector<FnStmt *> bodies = {};
+  static inline std::unordered_map<VarStmt *, ReadonlyArray> readonlyArrays = {};
+  static inline size_t steps = 0;      // in the current evaluation
+  static inline size_t totalSteps = 0; // in the whole compile
+  static inline size_t depth = 0;
+  static inline size_t foldCount = 0;
+
+  static constexpr size_t stepBudget = 100000;    // per folded call
+  static constexpr size_t totalBudget = 1000000;  // for the whole program, so compile times stay sane
+  static constexpr size_t maxDepth = 64;          // nested calls
+  static constexpr size_t maxElements = 1 << 16;  // biggest array we are willing to simulate
+  static constexpr long long readonlyMinBytes = 64;
+};
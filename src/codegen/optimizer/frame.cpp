@@ -0,0 +1,180 @@
+#include "frame.hpp"
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+// Every operand an instruction has, to check and rewrite them all in one place
+template <typename F> static void forEachOperand(Instr &instr, F f) {
+  std::visit([&](auto &i) {
+    using T = std::decay_t<decltype(i)>;
+    if constexpr (std::is_same_v<T, MovInstr> || std::is_same_v<T, LeaInstr>) { f(i.dest); f(i.src); }
+    else if constexpr (std::is_same_v<T, PushInstr>) f(i.what);
+    else if constexpr (std::is_same_v<T, PopInstr>) f(i.where);
+    else if constexpr (std::is_same_v<T, XorInstr> || std::is_same_v<T, AddInstr> || std::is_same_v<T, SubInstr> ||
+                       std::is_same_v<T, CmpInstr>) { f(i.lhs); f(i.rhs); }
+    else if constexpr (std::is_same_v<T, BinaryInstr>) { f(i.src); f(i.dst); }
+    else if constexpr (std::is_same_v<T, MulInstr> || std::is_same_v<T, DivInstr>) f(i.from);
+    else if constexpr (std::is_same_v<T, NegInstr> || std::is_same_v<T, NotInstr>) f(i.what);
+    else if constexpr (std::is_same_v<T, ConvertInstr>) { f(i.from); f(i.to); }
+  }, instr.var);
+}
+
+// The directive's text without the indentation, or "" if it isn't one
+static std::string directive(const Instr &instr) {
+  const LinkerDirective *linker = std::get_if<LinkerDirective>(&instr.var);
+  if (linker == nullptr) return "";
+  size_t start = linker->value.find_first_not_of(" \t\n");
+  return start == std::string::npos ? "" : linker->value.substr(start);
+}
+
+// Comments, .loc and endbr64 can sit anywhere in the prologue
+static bool isFiller(const Instr &instr) {
+  if (instr.type == InstrType::Comment) return true;
+  if (instr.type != InstrType::Linker) return false;
+  std::string text = directive(instr);
+  return text.empty() || text.starts_with(".loc") || text.starts_with("endbr64");
+}
+
+static bool isRegister(const Operand &operand, Reg reg) { return operand.isRegister() && operand.reg == reg; }
+
+static bool isLeave(const Instr &instr) {
+  const BinaryInstr *binary = std::get_if<BinaryInstr>(&instr.var);
+  return binary != nullptr && binary->op == "leave";
+}
+
+size_t FrameOmission::run(std::vector<Instr> &code) {
+  if (!isEnabled) return 0;
+  size_t changes = 0;
+  std::vector<bool> removed(code.size(), false);
+  for (size_t start = 0; start < code.size(); start++) {
+    if (!directive(code[start]).starts_with(".cfi_startproc")) continue;
+    size_t end = start + 1;
+    while (end < code.size() && !directive(code[end]).starts_with(".cfi_endproc")) end++;
+
+    Prologue prologue;
+    if (findPrologue(code, start, end, prologue) && isLeaf(code, prologue, end)) {
+      rewrite(code, prologue, end, removed);
+      changes++;
+    }
+    start = end;
+  }
+  if (changes == 0) return 0;
+
+  std::vector<Instr> output;
+  output.reserve(code.size());
+  for (size_t i = 0; i < code.size(); i++)
+    if (!removed[i]) output.push_back(std::move(code[i]));
+  code = std::move(output);
+  return changes;
+}
+
+// push %rbp, its CFI, mov %rsp, %rbp, its CFI, then maybe a sub from %rsp. Both codegen and the IR backend
+// put them out in that order (one with a SubInstr, the other with a `subq`)
+bool FrameOmission::findPrologue(const std::vector<Instr> &code, size_t start, size_t end, Prologue &prologue) {
+  size_t i = start + 1;
+  auto next = [&]() {
+    while (i < end && isFiller(code[i])) i++;
+    return i < end ? i++ : end;
+  };
+
+  prologue.push = next();
+  if (prologue.push == end) return false;
+  const PushInstr *push = std::get_if<PushInstr>(&code[prologue.push].var);
+  if (push == nullptr || !isRegister(push->what, Reg::Rbp)) return false;
+
+  prologue.pushCfi = next();
+  if (prologue.pushCfi == end || !directive(code[prologue.pushCfi]).starts_with(".cfi_def_cfa_offset")) return false;
+
+  prologue.mov = next();
+  if (prologue.mov == end) return false;
+  const MovInstr *mov = std::get_if<MovInstr>(&code[prologue.mov].var);
+  if (mov == nullptr || !isRegister(mov->dest, Reg::Rbp) || !isRegister(mov->src, Reg::Rsp)) return false;
+
+  prologue.movCfi = next();
+  if (prologue.movCfi == end || !directive(code[prologue.movCfi]).starts_with(".cfi_def_cfa_register")) return false;
+
+  size_t sub = next();
+  if (sub == end) return true;
+  if (const SubInstr *s = std::get_if<SubInstr>(&code[sub].var); s != nullptr && isRegister(s->lhs, Reg::Rsp)) {
+    if (!s->rhs.isImmediate() || s->rhs.symbol != -1) return false;
+    prologue.sub = (long long)sub;
+    prologue.frameSize = s->rhs.value;
+  } else if (const BinaryInstr *b = std::get_if<BinaryInstr>(&code[sub].var);
+             b != nullptr && b->op == "subq" && isRegister(b->dst, Reg::Rsp)) {
+    if (!b->src.isImmediate() || b->src.symbol != -1) return false;
+    prologue.sub = (long long)sub;
+    prologue.frameSize = b->src.value;
+  }
+  return true;
+}
+
+// Nothing after the prologue moves %rsp, calls anything, or uses %rbp as anything but the base of a frame slot
+bool FrameOmission::isLeaf(std::vector<Instr> &code, const Prologue &prologue, size_t end) {
+  size_t bodyStart = (size_t)std::max<long long>((long long)prologue.movCfi, prologue.sub) + 1;
+  for (size_t i = bodyStart; i < end; i++) {
+    Instr &instr = code[i];
+    switch (instr.type) {
+      case InstrType::Call:
+      case InstrType::Push:
+      case InstrType::Pop:
+        return false;
+      case InstrType::Linker: {
+        // Raw assembly we can't pick apart. Leave the function alone if it could be touching the frame
+        std::string text = directive(instr);
+        if (text.starts_with(".cfi") || isFiller(instr)) break;
+        if (text.find("%rsp") != std::string::npos || text.find("%rbp") != std::string::npos) return false;
+        for (const char *op : {"call", "push", "pop", "leave", "enter", "ret"})
+          if (text.starts_with(op)) return false;
+        break;
+      }
+      default:
+        break;
+    }
+    bool isFrameSafe = true;
+    forEachOperand(instr, [&](const Operand &operand) {
+      if (operand.reg == Reg::Rsp || operand.index == Reg::Rsp || operand.index == Reg::Rbp) isFrameSafe = false;
+      if (operand.reg == Reg::Rbp && !operand.isMemory()) isFrameSafe = false;
+    });
+    if (!isFrameSafe) return false;
+  }
+  return true;
+}
+
+void FrameOmission::rewrite(std::vector<Instr> &code, const Prologue &prologue, size_t end, std::vector<bool> &removed) {
+  removed[prologue.push] = removed[prologue.pushCfi] = true;
+  // Without the push, the return address is right at %rsp, which is 8 above where %rbp would have been
+  bool fitsRedZone = prologue.frameSize + 8 <= redZone;
+  int64_t shift = fitsRedZone ? -8 : prologue.frameSize - 8;
+  if (fitsRedZone) {
+    // The CFA stays at 8(%rsp) from start to finish, which is what .cfi_startproc already says
+    removed[prologue.mov] = removed[prologue.movCfi] = true;
+    if (prologue.sub != -1) removed[(size_t)prologue.sub] = true;
+  } else {
+    // Reserve the frame where the mov to %rbp was, and tell the unwinder how far down that put us
+    code[prologue.mov] = code[(size_t)prologue.sub];
+    code[prologue.movCfi] =
+        Instr{.var = LinkerDirective{.value = ".cfi_def_cfa_offset " + std::to_string(prologue.frameSize + 8) + "\n\t"},
+              .type = InstrType::Linker};
+    removed[(size_t)prologue.sub] = true;
+  }
+
+  for (size_t i = prologue.movCfi + 1; i < end; i++) {
+    if (removed[i]) continue;
+    if (isLeave(code[i])) {
+      // The CFI right after it already puts the CFA back at 8(%rsp)
+      if (fitsRedZone) removed[i] = true;
+      else
+        code[i] = Instr{.var = AddInstr{.lhs = "%rsp",
+                                        .rhs = "$" + std::to_string(prologue.frameSize),
+                                        .size = DataSize::Qword},
+                        .type = InstrType::Add};
+      continue;
+    }
+    forEachOperand(code[i], [&](Operand &operand) {
+      if (!operand.isMemory() || operand.reg != Reg::Rbp) return;
+      operand.reg = Reg::Rsp;
+      operand.value += shift;
+    });
+  }
+}
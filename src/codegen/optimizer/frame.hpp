@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "instr.hpp"
+
+// Frame pointer omission for leaf functions.
+// A function that never calls anything (and never pushes or pops once its prologue is done) doesn't need
+// %rbp: %rsp stays put the whole time, so every `-N(%rbp)` can just as well be `-(N+8)(%rsp)`.
+//  - If all of its slots fit in the 128 byte red zone below %rsp, there's no frame at all:
+//    no push %rbp, no mov, no sub on the way in and no leave on the way out.
+//  - Otherwise it still moves %rsp down once (and back up before each ret), but leaves %rbp alone.
+// The CFI gets rewritten to match, so debuggers and unwinders still find their way back.
+// Profilers that walk the %rbp chain lose leaf functions this way, so `-keep-frame-pointer` turns it off.
+// Run it after the peephole optimizer, which gets rid of most of the push/pop pairs that would stop it.
+class FrameOmission {
+public:
+  // Returns how many functions lost their frame pointer
+  static size_t run(std::vector<Instr> &code);
+
+  static inline bool isEnabled = true;
+
+private:
+  static constexpr int64_t redZone = 128;
+
+  // Where one function's frame setup is, by index into the code
+  struct Prologue {
+    size_t push = 0, pushCfi = 0, mov = 0, movCfi = 0;
+    long long sub = -1; // -1 if it doesn't reserve anything
+    int64_t frameSize = 0;
+  };
+
+  static bool findPrologue(const std::vector<Instr> &code, size_t start, size_t end, Prologue &prologue);
+  static bool isLeaf(std::vector<Instr> &code, const Prologue &prologue, size_t end);
+  static void rewrite(std::vector<Instr> &code, const Prologue &prologue, size_t end, std::vector<bool> &removed);
+};
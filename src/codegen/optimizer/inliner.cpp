@@ -0,0 +1,649 @@
+#include "inliner.hpp"
+#include "profile.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+#include <cstdint>
+
+// Every name a function body declares (params are added by the caller of this)
+static void gatherLocals(Node::Stmt *stmt, std::set<std::string> &out) {
+  if (stmt->kind == ND_VAR_STMT) out.insert(static_cast<VarStmt *>(stmt)->name);
+  if (stmt->kind == ND_FOR_STMT) out.insert(static_cast<ForStmt *>(stmt)->name);
+  if (stmt->kind == ND_FN_STMT || stmt->kind == ND_STRUCT_STMT) return;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { gatherLocals(s, out); });
+}
+
+// Anything that shows up as &x can be changed behind our back
+static void gatherEscaped(Node::Expr *expr, std::set<std::string> &out) {
+  if (expr->kind == ND_ADDRESS && static_cast<AddressExpr *>(expr)->right->kind == ND_IDENT)
+    out.insert(static_cast<IdentExpr *>(static_cast<AddressExpr *>(expr)->right)->name);
+  Walk::children(expr, [&](Node::Expr *&e) { gatherEscaped(e, out); });
+}
+
+static void gatherEscaped(Node::Stmt *stmt, std::set<std::string> &out) {
+  Walk::children(stmt, [&](Node::Expr *&e) { gatherEscaped(e, out); },
+                 [&](Node::Stmt *&s) { gatherEscaped(s, out); });
+}
+
+static bool containsLoop(Node::Stmt *stmt) {
+  if (stmt->kind == ND_WHILE_STMT || stmt->kind == ND_FOR_STMT) return true;
+  bool found = false;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { found = found || containsLoop(s); });
+  return found;
+}
+
+static bool isFloating(Node::Type *type) {
+  return type->kind == ND_SYMBOL_TYPE &&
+         (codegen::getUnderlying(type) == "float" || codegen::getUnderlying(type) == "double");
+}
+
+// Can this expression be stored into a `type` slot without any conversion?
+// The assignment codegen pops with the size of the *value*, so sizes have to agree exactly.
+static bool fitsType(Node::Expr *expr, Node::Type *type) {
+  if (expr->asmType == nullptr) return false;
+  if (expr->kind == ND_INT) return type->kind == ND_SYMBOL_TYPE && !isFloating(type);
+  if (expr->asmType->kind != type->kind) return false;
+  return isFloating(expr->asmType) == isFloating(type) &&
+         codegen::getByteSizeOfType(expr->asmType) == codegen::getByteSizeOfType(type);
+}
+
+size_t Inliner::run(Node::Stmt *program) {
+  functions.clear();
+  structNames.clear();
+  callCount.clear();
+  escapes.clear();
+  processed.clear();
+  callers.clear();
+  siteCount = 0;
+
+  collect(program, true);
+  countUses(program);
+  // Callees first, so whatever they inlined comes along for free when they get inlined themselves
+  for (FnStmt *fn : callers) process(fn);
+  return siteCount;
+}
+
+void Inliner::collect(Node::Stmt *stmt, bool isTopLevel) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s, isTopLevel);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt, isTopLevel);
+      break;
+    case ND_CONST_STMT: {
+      ConstStmt *s = static_cast<ConstStmt *>(stmt);
+      if (s->value->kind == ND_STRUCT_STMT) {
+        structNames.insert(s->name);
+        collect(s->value, false);
+      } else if (s->value->kind == ND_FN_STMT) {
+        if (isTopLevel) functions[s->name] = static_cast<FnStmt *>(s->value);
+        collect(s->value, isTopLevel);
+      }
+      break;
+    }
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *s : static_cast<StructStmt *>(stmt)->stmts) collect(s, false);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      if (!fn->isTemplate && fn->block != nullptr) callers.push_back(fn);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void Inliner::countUses(Node::Stmt *stmt) {
+  Walk::children(stmt, [](Node::Expr *&e) { countUses(e); }, [](Node::Stmt *&s) { countUses(s); });
+}
+
+void Inliner::countUses(Node::Expr *expr) {
+  if (expr->kind == ND_CALL && static_cast<CallExpr *>(expr)->callee->kind == ND_IDENT) {
+    CallExpr *call = static_cast<CallExpr *>(expr);
+    callCount[static_cast<IdentExpr *>(call->callee)->name]++;
+    for (Node::Expr *arg : call->args) countUses(arg);
+    return;
+  }
+  if (expr->kind == ND_IDENT && functions.contains(static_cast<IdentExpr *>(expr)->name))
+    escapes.insert(static_cast<IdentExpr *>(expr)->name); // Function pointer, keep the body around
+  Walk::children(expr, [](Node::Expr *&e) { countUses(e); });
+}
+
+void Inliner::process(FnStmt *fn) {
+  if (processed.contains(fn)) return;
+  processed.insert(fn);
+
+  std::set<std::string> callees;
+  calleesOf(fn->block, callees);
+  for (const std::string &name : callees)
+    if (functions.contains(name)) process(functions[name]);
+
+  Site site;
+  for (auto &param : fn->params) site.locals.insert(param.first->name);
+  gatherLocals(fn->block, site.locals);
+  gatherEscaped(fn->block, site.escaped);
+  inlineStmts(fn->block, site, false);
+}
+
+void Inliner::calleesOf(Node::Stmt *stmt, std::set<std::string> &out) {
+  std::function<void(Node::Expr *&)> onExpr = [&](Node::Expr *&e) {
+    // Function pointers count too, whoever gets handed one might call it
+    if (e->kind == ND_IDENT && functions.contains(static_cast<IdentExpr *>(e)->name))
+      out.insert(static_cast<IdentExpr *>(e)->name);
+    Walk::children(e, onExpr);
+  };
+  std::function<void(Node::Stmt *&)> onStmt = [&](Node::Stmt *&s) {
+    Walk::children(s, onExpr, onStmt);
+  };
+  onStmt(stmt);
+}
+
+bool Inliner::reaches(FnStmt *from, const std::string &target, std::set<std::string> &seen) {
+  std::set<std::string> callees;
+  calleesOf(from->block, callees);
+  for (const std::string &name : callees) {
+    if (name == target) return true;
+    if (!functions.contains(name) || seen.contains(name)) continue;
+    seen.insert(name);
+    if (reaches(functions[name], target, seen)) return true;
+  }
+  return false;
+}
+
+bool Inliner::isRecursive(FnStmt *fn) {
+  std::set<std::string> seen;
+  return reaches(fn, fn->name, seen);
+}
+
+bool Inliner::isScalar(Node::Type *type) {
+  if (type->kind == ND_POINTER_TYPE) return true;
+  if (type->kind != ND_SYMBOL_TYPE) return false; // arrays, function types, templates...
+  // Builtins only. Enums and structs don't even have a size yet, codegen works those out as it reaches them
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  return name != "void" && !structNames.contains(name) && codegen::typeSizes.contains(name);
+}
+
+bool Inliner::sameType(Node::Type *a, Node::Type *b) {
+  if (a == nullptr || b == nullptr || a->kind != b->kind) return false;
+  if (a->kind == ND_POINTER_TYPE)
+    return sameType(static_cast<PointerType *>(a)->underlying, static_cast<PointerType *>(b)->underlying);
+  if (a->kind != ND_SYMBOL_TYPE) return false;
+  SymbolType *l = static_cast<SymbolType *>(a);
+  SymbolType *r = static_cast<SymbolType *>(b);
+  return l->name == r->name && l->signedness == r->signedness;
+}
+
+bool Inliner::canInline(FnStmt *fn) {
+  if (fn->inlineHint == FnStmt::Inline::Never) return false;
+  if (fn->isTemplate || fn->isMain || fn->isEntry || fn->name == "main") return false;
+  if (fn->block == nullptr || fn->block->kind != ND_BLOCK_STMT) return false;
+
+  for (auto &param : fn->params)
+    if (!isScalar(param.second)) return false;
+  bool isVoid = fn->returnType->kind == ND_SYMBOL_TYPE && codegen::getUnderlying(fn->returnType) == "void";
+  if (!isVoid && !isScalar(fn->returnType)) return false;
+
+  std::set<std::string> names;
+  for (auto &param : fn->params) names.insert(param.first->name);
+  gatherLocals(fn->block, names);
+  // A local that shadows a function would make renaming ambiguous
+  for (const std::string &name : names)
+    if (functions.contains(name)) return false;
+
+  return checkBody(fn->block, fn, names, false) && !isRecursive(fn);
+}
+
+bool Inliner::checkBody(Node::Stmt *stmt, FnStmt *fn, const std::set<std::string> &names, bool inLoop) {
+  bool ok = true;
+  auto onExpr = [&](Node::Expr *&e) { ok = ok && checkExpr(e, names); };
+  switch (stmt->kind) {
+    case ND_BLOCK_STMT:
+    case ND_EXPR_STMT:
+    case ND_IF_STMT:
+    case ND_PRINT_STMT:
+    case ND_BREAK_STMT:
+    case ND_CONTINUE_STMT:
+      break;
+    case ND_VAR_STMT:
+      if (!isScalar(static_cast<VarStmt *>(stmt)->type)) return false;
+      break;
+    case ND_WHILE_STMT:
+    case ND_FOR_STMT:
+      inLoop = true;
+      break;
+    case ND_RETURN_STMT: {
+      // A return inside a loop would have to break out of every loop in between, and break
+      // can only get out of one. Not worth it.
+      if (inLoop) return false;
+      Node::Expr *value = static_cast<ReturnStmt *>(stmt)->expr;
+      bool isVoid = codegen::getUnderlying(fn->returnType) == "void";
+      if (value != nullptr && (isVoid || !fitsType(value, fn->returnType))) return false;
+      break;
+    }
+    default:
+      return false; // match, structs, nested functions, input...
+  }
+  Walk::children(stmt, onExpr, [&](Node::Stmt *&s) { ok = ok && checkBody(s, fn, names, inLoop); });
+  return ok;
+}
+
+bool Inliner::checkExpr(Node::Expr *expr, const std::set<std::string> &names) {
+  switch (expr->kind) {
+    case ND_IDENT: {
+      // Our own params/locals or another function. Globals would need to be looked up in the callee's scope.
+      const std::string &name = static_cast<IdentExpr *>(expr)->name;
+      return names.contains(name) || functions.contains(name);
+    }
+    case ND_CALL:
+      if (static_cast<CallExpr *>(expr)->callee->kind != ND_IDENT) return false;
+      break;
+    case ND_INT:
+    case ND_FLOAT:
+    case ND_STRING:
+    case ND_CHAR:
+    case ND_BOOL:
+    case ND_NULL:
+    case ND_BINARY:
+    case ND_UNARY:
+    case ND_PREFIX:
+    case ND_POSTFIX:
+    case ND_GROUP:
+    case ND_CAST:
+    case ND_INDEX:
+    case ND_ADDRESS:
+    case ND_DEREFERENCE:
+    case ND_ASSIGN:
+    case ND_TERNARY:
+    case ND_ALLOC_MEMORY:
+    case ND_FREE_MEMORY:
+    case ND_MEMCPY_MEMORY:
+    case ND_STRCMP:
+    case ND_EXTERNAL_CALL:
+      break;
+    default:
+      return false; // members, struct literals, sizeof (takes type names) and the rest
+  }
+  bool ok = true;
+  Walk::children(expr, [&](Node::Expr *&e) { ok = ok && checkExpr(e, names); });
+  return ok;
+}
+
+size_t Inliner::cost(Node::Stmt *stmt) {
+  size_t total = 1;
+  Walk::children(stmt, [&](Node::Expr *&e) { total += cost(e); }, [&](Node::Stmt *&s) { total += cost(s); });
+  return total;
+}
+
+size_t Inliner::cost(Node::Expr *expr) {
+  size_t total = 1;
+  Walk::children(expr, [&](Node::Expr *&e) { total += cost(e); });
+  return total;
+}
+
+size_t Inliner::budgetFor(FnStmt *fn) {
+  if (fn->inlineHint == FnStmt::Inline::Always) return SIZE_MAX;
+  // The only call site? Then the body disappears afterwards and inlining is pure win
+  if (callCount[fn->name] == 1 && !escapes.contains(fn->name)) return onceBudget;
+  // With -profile-use: a function that never ran isn't worth the bytes, and one that runs a lot is worth more of them
+  if (Profile::isCold(fn)) return sizeBudget;
+  if (Profile::isHot(fn)) return optimizeForSize ? autoBudget : hotBudget;
+  // Pasting a body into several callers only makes the binary smaller if it's smaller than the call itself
+  return optimizeForSize ? sizeBudget : autoBudget;
+}
+
+// `{ return <expr>; }` with nothing in <expr> that writes to (or takes the address of) a param
+Node::Expr *Inliner::exprBody(FnStmt *fn) {
+  BlockStmt *block = static_cast<BlockStmt *>(fn->block);
+  if (block->stmts.size() != 1 || block->stmts[0]->kind != ND_RETURN_STMT) return nullptr;
+  Node::Expr *value = static_cast<ReturnStmt *>(block->stmts[0])->expr;
+  if (value == nullptr) return nullptr;
+
+  bool writes = false;
+  std::function<void(Node::Expr *&)> check = [&](Node::Expr *&e) {
+    if (e->kind == ND_ASSIGN || e->kind == ND_PREFIX || e->kind == ND_POSTFIX || e->kind == ND_ADDRESS)
+      writes = true;
+    Walk::children(e, check);
+  };
+  check(value);
+  return writes ? nullptr : value;
+}
+
+FnStmt *Inliner::calleeOf(Node::Expr *expr, Site &site) {
+  if (expr->kind != ND_CALL) return nullptr;
+  CallExpr *call = static_cast<CallExpr *>(expr);
+  if (call->callee->kind != ND_IDENT) return nullptr;
+  const std::string &name = static_cast<IdentExpr *>(call->callee)->name;
+  if (site.locals.contains(name) || !functions.contains(name)) return nullptr; // function pointer
+
+  FnStmt *fn = functions[name];
+  if (fn->params.size() != call->args.size() || !canInline(fn)) return nullptr;
+  size_t size = cost(fn->block);
+  if (size > budgetFor(fn)) return nullptr;
+  if (fn->inlineHint != FnStmt::Inline::Always && site.growth + size > growthBudget) return nullptr;
+  return fn;
+}
+
+// Literals and untouchable locals can be evaluated any number of times (including zero) with the same result
+bool Inliner::isSimpleArg(Node::Expr *arg, Node::Type *paramType, Site &site) {
+  switch (arg->kind) {
+    case ND_INT:
+      return paramType->kind == ND_SYMBOL_TYPE && !isFloating(paramType);
+    case ND_FLOAT:
+    case ND_CHAR:
+    case ND_BOOL:
+      return sameType(arg->asmType, paramType);
+    case ND_IDENT: {
+      const std::string &name = static_cast<IdentExpr *>(arg)->name;
+      return site.locals.contains(name) && !site.escaped.contains(name) && sameType(arg->asmType, paramType);
+    }
+    default:
+      return false;
+  }
+}
+
+void Inliner::inlineStmts(Node::Stmt *stmt, Site &site, bool inLoop) {
+  switch (stmt->kind) {
+    case ND_BLOCK_STMT: {
+      BlockStmt *block = static_cast<BlockStmt *>(stmt);
+      std::vector<Node::Stmt *> out;
+      for (Node::Stmt *s : block->stmts) {
+        inlineStmts(s, site, inLoop);
+        if (!expandCall(out, s, site, inLoop)) out.push_back(s);
+      }
+      block->stmts = out;
+      return;
+    }
+    case ND_WHILE_STMT:
+    case ND_FOR_STMT:
+      inLoop = true;
+      break;
+    case ND_FN_STMT:
+    case ND_STRUCT_STMT:
+      return;
+    case ND_RETURN_STMT:
+      // @tailcall asked for a jump, so the call stays (what it gets passed is fair game)
+      if (static_cast<ReturnStmt *>(stmt)->isTailCall) {
+        for (Node::Expr *&arg : static_cast<CallExpr *>(static_cast<ReturnStmt *>(stmt)->expr)->args) inlineExprs(arg, site);
+        return;
+      }
+      break;
+    default:
+      break;
+  }
+  Walk::children(stmt, [&](Node::Expr *&e) { inlineExprs(e, site); },
+                 [&](Node::Stmt *&s) { inlineStmts(s, site, inLoop); });
+}
+
+void Inliner::inlineExprs(Node::Expr *&expr, Site &site) {
+  Walk::children(expr, [&](Node::Expr *&e) { inlineExprs(e, site); });
+
+  FnStmt *fn = calleeOf(expr, site);
+  if (fn == nullptr) return;
+  Node::Expr *body = exprBody(fn);
+  if (body == nullptr || !sameType(body->asmType, expr->asmType)) return;
+
+  CallExpr *call = static_cast<CallExpr *>(expr);
+  std::unordered_map<std::string, Node::Expr *> args;
+  for (size_t i = 0; i < call->args.size(); i++) {
+    Node::Type *paramType = fn->params[i].second;
+    if (!isSimpleArg(call->args[i], paramType, site)) return;
+    Node::Expr *arg = clone(call->args[i]);
+    arg->asmType = paramType; // only changes anything for int literals
+    args[fn->params[i].first->name] = arg;
+  }
+  site.growth += cost(body);
+  siteCount++;
+  expr = substitute(body, args);
+}
+
+bool Inliner::expandCall(std::vector<Node::Stmt *> &out, Node::Stmt *stmt, Site &site, bool inLoop) {
+  // Find the call, and the slot it lives in so it can be swapped for the result
+  Node::Expr **slot = nullptr;
+  bool needsValue = true;
+  switch (stmt->kind) {
+    case ND_EXPR_STMT: {
+      ExprStmt *s = static_cast<ExprStmt *>(stmt);
+      if (s->expr->kind == ND_CALL) {
+        slot = &s->expr;
+        needsValue = false;
+      } else if (s->expr->kind == ND_ASSIGN) {
+        AssignmentExpr *assign = static_cast<AssignmentExpr *>(s->expr);
+        if (assign->op == "=" && assign->assignee->kind == ND_IDENT && assign->rhs->kind == ND_CALL)
+          slot = &assign->rhs;
+      }
+      break;
+    }
+    case ND_VAR_STMT: {
+      VarStmt *s = static_cast<VarStmt *>(stmt);
+      if (s->expr != nullptr && s->expr->kind == ND_CALL && isScalar(s->type)) slot = &s->expr;
+      break;
+    }
+    case ND_RETURN_STMT: {
+      ReturnStmt *s = static_cast<ReturnStmt *>(stmt);
+      if (s->expr != nullptr && s->expr->kind == ND_CALL && !s->isTailCall) slot = &s->expr;
+      break;
+    }
+    default:
+      break;
+  }
+  if (slot == nullptr) return false;
+
+  FnStmt *fn = calleeOf(*slot, site);
+  if (fn == nullptr) return false;
+  // break/continue find their loop by counting labels, so an extra loop pasted into
+  // the middle of the caller's loop would send the caller's breaks to the wrong place
+  if (inLoop && containsLoop(fn->block)) return false;
+  bool isVoid = codegen::getUnderlying(fn->returnType) == "void";
+  if (needsValue && isVoid) return false;
+
+  CallExpr *call = static_cast<CallExpr *>(*slot);
+  std::string prefix = "__inline" + std::to_string(inlineCount++) + "_";
+  siteCount++;
+  std::string ret = isVoid ? "" : prefix + "ret";
+
+  // Fresh copy of the body, with every param and local renamed so nothing can clash with the caller
+  BlockStmt *body = static_cast<BlockStmt *>(clone(fn->block));
+  std::set<std::string> locals;
+  for (auto &param : fn->params) locals.insert(param.first->name);
+  gatherLocals(body, locals);
+  std::unordered_map<std::string, std::string> names;
+  for (const std::string &name : locals) names[name] = prefix + name;
+  rename(body, names);
+
+  std::vector<Node::Stmt *> stmts;
+  for (size_t i = 0; i < fn->params.size(); i++)
+    stmts.push_back(new VarStmt(call->line, call->pos, false, names[fn->params[i].first->name],
+                                fn->params[i].second, call->args[i], call->file_id));
+  std::string done = "";
+  if (!returnsOnlyAtEnd(body->stmts)) {
+    done = prefix + "done";
+    IntExpr *zero = new IntExpr(call->line, call->pos, 0, call->file_id);
+    zero->asmType = new SymbolType("int", SymbolType::Signedness::SIGNED);
+    stmts.push_back(new VarStmt(call->line, call->pos, false, done, zero->asmType, zero, call->file_id));
+  }
+  for (Node::Stmt *s : lowerReturns(body->stmts, fn, ret, done)) stmts.push_back(s);
+
+  if (!isVoid) out.push_back(new VarStmt(call->line, call->pos, false, ret, fn->returnType, nullptr, call->file_id));
+  out.push_back(new BlockStmt(call->line, call->pos, stmts, false, {}, call->file_id));
+  if (needsValue) {
+    *slot = ident(call->line, call->pos, call->file_id, ret, fn->returnType);
+    out.push_back(stmt);
+  }
+
+  for (auto &pair : names) site.locals.insert(pair.second);
+  if (!isVoid) site.locals.insert(ret);
+  gatherEscaped(body, site.escaped);
+  site.growth += cost(fn->block);
+  return true;
+}
+
+Node::Expr *Inliner::clone(Node::Expr *expr) {
+  Node::Expr *copy = nullptr;
+  switch (expr->kind) {
+    case ND_INT: copy = new IntExpr(*static_cast<IntExpr *>(expr)); break;
+    case ND_FLOAT: copy = new FloatExpr(*static_cast<FloatExpr *>(expr)); break;
+    case ND_IDENT: copy = new IdentExpr(*static_cast<IdentExpr *>(expr)); break;
+    case ND_STRING: copy = new StringExpr(*static_cast<StringExpr *>(expr)); break;
+    case ND_CHAR: copy = new CharExpr(*static_cast<CharExpr *>(expr)); break;
+    case ND_BOOL: copy = new BoolExpr(*static_cast<BoolExpr *>(expr)); break;
+    case ND_NULL: copy = new NullExpr(*static_cast<NullExpr *>(expr)); break;
+    case ND_BINARY: copy = new BinaryExpr(*static_cast<BinaryExpr *>(expr)); break;
+    case ND_UNARY: copy = new UnaryExpr(*static_cast<UnaryExpr *>(expr)); break;
+    case ND_PREFIX: copy = new PrefixExpr(*static_cast<PrefixExpr *>(expr)); break;
+    case ND_POSTFIX: copy = new PostfixExpr(*static_cast<PostfixExpr *>(expr)); break;
+    case ND_GROUP: copy = new GroupExpr(*static_cast<GroupExpr *>(expr)); break;
+    case ND_CAST: copy = new CastExpr(*static_cast<CastExpr *>(expr)); break;
+    case ND_CALL: copy = new CallExpr(*static_cast<CallExpr *>(expr)); break;
+    case ND_INDEX: copy = new IndexExpr(*static_cast<IndexExpr *>(expr)); break;
+    case ND_ADDRESS: copy = new AddressExpr(*static_cast<AddressExpr *>(expr)); break;
+    case ND_DEREFERENCE: copy = new DereferenceExpr(*static_cast<DereferenceExpr *>(expr)); break;
+    case ND_ASSIGN: copy = new AssignmentExpr(*static_cast<AssignmentExpr *>(expr)); break;
+    case ND_TERNARY: copy = new TernaryExpr(*static_cast<TernaryExpr *>(expr)); break;
+    case ND_ALLOC_MEMORY: copy = new AllocMemoryExpr(*static_cast<AllocMemoryExpr *>(expr)); break;
+    case ND_FREE_MEMORY: copy = new FreeMemoryExpr(*static_cast<FreeMemoryExpr *>(expr)); break;
+    case ND_MEMCPY_MEMORY: copy = new MemcpyExpr(*static_cast<MemcpyExpr *>(expr)); break;
+    case ND_STRCMP: copy = new StrCmp(*static_cast<StrCmp *>(expr)); break;
+    case ND_EXTERNAL_CALL: copy = new ExternalCall(*static_cast<ExternalCall *>(expr)); break;
+    default: return expr; // checkExpr never lets anything else through
+  }
+  Walk::children(copy, [](Node::Expr *&e) { e = clone(e); });
+  return copy;
+}
+
+Node::Stmt *Inliner::clone(Node::Stmt *stmt) {
+  Node::Stmt *copy = nullptr;
+  switch (stmt->kind) {
+    case ND_EXPR_STMT: copy = new ExprStmt(*static_cast<ExprStmt *>(stmt)); break;
+    case ND_VAR_STMT: copy = new VarStmt(*static_cast<VarStmt *>(stmt)); break;
+    case ND_RETURN_STMT: copy = new ReturnStmt(*static_cast<ReturnStmt *>(stmt)); break;
+    case ND_IF_STMT: copy = new IfStmt(*static_cast<IfStmt *>(stmt)); break;
+    case ND_BLOCK_STMT: copy = new BlockStmt(*static_cast<BlockStmt *>(stmt)); break;
+    case ND_WHILE_STMT: copy = new WhileStmt(*static_cast<WhileStmt *>(stmt)); break;
+    case ND_FOR_STMT: copy = new ForStmt(*static_cast<ForStmt *>(stmt)); break;
+    case ND_PRINT_STMT: copy = new OutputStmt(*static_cast<OutputStmt *>(stmt)); break;
+    case ND_BREAK_STMT: copy = new BreakStmt(*static_cast<BreakStmt *>(stmt)); break;
+    case ND_CONTINUE_STMT: copy = new ContinueStmt(*static_cast<ContinueStmt *>(stmt)); break;
+    default: return stmt; // checkBody never lets anything else through
+  }
+  Walk::children(copy, [](Node::Expr *&e) { e = clone(e); }, [](Node::Stmt *&s) { s = clone(s); });
+  return copy;
+}
+
+void Inliner::rename(Node::Stmt *stmt, std::unordered_map<std::string, std::string> &names) {
+  if (stmt->kind == ND_VAR_STMT && names.contains(static_cast<VarStmt *>(stmt)->name))
+    static_cast<VarStmt *>(stmt)->name = names[static_cast<VarStmt *>(stmt)->name];
+  if (stmt->kind == ND_FOR_STMT && names.contains(static_cast<ForStmt *>(stmt)->name))
+    static_cast<ForStmt *>(stmt)->name = names[static_cast<ForStmt *>(stmt)->name];
+  Walk::children(stmt, [&](Node::Expr *&e) { rename(e, names); },
+                 [&](Node::Stmt *&s) { rename(s, names); });
+}
+
+void Inliner::rename(Node::Expr *expr, std::unordered_map<std::string, std::string> &names) {
+  if (expr->kind == ND_IDENT && names.contains(static_cast<IdentExpr *>(expr)->name))
+    static_cast<IdentExpr *>(expr)->name = names[static_cast<IdentExpr *>(expr)->name];
+  Walk::children(expr, [&](Node::Expr *&e) { rename(e, names); });
+}
+
+Node::Expr *Inliner::substitute(Node::Expr *expr, std::unordered_map<std::string, Node::Expr *> &args) {
+  if (expr->kind == ND_IDENT && args.contains(static_cast<IdentExpr *>(expr)->name))
+    return clone(args[static_cast<IdentExpr *>(expr)->name]);
+  Node::Expr *copy = clone(expr);
+  Walk::children(copy, [&](Node::Expr *&e) { e = substitute(e, args); });
+  return copy;
+}
+
+bool Inliner::containsReturn(Node::Stmt *stmt) {
+  if (stmt->kind == ND_RETURN_STMT) return true;
+  bool found = false;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { found = found || containsReturn(s); });
+  return found;
+}
+
+std::vector<Node::Stmt *> Inliner::asList(Node::Stmt *stmt) {
+  if (stmt->kind == ND_BLOCK_STMT) return static_cast<BlockStmt *>(stmt)->stmts;
+  return {stmt};
+}
+
+// If every return is the very last thing that runs, falling off the end of the block IS returning,
+// and we don't need a flag to skip the rest
+bool Inliner::returnsOnlyAtEnd(const std::vector<Node::Stmt *> &stmts) {
+  if (stmts.empty()) return true;
+  for (size_t i = 0; i + 1 < stmts.size(); i++)
+    if (containsReturn(stmts[i])) return false;
+  Node::Stmt *last = stmts.back();
+  switch (last->kind) {
+    case ND_RETURN_STMT:
+      return true;
+    case ND_BLOCK_STMT:
+      return returnsOnlyAtEnd(static_cast<BlockStmt *>(last)->stmts);
+    case ND_IF_STMT: {
+      IfStmt *s = static_cast<IfStmt *>(last);
+      return returnsOnlyAtEnd(asList(s->thenStmt)) &&
+             (s->elseStmt == nullptr || returnsOnlyAtEnd(asList(s->elseStmt)));
+    }
+    default:
+      return !containsReturn(last);
+  }
+}
+
+// return x;  ->  ret = x; done = 1;
+// and everything after a statement that might have returned goes under `if (done == 0) { ... }`
+std::vector<Node::Stmt *> Inliner::lowerReturns(const std::vector<Node::Stmt *> &stmts, FnStmt *fn,
+                                                const std::string &ret, const std::string &done) {
+  std::vector<Node::Stmt *> out;
+  for (size_t i = 0; i < stmts.size(); i++) {
+    Node::Stmt *stmt = stmts[i];
+    if (stmt->kind == ND_RETURN_STMT) {
+      ReturnStmt *s = static_cast<ReturnStmt *>(stmt);
+      if (s->expr != nullptr) {
+        if (s->expr->kind == ND_INT) s->expr->asmType = fn->returnType; // so it gets stored with the right size
+        Node::Expr *assign = new AssignmentExpr(s->line, s->pos, ident(s->line, s->pos, s->file_id, ret, fn->returnType), "=", s->expr, s->file_id);
+        out.push_back(new ExprStmt(s->line, s->pos, assign, s->file_id));
+      }
+      if (done != "") {
+        IntExpr *one = new IntExpr(s->line, s->pos, 1, s->file_id);
+        IdentExpr *flag = ident(s->line, s->pos, s->file_id, done, new SymbolType("int", SymbolType::Signedness::SIGNED));
+        one->asmType = flag->asmType;
+        out.push_back(new ExprStmt(s->line, s->pos, new AssignmentExpr(s->line, s->pos, flag, "=", one, s->file_id), s->file_id));
+      }
+      return out; // Anything after this is dead anyway
+    }
+    if (!containsReturn(stmt)) {
+      out.push_back(stmt);
+      continue;
+    }
+
+    // Only ifs and blocks get this far, checkBody keeps returns out of loops
+    if (stmt->kind == ND_IF_STMT) {
+      IfStmt *s = static_cast<IfStmt *>(stmt);
+      s->thenStmt = new BlockStmt(s->line, s->pos, lowerReturns(asList(s->thenStmt), fn, ret, done), false, {}, s->file_id);
+      if (s->elseStmt != nullptr)
+        s->elseStmt = new BlockStmt(s->line, s->pos, lowerReturns(asList(s->elseStmt), fn, ret, done), false, {}, s->file_id);
+    } else {
+      BlockStmt *s = static_cast<BlockStmt *>(stmt);
+      s->stmts = lowerReturns(s->stmts, fn, ret, done);
+    }
+    out.push_back(stmt);
+
+    std::vector<Node::Stmt *> rest(stmts.begin() + i + 1, stmts.end());
+    if (!rest.empty()) {
+      IdentExpr *flag = ident(0, 0, stmt->file_id, done, new SymbolType("int", SymbolType::Signedness::SIGNED));
+      IntExpr *zero = new IntExpr(0, 0, 0, stmt->file_id);
+      zero->asmType = flag->asmType;
+      BinaryExpr *notDone = new BinaryExpr(0, 0, flag, zero, "==", stmt->file_id);
+      notDone->asmType = new SymbolType("bool");
+      BlockStmt *then = new BlockStmt(0, 0, lowerReturns(rest, fn, ret, done), false, {}, stmt->file_id);
+      out.push_back(new IfStmt(0, 0, notDone, then, nullptr, stmt->file_id));
+    }
+    return out;
+  }
+  return out;
+}
+
+IdentExpr *Inliner::ident(int line, int pos, size_t file, const std::string &name, Node::Type *type) {
+  IdentExpr *e = new IdentExpr(line, pos, name, type, file);
+  e->asmType = type;
+  return e;
+}
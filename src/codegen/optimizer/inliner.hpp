@@ -0,0 +1,95 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+#include "../../ast/types.hpp"
+
+// Function inlining on the typed AST.
+// Tiny helpers (getters, `sq(x)`, `max(a, b)`...) cost a whole frame setup, an argument shuffle and a call,
+// which is usually several times more work than the function itself. So we paste their bodies in instead.
+//
+// Two shapes are supported:
+//  - `fn (..) T { return <expr>; }` is substituted straight into the expression, anywhere, as long as
+//    every argument is a literal or a plain local (so evaluating it zero or many times changes nothing).
+//  - Anything else is expanded at the statement level (`f(..);`, `x = f(..);`, `have x := f(..);`, `return f(..);`)
+//    into a block that declares the params as locals, and early `return`s get lowered to a "done" flag.
+//
+// Small functions (by AST node count) get inlined automatically. `@inline` skips the size budget,
+// `@noinline` opts out completely. Recursion, structs, arrays, globals and `match` are never inlined.
+// Run this BEFORE the call graph, so helpers that got inlined everywhere also get dropped.
+class Inliner {
+public:
+  // Returns how many call sites got inlined
+  static size_t run(Node::Stmt *program);
+
+  static inline bool optimizeForSize = false; // -Os: only inline what won't grow the binary
+
+  // Deep copies (for the handful of node kinds checkBody lets through), renaming, and the size model.
+  // The loop unroller pastes bodies around the same way, so it borrows these
+  static Node::Expr *clone(Node::Expr *expr);
+  static Node::Stmt *clone(Node::Stmt *stmt);
+  static void rename(Node::Stmt *stmt, std::unordered_map<std::string, std::string> &names);
+  static void rename(Node::Expr *expr, std::unordered_map<std::string, std::string> &names);
+  static size_t cost(Node::Stmt *stmt);
+  static size_t cost(Node::Expr *expr);
+
+private:
+  struct Site {
+    std::set<std::string> locals;   // caller params and locals - the only things safe to duplicate
+    std::set<std::string> escaped;  // ... unless somebody took their address
+    size_t growth = 0;              // how many nodes we have pasted into this caller so far
+  };
+
+  static void collect(Node::Stmt *stmt, bool isTopLevel);
+  static void countUses(Node::Stmt *stmt);
+  static void countUses(Node::Expr *expr);
+  static void process(FnStmt *fn);
+  static bool isRecursive(FnStmt *fn);
+  static bool reaches(FnStmt *from, const std::string &target, std::set<std::string> &seen);
+  static void calleesOf(Node::Stmt *stmt, std::set<std::string> &out);
+
+  // Legality + cost model
+  static bool canInline(FnStmt *fn);
+  static bool isScalar(Node::Type *type);
+  static bool sameType(Node::Type *a, Node::Type *b);
+  static bool checkBody(Node::Stmt *stmt, FnStmt *fn, const std::set<std::string> &names, bool inLoop);
+  static bool checkExpr(Node::Expr *expr, const std::set<std::string> &names);
+  static size_t budgetFor(FnStmt *fn);
+  static Node::Expr *exprBody(FnStmt *fn);
+
+  // Rewriting the caller
+  static void inlineStmts(Node::Stmt *stmt, Site &site, bool inLoop);
+  static void inlineExprs(Node::Expr *&expr, Site &site);
+  static bool expandCall(std::vector<Node::Stmt *> &out, Node::Stmt *stmt, Site &site, bool inLoop);
+  static FnStmt *calleeOf(Node::Expr *expr, Site &site);
+  static bool isSimpleArg(Node::Expr *arg, Node::Type *paramType, Site &site);
+
+  // Lowering the callee
+  static Node::Expr *substitute(Node::Expr *expr, std::unordered_map<std::string, Node::Expr *> &args);
+  static bool containsReturn(Node::Stmt *stmt);
+  static bool returnsOnlyAtEnd(const std::vector<Node::Stmt *> &stmts);
+  static std::vector<Node::Stmt *> lowerReturns(const std::vector<Node::Stmt *> &stmts, FnStmt *fn,
+                                                const std::string &ret, const std::string &done);
+  static std::vector<Node::Stmt *> asList(Node::Stmt *stmt);
+  static IdentExpr *ident(int line, int pos, size_t file, const std::string &name, Node::Type *type);
+
+  static inline std::unordered_map<std::string, FnStmt *> functions = {}; // top level functions by name
+  static inline std::set<std::string> structNames = {};
+  static inline std::unordered_map<std::string, size_t> callCount = {};
+  static inline std::set<std::string> escapes = {}; // functions used as values
+  static inline std::set<FnStmt *> processed = {};
+  static inline std::vector<FnStmt *> callers = {}; // every function body, struct methods included
+  static inline size_t inlineCount = 0; // never reset, it keeps the __inlineN_ names unique
+  static inline size_t siteCount = 0;
+
+  static constexpr size_t autoBudget = 40;     // nodes, for a function with many callers
+  static constexpr size_t onceBudget = 120;    // nodes, for a function called exactly once (it dies after)
+  static constexpr size_t hotBudget = 120;     // nodes, for a function the profile says gets called a lot
+  static constexpr size_t growthBudget = 400;  // nodes a single caller is allowed to grow by
+  static constexpr size_t sizeBudget = 8;      // nodes, for -Os: about what the call sequence costs
+};
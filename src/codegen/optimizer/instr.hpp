@@ -4,6 +4,8 @@
 #include <unordered_map>
 #include <variant>
 
+#include "operand.hpp"
+
 enum class JumpCondition;
 
 enum class DataSize {
@@ -17,80 +19,89 @@ enum class DataSize {
 };
 
 struct MovInstr {
-  std::string dest;
-  std::string src;
+  Operand dest;
+  Operand src;
   DataSize destSize = DataSize::Qword; // "movq", "movb", etc...
   DataSize srcSize = DataSize::Qword;  // "movq $15, 0(%rsp)"
 };
 
 struct LeaInstr {
   DataSize size; // "leaq", "leaw", etc...
-  std::string dest;
-  std::string src;
+  Operand dest;
+  Operand src;
 };
 
 struct PushInstr {
-  std::string what;
+  Operand what;
   DataSize whatSize = DataSize::Qword;
 };
 
 struct PopInstr {
-  std::string where;
+  Operand where;
   DataSize whereSize = DataSize::Qword; // "popq", "popb", etc..
 };
 
 struct XorInstr {
-  std::string lhs;
-  std::string rhs;
+  Operand lhs;
+  Operand rhs;
 };
 
 struct BinaryInstr {
   std::string op;
-  std::string src;
-  std::string dst;
+  Operand src;
+  Operand dst;
 };
 
 struct AddInstr {
-  std::string lhs;
-  std::string rhs;
+  Operand lhs;
+  Operand rhs;
   DataSize size; // This helps understand overflow
 };
 
 struct SubInstr {
-  std::string lhs;
-  std::string rhs;
+  Operand lhs;
+  Operand rhs;
   DataSize size; // This helps with overflow
 };
 
 struct MulInstr {
-  std::string from;
+  Operand from;
   bool isSigned; // IMUL or MUL
   DataSize size; // Avoid size mismatch i suppose
 };
 
 struct DivInstr {
-  std::string from;
+  Operand from;
   bool isSigned; // IDIV or DIV
   DataSize size; // Understand what to divide i guess, i dont even know anymore
 };
 
+// What to pad the code out to before a label. Loop tops and function entries want to start a fresh
+// 16 byte fetch block, but a loop only gets it if that takes 10 bytes of nops or less
+enum class Alignment {
+  None,
+  Loop,     // .p2align 4,,10
+  Function, // .p2align 4
+};
+
 struct Label {
   std::string name;
+  Alignment align = Alignment::None;
 };
 
 struct CmpInstr {
-  std::string lhs;
-  std::string rhs;
+  Operand lhs;
+  Operand rhs;
   DataSize size;
 };
 
 struct NegInstr {
-  std::string what;
+  Operand what;
   DataSize size;
 };
 
 struct NotInstr {
-  std::string what;
+  Operand what;
 };
 
 struct JumpInstr {
@@ -147,8 +158,8 @@ enum class ConvertType {
 struct ConvertInstr {
   DataSize toSize;
   ConvertType convType;
-  std::string from;
-  std::string to;
+  Operand from;
+  Operand to;
 };
 
 enum class InstrType {
@@ -208,6 +219,8 @@ enum class JumpCondition {
   Less,
   LessEqual,
   NotLess, // just GreaterEqual, but different keyword
+
+  Above, // Greater, but unsigned. Bounds checks
 };
 
 struct Instr {
@@ -0,0 +1,165 @@
+#include "operand.hpp"
+
+#include <charconv>
+
+// names[reg] = {64 bit, 32 bit, 16 bit, 8 bit}
+static const std::vector<std::vector<std::string>> gprNames = {
+  {},
+  {"%rax", "%eax", "%ax", "%al"},     {"%rcx", "%ecx", "%cx", "%cl"},     {"%rdx", "%edx", "%dx", "%dl"},
+  {"%rbx", "%ebx", "%bx", "%bl"},     {"%rsp", "%esp", "%sp", "%spl"},    {"%rbp", "%ebp", "%bp", "%bpl"},
+  {"%rsi", "%esi", "%si", "%sil"},    {"%rdi", "%edi", "%di", "%dil"},    {"%r8", "%r8d", "%r8w", "%r8b"},
+  {"%r9", "%r9d", "%r9w", "%r9b"},    {"%r10", "%r10d", "%r10w", "%r10b"}, {"%r11", "%r11d", "%r11w", "%r11b"},
+  {"%r12", "%r12d", "%r12w", "%r12b"}, {"%r13", "%r13d", "%r13w", "%r13b"}, {"%r14", "%r14d", "%r14w", "%r14b"},
+  {"%r15", "%r15d", "%r15w", "%r15b"}, {"%rip"},
+};
+static constexpr uint8_t widths[] = {8, 4, 2, 1};
+
+static std::string registerName(Reg reg, uint8_t width) {
+  if (reg >= Reg::Xmm0) return "%xmm" + std::to_string((int)reg - (int)Reg::Xmm0);
+  const std::vector<std::string> &names = gprNames[(int)reg];
+  for (size_t i = 0; i < names.size(); i++)
+    if (widths[i] == width) return names[i];
+  return names[0];
+}
+
+// "%eax" -> {Rax, 4}. False if it isn't a register we know
+static bool parseRegister(const std::string &text, Reg &reg, uint8_t &width) {
+  static std::unordered_map<std::string, std::pair<Reg, uint8_t>> table;
+  if (table.empty()) {
+    for (size_t r = 1; r < gprNames.size(); r++)
+      for (size_t i = 0; i < gprNames[r].size(); i++) table[gprNames[r][i]] = {(Reg)r, widths[i]};
+    for (int x = 0; x < 16; x++) table["%xmm" + std::to_string(x)] = {(Reg)((int)Reg::Xmm0 + x), 16};
+  }
+  auto it = table.find(text);
+  if (it == table.end()) return false;
+  reg = it->second.first;
+  width = it->second.second;
+  return true;
+}
+
+static bool parseInteger(const std::string &text, int64_t &value) {
+  if (text.empty()) return false;
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc() && end == text.data() + text.size();
+}
+
+Operand::Operand(const std::string &text) {
+  if (text.empty()) return;
+  Operand raw;
+  raw.kind = Kind::Symbol;
+  raw.symbol = intern(text);
+
+  if (text[0] == '%') {
+    if (!parseRegister(text, reg, width)) *this = raw;
+    else kind = Kind::Register;
+    return;
+  }
+  if (text[0] == '$') {
+    kind = Kind::Immediate;
+    // Anything that isn't a plain number ($label, $0x10...) is kept exactly as it was written
+    if (!parseInteger(text.substr(1), value)) symbol = intern(text.substr(1));
+    return;
+  }
+
+  size_t open = text.find('(');
+  if (open == std::string::npos || text.back() != ')') {
+    *this = raw;
+    return;
+  }
+  // disp(base,index,scale)
+  kind = Kind::Memory;
+  std::string disp = text.substr(0, open);
+  std::vector<std::string> parts = {""};
+  for (size_t i = open + 1; i + 1 < text.size(); i++) {
+    if (text[i] == ',') parts.push_back("");
+    else if (text[i] != ' ') parts.back() += text[i];
+  }
+  uint8_t ignored;
+  if (!parts[0].empty() && !parseRegister(parts[0], reg, ignored)) {
+    *this = raw;
+    return;
+  }
+  if (parts.size() > 1 && !parts[1].empty() && !parseRegister(parts[1], index, ignored)) {
+    *this = raw;
+    return;
+  }
+  int64_t s = 1;
+  if (parts.size() > 2 && !parseInteger(parts[2], s)) {
+    *this = raw;
+    return;
+  }
+  scale = (uint8_t)s;
+
+  if (disp.empty() || parseInteger(disp, value)) return;
+  // label+8, label-8 or just label
+  size_t sign = disp.find_last_of("+-");
+  if (sign != std::string::npos && sign > 0 && parseInteger(disp.substr(sign + (disp[sign] == '+')), value)) {
+    symbol = intern(disp.substr(0, sign));
+  } else {
+    value = 0;
+    symbol = intern(disp);
+  }
+}
+
+Operand Operand::makeRegister(Reg reg, uint8_t width) {
+  Operand operand;
+  operand.kind = Kind::Register;
+  operand.reg = reg;
+  operand.width = reg >= Reg::Xmm0 ? 16 : width;
+  return operand;
+}
+
+std::string Operand::str() const {
+  switch (kind) {
+    case Kind::None: return "";
+    case Kind::Register: return registerName(reg, width);
+    case Kind::Immediate: return "$" + (symbol != -1 ? names[symbol] : std::to_string(value));
+    case Kind::Symbol: return names[symbol];
+    case Kind::Memory: {
+      std::string out;
+      if (symbol != -1) {
+        out = names[symbol];
+        if (value > 0) out += "+";
+        if (value != 0) out += std::to_string(value);
+      } else if (value != 0) {
+        out = std::to_string(value);
+      }
+      out += "(";
+      if (reg != Reg::None) out += registerName(reg, 8);
+      if (index != Reg::None) out += "," + registerName(index, 8) + "," + std::to_string(scale);
+      return out + ")";
+    }
+  }
+  return "";
+}
+
+bool Operand::uses(Reg r) const {
+  if (kind == Kind::Register) return reg == r;
+  if (kind == Kind::Memory) return reg == r || index == r;
+  return kind == Kind::Symbol; // no idea what's in there
+}
+
+bool Operand::overlaps(const Operand &other) const {
+  if (kind == Kind::Symbol || other.kind == Kind::Symbol) return true;
+  if (isRegister() && other.isRegister()) return reg == other.reg;
+  if (!isMemory() || !other.isMemory()) return false;
+
+  // Nothing we emit touches more than 8 bytes of memory at once
+  auto isStack = [](const Operand &o) { return o.reg == Reg::Rbp || o.reg == Reg::Rsp; };
+  if (reg == Reg::Rip && other.reg == Reg::Rip && index == Reg::None && other.index == Reg::None) {
+    if (symbol != other.symbol) return false; // two different globals
+    return value < other.value + 8 && other.value < value + 8;
+  }
+  if ((reg == Reg::Rip && isStack(other)) || (isStack(*this) && other.reg == Reg::Rip)) return false;
+  if (reg == other.reg && isStack(*this) && index == Reg::None && other.index == Reg::None)
+    return value < other.value + 8 && other.value < value + 8;
+  return true; // through some pointer- could be anywhere
+}
+
+int32_t Operand::intern(const std::string &name) {
+  auto [it, isNew] = ids.try_emplace(name, (int32_t)names.size());
+  if (isNew) names.push_back(name);
+  return it->second;
+}
+
+std::ostream &operator<<(std::ostream &out, const Operand &operand) { return out << operand.str(); }
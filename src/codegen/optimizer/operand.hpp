@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Every general purpose register, %rip and the xmm registers. The width lives in the Operand,
+// so %eax and %al are both Reg::Rax- which is exactly what aliasing checks want.
+enum class Reg : uint8_t {
+  None,
+  Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  Rip,
+  Xmm0, Xmm1, Xmm2, Xmm3, Xmm4, Xmm5, Xmm6, Xmm7,
+  Xmm8, Xmm9, Xmm10, Xmm11, Xmm12, Xmm13, Xmm14, Xmm15,
+};
+
+// One operand of an instruction, already picked apart:
+//   %eax               -> Register (reg = Rax, width = 4)
+//   -16(%rbp,%rcx,8)   -> Memory   (base = Rbp, index = Rcx, scale = 8, value = -16)
+//   string0+8(%rip)    -> Memory   (base = Rip, symbol = "string0", value = 8)
+//   $42 / $label       -> Immediate
+//   native_strlen      -> Symbol   (and anything else we can't make sense of, verbatim)
+// No strings inside (names are interned), so copying one around is free and comparing two is exact.
+// Codegen still writes operands as AT&T text (`.dest = "%rax"`); they get parsed right there.
+struct Operand {
+  enum class Kind : uint8_t { None, Register, Memory, Immediate, Symbol };
+
+  Kind kind = Kind::None;
+  Reg reg = Reg::None;   // the register, or the base of a memory operand
+  Reg index = Reg::None; // memory only
+  uint8_t scale = 1;     // memory only
+  uint8_t width = 8;     // registers only, in bytes (16 for xmm)
+  int32_t symbol = -1;   // interned name, -1 if there is none
+  int64_t value = 0;     // the immediate, or the displacement of a memory operand
+
+  Operand() = default;
+  Operand(const std::string &text); // NOLINT: implicit on purpose, see above
+  Operand(const char *text) : Operand(std::string(text)) {}
+  static Operand makeRegister(Reg reg, uint8_t width = 8);
+
+  std::string str() const;
+  bool operator==(const Operand &other) const = default;
+
+  bool empty() const { return kind == Kind::None; }
+  bool isRegister() const { return kind == Kind::Register; }
+  bool isMemory() const { return kind == Kind::Memory; }
+  bool isImmediate() const { return kind == Kind::Immediate; }
+  bool isConstant(int64_t v) const { return isImmediate() && symbol == -1 && value == v; }
+
+  // Does this operand read `r` at all, as itself or to work out an address?
+  bool uses(Reg r) const;
+  // Could writing to one of these two change what the other one holds?
+  bool overlaps(const Operand &other) const;
+
+private:
+  static int32_t intern(const std::string &name);
+  static inline std::vector<std::string> names = {};
+  static inline std::unordered_map<std::string, int32_t> ids = {};
+};
+
+std::ostream &operator<<(std::ostream &out, const Operand &operand);
@@ -1,335 +1,650 @@
 #include "optimize.hpp"
 #include "../gen.hpp"
-void Optimizer::optimizePair(std::vector<Instr> *output, Instr &prev, Instr &curr) {
-  if (!prev.optimize || !curr.optimize) {
-    appendAndResetPrev(output, curr, prev);
-    return;
-  }
-
-  if (curr.type == InstrType::Mov) {
-      processMov(output, prev, curr);
-  } else if (curr.type == InstrType::Linker && prev.type == InstrType::Linker) {
-      // simplifyDebug(output, prev, curr);
-      output->push_back(curr);
-  } else if (prev.type == opposites.at(curr.type)) {
-      processOppositePair(output, prev, curr);
-  } else {
-      output->push_back(curr);
-  }
+#include "passes.hpp"
+
+#include <algorithm>
+
+static constexpr uint64_t bit(Reg reg) { return 1ull << (uint64_t)reg; }
+static constexpr uint64_t registersUpTo(Reg reg) { return ~(~0ull << ((uint64_t)reg + 1)); }
+static constexpr uint64_t xmmRegisters = registersUpTo(Reg::Xmm15) & ~registersUpTo(Reg::Rip);
+static constexpr uint64_t argumentRegisters = bit(Reg::Rdi) | bit(Reg::Rsi) | bit(Reg::Rdx) | bit(Reg::Rcx) | bit(Reg::R8) |
+                                              bit(Reg::R9) | (xmmRegisters & registersUpTo(Reg::Xmm7));
+// Caller saved, plus %rbx, %r13 and %r14, which the natives trash without saving
+static constexpr uint64_t callClobbers = bit(Reg::Rax) | bit(Reg::Rcx) | bit(Reg::Rdx) | bit(Reg::Rsi) | bit(Reg::Rdi) |
+                                         bit(Reg::R8) | bit(Reg::R9) | bit(Reg::R10) | bit(Reg::R11) | bit(Reg::Rbx) |
+                                         bit(Reg::R13) | bit(Reg::R14) | xmmRegisters;
+
+static bool isGeneralPurpose(Reg reg) { return reg != Reg::None && reg < Reg::Rip; }
+
+// A plain -N(%rbp), which nothing but a pointer or the stack can alias
+static bool isFrameSlot(const Operand &what) {
+    return what.isMemory() && what.reg == Reg::Rbp && what.index == Reg::None && what.symbol == -1;
 }
 
-// Will run more instruction-specific optimizations depending on the type of the pair.
-std::vector<Instr> Optimizer::optimizeInstrs(std::vector<Instr> &input) {
-    if (input.empty())
-        return {};
-
-    std::vector<Instr> firstPass;
-    Instr prev = {.var = {}, .type = InstrType::NONE};
-
-    // Optimizes touching pairs
-    /* asm
-    pushq $4
-    popq %rax
-    */
-    for (Instr &instr : input) {
-        optimizePair(&firstPass, prev, instr);
-        prev = instr;
-    }
+// 8 bytes in, 8 bytes out. A size of None takes after the other side (`movq $1, -8(%rbp)` comes out like that)
+static bool isQwordMov(const MovInstr &mov) {
+    bool isSrcQword = mov.srcSize == DataSize::Qword, isDestQword = mov.destSize == DataSize::Qword;
+    return (isSrcQword || isDestQword) && (isSrcQword || mov.srcSize == DataSize::None) &&
+           (isDestQword || mov.destSize == DataSize::None);
+}
 
-    // Ex:
-    /* asm
-    pushq $4
-    # Comment getting the way
-    popq %rax
-    */
-   // will get optimized here
-    optimizeSpacedPairs(firstPass);
-    return firstPass;
+// How many bytes a mov/pop of this size touches, 0 if we can't tell
+static int64_t byteWidth(DataSize size) {
+    switch (size) {
+        case DataSize::Byte: return 1;
+        case DataSize::Word: return 2;
+        case DataSize::Dword:
+        case DataSize::SS: return 4;
+        case DataSize::Qword:
+        case DataSize::SD: return 8;
+        default: return 0;
+    }
 }
 
-// As the name says.
-void Optimizer::appendAndResetPrev(std::vector<Instr> *output, Instr &curr, Instr &prev) {
-    output->push_back(curr);
-    prev = Instr {.var = {}, .type=InstrType::NONE};
+// The registers an address is worked out from
+static uint64_t addressRegisters(const Operand &what) {
+    if (!what.isMemory()) return 0;
+    uint64_t regs = 0;
+    if (what.reg != Reg::None && what.reg != Reg::Rip) regs |= bit(what.reg);
+    if (what.index != Reg::None) regs |= bit(what.index);
+    return regs;
 }
 
-// Checks if mov instructions are redundant
-void Optimizer::processMov(std::vector<Instr> *output, Instr &prev, Instr &curr) {
-    MovInstr currAsMov = std::get<MovInstr>(curr.var);
+std::vector<Instr> Optimizer::optimizeInstrs(std::vector<Instr> &input) {
+    code = std::move(input);
+    removed.assign(code.size(), false);
+    extra.clear();
+    pending.clear();
+    copies.clear();
+    addresses.clear();
+    unreadStores.clear();
+    trackStores = PassManager::level != OptLevel::O0 && !codegen::debug;
+    frameEscaped = false;
+    lastRead.fill(never);
+    lastWrite.fill(never);
+    lastDef.fill(never);
+    memoryReads.clear();
+    memoryWrites.clear();
+    lastBarrier = never;
+    lastRealInstr = never;
+
+    for (size_t i = 0; i < code.size(); i++) step(i);
+
+    std::vector<Instr> output;
+    output.reserve(code.size());
+    size_t next = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        if (!removed[i]) legalize(code[i], output);
+        for (; next < extra.size() && extra[next].first == i; next++) legalize(extra[next].second, output);
+    }
+    code.clear();
+    return output;
+}
 
-    if (currAsMov.dest == currAsMov.src) return tryPop(output);
+void Optimizer::step(size_t index) {
+    if (code[index].optimize && !addresses.empty()) resolveAddresses(code[index]);
+
+    if (PushInstr *push = std::get_if<PushInstr>(&code[index].var)) {
+        PendingPush entry = {.index = index,
+                             .opaque = !code[index].optimize || shouldIgnorePushPop(push->what) || push->what.uses(Reg::Rsp) ||
+                                       push->what.kind == Operand::Kind::Symbol,
+                             .previousReads = {lastRead[(size_t)push->what.reg], lastRead[(size_t)push->what.index]}};
+        record(index, code[index]);
+        pending.push_back(entry);
+        lastRealInstr = index;
+        return;
+    }
 
-    if (prev.type == InstrType::Mov) {
-        MovInstr prevAsMov = std::get<MovInstr>(prev.var);
+    if (std::holds_alternative<PopInstr>(code[index].var) && !pending.empty()) {
+        PendingPush push = pending.back();
+        pending.pop_back();
+        if (!push.opaque && code[index].optimize && forwardPop(push, index)) return;
+    }
 
-        if (isSameMov(prevAsMov, currAsMov) || isOppositeMov(prevAsMov, currAsMov)) {
-            tryPop(output);
-            prev = Instr {.var = {}, .type=InstrType::NONE};
-            return;
-        }
-    } else if (prev.type == InstrType::Lea) {
-      processLeaMovPair(output, prev, curr);
-      return;
+    bool isGone = code[index].optimize &&
+                  ((std::holds_alternative<LeaInstr>(code[index].var) && simplifyLea(index)) ||
+                   (std::holds_alternative<MovInstr>(code[index].var) && simplifyMov(index)));
+    // Whatever goes right after it (the store half of a copy through %r13) is still there, gone or not
+    bool hasExtra = !extra.empty() && extra.back().first == index;
+    if (isGone && !hasExtra) return;
+
+    Effects fx = isGone ? Effects{} : record(index, code[index]);
+    if (hasExtra) {
+        record(index, extra.back().second, false, false);
+        lastRealInstr = index;
     }
 
-    output->push_back(curr);
-}
+    // Only a mov or an lea that does nothing but write a whole register can be deleted later on
+    Instr &instr = code[index];
+    Operand dest = {};
+    if (MovInstr *mov = std::get_if<MovInstr>(&instr.var)) dest = mov->dest;
+    else if (LeaInstr *lea = std::get_if<LeaInstr>(&instr.var)) dest = lea->dest;
+    if (instr.optimize && !hasExtra && dest.isRegister() && isGeneralPurpose(dest.reg) && dest.width >= 4)
+        lastDef[(size_t)dest.reg] = index;
 
-// Are the 2 mov instructions exactly the same src and dst
-bool Optimizer::isSameMov(const MovInstr &prev, const MovInstr &curr) {
-    return prev.dest == curr.dest && prev.src == curr.src;
+    if (fx.readCount || fx.writeCount || fx.implicitReads || fx.implicitWrites || fx.barrier) lastRealInstr = index;
 }
 
-// Are the 2 mov instructions opposites, meaning nothing has changed
-bool Optimizer::isOppositeMov(const MovInstr &prev, const MovInstr &curr) {
-    return prev.dest == curr.src && prev.src == curr.dest;
-}
+// push X ... pop Y. Returns true if the pop is gone
+bool Optimizer::forwardPop(const PendingPush &entry, size_t index) {
+    PushInstr push = std::get<PushInstr>(code[entry.index].var);
+    PopInstr pop = std::get<PopInstr>(code[index].var);
+    if (shouldIgnorePushPop(pop.where) || pop.where.uses(Reg::Rsp) || pop.where.kind == Operand::Kind::Symbol) return false;
+
+    auto dropPush = [&]() {
+        removed[entry.index] = true;
+        // It doesn't read anything anymore
+        Reg regs[] = {push.what.reg, push.what.index};
+        for (size_t r = 0; r < 2; r++)
+            if (regs[r] != Reg::None && lastRead[(size_t)regs[r]] == (long long)entry.index)
+                lastRead[(size_t)regs[r]] = entry.previousReads[r];
+    };
 
-void Optimizer::processOppositePair(std::vector<Instr> *output, Instr &prev, Instr &curr) {
-    if (curr.type == InstrType::Pop) {
-        tryPop(output);
-        simplifyPushPopPair(output, prev, curr);
-        prev = Instr {.var = {}, .type=InstrType::NONE}; // Reset prev after processing
-    } else if (curr.type == InstrType::Lea && prev.type == InstrType::Lea) {
-        // Check if the previous lea had the same source and destination
-        LeaInstr currAsLea = std::get<LeaInstr>(curr.var);
-        LeaInstr prevAsLea = std::get<LeaInstr>(prev.var);
-      
-        if (currAsLea.dest == prevAsLea.dest &&
-            !(currAsLea.src.find(prevAsLea.dest) != std::string::npos)) {
-            // leaq -8(%rbp), %rax
-            // leaq -8(%rbp), %rax
-            // will be replaced, BUT
-
-            // leaq -8(%rax), %rax
-            // leaq -8(%rax), %rax
-            // IS VERY NEEDED!!!!!!
-            // Remove prev
-            prev = Instr {.var = {}, .type=InstrType::NONE};
-            // Try pop
-            tryPop(output);
-          }
-          output->push_back(curr); // Push it anyway
-    } else {
-        output->push_back(curr);
+    bool isUnchanged = isUnchangedSince(push.what, entry.index, false);
+    // pushq %rax; popq %rax
+    if (push.what == pop.where && push.whatSize == pop.whereSize && isUnchanged) {
+        dropPush();
+        removed[index] = true;
+        return true;
     }
-}
 
-// Turn push/pops into mov's or xor's
-void Optimizer::simplifyPushPopPair(std::vector<Instr> *output, Instr &prev, Instr &curr) {
-    PushInstr prevAsPush = std::get<PushInstr>(prev.var);
-    PopInstr currAsPop = std::get<PopInstr>(curr.var);
+    bool isAdjacent = lastRealInstr == (long long)entry.index;
+    std::vector<Instr> replacement = replacePushPop(push, pop, isAdjacent);
+    // Going through %r13 is only fine if nobody else is using it in between
+    if (replacement.size() > 1 && !isAdjacent && !isUnchangedSince(Operand::makeRegister(Reg::R13), entry.index, true))
+        return false;
+
+    // X is still what it was when it got pushed: do the whole thing at the pop
+    if (isUnchanged) {
+        dropPush();
+        code[index] = replacement[0];
+        if (replacement.size() > 1) extra.push_back({index, replacement[1]});
+        return false; // there is still an instruction here, keep going with it
+    }
 
-    if (prevAsPush.what == currAsPop.where && prevAsPush.whatSize == currAsPop.whereSize) {
-        prev = Instr {.var = {}, .type=InstrType::NONE};
-        return;
+    // Nobody so much as looked at Y in between: do it at the push instead
+    if (replacement.size() == 1 && isUnchangedSince(pop.where, entry.index, true)) {
+        code[entry.index] = replacement[0];
+        removed[index] = true;
+        record(entry.index, code[entry.index], true);
+        return true;
     }
+    return false;
+}
 
-    // Check if both have same size and both have effective address ('(') 
-    if (prevAsPush.whatSize == currAsPop.whereSize && prevAsPush.what.find('(') != std::string::npos && currAsPop.where.find('(') != std::string::npos) {
-        std::string r13From = "%r13";
-        std::string r13To = "%r13";
-        switch (prevAsPush.whatSize) {
-            case DataSize::Byte:
-                r13From = "%r13b";
-                break;
-            case DataSize::Word:
-                r13From = "%r13w";
-                break;
-            case DataSize::Dword:
-            case DataSize::SS:
-                r13From = "%r13d";
-                break;
-            case DataSize::Qword:
-            case DataSize::SD:
-            default:
-                r13From = "%r13";
-                break;
-        }
-        switch (currAsPop.whereSize) {
-            case DataSize::Byte:
-                r13To = "%r13b";
-                break;
-            case DataSize::Word:
-                r13To = "%r13w";
-                break;
+// Turn push/pops into mov's or xor's
+std::vector<Instr> Optimizer::replacePushPop(const PushInstr &push, const PopInstr &pop, bool isAdjacent) {
+    // Memory to memory has to go through a register
+    if (push.whatSize == pop.whereSize && push.what.isMemory() && pop.where.isMemory()) {
+        uint8_t width = 8;
+        switch (push.whatSize) {
+            case DataSize::Byte: width = 1; break;
+            case DataSize::Word: width = 2; break;
             case DataSize::Dword:
-            case DataSize::SS:
-                r13To = "%r13d";
-                break;
-            case DataSize::Qword:
-            case DataSize::SD:
-            default:
-                r13To = "%r13";
-                break;
+            case DataSize::SS: width = 4; break;
+            default: break;
         }
-        Instr newInstr = {
-            .var = MovInstr{.dest=r13From,.src=prevAsPush.what,.destSize=prevAsPush.whatSize,.srcSize=prevAsPush.whatSize},
-            .type = InstrType::Mov,
-            .optimize = false // NO!!! DONT OPTIMIZE THIS!!!
-        };
-        prev = newInstr;
-        output->push_back(newInstr);
-
-        Instr anotherNewInstr = {
-            .var = MovInstr{.dest = currAsPop.where, .src = r13To, .destSize = currAsPop.whereSize, .srcSize = currAsPop.whereSize},
-            .type = InstrType::Mov,
-            .optimize = false // NO!!! DONT OPTIMIZE THIS!!!
+        Operand r13 = Operand::makeRegister(Reg::R13, width);
+        return {
+            // The load is fair game (it might not even have to touch memory), the store has to stay put
+            Instr{.var = MovInstr{.dest = r13, .src = push.what, .destSize = push.whatSize, .srcSize = push.whatSize},
+                  .type = InstrType::Mov},
+            Instr{.var = MovInstr{.dest = pop.where, .src = r13, .destSize = pop.whereSize, .srcSize = pop.whereSize},
+                  .type = InstrType::Mov,
+                  .optimize = false},
         };
-        output->push_back(anotherNewInstr);
-        prev = anotherNewInstr;
-        return;
     }
 
-    // NOTE: xor instruction cannot handle effective addresses (this is why we checked for the paren)
-    if (prevAsPush.what == "$0" && currAsPop.where.find('(') == std::string::npos) {
-        Instr newInstr = {.var = XorInstr{.lhs = currAsPop.where, .rhs = currAsPop.where}, .type = InstrType::Xor};
-        prev = newInstr;
-        output->push_back(newInstr);
-        return;
+    // NOTE: xor instruction cannot handle effective addresses. It also trashes the flags,
+    // so only if there is nothing in between that could have set them for somebody after us
+    if (isAdjacent && push.what.isConstant(0) && pop.where.isRegister() && isGeneralPurpose(pop.where.reg))
+        return {Instr{.var = XorInstr{.lhs = pop.where, .rhs = pop.where}, .type = InstrType::Xor}};
+
+    // The bits of a float, straight into an int register
+    if (pop.whereSize != DataSize::SS && push.whatSize == DataSize::SS && pop.where.isRegister() &&
+        isGeneralPurpose(pop.where.reg)) {
+        Operand to = Operand::makeRegister(pop.where.reg, 4);
+        if (push.what.isRegister())
+            return {Instr{.var = BinaryInstr{.op = "movd", .src = push.what, .dst = to}, .type = InstrType::Binary}};
+        return {Instr{.var = MovInstr{.dest = to, .src = push.what, .destSize = DataSize::Dword, .srcSize = DataSize::Dword},
+                      .type = InstrType::Mov}};
     }
 
-    if (currAsPop.whereSize != DataSize::SS && prevAsPush.whatSize == DataSize::SS) {
-        // If this is an effective address, use a regular mov
-        if (currAsPop.where.find('(') == std::string::npos) {
-            // The compiler would know when to convert and when not to.
-            // We have to copy the bits of the float **directly** into the register.
-
-            // movss %xmm0, (%where)
-            // movq (%where), %where
-
-            Instr firstManip = {
-                .var = MovInstr{.dest = "(" + currAsPop.where + ")", .src = prevAsPush.what, .destSize = currAsPop.whereSize, .srcSize = prevAsPush.whatSize},
-                .type = InstrType::Mov,
-                .optimize = false
-            };
-            output->push_back(firstManip);
-
-            Instr secondManip = {
-                .var = MovInstr{.dest = currAsPop.where, .src = "(" + currAsPop.where + ")", .destSize = currAsPop.whereSize, .srcSize = currAsPop.whereSize},
-                .type = InstrType::Mov,
-                .optimize = false
-            };
-            output->push_back(secondManip);
-
-            prev = {}; // This manipulation is necessary!
-            return;
+    return {Instr{.var = MovInstr{.dest = pop.where, .src = push.what, .destSize = pop.whereSize, .srcSize = push.whatSize},
+                  .type = InstrType::Mov}};
+}
+
+// Returns true if the mov is gone
+bool Optimizer::simplifyMov(size_t index) {
+    MovInstr mov = std::get<MovInstr>(code[index].var);
+
+    /*
+     * movq %rax, -8(%rbp)
+     * ...
+     * movq -8(%rbp), %rcx
+     the load doesn't have to go to memory, %rax still has it
+     */
+    if (trackStores && mov.src.isMemory() && !mov.src.uses(Reg::Rsp) && mov.dest.isRegister() && isQwordMov(mov)) {
+        for (const MovInstr &copy : copies) {
+            Operand held = {};
+            if (copy.dest == mov.src && (copy.src.isRegister() || copy.src.isImmediate())) held = copy.src;
+            else if (copy.src == mov.src && copy.dest.isRegister()) held = copy.dest;
+            // No immediates into xmm registers
+            if (held.empty() || (held.isImmediate() && !isGeneralPurpose(mov.dest.reg))) continue;
+            mov.src = held;
+            std::get<MovInstr>(code[index].var).src = held;
+            break;
         }
     }
 
-    // check if one is float register and one is int register
-    if (currAsPop.whereSize == DataSize::SS && prevAsPush.whatSize != DataSize::SS) {
-        // Instr cvtInstr = {
-        //     .var = ConvertInstr{.toSize = currAsPop.whereSize, .convType = ConvertType::SS2SI, .from = currAsPop.where, .to = currAsPop.where },
-        //     .type = InstrType::Convert
-        // };
-        // output->push_back(cvtInstr);
-        // prev = cvtInstr;
-        // return;
+    // movq %rax, %rax (but not movl %eax, %eax, that one clears the top half)
+    if (mov.dest == mov.src && mov.destSize == mov.srcSize && !(mov.dest.isRegister() && mov.dest.width == 4)) {
+        removed[index] = true;
+        return true;
     }
-    
-    Instr newInstr = {
-        .var = MovInstr{.dest = currAsPop.where, .src = prevAsPush.what, .destSize = currAsPop.whereSize, .srcSize = prevAsPush.whatSize},
-        .type = InstrType::Mov
-    };
-    prev = newInstr;
-    output->push_back(newInstr);
-    return;
-}
-
 
-void Optimizer::processLeaMovPair(std::vector<Instr> *output, Instr &prev, Instr &curr) {
-    MovInstr currAsMov = std::get<MovInstr>(curr.var);
-    LeaInstr prevAsLea = std::get<LeaInstr>(prev.var);
+    // It's already in there
+    if (isQwordMov(mov)) {
+        for (const MovInstr &copy : copies) {
+            if ((copy.dest == mov.dest && copy.src == mov.src) || (copy.dest == mov.src && copy.src == mov.dest)) {
+                removed[index] = true;
+                return true;
+            }
+        }
+    }
 
     /*
      * leaq -8(%rbp), %rax
      * movq %rax, %rdi
      is the same as
      * leaq -8(%rbp), %rdi
+     (and the first lea goes away by itself once %rax gets overwritten, if nobody else read it)
      */
-    if (currAsMov.src == prevAsLea.dest) {
-        // check if the dest was an effective address
-        if (currAsMov.dest.find('(') != std::string::npos) {
-          output->push_back(curr);
-          return;
+    if (mov.src.isRegister() && mov.src.width == 8 && mov.dest.isRegister() && mov.dest.width == 8 &&
+        isGeneralPurpose(mov.dest.reg) && mov.srcSize == DataSize::Qword && mov.destSize == DataSize::Qword) {
+        long long at = lastWrite[(size_t)mov.src.reg];
+        if (at <= lastBarrier || removed[at] || !code[at].optimize || (!extra.empty() && extra.back().first == (size_t)at))
+            return false;
+        LeaInstr *lea = std::get_if<LeaInstr>(&code[at].var);
+        if (lea == nullptr || lea->dest != mov.src || lea->src.uses(lea->dest.reg)) return false;
+        uint64_t regs = addressRegisters(lea->src);
+        for (size_t r = 0; r < registerCount; r++)
+            if ((regs & (1ull << r)) && lastWrite[r] > at) return false;
+        code[index] = Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = mov.dest, .src = lea->src}, .type = InstrType::Lea};
+    }
+    return false;
+}
+
+// Returns true if the lea is gone
+bool Optimizer::simplifyLea(size_t index) {
+    LeaInstr lea = std::get<LeaInstr>(code[index].var);
+    /*
+     * leaq -32(%rbp), %rcx
+     * movq (%rcx,%rdi,8), %rax
+     * leaq -32(%rbp), %rcx   <- still there
+     (codegen works out the address of `a[i]` or `s.x` from scratch every single time)
+     */
+    for (const LeaInstr &known : addresses) {
+        if (known.src != lea.src) continue;
+        if (known.dest == lea.dest) {
+            removed[index] = true;
+            return true;
         }
-        // Get rid of the mov and the leaq
-        tryPop(output);
-        // Create a new lea instruction with the mov's src
-        Instr newInstr = {
-          .var = LeaInstr{.size = prevAsLea.size, .dest = currAsMov.dest, .src = prevAsLea.src},
-          .type = InstrType::Lea
-        };
-        output->push_back(newInstr);
-        prev = Instr {.var = {}, .type=InstrType::NONE};
-        return;
+        if (lea.dest.isRegister() && isGeneralPurpose(lea.dest.reg) && lea.dest.width == 8)
+            code[index] = Instr{.var = MovInstr{.dest = lea.dest, .src = known.dest, .destSize = DataSize::Qword, .srcSize = DataSize::Qword},
+                                .type = InstrType::Mov};
+        return false;
+    }
+    return false;
+}
+
+/*
+ * leaq -48(%rbp), %rcx
+ * movq 8(%rcx), %rax
+ is just
+ * movq -40(%rbp), %rax
+ which is something we know a lot more about than "whatever %rcx points to" (and the lea might not be needed anymore)
+ */
+void Optimizer::resolveAddresses(Instr &instr) {
+    auto resolve = [](auto &field) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(field)>, Operand>) {
+        Operand &what = field; // (DataSectionInstr's `what` is just text)
+        if (!what.isMemory() || what.symbol != -1) return;
+        for (const LeaInstr &known : addresses) {
+            if (known.dest.reg != what.reg || known.src.index != Reg::None) continue;
+            if (known.src.reg != Reg::Rbp && !(known.src.reg == Reg::Rip && what.index == Reg::None)) continue;
+            what.reg = known.src.reg;
+            what.symbol = known.src.symbol;
+            what.value += known.src.value;
+            return;
+        }
+        }
+    };
+    std::visit([&](auto &i) {
+        if constexpr (requires { i.src; }) resolve(i.src);
+        if constexpr (requires { i.dest; }) resolve(i.dest);
+        if constexpr (requires { i.dst; }) resolve(i.dst);
+        if constexpr (requires { i.what; }) resolve(i.what);
+        if constexpr (requires { i.where; }) resolve(i.where);
+        if constexpr (requires { i.lhs; }) resolve(i.lhs);
+        if constexpr (requires { i.rhs; }) resolve(i.rhs);
+        if constexpr (requires { i.from; }) resolve(i.from);
+        if constexpr (requires { i.to; }) resolve(i.to);
+    }, instr.var);
+}
+
+void Optimizer::writeRegister(Reg reg, bool isFullWrite, long long index) {
+    size_t r = (size_t)reg;
+    long long def = lastDef[r];
+    // Written, and then written again before anybody had a look
+    if (isFullWrite && def > lastBarrier && def < index && lastRead[r] < def) removed[def] = true;
+    lastDef[r] = never;
+    lastWrite[r] = std::max(lastWrite[r], index);
+}
+
+// Remember what `index` read and wrote. Retroactive means it was just put in at an earlier index,
+// removable means it is code[index] itself (and not something that has to go right after it)
+Optimizer::Effects Optimizer::record(long long index, const Instr &instr, bool isRetroactive, bool isRemovable) {
+    Effects fx = effects(instr);
+    auto readRegisters = [&](uint64_t regs) {
+        for (size_t r = 0; regs; r++, regs >>= 1)
+            if (regs & 1) lastRead[r] = std::max(lastRead[r], index);
+    };
+    auto forget = [&](auto &&isClobbered) {
+        std::erase_if(copies, [&](const MovInstr &copy) { return isClobbered(copy.dest) || isClobbered(copy.src); });
+    };
+    // An address only changes with the registers it is made of, whatever happens to the memory there
+    auto forgetAddresses = [&](uint64_t regs) {
+        std::erase_if(addresses, [&](const LeaInstr &known) {
+            return (regs & bit(known.dest.reg)) || (addressRegisters(known.src) & regs);
+        });
+    };
+
+    // Reads first, `addq %rax, %rax` reads %rax before it writes it
+    for (size_t i = 0; i < fx.readCount; i++) {
+        const Operand &what = fx.reads[i];
+        if (what.isRegister()) readRegisters(bit(what.reg));
+        if (what.isMemory()) memoryReads.touch(what, index);
+        readRegisters(addressRegisters(what));
+    }
+    readRegisters(fx.implicitReads);
+    if (fx.touchesAllMemory) memoryReads.touchAll(index);
+
+    bool touchesStack = fx.implicitWrites & bit(Reg::Rsp);
+    for (size_t i = 0; i < fx.readCount; i++) touchesStack |= fx.reads[i].uses(Reg::Rsp);
+    for (size_t i = 0; i < fx.writeCount; i++) {
+        const Operand &what = fx.writes[i];
+        readRegisters(addressRegisters(what));
+        if (what.isRegister()) writeRegister(what.reg, isGeneralPurpose(what.reg) && what.width >= 4, index);
+        if (what.isMemory()) memoryWrites.touch(what, index);
+        touchesStack |= what.uses(Reg::Rsp);
+        forget([&](const Operand &held) { return held.overlaps(what) || (what.isRegister() && held.uses(what.reg)); });
+        if (what.isRegister()) forgetAddresses(bit(what.reg));
+    }
+    for (size_t r = 0; r < registerCount; r++)
+        if (fx.implicitWrites & (1ull << r)) writeRegister((Reg)r, true, index);
+    if (fx.implicitWrites) {
+        forget([&](const Operand &held) {
+            return (held.isRegister() && (fx.implicitWrites & bit(held.reg))) || (addressRegisters(held) & fx.implicitWrites);
+        });
+        forgetAddresses(fx.implicitWrites);
+    }
+    if (fx.touchesAllMemory) {
+        memoryWrites.touchAll(index);
+        forget([](const Operand &held) { return held.isMemory(); });
+    }
+
+    // Anything that moves %rsp (or reads off of it) between a push and its pop pins both of them down
+    if (touchesStack) pending.clear();
+
+    // Once the address of the frame is out there (an lea off of %rbp, or %rbp itself), it might get read after we return
+    bool readsFrame = fx.implicitReads & bit(Reg::Rbp);
+    for (size_t i = 0; i < fx.readCount; i++) readsFrame |= fx.reads[i].isRegister() && fx.reads[i].reg == Reg::Rbp;
+    if (readsFrame) frameEscaped = true;
+
+    const MovInstr *mov = std::get_if<MovInstr>(&instr.var);
+    const PopInstr *pop = std::get_if<PopInstr>(&instr.var);
+    if (trackStores && !isRetroactive) {
+        // Nobody can read this frame anymore, so whatever is still unread never will be
+        if (fx.endsFrame && !frameEscaped)
+            for (const Store &store : unreadStores) removed[store.index] = true;
+        // A pop reads off the stack, and who knows where that is compared to %rbp
+        if (fx.touchesAllMemory || pop != nullptr) unreadStores.clear();
+        for (size_t i = 0; i < fx.readCount; i++)
+            if (fx.reads[i].isMemory()) readStores(fx.reads[i]);
+        for (size_t i = 0; i < fx.writeCount; i++) {
+            const Operand &what = fx.writes[i];
+            if (!what.isMemory()) continue;
+            // Only a mov or a pop writes without reading what was there first
+            int64_t width = 0;
+            if (mov && (mov->destSize == mov->srcSize || mov->srcSize == DataSize::None)) width = byteWidth(mov->destSize);
+            else if (mov && mov->destSize == DataSize::None) width = byteWidth(mov->srcSize);
+            else if (pop) width = byteWidth(pop->whereSize);
+            overwriteStores(what, width);
+            if (mov && isRemovable && instr.optimize && width && isFrameSlot(what))
+                unreadStores.push_back({.index = index, .offset = what.value, .width = width});
+        }
+    }
+    if (fx.writeCount && fx.writes[0].isRegister() && fx.writes[0].reg == Reg::Rbp && !fx.endsFrame)
+        frameEscaped = false; // a brand new frame
+
+    if (fx.barrier) {
+        pending.clear();
+        copies.clear();
+        addresses.clear();
+        unreadStores.clear();
+        memoryReads.clear();
+        memoryWrites.clear();
+        lastBarrier = index;
+        return fx;
+    }
+
+    // Remember what this lea worked out, so we don't have to work it out again
+    const LeaInstr *lea = std::get_if<LeaInstr>(&instr.var);
+    if (!isRetroactive && lea && lea->dest.isRegister() && isGeneralPurpose(lea->dest.reg) && lea->dest.width == 8 &&
+        !lea->src.uses(lea->dest.reg) && !lea->src.uses(Reg::Rsp) && lea->src.kind == Operand::Kind::Memory) {
+        if (addresses.size() == 8) addresses.erase(addresses.begin());
+        addresses.push_back(*lea);
+    }
+
+    // Remember what this mov copied, so we don't copy it again. (Unless it went back in time,
+    // then the source might not hold that anymore.)
+    if (isRetroactive || mov == nullptr || !isQwordMov(*mov)) return fx;
+    auto isPlain = [](const Operand &o) {
+        return (o.isRegister() && isGeneralPurpose(o.reg) && o.width == 8) || o.isMemory() || o.isImmediate();
+    };
+    if (!isPlain(mov->dest) || !isPlain(mov->src) || mov->dest.isImmediate() || mov->dest == mov->src) return fx;
+    if (mov->dest.uses(Reg::Rsp) || mov->src.uses(Reg::Rsp)) return fx;
+    if (mov->dest.isRegister() && mov->src.uses(mov->dest.reg)) return fx; // movq (%rax), %rax
+    if (copies.size() == 16) copies.erase(copies.begin());
+    copies.push_back(*mov);
+    return fx;
+}
+
+// Somebody read `where`: the stores it could have read from aren't dead
+void Optimizer::readStores(const Operand &where) {
+    if (isFrameSlot(where)) {
+        // Nothing we emit reads more than 8 bytes at once
+        std::erase_if(unreadStores, [&](const Store &store) {
+            return store.offset < where.value + 8 && where.value < store.offset + store.width;
+        });
+    } else if (where.reg != Reg::Rip || where.index != Reg::None) {
+        unreadStores.clear(); // through a pointer, so it could be any of them
+    }
+}
+
+// Somebody wrote `width` bytes to `where` (0 if we don't know how many, or it read them first):
+// the stores it covers completely were never read by anybody
+void Optimizer::overwriteStores(const Operand &where, int64_t width) {
+    if (!isFrameSlot(where)) return; // a pointer might land on a slot, but that never makes a store live
+    std::erase_if(unreadStores, [&](const Store &store) {
+        bool isCovered = width && where.value <= store.offset && store.offset + store.width <= where.value + width;
+        if (isCovered) removed[store.index] = true;
+        return isCovered || (store.offset < where.value + std::max<int64_t>(width, 8) && where.value < store.offset + store.width);
+    });
+}
+
+// Has anything after `since` written `what` (or read it, with `orRead`)?
+bool Optimizer::isUnchangedSince(const Operand &what, long long since, bool orRead) {
+    if (!what.isRegister() && !what.isMemory() && !what.isImmediate()) return false;
+    uint64_t regs = addressRegisters(what);
+    if (what.isRegister()) regs |= bit(what.reg);
+    for (size_t r = 0; r < registerCount; r++)
+        if ((regs & (1ull << r)) && lastWrite[r] > since) return false;
+    if (what.isRegister()) return !orRead || lastRead[(size_t)what.reg] <= since;
+    if (what.isMemory()) return memoryWrites.last(what) <= since && (!orRead || memoryReads.last(what) <= since);
+    return true;
+}
+
+void Optimizer::MemoryClock::touch(const Operand &where, long long index) {
+    any = std::max(any, index);
+    if (where.reg == Reg::Rbp && where.index == Reg::None && where.symbol == -1) {
+        // Nothing we emit touches more than 8 bytes at once
+        for (int64_t block : {where.value >> 3, (where.value + 7) >> 3}) frame[block] = std::max(frame[block], index);
+    } else if (where.reg == Reg::Rip && where.index == Reg::None) {
+        global = std::max(global, index);
     } else {
-        output->push_back(curr);
+        pointer = std::max(pointer, index);
     }
 }
 
-// Optimize pairs with a useless instruction in between
-// Ok look, I fed the previous code into chatgpt until it gave me something good. Don't judge me!
-void Optimizer::optimizeSpacedPairs(std::vector<Instr> &firstPass) {
-    Instr prev = {.var = {}, .type = InstrType::NONE};
-    size_t prevIndex = 0;
-
-    for (size_t i = 0; i < firstPass.size(); ++i) {
-        Instr &instr = firstPass[i];
-
-        if (instr.type == InstrType::Push) {
-            PushInstr push = std::get<PushInstr>(instr.var);
-            if (shouldIgnorePushPop(push.what)) continue;
-            prev = instr;
-            prevIndex = i;
-        } else if (prev.type == InstrType::Push && instr.type == InstrType::Pop) {
-            PopInstr pop = std::get<PopInstr>(instr.var);
-            PushInstr push = std::get<PushInstr>(prev.var);
-
-            // Only replace push/pop with mov if no intermediate instructions
-            // are modifying the registers involved.
-            bool canOptimize = true;
-
-            // Check if the registers involved are used in any subsequent calculations
-            for (size_t j = prevIndex + 1; j < i; ++j) {
-                Instr &midInstr = firstPass[j];
-                // If any register is used in a calculation, we shouldn't optimize
-                if (midInstr.type == InstrType::Mov) {
-                    MovInstr mov = std::get<MovInstr>(midInstr.var);
-                    if (mov.dest == push.what || mov.src == push.what || 
-                        mov.dest == pop.where || mov.src == pop.where) {
-                        canOptimize = false;
-                        break;
-                    }
-                }
-            }
+void Optimizer::MemoryClock::touchAll(long long index) {
+    pointer = std::max(pointer, index);
+    any = std::max(any, index);
+}
 
-            if (canOptimize) {
-                firstPass.erase(firstPass.begin() + prevIndex);
-                firstPass.erase(firstPass.begin() + i - 1);
+long long Optimizer::MemoryClock::last(const Operand &where) const {
+    if (where.reg == Reg::Rbp && where.index == Reg::None && where.symbol == -1) {
+        long long latest = pointer;
+        for (int64_t block : {where.value >> 3, (where.value + 7) >> 3}) {
+            auto it = frame.find(block);
+            if (it != frame.end()) latest = std::max(latest, it->second);
+        }
+        return latest;
+    }
+    if (where.reg == Reg::Rip && where.index == Reg::None) return std::max(global, pointer);
+    return any;
+}
 
-                Instr newInstr = {
-                    .var = MovInstr{.dest = pop.where, .src = push.what, .destSize = pop.whereSize, .srcSize = push.whatSize},
-                    .type = InstrType::Mov
-                };
-                firstPass.insert(firstPass.begin() + prevIndex, newInstr);
+Optimizer::Effects Optimizer::effects(const Instr &instr) {
+    struct Visitor {
+        Effects fx = {};
 
-                // Skip over the new mov instruction and reset prev
-                i = prevIndex;
-                prev = Instr {.var = {}, .type = InstrType::NONE};
+        void operator()(const MovInstr &i) { fx.read(i.src); fx.write(i.dest); }
+        void operator()(const LeaInstr &i) { fx.implicitReads |= addressRegisters(i.src); fx.write(i.dest); }
+        void operator()(const PushInstr &i) { fx.read(i.what); }
+        void operator()(const PopInstr &i) {
+            fx.write(i.where);
+            fx.endsFrame = i.where.isRegister() && i.where.reg == Reg::Rbp; // the epilogue
+        }
+        void operator()(const XorInstr &i) { fx.read(i.lhs); fx.read(i.rhs); fx.write(i.rhs); } // xor lhs, rhs -> rhs
+        void operator()(const AddInstr &i) { fx.read(i.lhs); fx.read(i.rhs); fx.write(i.lhs); }
+        void operator()(const SubInstr &i) { fx.read(i.lhs); fx.read(i.rhs); fx.write(i.lhs); }
+        void operator()(const CmpInstr &i) { fx.read(i.lhs); fx.read(i.rhs); }
+        void operator()(const NegInstr &i) { fx.read(i.what); fx.write(i.what); }
+        void operator()(const NotInstr &i) { fx.read(i.what); fx.write(i.what); }
+        void operator()(const ConvertInstr &i) { fx.read(i.from); fx.read(i.to); fx.write(i.to); }
+        void operator()(const MulInstr &i) { wide(i.from); }
+        void operator()(const DivInstr &i) { wide(i.from); }
+        void operator()(const BinaryInstr &i) {
+            static const std::string signExtends[] = {"cqto", "cqo", "cltd", "cdq", "cltq", "cwtl"};
+            if (std::find(std::begin(signExtends), std::end(signExtends), i.op) != std::end(signExtends)) {
+                fx.implicitReads |= bit(Reg::Rax);
+                fx.implicitWrites |= bit(Reg::Rax) | bit(Reg::Rdx);
+            } else if (i.dst.empty() && (i.op.starts_with("div") || i.op.starts_with("idiv") || i.op.starts_with("mul") ||
+                                         i.op.starts_with("imul"))) {
+                wide(i.src);
+            } else if (i.src.empty() && i.dst.empty()) {
+                fx.barrier = true; // leave and friends
+                fx.endsFrame = i.op == "leave";
+            } else if (i.dst.empty()) {
+                fx.read(i.src); // inc, setcc...
+                fx.write(i.src);
             } else {
-                // If optimization isn't possible, just continue
-                prev = instr;
+                fx.read(i.src);
+                fx.read(i.dst);
+                fx.write(i.dst);
             }
         }
-    }
+        void operator()(const CallInstr &i) {
+            fx.implicitReads |= argumentRegisters;
+            // C functions could be variadic, and those take how many xmm registers they got in %al
+            if (i.name.ends_with("@PLT")) fx.implicitReads |= bit(Reg::Rax);
+            fx.implicitWrites |= callClobbers;
+            fx.touchesAllMemory = true;
+            fx.barrier = true;
+        }
+        void operator()(const Comment &) {}
+        void operator()(const LinkerDirective &i) {
+            // Debug info and CFI don't do anything at runtime. Everything else is raw assembly we can't see into
+            size_t start = i.value.find_first_not_of(" \t\n");
+            if (start == std::string::npos) return;
+            fx.barrier = i.value.compare(start, 4, ".loc") != 0 && i.value.compare(start, 4, ".cfi") != 0;
+        }
+        // Control flow, and things that aren't code at all
+        void operator()(const Label &) { fx.barrier = true; }
+        void operator()(const JumpInstr &) { fx.barrier = true; }
+        void operator()(const Ret &) { fx.barrier = true; }
+        void operator()(const Syscall &) { fx.barrier = true; }
+        void operator()(const DataSectionInstr &) { fx.barrier = true; }
+        void operator()(const AscizInstr &) { fx.barrier = true; }
+
+        // mul/div: rdx:rax in, rdx:rax out
+        void wide(const Operand &from) {
+            fx.read(from);
+            fx.implicitReads |= bit(Reg::Rax) | bit(Reg::Rdx);
+            fx.implicitWrites |= bit(Reg::Rax) | bit(Reg::Rdx);
+        }
+    };
+    Visitor visitor;
+    std::visit(visitor, instr.var);
+    // A new %rbp means every frame slot is somewhere else now
+    for (size_t i = 0; i < visitor.fx.writeCount; i++)
+        if (visitor.fx.writes[i].isRegister() && visitor.fx.writes[i].reg == Reg::Rbp) visitor.fx.barrier = true;
+    return visitor.fx;
 }
 
+// You can't push or pop a byte, a dword or an xmm register. If one of those didn't get paired up
+// with its other half, spell it out with a mov and move %rsp by hand (with lea, so the flags survive).
+void Optimizer::legalize(const Instr &instr, std::vector<Instr> &output) {
+    const PushInstr *push = std::get_if<PushInstr>(&instr.var);
+    const PopInstr *pop = std::get_if<PopInstr>(&instr.var);
+    DataSize size = push ? push->whatSize : pop ? pop->whereSize : DataSize::Qword;
+    if (size == DataSize::Qword || size == DataSize::Word || size == DataSize::None) {
+        output.push_back(instr);
+        return;
+    }
 
+    auto mov = [&](const Operand &dest, const Operand &src, DataSize movSize) {
+        output.push_back(Instr{.var = MovInstr{.dest = dest, .src = src, .destSize = movSize, .srcSize = movSize},
+                               .type = InstrType::Mov,
+                               .optimize = false});
+    };
+    auto moveStack = [&](const std::string &by) {
+        output.push_back(Instr{.var = LeaInstr{.size = DataSize::Qword, .dest = "%rsp", .src = by + "(%rsp)"},
+                               .type = InstrType::Lea,
+                               .optimize = false});
+    };
+    auto copy = [&](const Operand &dest, const Operand &src) {
+        if (!dest.isMemory() || !src.isMemory()) return mov(dest, src, size);
+        // Memory to memory goes through %r13, bit for bit
+        DataSize bits = size == DataSize::SS ? DataSize::Dword : size == DataSize::SD ? DataSize::Qword : size;
+        Operand r13 = Operand::makeRegister(Reg::R13, bits == DataSize::Byte ? 1 : bits == DataSize::Dword ? 4 : 8);
+        mov(r13, src, bits);
+        mov(dest, r13, bits);
+    };
+
+    if (push) {
+        moveStack("-8");
+        copy("(%rsp)", push->what);
+    } else {
+        copy(pop->where, "(%rsp)");
+        moveStack("8");
+    }
+}
 
 // Normal code compiled from user's zura will never affect the stack registers
 // They will be affected when it is ABSOLUTELY necessary (for exanple, function scopes)
-bool Optimizer::shouldIgnorePushPop(const std::string &reg) {
-    return reg == "%rbp" || reg == "%rsp";
-}
\ No newline at end of file
+bool Optimizer::shouldIgnorePushPop(const Operand &reg) {
+    return reg.isRegister() && (reg.reg == Reg::Rbp || reg.reg == Reg::Rsp);
+}
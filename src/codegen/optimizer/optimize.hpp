@@ -2,29 +2,107 @@
 
 #include "instr.hpp"
 
+#include <array>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
+// The peephole optimizer. It makes one pass over what codegen produced, front to back:
+//  - `push X ... pop Y` turns into a mov (or nothing at all), no matter what is in between, as long as it doesn't care
+//  - a mov that copies something that is already there goes away, and a load from a stack slot whose value
+//    is still sitting in a register (or is a known constant) reads that instead
+//  - a store to a stack slot that gets overwritten (or the function returns) before anybody reads it goes away
+//  - `lea S, %r; ... mov %r, %d` turns into `lea S, %d`, and an lea of an address some register already holds
+//    turns into a mov from that register (or nothing at all), and `8(%r)` turns into `S+8` if %r holds the address S
+//  - a register that is overwritten before anybody reads it didn't need to be written in the first place
+// Instead of looking at neighbouring instructions, it remembers the last instruction that read and wrote
+// every register (and, roughly, every bit of memory), which answers "did anything touch this since then?"
+// in O(1). Nothing is erased until the very end, so the whole thing is linear in the size of the code.
 class Optimizer {
 public:
-    template <typename T>
-    static void tryPop(std::vector<T> *out) {
-      if (out->empty()) return;
-      out->pop_back();
-    }
-
-    static void optimizePair(std::vector<Instr> *output, Instr &prev, Instr &curr);
     static std::vector<Instr> optimizeInstrs(std::vector<Instr> &input);
 
 private:
-    static void appendAndResetPrev(std::vector<Instr> *output, Instr &curr, Instr &prev);
-    static void processMov(std::vector<Instr> *output, Instr &prev, Instr &curr);
-    static void simplifyPushPopPair(std::vector<Instr> *output, Instr &prev, Instr &curr);
-    static void processLeaMovPair(std::vector<Instr> *output, Instr &prev, Instr &curr);
-    static void processOppositePair(std::vector<Instr> *output, Instr &prev, Instr &curr);
-    static void optimizeSpacedPairs(std::vector<Instr> &firstPass);
-    // static void simplifyDebug(std::vector<Instr> *output, Instr &prev, Instr &curr);
-    static bool isSameMov(const MovInstr &prev, const MovInstr &curr);
-    static bool isOppositeMov(const MovInstr &prev, const MovInstr &curr);
-    static bool shouldIgnorePushPop(const std::string &reg);
-    static inline int previousDebugLine = 0;
-};
\ No newline at end of file
+    static constexpr long long never = -1;
+    static constexpr size_t registerCount = (size_t)Reg::Xmm15 + 1;
+
+    // What a single instruction reads and writes
+    struct Effects {
+        std::array<Operand, 3> reads = {};
+        std::array<Operand, 2> writes = {};
+        size_t readCount = 0;
+        size_t writeCount = 0;
+        uint64_t implicitReads = 0;  // registers it reads without naming them (div, call, an lea's address...)
+        uint64_t implicitWrites = 0;
+        bool touchesAllMemory = false; // calls
+        bool barrier = false;          // control flow, or something we can't see into
+        bool endsFrame = false;        // popq %rbp / leave: nothing can read this frame's slots anymore
+
+        void read(const Operand &what) { if (!what.empty()) reads[readCount++] = what; }
+        void write(const Operand &what) { if (!what.empty()) writes[writeCount++] = what; }
+    };
+
+    // When memory was last read (or written), as precisely as the operand lets us tell
+    struct MemoryClock {
+        std::unordered_map<int64_t, long long> frame; // 8 byte blocks of the stack frame, off of %rbp
+        long long global;  // anything %rip relative
+        long long pointer; // through some other register, so it could be anywhere
+        long long any;
+
+        MemoryClock() { clear(); }
+        void touch(const Operand &where, long long index);
+        void touchAll(long long index);
+        long long last(const Operand &where) const;
+        void clear() {
+            frame.clear();
+            global = pointer = any = never;
+        }
+    };
+
+    // A store to a stack slot nobody has read yet
+    struct Store {
+        long long index;
+        int64_t offset;
+        int64_t width;
+    };
+
+    // A push that hasn't been popped yet
+    struct PendingPush {
+        size_t index;
+        bool opaque; // leave it alone (push %rbp, or codegen said so)
+        std::array<long long, 2> previousReads; // lastRead of its registers before the push, in case it goes away
+    };
+
+    static Effects effects(const Instr &instr);
+    static void step(size_t index);
+    static bool forwardPop(const PendingPush &push, size_t index);
+    static bool simplifyMov(size_t index);
+    static bool simplifyLea(size_t index);
+    static void resolveAddresses(Instr &instr);
+    static Effects record(long long index, const Instr &instr, bool isRetroactive = false, bool isRemovable = true);
+    static void readStores(const Operand &where);
+    static void overwriteStores(const Operand &where, int64_t width);
+    static void writeRegister(Reg reg, bool isFullWrite, long long index);
+    static bool isUnchangedSince(const Operand &what, long long since, bool orRead);
+    static std::vector<Instr> replacePushPop(const PushInstr &push, const PopInstr &pop, bool isAdjacent);
+    static void legalize(const Instr &instr, std::vector<Instr> &output);
+    static bool shouldIgnorePushPop(const Operand &reg);
+
+    static inline std::vector<Instr> code = {};
+    static inline std::vector<bool> removed = {};
+    static inline std::vector<std::pair<size_t, Instr>> extra = {}; // {i, instr}: goes right after code[i]
+    static inline std::vector<PendingPush> pending = {};
+    static inline std::vector<MovInstr> copies = {}; // after these movs, `dest` and `src` hold the same thing
+    static inline std::vector<LeaInstr> addresses = {}; // after these leas, `dest` holds the address of `src`
+    static inline std::vector<Store> unreadStores = {};
+    static inline bool trackStores = false;  // forwarding and dead stores, not at -O0 or with -debug
+    static inline bool frameEscaped = false; // something knows where this frame is, so it isn't dead after we return
+
+    static inline std::array<long long, registerCount> lastRead = {};
+    static inline std::array<long long, registerCount> lastWrite = {};
+    static inline std::array<long long, registerCount> lastDef = {}; // last mov/lea into it we could delete
+    static inline MemoryClock memoryReads = {};
+    static inline MemoryClock memoryWrites = {};
+    static inline long long lastBarrier = never;
+    static inline long long lastRealInstr = never; // not a comment or a .loc
+};
@@ -0,0 +1,170 @@
+#include "passes.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include "../ir/opt.hpp"
+#include "callgraph.hpp"
+#include "compiler.hpp"
+#include "ctfe.hpp"
+#include "frame.hpp"
+#include "inliner.hpp"
+#include "optimize.hpp"
+#include "profile.hpp"
+#include "tailcall.hpp"
+#include "unroll.hpp"
+#include "vectorize.hpp"
+
+static constexpr unsigned bit(OptLevel level) { return 1u << (unsigned)level; }
+static constexpr unsigned allLevels = bit(OptLevel::O0) | bit(OptLevel::O1) | bit(OptLevel::O2) | bit(OptLevel::Os);
+static constexpr unsigned optimizing = bit(OptLevel::O1) | bit(OptLevel::O2) | bit(OptLevel::Os);
+static constexpr unsigned never = 0;
+
+// In the order they run
+std::vector<PassManager::Pass> PassManager::passes = {
+  // Before anything else touches the tree, so both profile builds number the counters the same way
+  {.name = "profile", .stage = Stage::Ast, .levels = allLevels, .fixpointLevels = never,
+   .ast = Profile::run},
+  {.name = "ctfe", .stage = Stage::Ast, .levels = bit(OptLevel::O2) | bit(OptLevel::Os), .fixpointLevels = never,
+   .ast = Ctfe::run},
+  // Before inlining, which leaves recursive functions alone but is happy to paste in a loop
+  {.name = "tail-calls", .stage = Stage::Ast, .levels = optimizing, .fixpointLevels = never,
+   .ast = TailCalls::run, .reshapes = true},
+  {.name = "inline", .stage = Stage::Ast, .levels = bit(OptLevel::O2) | bit(OptLevel::Os), .fixpointLevels = never,
+   .ast = [](Node::Stmt *program) {
+     Inliner::optimizeForSize = level == OptLevel::Os;
+     return Inliner::run(program);
+   }, .reshapes = true},
+  // Before the unroller gets to them: a vector loop already does 2 to 32 elements at a time
+  {.name = "vectorize", .stage = Stage::Ast, .levels = bit(OptLevel::O2), .fixpointLevels = never,
+   .ast = Vectorizer::run, .reshapes = true},
+  // -O1 and -Os only unroll what they are told to with @unroll(n)
+  {.name = "unroll", .stage = Stage::Ast, .levels = optimizing, .fixpointLevels = never,
+   .ast = [](Node::Stmt *program) {
+     Unroller::isAutomatic = level == OptLevel::O2;
+     return Unroller::run(program);
+   }, .reshapes = true},
+  {.name = "dead-functions", .stage = Stage::Ast, .levels = optimizing, .fixpointLevels = never,
+   .ast = CallGraph::build},
+  // Folding and the peephole optimizer run even at -O0 (just once there). Codegen leans on both of them:
+  // it can't lower a few shapes on its own (like negative float literals), and some of what it emits
+  // (byte sized push/pop pairs) only turns into valid assembly after the peephole optimizer rewrites it.
+  {.name = "fold", .stage = Stage::Ast, .levels = allLevels, .fixpointLevels = optimizing,
+   .ast = CompileOptimizer::foldTree},
+  {.name = "ir-fold", .stage = Stage::Ir, .levels = optimizing, .fixpointLevels = optimizing,
+   .ir = ir::Passes::fold},
+  {.name = "ir-simplify-cfg", .stage = Stage::Ir, .levels = optimizing, .fixpointLevels = optimizing,
+   .ir = ir::Passes::simplifyCfg},
+  {.name = "ir-gvn", .stage = Stage::Ir, .levels = optimizing, .fixpointLevels = optimizing,
+   .ir = ir::Passes::valueNumbering},
+  {.name = "ir-licm", .stage = Stage::Ir, .levels = optimizing, .fixpointLevels = optimizing,
+   .ir = ir::Passes::hoistInvariants},
+  // Trades a multiply for an extra register and an add, which isn't a trade -Os wants to make
+  {.name = "ir-iv", .stage = Stage::Ir, .levels = bit(OptLevel::O1) | bit(OptLevel::O2), .fixpointLevels = never,
+   .ir = ir::Passes::reduceInductions},
+  {.name = "ir-dce", .stage = Stage::Ir, .levels = optimizing, .fixpointLevels = optimizing,
+   .ir = ir::Passes::deadCode},
+  // One pass is enough for the peephole optimizer, it already sees through whatever is in between (see optimize.hpp)
+  {.name = "peephole", .stage = Stage::Machine, .levels = allLevels, .fixpointLevels = never,
+   .machine = [](std::vector<Instr> &code) {
+     size_t before = code.size();
+     code = Optimizer::optimizeInstrs(code);
+     return before - code.size(); // it only ever removes (or merges) instructions
+   }},
+  // After the peephole optimizer, once the push/pop pairs that would keep %rsp moving are gone
+  {.name = "omit-frame", .stage = Stage::Machine, .levels = optimizing, .fixpointLevels = never,
+   .machine = FrameOmission::run},
+};
+
+bool PassManager::parseLevel(const std::string &flag) {
+  if (flag == "-O0") level = OptLevel::O0;
+  else if (flag == "-O1") level = OptLevel::O1;
+  else if (flag == "-O2") level = OptLevel::O2;
+  else if (flag == "-Os") level = OptLevel::Os;
+  else return false;
+  return true;
+}
+
+bool PassManager::parseArch(const std::string &arch) {
+  if (arch == "x86-64") isa = Isa::Sse2;
+  else if (arch == "x86-64-v2") isa = Isa::Sse41;
+  else if (arch == "x86-64-v3" || arch == "x86-64-v4") isa = Isa::Avx2;
+  else if (arch == "native") isa = __builtin_cpu_supports("avx2") ? Isa::Avx2 : __builtin_cpu_supports("sse4.1") ? Isa::Sse41 : Isa::Sse2;
+  else return false;
+  return true;
+}
+
+bool PassManager::isEnabled(const Pass &pass) {
+  if (pass.reshapes && Profile::mode == Profile::Mode::Generate) return false;
+  return (pass.levels & bit(level)) != 0;
+}
+
+void PassManager::runAst(Node::Stmt *program) {
+  // Codegen asks the call graph about every function. Unless the dead function pass
+  // builds a real one, the answer is "yes, keep it".
+  CallGraph::keepEverything();
+  for (Pass &pass : passes)
+    if (pass.stage == Stage::Ast && isEnabled(pass)) run(pass, program, nullptr, nullptr);
+}
+
+void PassManager::runIr(ir::Function &fn) {
+  // Folding can turn branches into jumps, which leaves blocks for simplify-cfg, which leaves
+  // phis with one operand for folding... so keep going around until all three are happy
+  for (size_t i = 0; i < maxIterations; i++) {
+    size_t changes = 0;
+    for (Pass &pass : passes)
+      if (pass.stage == Stage::Ir && isEnabled(pass)) {
+        size_t before = pass.changes;
+        run(pass, nullptr, &fn, nullptr);
+        changes += pass.changes - before;
+      }
+    if (changes == 0) break;
+  }
+  if (dumpIr) fn.print(std::cout);
+}
+
+void PassManager::runMachine(std::vector<Instr> &code) {
+  for (Pass &pass : passes)
+    if (pass.stage == Stage::Machine && isEnabled(pass)) run(pass, nullptr, nullptr, &code);
+}
+
+size_t PassManager::runOnce(Pass &pass, Node::Stmt *program, ir::Function *fn, std::vector<Instr> *code) {
+  switch (pass.stage) {
+    case Stage::Ast: return pass.ast(program);
+    case Stage::Ir: return pass.ir(*fn);
+    case Stage::Machine: return pass.machine(*code);
+  }
+  return 0;
+}
+
+void PassManager::run(Pass &pass, Node::Stmt *program, ir::Function *fn, std::vector<Instr> *code) {
+  size_t rounds = (pass.fixpointLevels & bit(level)) ? maxIterations : 1;
+  for (size_t i = 0; i < rounds; i++) {
+    std::chrono::time_point start = std::chrono::high_resolution_clock::now();
+    size_t changes = runOnce(pass, program, fn, code);
+    std::chrono::time_point end = std::chrono::high_resolution_clock::now();
+
+    pass.millis += std::chrono::duration<double, std::milli>(end - start).count();
+    pass.runs++;
+    pass.changes += changes;
+    if (changes == 0) break; // fixpoint!
+  }
+}
+
+void PassManager::printReport() {
+  const char *names[] = {"-O0", "-O1", "-O2", "-Os"};
+  std::cout << "\nPasses (" << names[(int)level] << "):\n";
+  char line[128];
+  std::snprintf(line, sizeof(line), "  %-16s %6s %9s %11s\n", "pass", "runs", "changes", "time (ms)");
+  std::cout << line;
+  double total = 0;
+  for (Pass &pass : passes) {
+    if (!isEnabled(pass)) continue;
+    std::snprintf(line, sizeof(line), "  %-16s %6zu %9zu %11.3f\n", pass.name.c_str(), pass.runs, pass.changes, pass.millis);
+    std::cout << line;
+    total += pass.millis;
+  }
+  std::snprintf(line, sizeof(line), "  %-16s %6s %9s %11.3f\n", "total", "", "", total);
+  std::cout << line;
+}
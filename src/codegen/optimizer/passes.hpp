@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../../ast/ast.hpp"
+#include "../ir/ir.hpp"
+#include "instr.hpp"
+
+enum class OptLevel { O0, O1, O2, Os };
+// What vector instructions we get to use, from -march. SSE2 comes with every x86-64
+enum class Isa { Sse2, Sse41, Avx2 };
+
+// Decides which optimizations run, in what order, and how many times.
+// Every pass is registered once in passes.cpp with the -O levels it belongs to:
+//  - AST passes rewrite the typed tree before codegen ever sees it (folding, CTFE, inlining, dead functions)
+//  - IR passes rewrite each function that made it into the SSA IR (see ir/ir.hpp)
+//  - Machine passes rewrite the instruction list codegen produced (the peephole optimizer)
+// Passes can be re-run until they stop changing anything (or give up after a few rounds),
+// so we don't have to guess how many times to call the peephole optimizer anymore.
+// Pass `-time-passes` to see what each pass did and how long it took.
+class PassManager {
+public:
+  enum class Stage { Ast, Ir, Machine };
+
+  static void runAst(Node::Stmt *program);
+  static void runIr(ir::Function &fn);
+  static void runMachine(std::vector<Instr> &code);
+  static void printReport();
+  // "-O0", "-O1", "-O2" or "-Os". Returns false if the flag isn't one of those.
+  static bool parseLevel(const std::string &flag);
+  // What comes after -march=: "x86-64", "x86-64-v2", "x86-64-v3" or "native". Returns false if it's none of those.
+  static bool parseArch(const std::string &arch);
+  // Padding loop tops and function entries out to 16 bytes. Only at -O2: -Os wants the bytes more
+  static bool alignsCode() { return level == OptLevel::O2; }
+
+  static inline OptLevel level = OptLevel::O2;
+  static inline Isa isa = Isa::Sse2;
+  static inline bool timePasses = false;
+  static inline bool dumpIr = false;
+
+private:
+  struct Pass {
+    std::string name;
+    Stage stage;
+    unsigned levels;         // bitmask of OptLevels it runs at
+    unsigned fixpointLevels; // ...and the ones where it keeps going until nothing changes (otherwise it runs once)
+    size_t (*ast)(Node::Stmt *program) = nullptr;
+    size_t (*ir)(ir::Function &fn) = nullptr;
+    size_t (*machine)(std::vector<Instr> &code) = nullptr;
+    // Copies or reshapes the statements the profile counts, so it sits out -profile-generate builds (see profile.hpp)
+    bool reshapes = false;
+
+    // Filled in as we go, for -time-passes
+    size_t runs = 0;
+    size_t changes = 0;
+    double millis = 0;
+  };
+
+  static bool isEnabled(const Pass &pass);
+  static size_t runOnce(Pass &pass, Node::Stmt *program, ir::Function *fn, std::vector<Instr> *code);
+  static void run(Pass &pass, Node::Stmt *program, ir::Function *fn, std::vector<Instr> *code);
+
+  static std::vector<Pass> passes;
+  static constexpr size_t maxIterations = 8; // for fixpoint passes, in case two rewrites keep undoing each other
+};
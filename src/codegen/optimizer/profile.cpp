@@ -0,0 +1,215 @@
+#include "profile.hpp"
+#include "../../ast/walk.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+size_t Profile::run(Node::Stmt *program) {
+  first.clear();
+  keys.clear();
+  counts.clear();
+  hottest = 0;
+  number(program, "");
+
+  // FNV-1a, over what every counter is counting
+  checksum = 14695981039346656037ull;
+  for (const std::string &key : keys)
+    for (char c : key + "\n") checksum = (checksum ^ (unsigned char)c) * 1099511628211ull;
+
+  if (mode == Mode::Use) load();
+  return keys.size();
+}
+
+// Preorder, so a statement's counters come before the ones inside of it
+void Profile::number(Node::Stmt *stmt, const std::string &function) {
+  if (stmt == nullptr) return;
+  auto add = [&](const char *kind, int line, int pos, size_t points) {
+    first[stmt] = keys.size();
+    std::string where = function + ":" + kind + ":" + std::to_string(stmt->file_id) + ":" + std::to_string(line) + ":" +
+                        std::to_string(pos);
+    for (size_t i = 0; i < points; i++) keys.push_back(where + ":" + std::to_string(i));
+  };
+
+  std::string inside = function;
+  switch (stmt->kind) {
+    case ND_FN_STMT: {
+      FnStmt *s = static_cast<FnStmt *>(stmt);
+      if (s->isTemplate) return; // every instance is a copy of the body, none of them are this one
+      inside = s->name;
+      add("fn", s->line, s->pos, 1);
+      break;
+    }
+    case ND_IF_STMT: add("if", static_cast<IfStmt *>(stmt)->line, static_cast<IfStmt *>(stmt)->pos, 2); break;
+    case ND_WHILE_STMT: add("while", static_cast<WhileStmt *>(stmt)->line, static_cast<WhileStmt *>(stmt)->pos, 2); break;
+    case ND_FOR_STMT: add("for", static_cast<ForStmt *>(stmt)->line, static_cast<ForStmt *>(stmt)->pos, 2); break;
+    case ND_MATCH_STMT: {
+      MatchStmt *s = static_cast<MatchStmt *>(stmt);
+      add("match", s->line, s->pos, 1 + s->cases.size());
+      break;
+    }
+    default:
+      break;
+  }
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { number(s, inside); });
+}
+
+// magic, how many counters, the checksum, and then the counters. All 8 bytes, little endian like everything else here
+void Profile::load() {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Warning: no profile at '" << path << "', building without one (run a -profile-generate build first)"
+              << std::endl;
+    return;
+  }
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  uint64_t header[3] = {};
+  if (bytes.size() >= sizeof(header)) std::memcpy(header, bytes.data(), sizeof(header));
+  bool matches = bytes.size() == sizeof(header) + 8 * keys.size() && std::memcmp(header, magic, 8) == 0 &&
+                 header[1] == keys.size() && header[2] == checksum;
+  if (!matches) {
+    std::cerr << "Warning: the profile at '" << path << "' is from a different version of this program, ignoring it"
+              << std::endl;
+    return;
+  }
+  counts.resize(keys.size());
+  std::memcpy(counts.data(), bytes.data() + sizeof(header), 8 * keys.size());
+  for (auto &[stmt, index] : first)
+    if (stmt->kind == ND_FN_STMT) hottest = std::max(hottest, counts[index]);
+}
+
+int64_t Profile::counter(Node::Stmt *stmt, size_t point) {
+  if (mode != Mode::Generate) return -1;
+  auto it = first.find(stmt);
+  return it == first.end() ? -1 : (int64_t)(it->second + point);
+}
+
+int64_t Profile::count(Node::Stmt *stmt, size_t point) {
+  if (counts.empty()) return -1;
+  auto it = first.find(stmt);
+  return it == first.end() ? -1 : counts[it->second + point];
+}
+
+std::string Profile::address(int64_t counter) {
+  return ".Lzprof_counters+" + std::to_string(8 * counter) + "(%rip)";
+}
+
+bool Profile::isHot(FnStmt *fn) {
+  int64_t calls = count(fn, Entry);
+  return calls > 1 && calls * 10 >= hottest;
+}
+
+bool Profile::isCold(FnStmt *fn) {
+  return count(fn, Entry) == 0 && hottest > 0;
+}
+
+int64_t Profile::averageTrips(Node::Stmt *loop) {
+  int64_t reached = count(loop, Reached), body = count(loop, Taken);
+  if (reached <= 0 || body < 0) return -1;
+  return body / reached;
+}
+
+std::string Profile::data() {
+  std::string escaped;
+  for (char c : path) {
+    if (c == '"' || c == '\\') escaped += '\\';
+    escaped += c;
+  }
+  std::string n = std::to_string(keys.size());
+  char hex[19];
+  std::snprintf(hex, sizeof(hex), "0x%016llx", (unsigned long long)checksum);
+  return "\n# profile counters, written to the .zprof file on the way out (see native_zprof_write)"
+         "\n.data"
+         "\n.p2align 3"
+         "\n.Lzprof:"
+         "\n  .ascii \"" + std::string(magic) + "\""
+         "\n  .quad " + n +
+         "\n  .quad " + hex +
+         "\n.Lzprof_counters:"
+         "\n  .zero " + std::to_string(8 * keys.size()) +
+         "\n.Lzprof_old:"
+         "\n  .zero " + std::to_string(24 + 8 * keys.size()) +
+         "\n.Lzprof_path:"
+         "\n  .asciz \"" + escaped + "\"\n";
+}
+
+// Every register it touches goes back the way it was, so it can be called right before an exit
+// without caring what is where (the exit code is already in %rdi by then)
+std::string Profile::runtime() {
+  std::string n = std::to_string(keys.size());
+  std::string size = std::to_string(24 + 8 * keys.size());
+  return ".type native_zprof_write, @function\n"
+         "native_zprof_write:\n"
+         "  pushq %rax\n"
+         "  pushq %rcx\n"
+         "  pushq %rdx\n"
+         "  pushq %rsi\n"
+         "  pushq %rdi\n"
+         "  pushq %r8\n"
+         "  pushq %r11\n"
+         "  movq $2, %rax                # open(path, O_RDWR | O_CREAT, 0644)\n"
+         "  leaq .Lzprof_path(%rip), %rdi\n"
+         "  movq $66, %rsi\n"
+         "  movq $420, %rdx\n"
+         "  syscall\n"
+         "  testq %rax, %rax\n"
+         "  js .Lzprof_done\n"
+         "  movq %rax, %r8\n"
+         "  xorq %rax, %rax              # read whatever an earlier run left\n"
+         "  movq %r8, %rdi\n"
+         "  leaq .Lzprof_old(%rip), %rsi\n"
+         "  movq $" + size + ", %rdx\n"
+         "  syscall\n"
+         "  cmpq $" + size + ", %rax\n"
+         "  jne .Lzprof_save\n"
+         "  movq .Lzprof_old(%rip), %rax  # same magic, counter count and checksum?\n"
+         "  cmpq .Lzprof(%rip), %rax\n"
+         "  jne .Lzprof_save\n"
+         "  movq .Lzprof_old+8(%rip), %rax\n"
+         "  cmpq .Lzprof+8(%rip), %rax\n"
+         "  jne .Lzprof_save\n"
+         "  movq .Lzprof_old+16(%rip), %rax\n"
+         "  cmpq .Lzprof+16(%rip), %rax\n"
+         "  jne .Lzprof_save\n"
+         "  leaq .Lzprof_old+24(%rip), %rsi  # then add its counts to ours\n"
+         "  leaq .Lzprof_counters(%rip), %rdi\n"
+         "  xorq %rcx, %rcx\n"
+         ".Lzprof_merge:\n"
+         "  cmpq $" + n + ", %rcx\n"
+         "  je .Lzprof_save\n"
+         "  movq (%rsi, %rcx, 8), %rax\n"
+         "  addq %rax, (%rdi, %rcx, 8)\n"
+         "  incq %rcx\n"
+         "  jmp .Lzprof_merge\n"
+         ".Lzprof_save:\n"
+         "  movq $8, %rax                # lseek(fd, 0, SEEK_SET)\n"
+         "  movq %r8, %rdi\n"
+         "  xorq %rsi, %rsi\n"
+         "  xorq %rdx, %rdx\n"
+         "  syscall\n"
+         "  movq $1, %rax                # write(fd, header and counters)\n"
+         "  movq %r8, %rdi\n"
+         "  leaq .Lzprof(%rip), %rsi\n"
+         "  movq $" + size + ", %rdx\n"
+         "  syscall\n"
+         "  movq $77, %rax               # ftruncate, in case it was longer\n"
+         "  movq %r8, %rdi\n"
+         "  movq $" + size + ", %rsi\n"
+         "  syscall\n"
+         "  movq $3, %rax                # close\n"
+         "  movq %r8, %rdi\n"
+         "  syscall\n"
+         ".Lzprof_done:\n"
+         "  popq %r11\n"
+         "  popq %r8\n"
+         "  popq %rdi\n"
+         "  popq %rsi\n"
+         "  popq %rdx\n"
+         "  popq %rcx\n"
+         "  popq %rax\n"
+         "  ret\n"
+         ".size native_zprof_write, .-native_zprof_write\n";
+}
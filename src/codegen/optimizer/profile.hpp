@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/stmt.hpp"
+
+// Profile guided optimization, in two builds of the same program:
+//
+//  - `-profile-generate` puts a counter on every function entry, on the way into every `if` and its then arm,
+//    every loop and its body, and every `match` and each of its cases. When the program exits it writes them
+//    all to a .zprof file. Runs add up: counts from the same program that are already in there get added to.
+//  - `-profile-use` reads the file back, and the optimizer asks it how often things ran: block placement
+//    (the hotter way out of a branch falls through, and code that never ran goes to the end of its function),
+//    the inliner (hot callees get a bigger budget, ones that never ran get the -Os one), the order `match` tries
+//    its cases in, and how far the unroller goes with loops it can't count the trips of.
+//
+// Counters are numbered in the order this pass meets them on the AST, before any other pass gets to change it,
+// so both builds agree on what counter k is as long as the source is the same. The file carries a checksum of
+// where every counter is, and one from a different version of the program gets ignored (with a warning).
+//
+// While generating, the passes that copy or reshape the statements counters sit on (inlining, unrolling,
+// vectorizing, turning recursion into loops) stay off. The counts are for the code as it was written.
+class Profile {
+public:
+  enum class Mode { Off, Generate, Use };
+
+  // Where each statement's counters are, counting from its first one
+  static constexpr size_t Entry = 0;   // FnStmt: times it was called
+  static constexpr size_t Reached = 0; // if, loops and match: times we got to it
+  static constexpr size_t Taken = 1;   // if: times the then arm ran. Loops: times the body did
+  static size_t caseAt(size_t i) { return 1 + i; } // match: times case i ran (falling into it from the one before counts too)
+
+  // Numbers the counters and, with -profile-use, loads the file. Returns how many counters there are
+  static size_t run(Node::Stmt *program);
+
+  // The counter to bump for `point` of `stmt`, or -1 if we aren't generating (or it doesn't have one)
+  static int64_t counter(Node::Stmt *stmt, size_t point);
+  // How many times `point` of `stmt` ran, or -1 if we don't know
+  static int64_t count(Node::Stmt *stmt, size_t point);
+  // The memory operand for counter k, for an `incq`
+  static std::string address(int64_t counter);
+
+  // Called a lot, compared to the busiest function in the program
+  static bool isHot(FnStmt *fn);
+  // Never ran at all, in a program that did
+  static bool isCold(FnStmt *fn);
+  // How many times the body of `loop` ran every time we got to it, or -1 if we don't know
+  static int64_t averageTrips(Node::Stmt *loop);
+
+  // The counters and the file header, for the data section
+  static std::string data();
+  // native_zprof_write: adds the counters to whatever the file already has and writes it back
+  static std::string runtime();
+
+  static inline Mode mode = Mode::Off;
+  static inline std::string path = ""; // the .zprof file
+
+private:
+  static void number(Node::Stmt *stmt, const std::string &function);
+  static void load();
+
+  static inline std::unordered_map<Node::Stmt *, size_t> first = {}; // a statement's first counter
+  static inline std::vector<std::string> keys = {};                    // what each counter counts, for the checksum
+  static inline std::vector<int64_t> counts = {};                      // from the file, empty if it didn't load
+  static inline uint64_t checksum = 0;
+  static inline int64_t hottest = 0; // entry count of the busiest function
+  static constexpr const char *magic = "ZPROF001";
+};
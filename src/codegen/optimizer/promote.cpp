@@ -0,0 +1,86 @@
+#include "promote.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+#include <algorithm>
+
+static const std::string registers[] = {"%r12", "%r15"};
+
+std::unordered_map<std::string, std::string> RegisterPromotion::run(FnStmt *fn) {
+  candidates.clear();
+  loopDepth = 0;
+  addressDepth = 0;
+  isComplete = true;
+
+  scan(fn->block);
+  // A local with the same name as a param would share its table entry, so leave both alone
+  for (auto &param : fn->params) candidates[param.first->name].escapes = true;
+  if (!isComplete) return {};
+
+  std::vector<std::pair<std::string, Candidate>> ranked;
+  for (auto &[name, candidate] : candidates)
+    if (candidate.isLocal && !candidate.escapes && candidate.weight > 0) ranked.push_back({name, candidate});
+  std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) {
+    if (a.second.isInduction != b.second.isInduction) return a.second.isInduction;
+    if (a.second.weight != b.second.weight) return a.second.weight > b.second.weight;
+    return a.first < b.first; // same input, same output
+  });
+
+  std::unordered_map<std::string, std::string> promoted;
+  for (size_t i = 0; i < ranked.size() && i < std::size(registers); i++) promoted[ranked[i].first] = registers[i];
+  return promoted;
+}
+
+void RegisterPromotion::declare(const std::string &name, Node::Type *type, bool isInduction) {
+  Candidate &candidate = candidates[name];
+  candidate.isLocal = true;
+  candidate.isInduction |= isInduction;
+  if (type == nullptr || !fitsInRegister(type)) candidate.escapes = true;
+}
+
+// Only things the stack machine always moves around as a whole qword
+bool RegisterPromotion::fitsInRegister(Node::Type *type) {
+  if (type->kind == ND_POINTER_TYPE) return true;
+  if (type->kind != ND_SYMBOL_TYPE) return false; // arrays, function types, templates...
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (name == "float" || name == "double") return false;
+  return codegen::typeSizes.contains(name) && codegen::typeSizes[name] == 8;
+}
+
+void RegisterPromotion::scan(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_VAR_STMT: {
+      VarStmt *s = static_cast<VarStmt *>(stmt);
+      declare(s->name, s->type, false);
+      break;
+    }
+    case ND_FOR_STMT: {
+      ForStmt *s = static_cast<ForStmt *>(stmt);
+      AssignmentExpr *assign = static_cast<AssignmentExpr *>(s->forLoop);
+      if (assign->assignee->kind == ND_IDENT)
+        declare(static_cast<IdentExpr *>(assign->assignee)->name, assign->assignee->asmType, true);
+      loopDepth++;
+      break;
+    }
+    case ND_WHILE_STMT:
+      loopDepth++;
+      break;
+    default:
+      break;
+  }
+  bool known = Walk::children(stmt, [](Node::Expr *&e) { scan(e); }, [](Node::Stmt *&s) { scan(s); });
+  if (!known) isComplete = false;
+  if (stmt->kind == ND_FOR_STMT || stmt->kind == ND_WHILE_STMT) loopDepth--;
+}
+
+void RegisterPromotion::scan(Node::Expr *expr) {
+  if (expr->kind == ND_IDENT) {
+    Candidate &candidate = candidates[static_cast<IdentExpr *>(expr)->name];
+    // Anything under a `&` needs an address, even if it's buried in `&(x)`
+    if (addressDepth > 0) candidate.escapes = true;
+    candidate.weight += 1ll << (3 * std::min(loopDepth, 6)); // a use in a loop is worth ~8 outside of it
+    return;
+  }
+  if (expr->kind == ND_ADDRESS) addressDepth++;
+  if (!Walk::children(expr, [](Node::Expr *&e) { scan(e); })) isComplete = false;
+  if (expr->kind == ND_ADDRESS) addressDepth--;
+}
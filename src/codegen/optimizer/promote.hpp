@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+#include "../../ast/types.hpp"
+
+// Keeps a few scalar locals of a stack machine function in callee saved registers instead of -N(%rbp).
+// (Functions that make it into the IR get a real register allocator, see ir/regalloc.hpp. This is for the rest.)
+//
+// A local can live in a register for the whole function as long as nobody ever needs its address,
+// so we walk the body once looking for `&x`. Whatever is left gets ranked by how often it is used
+// (uses inside loops count a lot more), with loop induction variables first in line.
+//
+// Only %r12 and %r15 are up for grabs: the stack machine uses %rbx, %r13 and %r14 as scratch
+// without saving them, and everything else is caller saved.
+class RegisterPromotion {
+public:
+  // name -> register, for every local of `fn` that got one
+  static std::unordered_map<std::string, std::string> run(FnStmt *fn);
+
+private:
+  struct Candidate {
+    long long weight = 0;     // uses, scaled up by how many loops they are in
+    bool isLocal = false;     // declared in this function, not a param or a global
+    bool isInduction = false; // the `i` of a `loop (i = 0; ...)`
+    bool escapes = false;
+  };
+
+  static void scan(Node::Stmt *stmt);
+  static void scan(Node::Expr *expr);
+  static void declare(const std::string &name, Node::Type *type, bool isInduction);
+  static bool fitsInRegister(Node::Type *type);
+
+  static inline std::unordered_map<std::string, Candidate> candidates = {};
+  static inline int loopDepth = 0;
+  static inline int addressDepth = 0; // how many `&`s we are under
+  static inline bool isComplete = true; // found a node we don't know- can't prove anything doesn't escape
+};
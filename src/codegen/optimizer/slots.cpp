@@ -0,0 +1,118 @@
+#include "slots.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+#include <algorithm>
+
+static void gatherEscaped(Node::Expr *expr, std::set<std::string> &out) {
+  if (expr->kind == ND_ADDRESS && static_cast<AddressExpr *>(expr)->right->kind == ND_IDENT)
+    out.insert(static_cast<IdentExpr *>(static_cast<AddressExpr *>(expr)->right)->name);
+  Walk::children(expr, [&](Node::Expr *&e) { gatherEscaped(e, out); });
+}
+
+static void gatherEscaped(Node::Stmt *stmt, std::set<std::string> &out) {
+  Walk::children(stmt, [&](Node::Expr *&e) { gatherEscaped(e, out); },
+                 [&](Node::Stmt *&s) { gatherEscaped(s, out); });
+}
+
+int64_t StackSlots::run(FnStmt *fn, int64_t used, bool reuse,
+                        const std::unordered_map<std::string, std::string> &promoted) {
+  locals.clear();
+  first.clear();
+  last.clear();
+  escaped.clear();
+  promotedLocals = &promoted;
+  isReusing = reuse;
+  counter = 0;
+  gatherEscaped(fn->block, escaped);
+  number(fn->block);
+
+  // Each local goes into the first slot of its size that nobody needs anymore by the time it is declared
+  struct Slot {
+    int64_t size;
+    size_t end;
+    std::vector<Node::Stmt *> locals;
+  };
+  std::stable_sort(locals.begin(), locals.end(), [](const Local &a, const Local &b) { return a.start < b.start; });
+  std::vector<Slot> slots;
+  for (const Local &local : locals) {
+    auto free = std::find_if(slots.begin(), slots.end(), [&](const Slot &slot) {
+      return isReusing && slot.size == local.size && slot.end < local.start;
+    });
+    if (free == slots.end()) free = slots.insert(slots.end(), Slot{.size = local.size, .end = 0, .locals = {}});
+    free->end = std::max(free->end, local.end);
+    free->locals.push_back(local.decl);
+  }
+
+  // Biggest first: every size is a power of two, so each slot ends up aligned to its own size for free
+  std::stable_sort(slots.begin(), slots.end(), [](const Slot &a, const Slot &b) { return a.size > b.size; });
+  int64_t bytes = 0;
+  for (const Slot &slot : slots) {
+    bytes += slot.size;
+    for (Node::Stmt *decl : slot.locals) offsets[decl] = -(used + bytes);
+  }
+  return (bytes + 7) / 8 * 8;
+}
+
+// Numbers statements in the order they show up, and picks up the locals of each block on the way back out
+void StackSlots::number(Node::Stmt *stmt) {
+  first[stmt] = counter++;
+  if (stmt->kind != ND_FN_STMT && stmt->kind != ND_STRUCT_STMT)
+    Walk::children(stmt, [](Node::Expr *&) {}, [](Node::Stmt *&s) { number(s); });
+  last[stmt] = counter - 1;
+
+  if (stmt->kind == ND_BLOCK_STMT) liveRanges(static_cast<BlockStmt *>(stmt));
+  if (stmt->kind == ND_FOR_STMT) {
+    // Codegen always gives the counter 8 bytes, and it's alive for the whole loop
+    ForStmt *loop = static_cast<ForStmt *>(stmt);
+    IdentExpr *counterVar = static_cast<IdentExpr *>(static_cast<AssignmentExpr *>(loop->forLoop)->assignee);
+    if (!promotedLocals->contains(counterVar->name))
+      locals.push_back({.decl = stmt, .size = 8, .start = first[stmt], .end = last[stmt]});
+  }
+}
+
+void StackSlots::liveRanges(BlockStmt *block) {
+  std::vector<Node::Stmt *> &stmts = block->stmts;
+  for (size_t i = 0; i < stmts.size(); i++) {
+    if (stmts[i]->kind != ND_VAR_STMT) continue;
+    VarStmt *var = static_cast<VarStmt *>(stmts[i]);
+    int64_t size = slotSize(var->type);
+    if (size == 0 || promotedLocals->contains(var->name)) continue;
+
+    size_t end = last[block];
+    if (isReusing && !escaped.contains(var->name)) {
+      end = last[var];
+      for (size_t j = i + 1; j < stmts.size(); j++)
+        if (mentions(stmts[j], var->name)) end = last[stmts[j]];
+    }
+    locals.push_back({.decl = var, .size = size, .start = first[var], .end = end});
+  }
+}
+
+// Anything Walk doesn't know about might mention it, as far as we can tell
+bool StackSlots::mentions(Node::Stmt *stmt, const std::string &name) {
+  bool found = false;
+  bool isKnown = Walk::children(stmt, [&](Node::Expr *&e) { found = found || mentions(e, name); },
+                                [&](Node::Stmt *&s) { found = found || mentions(s, name); });
+  return found || !isKnown;
+}
+
+bool StackSlots::mentions(Node::Expr *expr, const std::string &name) {
+  if (expr->kind == ND_IDENT) return static_cast<IdentExpr *>(expr)->name == name;
+  bool found = false;
+  bool isKnown = Walk::children(expr, [&](Node::Expr *&e) { found = found || mentions(e, name); });
+  return found || !isKnown;
+}
+
+// Ints, floats, bools, chars, enums and pointers: whatever varDecl pops straight into a slot.
+// 0 for everything else (arrays, structs, long double), which codegen keeps placing on its own
+int64_t StackSlots::slotSize(Node::Type *type) {
+  if (type == nullptr) return 0;
+  if (type->kind == ND_POINTER_TYPE || type->kind == ND_FUNCTION_TYPE || type->kind == ND_FUNCTION_TYPE_PARAM) return 8;
+  if (type->kind != ND_SYMBOL_TYPE) return 0;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (codegen::structByteSizes.contains(name)) return 0;
+  if (!codegen::typeSizes.contains(name) && !codegen::enumTable.contains(name)) return 0;
+  int64_t size = codegen::getByteSizeOfType(type);
+  return size == 1 || size == 2 || size == 4 || size == 8 ? size : 0;
+}
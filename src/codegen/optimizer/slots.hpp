@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+
+// Stack slots for the scalar locals (and `loop (i = ...)` counters) of a stack machine function,
+// laid out before codegen walks the body instead of handed out one after the other as it goes.
+//
+//  - Every slot is exactly as big as its type and aligned to its size. The 8 byte slots go first, then the
+//    4s, 2s and 1s, so a few chars and bools share the 8 bytes one of them used to take up, with no padding.
+//  - With `reuse` (when optimizing and not debugging), locals that are never alive at the same time share a slot.
+//    A local is alive from its declaration to the last statement of its block that mentions it, so a loop it
+//    shows up in counts as a whole. (If its address is ever taken, to the end of its block.)
+//    That's stack coloring, with statements numbered in the order they appear for the live ranges.
+//
+// Arrays, structs and whatever codegen needs on the fly keep coming off variableCount, below these.
+class StackSlots {
+public:
+  // Lays out `fn`'s locals starting `used` bytes below %rbp (a multiple of 8). Returns how many bytes they
+  // take up, always a multiple of 8 so whatever comes after stays aligned
+  static int64_t run(FnStmt *fn, int64_t used, bool reuse, const std::unordered_map<std::string, std::string> &promoted);
+
+  // The VarStmt / ForStmt -> its slot, as an offset from %rbp. Anything not in here, codegen puts wherever
+  static inline std::unordered_map<Node::Stmt *, int64_t> offsets = {};
+
+private:
+  struct Local {
+    Node::Stmt *decl;
+    int64_t size;
+    size_t start, end; // statement numbers, both inclusive
+  };
+
+  static void number(Node::Stmt *stmt);
+  static void liveRanges(BlockStmt *block);
+  static bool mentions(Node::Stmt *stmt, const std::string &name);
+  static bool mentions(Node::Expr *expr, const std::string &name);
+  static int64_t slotSize(Node::Type *type);
+
+  static inline std::vector<Local> locals = {};
+  static inline std::unordered_map<Node::Stmt *, size_t> first = {}, last = {}; // a statement's number, and its last child's
+  static inline std::set<std::string> escaped = {};
+  static inline const std::unordered_map<std::string, std::string> *promotedLocals = nullptr;
+  static inline bool isReusing = false;
+  static inline size_t counter = 0;
+};
@@ -0,0 +1,208 @@
+#include "strength.hpp"
+#include "passes.hpp"
+
+#include <bit>
+#include <climits>
+#include <string>
+
+static bool fitsInImmediate(int64_t value) { return value >= INT_MIN && value <= INT_MAX; }
+
+static void op(const StrengthReduce::Emit &emit, const std::string &name, const Operand &src, const Operand &dst = {}) {
+  emit(Instr{.var = BinaryInstr{.op = name, .src = src, .dst = dst}, .type = InstrType::Binary});
+}
+
+// At -Os, only when it's no bigger than the imul or div it replaces
+static bool isSmallOnly() { return PassManager::level == OptLevel::Os; }
+
+static Operand imm(int64_t value) { return Operand("$" + std::to_string(value)); }
+
+// Anything that doesn't fit in an imm32 has to go through a register first
+static Operand constant(const StrengthReduce::Emit &emit, int64_t value, Reg via) {
+  if (fitsInImmediate(value)) return imm(value);
+  op(emit, "movabsq", imm(value), Operand::makeRegister(via));
+  return Operand::makeRegister(via);
+}
+
+bool StrengthReduce::multiply(Reg reg, int64_t by, int bytes, Reg scratch, const Emit &emit) {
+  if (by == 0 || by == INT64_MIN) return false;
+  // lea doesn't come in 8 bits, and the junk above `bytes` doesn't matter anyways
+  uint8_t width = bytes <= 4 ? 4 : 8;
+  DataSize size = width == 4 ? DataSize::Dword : DataSize::Qword;
+  Operand x = Operand::makeRegister(reg, width);
+  std::string full = Operand::makeRegister(reg).str();
+  auto isLeaFactor = [](uint64_t f) { return f == 3 || f == 5 || f == 9; };
+  auto lea = [&](uint64_t factor) { // x = x * factor, for factor 3, 5 or 9
+    std::string address = "(" + full + ", " + full + ", " + std::to_string(factor - 1) + ")";
+    emit(Instr{.var = LeaInstr{.size = size, .dest = x, .src = address}, .type = InstrType::Lea});
+  };
+
+  uint64_t c = by < 0 ? -(uint64_t)by : (uint64_t)by;
+  int zeros = std::countr_zero(c);
+  uint64_t odd = c >> zeros;
+  uint64_t first = 0; // c = first * (c / first), and both of them are 3, 5 or 9
+  for (uint64_t factor : {3, 5, 9})
+    if (c % factor == 0 && isLeaFactor(c / factor)) first = factor;
+  // One shift or one lea, or it's bigger than the imul
+  if (isSmallOnly() && (by < 0 || (odd != 1 && (zeros > 0 || !isLeaFactor(odd))))) return false;
+  if (odd == 1) {
+    if (zeros > 0) op(emit, "shl", imm(zeros), x);
+  } else if (isLeaFactor(odd)) {
+    lea(odd);
+    if (zeros > 0) op(emit, "shl", imm(zeros), x);
+  } else if (zeros == 0 && first != 0) {
+    lea(first);
+    lea(c / first);
+  } else if (zeros == 0 && std::has_single_bit(c - 1)) {
+    // x * 17 = (x << 4) + x
+    Operand copy = Operand::makeRegister(scratch, width);
+    op(emit, "mov", x, copy);
+    op(emit, "shl", imm(std::countr_zero(c - 1)), x);
+    op(emit, "add", copy, x);
+  } else if (zeros == 0 && std::has_single_bit(c + 1)) {
+    // x * 31 = (x << 5) - x
+    Operand copy = Operand::makeRegister(scratch, width);
+    op(emit, "mov", x, copy);
+    op(emit, "shl", imm(std::countr_zero(c + 1)), x);
+    op(emit, "sub", copy, x);
+  } else {
+    return false;
+  }
+  if (by < 0) op(emit, "neg", x);
+  return true;
+}
+
+// CHOOSE_MULTIPLIER from the paper: start from the biggest shift that is sure to work and
+// keep halving while the smallest and biggest multipliers that would do still disagree
+StrengthReduce::Magic StrengthReduce::chooseMultiplier(uint64_t d, int N, int precision) {
+  int l = 64 - std::countl_zero(d - 1); // ceil(log2(d))
+  uint128 low = ((uint128)1 << (N + l)) / d;
+  uint128 high = (((uint128)1 << (N + l)) + ((uint128)1 << (N + l - precision))) / d;
+  int shift = l;
+  while (low / 2 < high / 2 && shift > 0) {
+    low /= 2;
+    high /= 2;
+    shift--;
+  }
+  return {high, shift};
+}
+
+bool StrengthReduce::divide(int64_t by, int bytes, bool isSigned, bool isModulo, Reg scratch, const Emit &emit) {
+  // 0 should trap like it always has, and past 2^63 the magic numbers need more than 128 bits to work out
+  if (by == 0 || by == INT64_MIN || (!isSigned && by < 0)) return false;
+  Operand rax = "%rax", rdx = "%rdx", saved = Operand::makeRegister(scratch);
+  uint64_t d = by < 0 ? -(uint64_t)by : (uint64_t)by;
+
+  if (d == 1) {
+    if (isModulo) op(emit, "xorl", "%eax", "%eax");
+    else if (by < 0) op(emit, "negq", rax);
+    return true;
+  }
+  if (std::has_single_bit(d)) {
+    int k = std::countr_zero(d);
+    if (!isSigned) {
+      if (isModulo) op(emit, "andq", constant(emit, d - 1, scratch), rax);
+      else op(emit, "shrq", imm(k), rax);
+      return true;
+    }
+    // A shift rounds towards -infinity and division towards zero, so a negative x gets d - 1 added first
+    op(emit, "movq", rax, rdx);
+    op(emit, "sarq", imm(63), rdx);
+    op(emit, "shrq", imm(64 - k), rdx);
+    op(emit, "addq", rax, rdx);
+    if (isModulo) {
+      op(emit, "andq", constant(emit, -(int64_t)d, scratch), rdx);
+      op(emit, "subq", rdx, rax);
+      return true;
+    }
+    op(emit, "sarq", imm(k), rdx);
+    op(emit, "movq", rdx, rax);
+    if (by < 0) op(emit, "negq", rax);
+    return true;
+  }
+
+  if (isSmallOnly()) return false;
+  // Up to 32 bits, x * magic fits in one 64 bit register, so there's no need for the high half of a mul
+  int N = bytes <= 4 && d < (1ull << 31) ? 32 : 64;
+  op(emit, "movq", rax, saved);
+  if (isSigned) divideSigned(by, N, scratch, emit);
+  else divideUnsigned(d, N, scratch, emit);
+  if (isModulo) {
+    // x % d = x - (x / d) * d
+    if (fitsInImmediate(by)) {
+      op(emit, "imulq", imm(by), rax);
+    } else {
+      op(emit, "movabsq", imm(by), rdx);
+      op(emit, "imulq", rdx, rax);
+    }
+    op(emit, "subq", rax, saved);
+    op(emit, "movq", saved, rax);
+  }
+  return true;
+}
+
+// x is in %rax and in `scratch`, the quotient goes in %rax
+void StrengthReduce::divideUnsigned(uint64_t d, int N, Reg scratch, const Emit &emit) {
+  Operand rax = "%rax", rdx = "%rdx", saved = Operand::makeRegister(scratch);
+  Magic magic = chooseMultiplier(d, N, N);
+  if (magic.multiplier >> N && d % 2 == 0) {
+    // An even d can shift some of itself out of x first, and that buys enough precision for a smaller multiplier
+    int pre = std::countr_zero(d);
+    magic = chooseMultiplier(d >> pre, N, N - pre);
+    op(emit, "shrq", imm(pre), rax);
+  }
+  uint64_t multiplier = (uint64_t)(magic.multiplier & (((uint128)1 << N) - 1)); // the low N bits, if it takes N + 1
+  if (!(magic.multiplier >> N)) {
+    if (N == 32) {
+      op(emit, "movl", imm(multiplier), "%edx");
+      op(emit, "imulq", rdx, rax);
+      op(emit, "shrq", imm(32 + magic.shift), rax);
+      return;
+    }
+    op(emit, "movabsq", imm((int64_t)multiplier), rdx);
+    op(emit, "mulq", rdx);
+    op(emit, "movq", rdx, rax);
+    if (magic.shift > 0) op(emit, "shrq", imm(magic.shift), rax);
+    return;
+  }
+  // The multiplier takes N + 1 bits. With t = the high half of x * (its low N bits),
+  // x / d = (t + (x - t) / 2) >> (shift - 1), which can't overflow
+  if (N == 32) {
+    op(emit, "movl", imm(multiplier), "%edx");
+    op(emit, "imulq", rax, rdx);
+    op(emit, "shrq", imm(32), rdx);
+  } else {
+    op(emit, "movabsq", imm((int64_t)multiplier), rdx);
+    op(emit, "mulq", rdx);
+    op(emit, "movq", saved, rax);
+  }
+  op(emit, "subq", rdx, rax);
+  op(emit, "shrq", imm(1), rax);
+  op(emit, "addq", rdx, rax);
+  if (magic.shift > 1) op(emit, "shrq", imm(magic.shift - 1), rax);
+}
+
+// Same deal, but the multiply is signed and the quotient has to round towards zero
+void StrengthReduce::divideSigned(int64_t by, int N, Reg scratch, const Emit &emit) {
+  Operand rax = "%rax", rdx = "%rdx", saved = Operand::makeRegister(scratch);
+  uint64_t d = by < 0 ? -(uint64_t)by : (uint64_t)by;
+  Magic magic = chooseMultiplier(d, N, N - 1); // always fits in N bits
+  uint64_t multiplier = (uint64_t)magic.multiplier;
+  if (N == 32) {
+    // |x| < 2^31 and the multiplier < 2^32, so x * multiplier stays clear of the sign bit
+    op(emit, "movl", imm(multiplier), "%edx");
+    op(emit, "imulq", rdx, rax);
+    op(emit, "sarq", imm(32 + magic.shift), rax);
+  } else {
+    op(emit, "movabsq", imm((int64_t)multiplier), rdx);
+    op(emit, "imulq", rdx);
+    // imul took the multiplier as negative (it is past 2^63), which is off by exactly one x
+    if (multiplier >> 63) op(emit, "addq", saved, rdx);
+    if (magic.shift > 0) op(emit, "sarq", imm(magic.shift), rdx);
+    op(emit, "movq", rdx, rax);
+  }
+  // That rounded towards -infinity. One more for a negative x
+  op(emit, "movq", saved, rdx);
+  op(emit, "sarq", imm(63), rdx);
+  op(emit, "subq", rdx, rax);
+  if (by < 0) op(emit, "negq", rax);
+}
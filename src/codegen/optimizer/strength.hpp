@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "instr.hpp"
+
+// Multiplying and dividing by a constant, without paying for imul or (much worse) div.
+// Both codegens use this: the stack machine for `x * 10` and friends, and ir::Backend for Mul/Div/Mod
+// with a constant on the right.
+//
+//  - x * c turns into a shift, an lea or two (c = 3, 5, 9, those times a power of two, or two of them
+//    multiplied together), or a shift and an add/sub (c = 2^k +- 1). Negative c gets a neg on the end.
+//  - x / c and x % c turn into a multiply by c's "magic number" and a shift (Granlund and Montgomery,
+//    "Division by Invariant Integers using Multiplication"), or just shifts if c is a power of two.
+//    Values up to 32 bits get by with one 64 bit imul, full 64 bit ones need the high half of mulq/imulq.
+// At -Os it only does the ones that come out no bigger than the imul or div would have been.
+class StrengthReduce {
+public:
+  using Emit = std::function<void(Instr)>;
+
+  // `reg` *= `by`, where `reg` is `bytes` wide (whatever is above that doesn't matter). May write `scratch`.
+  // False (and nothing emitted) if a plain imul is as good as it gets.
+  static bool multiply(Reg reg, int64_t by, int bytes, Reg scratch, const Emit &emit);
+
+  // %rax = %rax / `by` (or % `by`). %rax has to hold the whole value, sign or zero extended to 64 bits
+  // depending on `isSigned`, and so will the result. Trashes %rdx and `scratch`.
+  // False (and nothing emitted) if `by` is something we would rather leave to div, like 0.
+  static bool divide(int64_t by, int bytes, bool isSigned, bool isModulo, Reg scratch, const Emit &emit);
+
+private:
+  __extension__ typedef unsigned __int128 uint128; // not standard, but every compiler we care about has it
+
+  // x / d == (x * multiplier) >> (N + shift) for every x below 2^precision
+  struct Magic {
+    uint128 multiplier;
+    int shift;
+  };
+  static Magic chooseMultiplier(uint64_t d, int N, int precision);
+  static void divideUnsigned(uint64_t by, int N, Reg scratch, const Emit &emit);
+  static void divideSigned(int64_t by, int N, Reg scratch, const Emit &emit);
+};
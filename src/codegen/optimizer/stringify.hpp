@@ -39,6 +39,8 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
         return "q";
       case DataSize::SS:
         return "ss";
+      case DataSize::SD:
+        return "sd";
       case DataSize::None:
       default:
         return "";  // "I dont know", but usually the assembler can assume types
@@ -82,53 +84,51 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
           ss << "movzx" << dsToChar(instr.srcSize) << " " << instr.src << ", " << instr.dest << "\n\t";
           return ss.str();
         }
-        if (instr.src.starts_with("$") && instr.src.size() > 1) {
-          if (std::isdigit(instr.src[1])) {
-            // it's a number! if its larger than 2^32, we must use movabsq
-            if (std::stoll(instr.src.substr(1)) > 4294967295) {
-              std::stringstream ss;
-              // you cant fit a number greater than 2^32 into a 32-bit integer but we put a dsToChar here for parity
-              ss << "movabs" << dsToChar(instr.destSize) << ' ' << instr.src << ", " << instr.dest << "\n\t";
-              return ss.str();
-            }
-          }
+        // it's a number! if its larger than 2^32, we must use movabsq
+        if (instr.src.isImmediate() && instr.src.symbol == -1 && instr.src.value > 4294967295) {
+          std::stringstream ss;
+          // you cant fit a number greater than 2^32 into a 32-bit integer but we put a dsToChar here for parity
+          ss << "movabs" << dsToChar(instr.destSize) << ' ' << instr.src << ", " << instr.dest << "\n\t";
+          return ss.str();
         }
         std::stringstream ss;
         ss << "mov" << dsToChar(instr.srcSize) << ' ' << instr.src << ", " << instr.dest << "\n\t";
         return ss.str();
       }
       std::string operator()(PushInstr instr) const {
-        return "push" + dsToChar(instr.whatSize) + " " + instr.what + "\n\t";
+        return "push" + dsToChar(instr.whatSize) + " " + instr.what.str() + "\n\t";
       }
       std::string operator()(PopInstr instr) const {
-        return "pop" + dsToChar(instr.whereSize) + " " + instr.where + "\n\t";
+        return "pop" + dsToChar(instr.whereSize) + " " + instr.where.str() + "\n\t";
       }
       std::string operator()(XorInstr instr) const {
         // Assume qword
-        return "xor " + instr.lhs + ", " + instr.rhs + "\n\t";
+        return "xor " + instr.lhs.str() + ", " + instr.rhs.str() + "\n\t";
       }
       std::string operator()(AddInstr instr) const {
-        return "add" + dsToChar(instr.size) + " " + instr.rhs + ", " + instr.lhs + "\n\t";
+        return "add" + dsToChar(instr.size) + " " + instr.rhs.str() + ", " + instr.lhs.str() + "\n\t";
       }
       std::string operator()(LeaInstr instr) const {
-        return "lea" + dsToChar(instr.size) + " " + instr.src + ", " + instr.dest + "\n\t";
+        return "lea" + dsToChar(instr.size) + " " + instr.src.str() + ", " + instr.dest.str() + "\n\t";
       };
       std::string operator()(SubInstr instr) const {
-        return "sub" + dsToChar(instr.size) + " " + instr.rhs + ", " + instr.lhs + "\n\t";
+        return "sub" + dsToChar(instr.size) + " " + instr.rhs.str() + ", " + instr.lhs.str() + "\n\t";
       }
       std::string operator()(MulInstr instr) const {
         if (instr.isSigned) {
-          return "imul" + dsToChar(instr.size) + " " + instr.from + "\n\t";
+          return "imul" + dsToChar(instr.size) + " " + instr.from.str() + "\n\t";
         }
-        return "mul" + dsToChar(instr.size) + " " + instr.from + "\n\t";
+        return "mul" + dsToChar(instr.size) + " " + instr.from.str() + "\n\t";
       }
       std::string operator()(DivInstr instr) const {
         if (instr.isSigned) {
-          return "idiv" + dsToChar(instr.size) + " " + instr.from + "\n\t";
+          return "idiv" + dsToChar(instr.size) + " " + instr.from.str() + "\n\t";
         }
-        return "div" + dsToChar(instr.size) + " " + instr.from + "\n\t";
+        return "div" + dsToChar(instr.size) + " " + instr.from.str() + "\n\t";
       }
       std::string operator()(Label instr) const {
+        if (instr.align == Alignment::Loop) return "\n.p2align 4,,10\n" + instr.name + ":\n\t";
+        if (instr.align == Alignment::Function) return "\n.p2align 4\n" + instr.name + ":\n\t";
         return "\n" + instr.name + ":\n\t";
       }
       std::string operator()(CmpInstr instr) const {
@@ -137,7 +137,7 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
         cmpq $8, $16
         jg example # JUMPS IF 16 > 8 ???!?!?
         */
-        return "cmp" + dsToChar(instr.size) + " " + instr.rhs + ", " + instr.lhs + "\n\t";
+        return "cmp" + dsToChar(instr.size) + " " + instr.rhs.str() + ", " + instr.lhs.str() + "\n\t";
       }
       std::string operator()(JumpInstr instr) const {
         std::string keyword = {};
@@ -172,6 +172,9 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
           case JumpCondition::NotEqual:
             keyword = "jne";
             break;
+          case JumpCondition::Above:
+            keyword = "ja";
+            break;
 
           case JumpCondition::Unconditioned:
             keyword = "jmp";
@@ -195,11 +198,11 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
       }
       // 2's complement - negate a reg / effective addr
       std::string operator()(NegInstr instr) const {
-        return "neg" + dsToChar(instr.size) + " " + instr.what + "\n\t";
+        return "neg" + dsToChar(instr.size) + " " + instr.what.str() + "\n\t";
       }
       // bitwise not
       std::string operator()(NotInstr instr) const {
-        return "not " + instr.what + "\n\t";
+        return "not " + instr.what.str() + "\n\t";
       }
       // define bytes
       std::string operator()(DataSectionInstr instr) const {
@@ -217,7 +220,7 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
           case DataSize::None:  // assume qword (i mean, this is x86-64 architecture after all)
           case DataSize::Qword:
             // case DataSize::DS:
-            op = ".qword";
+            op = ".quad";
             break;
           case DataSize::SD:
             op = ".double";
@@ -245,9 +248,9 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
       }
       // binary operation (Add, Sub, Mul, Div, ...)
       std::string operator()(BinaryInstr instr) const {
-        std::string inst = instr.op + " " + instr.src;
-        if (instr.dst != "") {
-          inst += ", " + instr.dst;
+        std::string inst = instr.op + " " + instr.src.str();
+        if (!instr.dst.empty()) {
+          inst += ", " + instr.dst.str();
         }
         return inst + "\n\t";
       }
@@ -283,7 +286,7 @@ class Stringifier {  // converts Instr structures into AT&T Syntax strings
             std::cerr << "Unimplemnted ConvertType [" << (int)instr.convType << "]" << std::endl;
             return "# unimplented cvt. :(\n\t";
         }
-        return inst + " " + instr.from + ", " + instr.to + "\n\t";
+        return inst + " " + instr.from.str() + ", " + instr.to.str() + "\n\t";
       }
 
       // String literal (eg .cfi_startproc in functions)
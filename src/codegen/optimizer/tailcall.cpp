@@ -0,0 +1,168 @@
+#include "tailcall.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+static Node::Expr *ungroup(Node::Expr *expr) {
+  while (expr->kind == ND_GROUP) expr = static_cast<GroupExpr *>(expr)->expr;
+  return expr;
+}
+
+static bool isStruct(Node::Type *type) {
+  return type != nullptr && type->kind == ND_SYMBOL_TYPE &&
+         codegen::structByteSizes.contains(static_cast<SymbolType *>(type)->name);
+}
+
+static bool isFloat(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return false;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  return name == "float" || name == "double";
+}
+
+static bool isVoid(Node::Type *type) {
+  return type == nullptr || (type->kind == ND_SYMBOL_TYPE && static_cast<SymbolType *>(type)->name == "void");
+}
+
+// Ints, floats and pointers, the things that fit in one register and can be assigned like any other local
+static bool isScalar(Node::Type *type) {
+  return type != nullptr && type->kind != ND_ARRAY_TYPE && !isStruct(type) && !isVoid(type);
+}
+
+static bool hasAddress(Node::Expr *expr) {
+  if (expr->kind == ND_ADDRESS) return true;
+  bool found = false;
+  Walk::children(expr, [&](Node::Expr *&e) { found = found || hasAddress(e); });
+  return found;
+}
+
+static bool escapes(Node::Stmt *stmt) {
+  if (stmt->kind == ND_VAR_STMT) {
+    Node::Type *type = static_cast<VarStmt *>(stmt)->type;
+    if (type != nullptr && (type->kind == ND_ARRAY_TYPE || isStruct(type))) return true;
+  }
+  bool found = false;
+  Walk::children(stmt, [&](Node::Expr *&e) { found = found || hasAddress(e); },
+                 [&](Node::Stmt *&s) { found = found || escapes(s); });
+  return found;
+}
+
+bool TailCalls::frameEscapes(FnStmt *fn) { return escapes(fn->block); }
+
+std::string TailCalls::whyNot(FnStmt *caller, ReturnStmt *ret) {
+  Node::Expr *expr = ret->expr == nullptr ? nullptr : ungroup(ret->expr);
+  if (expr == nullptr || expr->kind != ND_CALL) return "there is no call to jump to";
+  CallExpr *call = static_cast<CallExpr *>(expr);
+  if (call->callee->kind != ND_IDENT) return "only calls to plain functions can be jumps, not methods";
+  std::string name = static_cast<IdentExpr *>(call->callee)->name;
+
+  // Whatever it leaves in %rax or %xmm0 is what our caller gets, so it had better be what they expect
+  Node::Type *ours = caller->returnType, *theirs = call->asmType;
+  if (!isVoid(ours)) {
+    if (!isScalar(ours) || !isScalar(theirs)) return "structs and arrays come back through memory in our frame";
+    if (isFloat(ours) != isFloat(theirs) || codegen::getByteSizeOfType(ours) != codegen::getByteSizeOfType(theirs))
+      return "'" + name + "' returns a different type than '" + caller->name + "' does";
+  }
+
+  size_t ints = 0, floats = 0;
+  for (Node::Expr *arg : call->args) {
+    if (isStruct(arg->asmType)) return "struct arguments are copies in our frame";
+    (isFloat(arg->asmType) ? floats : ints)++;
+  }
+  if (ints > codegen::intArgOrder.size() || floats > codegen::floatArgOrder.size())
+    return "'" + name + "' takes arguments on the stack, and there's no room for them";
+  if (frameEscapes(caller))
+    return "'" + caller->name + "' has arrays, structs or addresses of locals that go away with its frame";
+  return "";
+}
+
+size_t TailCalls::run(Node::Stmt *program) {
+  functions.clear();
+  callCount = 0;
+  collect(program);
+  for (FnStmt *fn : functions) process(fn);
+  return callCount;
+}
+
+// Methods are left out: a plain `f(...)` in one calls the global function, not itself
+void TailCalls::collect(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt);
+      break;
+    case ND_CONST_STMT:
+      collect(static_cast<ConstStmt *>(stmt)->value);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      if (!fn->isTemplate && fn->block != nullptr && fn->name != "main") functions.push_back(fn);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void TailCalls::process(FnStmt *fn) {
+  for (auto &[param, type] : fn->params)
+    if (!isScalar(type)) return;
+  if (frameEscapes(fn)) return;
+  size_t before = callCount;
+  rewrite(fn->block, fn);
+  if (callCount == before) return;
+  // loop (true) { <body> break; }
+  Node::Type *boolType = new SymbolType("bool");
+  BoolExpr *always = new BoolExpr(fn->line, fn->pos, true, fn->file_id);
+  always->asmType = boolType;
+  std::vector<Node::Stmt *> body = {fn->block, new BreakStmt(fn->line, fn->pos, fn->file_id)};
+  WhileStmt *loop = new WhileStmt(fn->line, fn->pos, always, nullptr,
+                                  new BlockStmt(fn->line, fn->pos, body, false, {}, fn->file_id), fn->file_id);
+  fn->block = new BlockStmt(fn->line, fn->pos, {loop}, false, {}, fn->file_id);
+}
+
+bool TailCalls::isSelfCall(Node::Stmt *stmt, FnStmt *fn) {
+  if (stmt->kind != ND_RETURN_STMT || static_cast<ReturnStmt *>(stmt)->expr == nullptr) return false;
+  Node::Expr *expr = ungroup(static_cast<ReturnStmt *>(stmt)->expr);
+  if (expr->kind != ND_CALL) return false;
+  CallExpr *call = static_cast<CallExpr *>(expr);
+  return call->callee->kind == ND_IDENT && static_cast<IdentExpr *>(call->callee)->name == fn->name &&
+         call->args.size() == fn->params.size();
+}
+
+// return f(a, b);  ->  { have t0 = a; have t1 = b; x = t0; y = t1; continue; }
+// Every argument is worked out before any param changes, they can use the old values of all of them.
+// Only through blocks and ifs: in a loop or a match that `continue` would mean something else, so those stay calls
+void TailCalls::rewrite(Node::Stmt *&stmt, FnStmt *fn) {
+  if (stmt->kind == ND_BLOCK_STMT) {
+    for (Node::Stmt *&s : static_cast<BlockStmt *>(stmt)->stmts) rewrite(s, fn);
+    return;
+  }
+  if (stmt->kind == ND_IF_STMT) {
+    IfStmt *s = static_cast<IfStmt *>(stmt);
+    rewrite(s->thenStmt, fn);
+    if (s->elseStmt != nullptr) rewrite(s->elseStmt, fn);
+    return;
+  }
+  if (!isSelfCall(stmt, fn)) return;
+
+  ReturnStmt *ret = static_cast<ReturnStmt *>(stmt);
+  CallExpr *call = static_cast<CallExpr *>(ungroup(ret->expr));
+  std::string prefix = "__tail" + std::to_string(tempCount++) + "_";
+  std::vector<Node::Stmt *> stmts;
+  for (size_t i = 0; i < fn->params.size(); i++)
+    stmts.push_back(new VarStmt(ret->line, ret->pos, false, prefix + fn->params[i].first->name, fn->params[i].second,
+                                call->args[i], ret->file_id));
+  for (size_t i = 0; i < fn->params.size(); i++) {
+    Node::Type *type = fn->params[i].second;
+    IdentExpr *param = new IdentExpr(ret->line, ret->pos, fn->params[i].first->name, type, ret->file_id);
+    IdentExpr *temp = new IdentExpr(ret->line, ret->pos, prefix + fn->params[i].first->name, type, ret->file_id);
+    param->asmType = temp->asmType = type;
+    AssignmentExpr *assign = new AssignmentExpr(ret->line, ret->pos, param, "=", temp, ret->file_id);
+    assign->asmType = type;
+    stmts.push_back(new ExprStmt(ret->line, ret->pos, assign, ret->file_id));
+  }
+  stmts.push_back(new ContinueStmt(ret->line, ret->pos, ret->file_id));
+  stmt = new BlockStmt(ret->line, ret->pos, stmts, false, {}, ret->file_id);
+  callCount++;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+
+// Calls in tail position, `return f(...);`, where nothing is left to do with f's result but hand it back.
+// Our frame isn't needed anymore by then, so there's no reason for the stack to grow:
+//
+//  - A function returning a call to itself becomes a loop, on the AST: the body goes into a
+//    `loop (true) { ...; break; }`, and each of those returns into new values for the params and a `continue`.
+//    (That's this pass. It runs before inlining, so loops that used to be recursion can still get inlined.)
+//  - Any other call gets its arguments put in registers, our frame torn down, and a `jmp` instead of a `call`:
+//    the callee returns straight to our caller. Codegen and the IR backend do that part, whyNot() says when.
+//
+// Anything pointing into our frame (`&x`, arrays, structs) would be left dangling, so functions with those keep
+// their calls. So do calls that need arguments on the stack, which would go where our caller's frame is.
+// By itself it only kicks in when optimizing, `@tailcall return f(...);` gets it at -O0 too, and fails to
+// compile when it can't.
+class TailCalls {
+public:
+  // Returns how many self-recursive calls became loops
+  static size_t run(Node::Stmt *program);
+
+  // Why `ret` in `caller` can't jump to the function it calls, or "" if it can
+  static std::string whyNot(FnStmt *caller, ReturnStmt *ret);
+
+  // Does anything in the body point into the frame? (`&x`, array or struct locals)
+  static bool frameEscapes(FnStmt *fn);
+
+private:
+  static void collect(Node::Stmt *stmt);
+  static void process(FnStmt *fn);
+  static void rewrite(Node::Stmt *&stmt, FnStmt *fn);
+  static bool isSelfCall(Node::Stmt *stmt, FnStmt *fn);
+
+  static inline std::vector<FnStmt *> functions = {};
+  static inline size_t callCount = 0;
+  static inline size_t tempCount = 0;
+};
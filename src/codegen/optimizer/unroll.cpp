@@ -0,0 +1,432 @@
+#include "unroll.hpp"
+#include "inliner.hpp"
+#include "profile.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+#include <algorithm>
+#include <climits>
+
+__extension__ typedef __int128 int128; // see strength.hpp
+
+// Every name a function body declares, and the ones that show up as &x
+static void gatherLocals(Node::Stmt *stmt, std::set<std::string> &out) {
+  if (stmt->kind == ND_VAR_STMT) out.insert(static_cast<VarStmt *>(stmt)->name);
+  if (stmt->kind == ND_FOR_STMT) out.insert(static_cast<ForStmt *>(stmt)->name);
+  if (stmt->kind == ND_FN_STMT || stmt->kind == ND_STRUCT_STMT) return;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { gatherLocals(s, out); });
+}
+
+static void gatherEscaped(Node::Expr *expr, std::set<std::string> &out) {
+  if (expr->kind == ND_ADDRESS && static_cast<AddressExpr *>(expr)->right->kind == ND_IDENT)
+    out.insert(static_cast<IdentExpr *>(static_cast<AddressExpr *>(expr)->right)->name);
+  Walk::children(expr, [&](Node::Expr *&e) { gatherEscaped(e, out); });
+}
+
+static void gatherEscaped(Node::Stmt *stmt, std::set<std::string> &out) {
+  Walk::children(stmt, [&](Node::Expr *&e) { gatherEscaped(e, out); },
+                 [&](Node::Stmt *&s) { gatherEscaped(s, out); });
+}
+
+static bool containsLoop(Node::Stmt *stmt) {
+  if (stmt->kind == ND_WHILE_STMT || stmt->kind == ND_FOR_STMT) return true;
+  bool found = false;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { found = found || containsLoop(s); });
+  return found;
+}
+
+// 4, -4 and (4) all count, the folder hasn't had a go at anything yet
+static bool constantOf(Node::Expr *expr, long long &out) {
+  if (expr->kind == ND_INT) {
+    out = static_cast<IntExpr *>(expr)->value;
+    return true;
+  }
+  if (expr->kind == ND_GROUP) return constantOf(static_cast<GroupExpr *>(expr)->expr, out);
+  if (expr->kind == ND_UNARY && static_cast<UnaryExpr *>(expr)->op == "-" && constantOf(static_cast<UnaryExpr *>(expr)->expr, out)) {
+    out = -out;
+    return true;
+  }
+  return false;
+}
+
+static bool isNamed(Node::Expr *expr, const std::string &name) {
+  return expr->kind == ND_IDENT && static_cast<IdentExpr *>(expr)->name == name;
+}
+
+// The same integer types the IR knows about; bytes is 0 for anything else
+static int bytesOf(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return 0;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (name != "int" && name != "short" && name != "char" && name != "long") return 0;
+  return (int)codegen::typeSizes[name];
+}
+
+size_t Unroller::run(Node::Stmt *program) {
+  functions.clear();
+  loopCount = 0;
+  collect(program);
+  for (FnStmt *fn : functions) process(fn);
+  return loopCount;
+}
+
+void Unroller::collect(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt);
+      break;
+    case ND_CONST_STMT:
+      collect(static_cast<ConstStmt *>(stmt)->value);
+      break;
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *s : static_cast<StructStmt *>(stmt)->stmts) collect(s);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      if (!fn->isTemplate && fn->block != nullptr) functions.push_back(fn);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void Unroller::process(FnStmt *fn) {
+  locals.clear();
+  for (auto &param : fn->params) locals.insert(param.first->name);
+  gatherLocals(fn->block, locals);
+  std::set<std::string> escaped;
+  gatherEscaped(fn->block, escaped);
+  for (const std::string &name : escaped) locals.erase(name);
+  visit(fn->block);
+}
+
+// Inner loops first. Once one of those is unrolled the outer body is usually too big to copy, which is what we want
+void Unroller::visit(Node::Stmt *&stmt) {
+  if (stmt->kind == ND_FN_STMT || stmt->kind == ND_STRUCT_STMT) return;
+  Walk::children(stmt, [](Node::Expr *&) {}, [](Node::Stmt *&s) { visit(s); });
+  if (stmt->kind != ND_FOR_STMT) return;
+
+  ForStmt *loop = static_cast<ForStmt *>(stmt);
+  if (loop->unroll == 0 || loop->unroll == 1 || (loop->unroll == -1 && !isAutomatic) || loop->vectorize) return;
+  Counted counted;
+  if (!analyze(loop, counted)) return;
+
+  if (loop->unroll > 1) {
+    long long factor = std::min((long long)loop->unroll, maxFactor);
+    stmt = counted.trips != -1 && counted.trips <= factor ? unrollFully(loop, counted) : unrollBy(loop, counted, factor);
+    loopCount++;
+    return;
+  }
+
+  // On our own, only if it's small enough that the copies are mostly what used to be loop overhead.
+  // With -profile-use, not if it never ran, and the trips it usually makes stand in for the ones we can't count
+  if (Profile::count(loop, Profile::Reached) == 0) return;
+  size_t size = Inliner::cost(loop->block);
+  long long trips = counted.trips;
+  long long expected = trips != -1 ? trips : Profile::averageTrips(loop);
+  if (trips != -1 && trips <= maxFullTrips && (size_t)trips * size <= fullBudget) {
+    stmt = unrollFully(loop, counted);
+  } else if (containsLoop(loop->block)) {
+    return;
+  } else if (size * 8 <= partialBudget && (expected == -1 || expected >= 8)) {
+    stmt = unrollBy(loop, counted, 8);
+  } else if (size * 4 <= partialBudget && (expected == -1 || expected >= 4)) {
+    stmt = unrollBy(loop, counted, 4);
+  } else {
+    return;
+  }
+  loopCount++;
+}
+
+bool Unroller::analyze(ForStmt *loop, Counted &out) {
+  if (loop->forLoop->kind != ND_ASSIGN || loop->optional == nullptr || loop->condition->kind != ND_BINARY) return false;
+  AssignmentExpr *init = static_cast<AssignmentExpr *>(loop->forLoop);
+  if (init->op != "=" || !isNamed(init->assignee, loop->name) || !isClonable(init->rhs)) return false;
+  out.var = static_cast<IdentExpr *>(init->assignee);
+  out.type = out.var->asmType;
+  int bytes = bytesOf(out.type);
+  if (bytes == 0) return false;
+  const std::string &name = loop->name;
+
+  // i++, i--, ++i, --i, i += c, i -= c, i = i + c, i = i - c
+  Node::Expr *step = loop->optional;
+  long long by = 0;
+  if (step->kind == ND_POSTFIX || step->kind == ND_PREFIX) {
+    const std::string &op = step->kind == ND_POSTFIX ? static_cast<PostfixExpr *>(step)->op : static_cast<PrefixExpr *>(step)->op;
+    Node::Expr *of = step->kind == ND_POSTFIX ? static_cast<PostfixExpr *>(step)->expr : static_cast<PrefixExpr *>(step)->expr;
+    if (!isNamed(of, name) || (op != "++" && op != "--")) return false;
+    out.step = op == "++" ? 1 : -1;
+  } else if (step->kind == ND_ASSIGN) {
+    AssignmentExpr *assign = static_cast<AssignmentExpr *>(step);
+    if (!isNamed(assign->assignee, name)) return false;
+    if ((assign->op == "+=" || assign->op == "-=") && constantOf(assign->rhs, by)) {
+      out.step = assign->op == "+=" ? by : -by;
+    } else if (assign->op == "=" && assign->rhs->kind == ND_BINARY) {
+      BinaryExpr *add = static_cast<BinaryExpr *>(assign->rhs);
+      if (!isNamed(add->lhs, name) || (add->op != "+" && add->op != "-") || !constantOf(add->rhs, by)) return false;
+      out.step = add->op == "+" ? by : -by;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  if (out.step == 0 || out.step > (1LL << 32) || out.step < -(1LL << 32)) return false;
+
+  // i < bound, where the bound can't change under us
+  BinaryExpr *cond = static_cast<BinaryExpr *>(loop->condition);
+  out.op = cond->op;
+  if (!isNamed(cond->lhs, name)) return false;
+  if (out.op != "<" && out.op != "<=" && out.op != ">" && out.op != ">=" && out.op != "!=") return false;
+  long long bound = 0;
+  bool isConstBound = constantOf(cond->rhs, bound);
+  if (isConstBound) {
+    out.bound = literal(loop, bound, out.type);
+  } else if (cond->rhs->kind == ND_IDENT && locals.contains(static_cast<IdentExpr *>(cond->rhs)->name) &&
+             !isNamed(cond->rhs, name) && !writes(loop->block, static_cast<IdentExpr *>(cond->rhs)->name)) {
+    out.bound = cond->rhs;
+  } else {
+    return false;
+  }
+  if (!isClonable(loop->block, false) || writes(loop->block, name)) return false;
+
+  out.trips = isConstBound && constantOf(init->rhs, out.init) ? tripCount(out) : -1;
+  if (out.trips != -1) return true;
+  // Unrolling by the trip count we find out at runtime works out how many are left with `bound - i`,
+  // which needs a full 64 bits on both sides, and the loop has to be headed towards the bound
+  if (bytes != 8 || bytesOf(out.bound->asmType) != 8 || out.op == "!=") return false;
+  return out.step > 0 ? out.op[0] == '<' : out.op[0] == '>';
+}
+
+// -1 if it never stops, or if `i` goes somewhere it can't be trusted to compare the way we think it does
+long long Unroller::tripCount(const Counted &loop) {
+  long long bound = static_cast<IntExpr *>(loop.bound)->value;
+  int128 init = loop.init, step = loop.step, trips = 0;
+  const std::string &op = loop.op;
+  bool isUp = step > 0;
+  if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+    bool runs = op == "<" ? init < bound : op == "<=" ? init <= bound : op == ">" ? init > bound : init >= bound;
+    if (runs && isUp != (op[0] == '<')) return -1; // heading the wrong way
+    int128 distance = isUp ? bound - init : init - bound, by = isUp ? step : -step;
+    bool isInclusive = op.size() == 2;
+    if (runs) trips = isInclusive ? distance / by + 1 : (distance + by - 1) / by;
+  } else {
+    int128 distance = (int128)bound - init;
+    if (distance % step != 0 || distance / step < 0) return -1;
+    trips = distance / step;
+  }
+  int128 last = init + trips * step;
+  if (trips > INT_MAX || last > LLONG_MAX || last < LLONG_MIN) return -1;
+  if (!fits(loop.init, loop.type) || !fits((long long)last, loop.type)) return -1;
+  return (long long)trips;
+}
+
+// Can `value` stand in for `i` as a literal? Compares are always signed, at the full width of the type, so
+// narrow unsigned values past the sign bit would come out negative. And a negative literal for an unsigned
+// `i` would get folded as signed (-4 % 3 isn't what (2^64 - 4) % 3 is), so those don't count either
+bool Unroller::fits(long long value, Node::Type *type) {
+  int bits = bytesOf(type) * 8;
+  if (bits == 0) return false;
+  bool isSigned = static_cast<SymbolType *>(type)->signedness == SymbolType::Signedness::SIGNED;
+  long long max = bits >= 64 ? LLONG_MAX : (1LL << (bits - 1)) - 1;
+  return value <= max && value >= (isSigned ? -max - 1 : 0);
+}
+
+// Only what Inliner::clone knows how to copy, and no break/continue that would be aimed at this loop
+bool Unroller::isClonable(Node::Stmt *stmt, bool inLoop) {
+  switch (stmt->kind) {
+    case ND_BLOCK_STMT:
+    case ND_EXPR_STMT:
+    case ND_VAR_STMT:
+    case ND_RETURN_STMT:
+    case ND_IF_STMT:
+    case ND_PRINT_STMT:
+      break;
+    case ND_WHILE_STMT:
+    case ND_FOR_STMT:
+      inLoop = true;
+      break;
+    case ND_BREAK_STMT:
+    case ND_CONTINUE_STMT:
+      if (!inLoop) return false;
+      break;
+    default:
+      return false; // match, structs, nested functions, input...
+  }
+  bool ok = true;
+  bool isKnown = Walk::children(stmt, [&](Node::Expr *&e) { ok = ok && isClonable(e); },
+                                [&](Node::Stmt *&s) { ok = ok && isClonable(s, inLoop); });
+  return ok && isKnown;
+}
+
+bool Unroller::isClonable(Node::Expr *expr) {
+  switch (expr->kind) {
+    case ND_INT:
+    case ND_FLOAT:
+    case ND_IDENT:
+    case ND_STRING:
+    case ND_CHAR:
+    case ND_BOOL:
+    case ND_NULL:
+    case ND_BINARY:
+    case ND_UNARY:
+    case ND_PREFIX:
+    case ND_POSTFIX:
+    case ND_GROUP:
+    case ND_CAST:
+    case ND_CALL:
+    case ND_INDEX:
+    case ND_ADDRESS:
+    case ND_DEREFERENCE:
+    case ND_ASSIGN:
+    case ND_TERNARY:
+    case ND_ALLOC_MEMORY:
+    case ND_FREE_MEMORY:
+    case ND_MEMCPY_MEMORY:
+    case ND_STRCMP:
+    case ND_EXTERNAL_CALL:
+      break;
+    default:
+      return false;
+  }
+  bool ok = true;
+  bool isKnown = Walk::children(expr, [&](Node::Expr *&e) { ok = ok && isClonable(e); });
+  return ok && isKnown;
+}
+
+// Assigned, incremented, pointed at or shadowed anywhere in here
+bool Unroller::writes(Node::Stmt *stmt, const std::string &name) {
+  if (stmt->kind == ND_VAR_STMT && static_cast<VarStmt *>(stmt)->name == name) return true;
+  if (stmt->kind == ND_FOR_STMT && static_cast<ForStmt *>(stmt)->name == name) return true;
+  bool found = false;
+  Walk::children(stmt, [&](Node::Expr *&e) { found = found || writes(e, name); },
+                 [&](Node::Stmt *&s) { found = found || writes(s, name); });
+  return found;
+}
+
+bool Unroller::writes(Node::Expr *expr, const std::string &name) {
+  if (expr->kind == ND_ASSIGN && isNamed(static_cast<AssignmentExpr *>(expr)->assignee, name)) return true;
+  if (expr->kind == ND_PREFIX && isNamed(static_cast<PrefixExpr *>(expr)->expr, name)) return true;
+  if (expr->kind == ND_POSTFIX && isNamed(static_cast<PostfixExpr *>(expr)->expr, name)) return true;
+  if (expr->kind == ND_ADDRESS && isNamed(static_cast<AddressExpr *>(expr)->right, name)) return true;
+  bool found = false;
+  Walk::children(expr, [&](Node::Expr *&e) { found = found || writes(e, name); });
+  return found;
+}
+
+// { body with i = 0 } { body with i = 1 } ...
+Node::Stmt *Unroller::unrollFully(ForStmt *loop, const Counted &counted) {
+  std::vector<Node::Stmt *> stmts;
+  for (long long k = 0; k < counted.trips; k++)
+    stmts.push_back(copyOf(loop, literal(loop, counted.init + k * counted.step, counted.type)));
+  return new BlockStmt(loop->line, loop->pos, stmts, false, {}, loop->file_id);
+}
+
+// have j: T = init;
+// if (j < bound) { loop (bound - j > 3) : (j = j + 4) { body(j) body(j + 1) body(j + 2) body(j + 3) } }
+// loop (j < bound) : (j = j + 1) { body(j) }
+// `bound - j` is how many are left. It can come out negative if that's more than fits in 63 bits, but then
+// the leftover loop just gets all of them (and once we're in, it only ever gets smaller, so it can't wrap).
+// With a known trip count both loops know exactly where to stop.
+Node::Stmt *Unroller::unrollBy(ForStmt *loop, const Counted &counted, long long factor) {
+  std::string name = "__unroll" + std::to_string(unrollCount++) + "_" + loop->name;
+  Node::Type *type = counted.type;
+  Node::Type *boolType = new SymbolType("bool");
+  long long step = counted.step, reach = (factor - 1) * step; // how far ahead the last copy is
+  AssignmentExpr *init = static_cast<AssignmentExpr *>(loop->forLoop);
+  std::vector<Node::Stmt *> stmts;
+  stmts.push_back(new VarStmt(loop->line, loop->pos, false, name, type, Inliner::clone(init->rhs), loop->file_id));
+
+  auto compare = [&](Node::Expr *lhs, const std::string &op, Node::Expr *rhs) {
+    BinaryExpr *e = new BinaryExpr(loop->line, loop->pos, lhs, rhs, op, loop->file_id);
+    e->asmType = boolType;
+    return e;
+  };
+  auto advance = [&](long long by) {
+    AssignmentExpr *e = new AssignmentExpr(loop->line, loop->pos, ident(loop, name, type), "=",
+                                           offset(loop, ident(loop, name, type), by, type), loop->file_id);
+    e->asmType = type;
+    return e;
+  };
+
+  Node::Expr *cond;
+  if (counted.trips != -1) {
+    long long end = counted.init + counted.trips / factor * factor * step;
+    cond = compare(ident(loop, name, type), step > 0 ? "<" : ">", literal(loop, end, type));
+  } else {
+    Node::Expr *bound = Inliner::clone(counted.bound);
+    BinaryExpr *left = step > 0 ? new BinaryExpr(loop->line, loop->pos, bound, ident(loop, name, type), "-", loop->file_id)
+                                : new BinaryExpr(loop->line, loop->pos, ident(loop, name, type), bound, "-", loop->file_id);
+    left->asmType = type;
+    bool isInclusive = counted.op.size() == 2;
+    cond = compare(left, isInclusive ? ">=" : ">", literal(loop, reach < 0 ? -reach : reach, type));
+  }
+  std::vector<Node::Stmt *> copies;
+  for (long long k = 0; k < factor; k++) {
+    Node::Expr *value = ident(loop, name, type);
+    if (k > 0) value = offset(loop, value, k * step, type);
+    copies.push_back(copyOf(loop, value));
+  }
+  Node::Stmt *unrolled = new WhileStmt(loop->line, loop->pos, cond, advance(factor * step),
+                                       new BlockStmt(loop->line, loop->pos, copies, false, {}, loop->file_id), loop->file_id);
+  if (counted.trips == -1) {
+    // The stack machine can't branch on a && b, so the "are we even going in" test gets an if of its own
+    Node::Expr *entry = compare(ident(loop, name, type), counted.op, Inliner::clone(counted.bound));
+    Node::Stmt *then = new BlockStmt(loop->line, loop->pos, {unrolled}, false, {}, loop->file_id);
+    unrolled = new IfStmt(loop->line, loop->pos, entry, then, nullptr, loop->file_id);
+  }
+  stmts.push_back(unrolled);
+
+  if (counted.trips != -1) {
+    for (long long k = counted.trips - counted.trips % factor; k < counted.trips; k++)
+      stmts.push_back(copyOf(loop, literal(loop, counted.init + k * step, type)));
+  } else {
+    Node::Expr *rest = compare(ident(loop, name, type), counted.op, Inliner::clone(counted.bound));
+    stmts.push_back(new WhileStmt(loop->line, loop->pos, rest, advance(step),
+                                  copyOf(loop, ident(loop, name, type)), loop->file_id));
+  }
+  return new BlockStmt(loop->line, loop->pos, stmts, false, {}, loop->file_id);
+}
+
+// A fresh copy of the body with `var` swapped out for `value`, and its own names for whatever it declares
+Node::Stmt *Unroller::copyOf(ForStmt *loop, Node::Expr *value) {
+  Node::Stmt *copy = Inliner::clone(loop->block);
+  std::set<std::string> declared;
+  gatherLocals(copy, declared);
+  std::string prefix = "__unroll" + std::to_string(unrollCount++) + "_";
+  std::unordered_map<std::string, std::string> names;
+  for (const std::string &name : declared) names[name] = prefix + name;
+  Inliner::rename(copy, names);
+
+  std::function<void(Node::Expr *&)> onExpr = [&](Node::Expr *&e) {
+    if (isNamed(e, loop->name)) e = Inliner::clone(value);
+    else Walk::children(e, onExpr);
+  };
+  std::function<void(Node::Stmt *&)> onStmt = [&](Node::Stmt *&s) { Walk::children(s, onExpr, onStmt); };
+  onStmt(copy);
+  if (copy->kind == ND_BLOCK_STMT) return copy;
+  return new BlockStmt(loop->line, loop->pos, {copy}, false, {}, loop->file_id);
+}
+
+IntExpr *Unroller::literal(ForStmt *loop, long long value, Node::Type *type) {
+  IntExpr *e = new IntExpr(loop->line, loop->pos, value, loop->file_id);
+  e->asmType = type;
+  return e;
+}
+
+IdentExpr *Unroller::ident(ForStmt *loop, const std::string &name, Node::Type *type) {
+  IdentExpr *e = new IdentExpr(loop->line, loop->pos, name, type, loop->file_id);
+  e->asmType = type;
+  return e;
+}
+
+// base + by, or base - -by
+BinaryExpr *Unroller::offset(ForStmt *loop, Node::Expr *base, long long by, Node::Type *type) {
+  BinaryExpr *e = new BinaryExpr(loop->line, loop->pos, base, literal(loop, by < 0 ? -by : by, type),
+                                 by < 0 ? "-" : "+", loop->file_id);
+  e->asmType = type;
+  return e;
+}
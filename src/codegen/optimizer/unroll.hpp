@@ -0,0 +1,73 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+
+// Loop unrolling on the typed AST, for counted loops: `loop (i = <int>; i < <bound>) : (i++ / i-- / i += <int>)`.
+// A compare and a branch for every element of a `[64]int` adds up, and straight line code gives the
+// folder (and the IR, for int-only functions) constant indexes and offsets to chew on.
+//
+//  - Constant trip count, and a small one: the loop goes away completely, every copy of the body gets
+//    its own value of `i` as a literal.
+//  - Otherwise: the body gets pasted 4 or 8 times into a loop that steps that much further each time
+//    around (with `i`, `i + 1`, `i + 2`... in the copies), and whatever is left over runs in a copy of
+//    the original loop. With a constant trip count, the leftovers get fully unrolled instead.
+//
+// The bound has to be a literal or a local nobody can change while the loop runs, the body can't touch `i`,
+// and break/continue (which would have to leave all the copies at once) keep a loop rolled.
+// `@unroll(n)` unrolls n times with no questions about size, `@unroll(1)` keeps a loop as it is.
+// By itself it only kicks in at -O2, -O1 and -Os leave everything but `@unroll` loops alone.
+// Run it after inlining (so calls in the body are already pasted in and get counted) and before folding.
+class Unroller {
+public:
+  // Returns how many loops got unrolled
+  static size_t run(Node::Stmt *program);
+
+  static inline bool isAutomatic = false; // -O2: pick loops (and factors) on our own
+
+private:
+  struct Counted {
+    IdentExpr *var;       // the original `i`
+    Node::Type *type;     // ... and its type
+    long long init = 0;   // only if it starts at a literal
+    long long step = 0;
+    std::string op;       // how `i` is compared against the bound, `i` on the left
+    Node::Expr *bound;    // a literal, or a local
+    long long trips = -1; // -1 if it can only be told at runtime
+  };
+
+  static void collect(Node::Stmt *stmt);
+  static void process(FnStmt *fn);
+  static void visit(Node::Stmt *&stmt);
+  static bool analyze(ForStmt *loop, Counted &out);
+  static long long tripCount(const Counted &loop);
+  static bool fits(long long value, Node::Type *type);
+
+  // Legality
+  static bool isClonable(Node::Stmt *stmt, bool inLoop);
+  static bool isClonable(Node::Expr *expr);
+  static bool writes(Node::Stmt *stmt, const std::string &name);
+  static bool writes(Node::Expr *expr, const std::string &name);
+
+  // Rewriting
+  static Node::Stmt *unrollFully(ForStmt *loop, const Counted &counted);
+  static Node::Stmt *unrollBy(ForStmt *loop, const Counted &counted, long long factor);
+  static Node::Stmt *copyOf(ForStmt *loop, Node::Expr *value);
+  static IntExpr *literal(ForStmt *loop, long long value, Node::Type *type);
+  static IdentExpr *ident(ForStmt *loop, const std::string &name, Node::Type *type);
+  static BinaryExpr *offset(ForStmt *loop, Node::Expr *base, long long by, Node::Type *type);
+
+  static inline std::vector<FnStmt *> functions = {}; // every function body, struct methods included
+  static inline std::set<std::string> locals = {};    // params and locals of the function we are in, unless escaped
+  static inline size_t unrollCount = 0; // never reset, it keeps the __unrollN_ names unique
+  static inline size_t loopCount = 0;
+
+  static constexpr long long maxFullTrips = 16;   // iterations, for unrolling a loop away by itself
+  static constexpr size_t fullBudget = 160;       // nodes the body may grow to when it does
+  static constexpr size_t partialBudget = 80;     // nodes, for 4 (or 8) copies of the body
+  static constexpr long long maxFactor = 64;      // even with @unroll
+};
@@ -0,0 +1,700 @@
+#include "vectorize.hpp"
+#include "passes.hpp"
+#include "../gen.hpp"
+#include "../../ast/walk.hpp"
+
+#include <algorithm>
+
+// 4, -4 and (4) all count
+static bool constantOf(Node::Expr *expr, long long &out) {
+  if (expr->kind == ND_INT) {
+    out = static_cast<IntExpr *>(expr)->value;
+    return true;
+  }
+  if (expr->kind == ND_GROUP) return constantOf(static_cast<GroupExpr *>(expr)->expr, out);
+  if (expr->kind == ND_UNARY && static_cast<UnaryExpr *>(expr)->op == "-" && constantOf(static_cast<UnaryExpr *>(expr)->expr, out)) {
+    out = -out;
+    return true;
+  }
+  return false;
+}
+
+static bool isNamed(Node::Expr *expr, const std::string &name) {
+  return expr->kind == ND_IDENT && static_cast<IdentExpr *>(expr)->name == name;
+}
+
+// Integers only; bytes is 0 for anything else
+static int bytesOf(Node::Type *type) {
+  if (type == nullptr || type->kind != ND_SYMBOL_TYPE) return 0;
+  const std::string &name = static_cast<SymbolType *>(type)->name;
+  if (name != "int" && name != "short" && name != "char" && name != "long") return 0;
+  return (int)codegen::typeSizes[name];
+}
+
+// What one load out of `type` gets: [N]int, [N]char... or *char, the only pointer you can index
+static Node::Type *elementOf(Node::Type *type) {
+  if (type == nullptr) return nullptr;
+  if (type->kind == ND_ARRAY_TYPE) return static_cast<ArrayType *>(type)->underlying;
+  if (type->kind == ND_POINTER_TYPE && bytesOf(static_cast<PointerType *>(type)->underlying) == 1)
+    return static_cast<PointerType *>(type)->underlying;
+  return nullptr;
+}
+
+// { x; } -> x
+static Node::Stmt *only(Node::Stmt *stmt) {
+  if (stmt == nullptr || stmt->kind != ND_BLOCK_STMT) return stmt;
+  BlockStmt *block = static_cast<BlockStmt *>(stmt);
+  return block->stmts.size() == 1 ? only(block->stmts[0]) : nullptr;
+}
+
+// x++, ++x, x += 1, x = x + 1, x = 1 + x
+static bool isIncrementOf(Node::Expr *expr, std::string &name) {
+  Node::Expr *of = nullptr;
+  long long by = 0;
+  if (expr->kind == ND_POSTFIX && static_cast<PostfixExpr *>(expr)->op == "++") of = static_cast<PostfixExpr *>(expr)->expr;
+  if (expr->kind == ND_PREFIX && static_cast<PrefixExpr *>(expr)->op == "++") of = static_cast<PrefixExpr *>(expr)->expr;
+  if (expr->kind == ND_ASSIGN) {
+    AssignmentExpr *assign = static_cast<AssignmentExpr *>(expr);
+    if (assign->assignee->kind != ND_IDENT) return false;
+    const std::string &target = static_cast<IdentExpr *>(assign->assignee)->name;
+    if (assign->op == "+=" && constantOf(assign->rhs, by) && by == 1) of = assign->assignee;
+    if (assign->op == "=" && assign->rhs->kind == ND_BINARY) {
+      BinaryExpr *add = static_cast<BinaryExpr *>(assign->rhs);
+      if (add->op == "+" && ((isNamed(add->lhs, target) && constantOf(add->rhs, by) && by == 1) ||
+                             (isNamed(add->rhs, target) && constantOf(add->lhs, by) && by == 1)))
+        of = assign->assignee;
+    }
+  }
+  if (of == nullptr || of->kind != ND_IDENT) return false;
+  name = static_cast<IdentExpr *>(of)->name;
+  return true;
+}
+
+// `x * 8` is a shift by 3, which there is an instruction for at every width but bytes.
+// (Multiplying lanes is only a thing for 2 bytes, and 4 with SSE4.1)
+static bool isShift(BinaryExpr *bin, int width, int &bits, Node::Expr *&other) {
+  long long by = 0;
+  if (bin->op != "*" || width < 2) return false;
+  if (constantOf(bin->rhs, by)) other = bin->lhs;
+  else if (constantOf(bin->lhs, by)) other = bin->rhs;
+  else return false;
+  if (by <= 0 || (by & (by - 1)) != 0) return false;
+  bits = __builtin_ctzll((unsigned long long)by);
+  return true;
+}
+
+static void gatherEscaped(Node::Expr *expr, std::set<std::string> &out) {
+  if (expr->kind == ND_ADDRESS && static_cast<AddressExpr *>(expr)->right->kind == ND_IDENT)
+    out.insert(static_cast<IdentExpr *>(static_cast<AddressExpr *>(expr)->right)->name);
+  Walk::children(expr, [&](Node::Expr *&e) { gatherEscaped(e, out); });
+}
+
+static void gatherEscaped(Node::Stmt *stmt, std::set<std::string> &out) {
+  Walk::children(stmt, [&](Node::Expr *&e) { gatherEscaped(e, out); },
+                 [&](Node::Stmt *&s) { gatherEscaped(s, out); });
+}
+
+static void gatherArrays(Node::Stmt *stmt, std::set<std::string> &out) {
+  if (stmt->kind == ND_VAR_STMT && static_cast<VarStmt *>(stmt)->type != nullptr &&
+      static_cast<VarStmt *>(stmt)->type->kind == ND_ARRAY_TYPE)
+    out.insert(static_cast<VarStmt *>(stmt)->name);
+  if (stmt->kind == ND_FN_STMT || stmt->kind == ND_STRUCT_STMT) return;
+  Walk::children(stmt, [](Node::Expr *&) {}, [&](Node::Stmt *&s) { gatherArrays(s, out); });
+}
+
+size_t Vectorizer::run(Node::Stmt *program) {
+  functions.clear();
+  loopCount = 0;
+  collect(program);
+  for (FnStmt *fn : functions) {
+    escaped.clear();
+    localArrays.clear();
+    gatherEscaped(fn->block, escaped);
+    gatherArrays(fn->block, localArrays);
+    for (auto &param : fn->params) localArrays.erase(param.first->name); // shadowed, or about to be
+    visit(fn->block);
+  }
+  return loopCount;
+}
+
+void Vectorizer::collect(Node::Stmt *stmt) {
+  switch (stmt->kind) {
+    case ND_PROGRAM:
+      for (Node::Stmt *s : static_cast<ProgramStmt *>(stmt)->stmt) collect(s);
+      break;
+    case ND_IMPORT_STMT:
+      collect(static_cast<ImportStmt *>(stmt)->stmt);
+      break;
+    case ND_CONST_STMT:
+      collect(static_cast<ConstStmt *>(stmt)->value);
+      break;
+    case ND_STRUCT_STMT:
+      for (Node::Stmt *s : static_cast<StructStmt *>(stmt)->stmts) collect(s);
+      break;
+    case ND_FN_STMT: {
+      FnStmt *fn = static_cast<FnStmt *>(stmt);
+      if (!fn->isTemplate && fn->block != nullptr) functions.push_back(fn);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void Vectorizer::visit(Node::Stmt *stmt) {
+  if (stmt->kind == ND_FN_STMT || stmt->kind == ND_STRUCT_STMT) return;
+  Walk::children(stmt, [](Node::Expr *&) {}, [](Node::Stmt *&s) { visit(s); });
+  if (stmt->kind != ND_FOR_STMT) return;
+
+  // @unroll(n) asked for something else
+  ForStmt *loop = static_cast<ForStmt *>(stmt);
+  Plan plan;
+  if (loop->unroll > 1 || !analyze(loop, plan) || !isSafe(loop, plan)) return;
+  loop->vectorize = true;
+  loopCount++;
+}
+
+bool Vectorizer::analyze(ForStmt *loop, Plan &out) {
+  const std::string &name = loop->name;
+  out.var = name;
+  if (loop->forLoop->kind != ND_ASSIGN || loop->optional == nullptr || loop->condition->kind != ND_BINARY) return false;
+  AssignmentExpr *init = static_cast<AssignmentExpr *>(loop->forLoop);
+  std::string stepped;
+  if (init->op != "=" || !isNamed(init->assignee, name) || bytesOf(init->assignee->asmType) != 8) return false;
+  if (!isIncrementOf(loop->optional, stepped) || stepped != name) return false;
+
+  // i < n, where n is a literal or a full width int
+  BinaryExpr *cond = static_cast<BinaryExpr *>(loop->condition);
+  long long bound = 0;
+  if (!isNamed(cond->lhs, name) || (cond->op != "<" && cond->op != "<=")) return false;
+  if (cond->rhs->kind == ND_IDENT) {
+    if (isNamed(cond->rhs, name) || bytesOf(cond->rhs->asmType) != 8) return false;
+    out.reads.push_back(static_cast<IdentExpr *>(cond->rhs)->name);
+  } else if (!constantOf(cond->rhs, bound)) {
+    return false;
+  }
+  out.bound = cond->rhs;
+  out.isInclusive = cond->op == "<=";
+
+  Node::Stmt *body = only(loop->block);
+  if (body == nullptr) return false;
+  size_t nodes = 0;
+
+  if (body->kind == ND_EXPR_STMT && static_cast<ExprStmt *>(body)->expr->kind == ND_ASSIGN) {
+    AssignmentExpr *assign = static_cast<AssignmentExpr *>(static_cast<ExprStmt *>(body)->expr);
+    if (assign->op != "=") return false;
+
+    // d[i] = ...
+    if (assign->assignee->kind == ND_INDEX) {
+      out.kind = Kind::Map;
+      out.target = static_cast<IndexExpr *>(assign->assignee);
+      out.value = assign->rhs;
+      if (out.target->lhs->kind != ND_IDENT) return false;
+      out.width = bytesOf(elementOf(out.target->lhs->asmType));
+      return out.width != 0 && isLoad(out.target, out) && isLanes(out.value, out, nodes) && nodes <= maxNodes;
+    }
+
+    // s = s + ...
+    if (assign->assignee->kind != ND_IDENT || assign->rhs->kind != ND_BINARY) return false;
+    out.kind = Kind::Reduce;
+    out.result = static_cast<IdentExpr *>(assign->assignee);
+    out.width = bytesOf(out.result->asmType);
+    BinaryExpr *bin = static_cast<BinaryExpr *>(assign->rhs);
+    out.op = bin->op;
+    if (out.width == 0 || out.result->name == name) return false;
+    if (out.op != "+" && out.op != "-" && out.op != "&" && out.op != "|" && out.op != "^") return false;
+    if (isNamed(bin->lhs, out.result->name)) out.value = bin->rhs;
+    else if (out.op != "-" && isNamed(bin->rhs, out.result->name)) out.value = bin->lhs;
+    else return false;
+    if (!isLanes(out.value, out, nodes) || nodes > maxNodes || out.bases.empty()) return false;
+    return std::find(out.reads.begin(), out.reads.end(), out.result->name) == out.reads.end();
+  }
+
+  // if (x[i] == c) { ... }, with no else: the lanes that don't match can't have anything to do
+  if (body->kind != ND_IF_STMT) return false;
+  IfStmt *branch = static_cast<IfStmt *>(body);
+  if (branch->elseStmt != nullptr || branch->condition->kind != ND_BINARY) return false;
+  BinaryExpr *test = static_cast<BinaryExpr *>(branch->condition);
+  out.op = test->op;
+  if (out.op != "==" && out.op != "!=") return false;
+  bool isLeft = test->lhs->kind == ND_INDEX;
+  Node::Expr *load = isLeft ? test->lhs : test->rhs;
+  if (load->kind != ND_INDEX || static_cast<IndexExpr *>(load)->lhs->kind != ND_IDENT) return false;
+  out.target = static_cast<IndexExpr *>(load);
+  out.value = isLeft ? test->rhs : test->lhs;
+  out.width = bytesOf(elementOf(out.target->lhs->asmType));
+  if (out.width == 0 || !isLoad(out.target, out) || !isComparable(out.value, out)) return false;
+
+  std::string counter;
+  Node::Stmt *then = only(branch->thenStmt);
+  out.kind = Kind::Search;
+  if (then != nullptr && then->kind == ND_EXPR_STMT && isIncrementOf(static_cast<ExprStmt *>(then)->expr, counter)) {
+    // k = k + 1: count them up instead. The counter is the only thing that assignment can be to
+    Node::Expr *expr = static_cast<ExprStmt *>(then)->expr;
+    Node::Expr *of = expr->kind == ND_POSTFIX   ? static_cast<PostfixExpr *>(expr)->expr
+                     : expr->kind == ND_PREFIX ? static_cast<PrefixExpr *>(expr)->expr
+                                               : static_cast<AssignmentExpr *>(expr)->assignee;
+    bool isOther = counter != name && std::find(out.reads.begin(), out.reads.end(), counter) == out.reads.end();
+    if (isOther && bytesOf(of->asmType) == 8) {
+      out.kind = Kind::Count;
+      out.result = static_cast<IdentExpr *>(of);
+      out.needsZero = true;
+    }
+  }
+  return true;
+}
+
+// What analyze can't tell from the loop alone
+bool Vectorizer::isSafe(ForStmt *loop, const Plan &plan) {
+  // Nothing we read (or write, or count with) can change behind our back. A store through a
+  // *char could land on a local whose address got out
+  if (escaped.contains(loop->name) || (plan.result != nullptr && escaped.contains(plan.result->name))) return false;
+  for (const std::string &name : plan.reads)
+    if (escaped.contains(name)) return false;
+
+  // Stores and loads can't overlap unless they are the same element. Arrays declared right here don't
+  // overlap each other, but *chars can point anywhere
+  if (plan.kind == Kind::Map && plan.bases.size() > 1)
+    for (IdentExpr *base : plan.bases)
+      if (!localArrays.contains(base->name)) return false;
+
+  // Not enough trips to fill a vector even once
+  long long init = 0, bound = 0;
+  if (constantOf(static_cast<AssignmentExpr *>(loop->forLoop)->rhs, init) && constantOf(plan.bound, bound))
+    return bound - init + (plan.isInclusive ? 1 : 0) >= lanesPerVector(plan.width);
+  return true;
+}
+
+// Can `expr` be worked out for every lane at once?
+bool Vectorizer::isLanes(Node::Expr *expr, Plan &plan, size_t &nodes) {
+  nodes++;
+  if (isInvariant(expr, plan)) {
+    plan.invariants.push_back(expr);
+    return true;
+  }
+  switch (expr->kind) {
+    case ND_GROUP:
+      nodes--;
+      return isLanes(static_cast<GroupExpr *>(expr)->expr, plan, nodes);
+    case ND_INDEX:
+      return isLoad(expr, plan);
+    case ND_UNARY:
+      plan.needsZero = true; // -x is 0 - x
+      return static_cast<UnaryExpr *>(expr)->op == "-" && isLanes(static_cast<UnaryExpr *>(expr)->expr, plan, nodes);
+    case ND_BINARY: {
+      BinaryExpr *bin = static_cast<BinaryExpr *>(expr);
+      int bits = 0;
+      Node::Expr *other = nullptr;
+      if (isShift(bin, plan.width, bits, other)) return isLanes(other, plan, nodes);
+      if (bin->op == "*" && plan.width != 2 && (plan.width != 4 || PassManager::isa == Isa::Sse2)) return false;
+      if (bin->op != "+" && bin->op != "-" && bin->op != "*" && bin->op != "&" && bin->op != "|" && bin->op != "^") return false;
+      return isLanes(bin->lhs, plan, nodes) && isLanes(bin->rhs, plan, nodes);
+    }
+    default:
+      return false;
+  }
+}
+
+// The same in every iteration, and nothing happens if we work it out once before the loop even starts
+// (so no calls, and no dividing by something that might be 0)
+bool Vectorizer::isInvariant(Node::Expr *expr, Plan &plan) {
+  switch (expr->kind) {
+    case ND_INT:
+    case ND_CHAR:
+      return true;
+    case ND_IDENT: {
+      IdentExpr *ident = static_cast<IdentExpr *>(expr);
+      if (ident->name == plan.var || bytesOf(ident->asmType) == 0) return false;
+      plan.reads.push_back(ident->name);
+      return true;
+    }
+    case ND_GROUP:
+      return isInvariant(static_cast<GroupExpr *>(expr)->expr, plan);
+    case ND_UNARY:
+      return static_cast<UnaryExpr *>(expr)->op == "-" && isInvariant(static_cast<UnaryExpr *>(expr)->expr, plan);
+    case ND_BINARY: {
+      BinaryExpr *bin = static_cast<BinaryExpr *>(expr);
+      if (bin->op != "+" && bin->op != "-" && bin->op != "*" && bin->op != "&" && bin->op != "|" && bin->op != "^") return false;
+      return isInvariant(bin->lhs, plan) && isInvariant(bin->rhs, plan);
+    }
+    default:
+      return false;
+  }
+}
+
+// x[i], and x has elements of the size everything else has
+bool Vectorizer::isLoad(Node::Expr *expr, Plan &plan) {
+  if (expr->kind != ND_INDEX) return false;
+  IndexExpr *index = static_cast<IndexExpr *>(expr);
+  if (index->lhs->kind != ND_IDENT || !isNamed(index->rhs, plan.var)) return false;
+  if (bytesOf(elementOf(index->lhs->asmType)) != plan.width) return false;
+  IdentExpr *base = static_cast<IdentExpr *>(index->lhs);
+  for (IdentExpr *known : plan.bases)
+    if (known->name == base->name) return true;
+  plan.bases.push_back(base);
+  return plan.bases.size() <= maxBases;
+}
+
+// Compares happen on the extended values, lanes compare bits. Those agree as long as `expr` is of the
+// element's own type, or a literal that comes out the same whether the element is sign or zero extended
+bool Vectorizer::isComparable(Node::Expr *expr, Plan &plan) {
+  long long value = 0;
+  bool isLiteral = constantOf(expr, value);
+  if (expr->kind == ND_CHAR) {
+    value = static_cast<CharExpr *>(expr)->value;
+    isLiteral = true;
+  }
+  if (isLiteral) {
+    if (plan.width != 8 && (value < 0 || value >= (1LL << (plan.width * 8 - 1)))) return false;
+  } else {
+    Node::Type *element = elementOf(plan.target->lhs->asmType);
+    if (expr->kind != ND_IDENT || isNamed(expr, plan.var) || expr->asmType == nullptr || expr->asmType->kind != ND_SYMBOL_TYPE)
+      return false;
+    SymbolType *type = static_cast<SymbolType *>(expr->asmType), *of = static_cast<SymbolType *>(element);
+    if (type->name != of->name || type->signedness != of->signedness) return false;
+    plan.reads.push_back(static_cast<IdentExpr *>(expr)->name);
+  }
+  plan.invariants.push_back(expr);
+  return true;
+}
+
+long long Vectorizer::lanesPerVector(int bytes) {
+  return (PassManager::isa == Isa::Avx2 ? 32 : 16) / bytes;
+}
+
+// The vector loop goes right in front of the scalar one (which starts with its own `i < n`):
+//     (broadcast invariants, load the array addresses, n into %rdx and i into %rax)
+//     cmp %rdx, %rax; jge done
+//     sub %rax, %rdx                 elements left (add 1 for <=)
+//     jmp test
+//   body:
+//     ... one vector's worth ...
+//     add $lanes, %rax; sub $lanes, %rdx
+//   test:
+//     cmp $lanes - 1, %rdx; ja body
+//     mov %rax, i                    and fold a reduction (or count) into its variable
+//   done:
+// A search that finds something jumps into the scalar loop's body with `i` at the hit
+bool Vectorizer::emit(ForStmt *loop, size_t label) {
+  Plan plan;
+  if (!analyze(loop, plan)) return false;
+  isWide = PassManager::isa == Isa::Avx2;
+  width = plan.width;
+  taken.assign(16, 0);
+  broadcasts.clear();
+  baseRegisters.clear();
+  zero = -1;
+  long long count = lanesPerVector(width);
+  std::string n = std::to_string(label);
+  std::string body = "vec_body" + n, test = "vec_test" + n, found = "vec_found" + n, done = "vec_done" + n;
+  auto push = [](Instr instr) { codegen::push(instr, codegen::Section::Main); };
+  auto jump = [&](JumpCondition op, const std::string &to) {
+    push(Instr{.var = JumpInstr{.op = op, .label = to}, .type = InstrType::Jmp});
+  };
+  auto mov = [&](const std::string &dest, const std::string &src) {
+    push(Instr{.var = MovInstr{.dest = dest, .src = src, .destSize = DataSize::Qword, .srcSize = DataSize::Qword}, .type = InstrType::Mov});
+  };
+  push(Instr{.var = Comment{.comment = "vectorized, " + std::to_string(count) + " at a time"}, .type = InstrType::Comment});
+
+  for (Node::Expr *invariant : plan.invariants) {
+    codegen::visitExpr(invariant);
+    codegen::popToRegister("%rax");
+    int into = take(false);
+    broadcast(into);
+    broadcasts[invariant] = into;
+  }
+  if (plan.needsZero) {
+    zero = take(false);
+    vop(isWide ? "vpxor" : "pxor", isWide ? std::vector<std::string>{reg(zero), reg(zero), reg(zero)}
+                                         : std::vector<std::string>{reg(zero), reg(zero)});
+  }
+  int acc = -1;
+  if (plan.kind == Kind::Reduce || plan.kind == Kind::Count) {
+    // Every lane starts out as nothing: 0, or all ones for &
+    acc = take(false);
+    std::string clear = plan.op == "&" ? "pcmpeqd" : "pxor";
+    if (isWide) vop("v" + clear, {reg(acc), reg(acc), reg(acc)});
+    else vop(clear, {reg(acc), reg(acc)});
+  }
+
+  static const char *registers[] = {"%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11"};
+  for (size_t b = 0; b < plan.bases.size(); b++) {
+    codegen::visitExpr(plan.bases[b]);
+    codegen::popToRegister(registers[b]);
+    baseRegisters[plan.bases[b]->name] = registers[b];
+  }
+  codegen::visitExpr(plan.bound);
+  codegen::popToRegister("%rdx");
+  std::string at = codegen::variableTable[loop->name];
+  mov("%rax", at);
+
+  // Once i < n, n - i is exact as an unsigned number: the trip count (plus one more for <=)
+  push(Instr{.var = CmpInstr{.lhs = "%rax", .rhs = "%rdx", .size = DataSize::Qword}, .type = InstrType::Cmp});
+  jump(plan.isInclusive ? JumpCondition::Greater : JumpCondition::GreaterEqual, done);
+  push(Instr{.var = SubInstr{.lhs = "%rdx", .rhs = "%rax", .size = DataSize::Qword}, .type = InstrType::Sub});
+  if (plan.isInclusive) push(Instr{.var = AddInstr{.lhs = "%rdx", .rhs = "$1", .size = DataSize::Qword}, .type = InstrType::Add});
+  if (plan.kind == Kind::Count && plan.op == "!=") mov("%rcx", "%rax"); // where we started, see below
+  jump(JumpCondition::Unconditioned, test);
+  push(Instr{.var = Label{.name = body, .align = PassManager::alignsCode() ? Alignment::Loop : Alignment::None}, .type = InstrType::Label});
+
+  switch (plan.kind) {
+    case Kind::Map: {
+      int value = lanes(plan.value);
+      vop(isWide ? "vmovdqu" : "movdqu", {reg(value), address(plan.target)});
+      give(value);
+      break;
+    }
+    case Kind::Reduce: {
+      // a - b - c is a - (b + c)
+      accumulate(packed(plan.op == "-" ? "+" : plan.op, width), lanes(plan.value), acc);
+      break;
+    }
+    case Kind::Count: {
+      // A match is all ones, -1. Bytes (and words and dwords) would run out of room to count in,
+      // so 0 - mask gets added up into the qwords with psadbw
+      int mask = lanes(plan.target);
+      compare(broadcasts[plan.value], mask);
+      if (width == 8) {
+        accumulate("psubq", mask, acc);
+      } else {
+        int ones = combine("psub" + suffix(), zero, mask, false);
+        if (isWide) vop("vpsadbw", {reg(zero), reg(ones), reg(ones)});
+        else vop("psadbw", {reg(zero), reg(ones)});
+        accumulate("paddq", ones, acc);
+      }
+      break;
+    }
+    case Kind::Search: {
+      int mask = lanes(plan.target);
+      compare(broadcasts[plan.value], mask);
+      vop(isWide ? "vpmovmskb" : "pmovmskb", {reg(mask), "%ecx"});
+      give(mask);
+      if (plan.op == "!=") {
+        if (isWide) vop("notl", {"%ecx"});
+        else vop("xorl", {"$0xffff", "%ecx"});
+      }
+      vop("testl", {"%ecx", "%ecx"});
+      jump(JumpCondition::NotZero, found);
+      break;
+    }
+  }
+
+  push(Instr{.var = AddInstr{.lhs = "%rax", .rhs = "$" + std::to_string(count), .size = DataSize::Qword}, .type = InstrType::Add});
+  push(Instr{.var = SubInstr{.lhs = "%rdx", .rhs = "$" + std::to_string(count), .size = DataSize::Qword}, .type = InstrType::Sub});
+  push(Instr{.var = Label{.name = test}, .type = InstrType::Label});
+  push(Instr{.var = CmpInstr{.lhs = "%rdx", .rhs = "$" + std::to_string(count - 1), .size = DataSize::Qword},
+             .type = InstrType::Cmp});
+  jump(JumpCondition::Above, body);
+  mov(at, "%rax");
+
+  if (plan.kind == Kind::Reduce) {
+    fold(acc, packed(plan.op == "-" ? "+" : plan.op, width), width);
+    static const std::unordered_map<std::string, std::string> scalar = {{"+", "add"}, {"-", "sub"}, {"&", "and"}, {"|", "or"}, {"^", "xor"}};
+    static const std::string sizes = "bw?l???q";
+    Operand into = codegen::variableTable[plan.result->name];
+    if (into.isRegister()) into = Operand::makeRegister(into.reg, (uint8_t)width);
+    push(Instr{.var = BinaryInstr{.op = scalar.at(plan.op) + sizes[width - 1], .src = Operand::makeRegister(Reg::Rax, (uint8_t)width), .dst = into},
+               .type = InstrType::Binary});
+  } else if (plan.kind == Kind::Count) {
+    // Counting what's != is counting what's == and taking that away from how many we looked at
+    if (plan.op == "!=") {
+      push(Instr{.var = SubInstr{.lhs = "%rax", .rhs = "%rcx", .size = DataSize::Qword}, .type = InstrType::Sub});
+      mov("%rcx", "%rax");
+    }
+    fold(acc, "paddq", 8);
+    if (plan.op == "!=") {
+      push(Instr{.var = SubInstr{.lhs = "%rcx", .rhs = "%rax", .size = DataSize::Qword}, .type = InstrType::Sub});
+      mov("%rax", "%rcx");
+    }
+    push(Instr{.var = AddInstr{.lhs = codegen::variableTable[plan.result->name], .rhs = "%rax", .size = DataSize::Qword}, .type = InstrType::Add});
+  } else if (plan.kind == Kind::Search) {
+    // The first lane that matched: its byte in the mask, over the bytes in a lane
+    jump(JumpCondition::Unconditioned, done);
+    push(Instr{.var = Label{.name = found}, .type = InstrType::Label});
+    vop("bsfl", {"%ecx", "%ecx"});
+    if (width > 1) vop("shrl", {"$" + std::to_string(__builtin_ctz((unsigned)width)), "%ecx"});
+    push(Instr{.var = AddInstr{.lhs = "%rax", .rhs = "%rcx", .size = DataSize::Qword}, .type = InstrType::Add});
+    mov(at, "%rax");
+    if (isWide) vop("vzeroupper", {});
+    jump(JumpCondition::Unconditioned, "loop_body" + n);
+  }
+  push(Instr{.var = Label{.name = done}, .type = InstrType::Label});
+  if (isWide) vop("vzeroupper", {}); // or every SSE instruction after this pays for the upper halves
+  return true;
+}
+
+// What's in the lanes of `expr`, in a vector register. Temporaries are the caller's to give back
+int Vectorizer::lanes(Node::Expr *expr) {
+  auto it = broadcasts.find(expr);
+  if (it != broadcasts.end()) return it->second;
+  switch (expr->kind) {
+    case ND_GROUP:
+      return lanes(static_cast<GroupExpr *>(expr)->expr);
+    case ND_INDEX: {
+      int into = take();
+      vop(isWide ? "vmovdqu" : "movdqu", {address(static_cast<IndexExpr *>(expr)), reg(into)});
+      return into;
+    }
+    case ND_UNARY:
+      return combine("psub" + suffix(), zero, lanes(static_cast<UnaryExpr *>(expr)->expr), false);
+    case ND_BINARY: {
+      BinaryExpr *bin = static_cast<BinaryExpr *>(expr);
+      int bits = 0;
+      Node::Expr *other = nullptr;
+      if (isShift(bin, width, bits, other)) {
+        int from = lanes(other);
+        int into = taken[from] == 2 ? from : take();
+        if (isWide) {
+          vop("vpsll" + suffix(), {"$" + std::to_string(bits), reg(from), reg(into)});
+        } else {
+          if (into != from) vop("movdqa", {reg(from), reg(into)});
+          vop("psll" + suffix(), {"$" + std::to_string(bits), reg(into)});
+        }
+        return into;
+      }
+      int lhs = lanes(bin->lhs);
+      int rhs = lanes(bin->rhs);
+      return combine(packed(bin->op, width), lhs, rhs, bin->op != "-");
+    }
+    default:
+      return -1; // analyze doesn't let anything else through
+  }
+}
+
+// lhs = lhs op rhs, lane by lane, into whichever of them is a temporary (or a new one)
+int Vectorizer::combine(const std::string &op, int lhs, int rhs, bool isCommutative) {
+  if (isWide) {
+    int into = taken[lhs] == 2 ? lhs : taken[rhs] == 2 ? rhs : take();
+    vop("v" + op, {reg(rhs), reg(lhs), reg(into)});
+    if (into != lhs) give(lhs);
+    if (into != rhs) give(rhs);
+    return into;
+  }
+  // SSE only has `op src, dst`
+  if (taken[lhs] != 2 && taken[rhs] == 2 && isCommutative) std::swap(lhs, rhs);
+  int into = lhs;
+  if (taken[lhs] != 2) {
+    into = take();
+    vop("movdqa", {reg(lhs), reg(into)});
+  }
+  vop(op, {reg(rhs), reg(into)});
+  if (rhs != into) give(rhs);
+  return into;
+}
+
+// into = into op from, and `into` stays where it is (combine would pick whichever is a temporary)
+void Vectorizer::accumulate(const std::string &op, int from, int into) {
+  if (isWide) vop("v" + op, {reg(from), reg(into), reg(into)});
+  else vop(op, {reg(from), reg(into)});
+  give(from);
+}
+
+// into = into == against ? all ones : 0, lane by lane
+void Vectorizer::compare(int against, int into) {
+  if (width == 8 && PassManager::isa == Isa::Sse2) {
+    // No pcmpeqq before SSE4.1: both dwords of a qword have to match
+    int halves = take();
+    vop("pcmpeqd", {reg(against), reg(into)});
+    vop("pshufd", {"$0xb1", reg(into), reg(halves)});
+    vop("pand", {reg(halves), reg(into)});
+    give(halves);
+    return;
+  }
+  if (isWide) vop("vpcmpeq" + suffix(), {reg(against), reg(into), reg(into)});
+  else vop("pcmpeq" + suffix(), {reg(against), reg(into)});
+}
+
+// %rax, in every lane of `into`
+void Vectorizer::broadcast(int into) {
+  std::string xmm = "%xmm" + std::to_string(into);
+  if (isWide) {
+    vop("vmovq", {"%rax", xmm});
+    vop("vpbroadcast" + suffix(), {xmm, reg(into)});
+    return;
+  }
+  vop("movq", {"%rax", xmm});
+  if (width == 8) {
+    vop("punpcklqdq", {xmm, xmm});
+    return;
+  }
+  if (width == 1) vop("punpcklbw", {xmm, xmm});
+  if (width <= 2) vop("punpcklwd", {xmm, xmm});
+  vop("pshufd", {"$0", xmm, xmm});
+}
+
+// Every lane of `from`, op'd together into %rax: the top half onto the bottom half until there is one lane left
+void Vectorizer::fold(int from, const std::string &op, int bytes) {
+  std::string xmm = "%xmm" + std::to_string(from);
+  if (isWide) {
+    int high = take();
+    std::string top = "%xmm" + std::to_string(high);
+    vop("vextracti128", {"$1", reg(from), top});
+    vop("v" + op, {top, xmm, xmm});
+    give(high);
+  }
+  for (int shift = 8; shift >= bytes; shift /= 2) {
+    int half = take();
+    std::string rest = "%xmm" + std::to_string(half);
+    if (isWide) {
+      vop("vpsrldq", {"$" + std::to_string(shift), xmm, rest});
+      vop("v" + op, {rest, xmm, xmm});
+    } else {
+      vop("movdqa", {xmm, rest});
+      vop("psrldq", {"$" + std::to_string(shift), rest});
+      vop(op, {rest, xmm});
+    }
+    give(half);
+  }
+  vop(isWide ? "vmovq" : "movq", {xmm, "%rax"});
+}
+
+// Two operands fit in a BinaryInstr (and the peephole optimizer can see what they do). Three don't
+void Vectorizer::vop(const std::string &op, const std::vector<std::string> &operands) {
+  if (operands.size() <= 2) {
+    codegen::push(Instr{.var = BinaryInstr{.op = op, .src = operands.empty() ? "" : operands[0], .dst = operands.size() < 2 ? "" : operands[1]},
+                        .type = InstrType::Binary},
+                  codegen::Section::Main);
+    return;
+  }
+  std::string line = op;
+  for (size_t i = 0; i < operands.size(); i++) line += (i == 0 ? " " : ", ") + operands[i];
+  codegen::pushLinker(line + "\n\t", codegen::Section::Main);
+}
+
+std::string Vectorizer::reg(int index) {
+  return (isWide ? "%ymm" : "%xmm") + std::to_string(index);
+}
+
+// x[i] is `x + i * width`, with `x` in the register it got up front
+std::string Vectorizer::address(IndexExpr *load) {
+  const std::string &base = baseRegisters[static_cast<IdentExpr *>(load->lhs)->name];
+  return "(" + base + ",%rax," + std::to_string(width) + ")";
+}
+
+// The lane size, as the instruction names spell it: paddb, paddw, paddd, paddq
+std::string Vectorizer::suffix() {
+  return width == 1 ? "b" : width == 2 ? "w" : width == 4 ? "d" : "q";
+}
+
+std::string Vectorizer::packed(const std::string &op, int bytes) {
+  std::string lane = bytes == 1 ? "b" : bytes == 2 ? "w" : bytes == 4 ? "d" : "q";
+  if (op == "+") return "padd" + lane;
+  if (op == "-") return "psub" + lane;
+  if (op == "*") return bytes == 2 ? "pmullw" : "pmulld";
+  if (op == "&") return "pand";
+  if (op == "|") return "por";
+  return "pxor";
+}
+
+int Vectorizer::take(bool isTemp) {
+  for (int i = 0; i < 16; i++)
+    if (taken[i] == 0) {
+      taken[i] = isTemp ? 2 : 1;
+      return i;
+    }
+  return 15; // maxNodes keeps us from ever getting here
+}
+
+void Vectorizer::give(int index) {
+  if (index >= 0 && taken[index] == 2) taken[index] = 0;
+}
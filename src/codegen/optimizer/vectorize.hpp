@@ -0,0 +1,92 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast/expr.hpp"
+#include "../../ast/stmt.hpp"
+
+// Runs element-wise loops over arrays (and *char buffers) 16 bytes at a time with SSE2, or 32 with AVX2
+// (-march=x86-64-v3). The loop has to count up by one, `loop (i = a; i < n) : (i++)`, around one of:
+//   - a map:        d[i] = <lanes>;                  copies, fills, scaling...
+//   - a reduction:  s = s + <lanes>;                 sums (and -, &, | and ^), folded horizontally at the end
+//   - a count:      if (x[i] == c) { k = k + 1; }
+//   - a search:     if (x[i] == c) { ... }           memchr: the first hit goes to the scalar loop to deal with
+// <lanes> is + - * & | ^ and unary - over `x[i]` loads (all the same element size), and anything that doesn't
+// change in the loop, which gets broadcast to every lane once up front. Every index has to be exactly `i`,
+// so no iteration can see what another one did, and only the reduction carries anything around at all.
+//
+// Codegen puts the vector loop in front of the normal one and leaves `i` wherever it stopped, so the normal
+// loop is the epilogue: it does whatever is left (less than a vector), or all of it if there wasn't a vector's
+// worth to begin with. Only integers; a float reduction would add things up in a different order than the loop.
+class Vectorizer {
+public:
+  // Flags the loops codegen should vectorize (ForStmt::vectorize) before the unroller gets to them.
+  // Returns how many
+  static size_t run(Node::Stmt *program);
+  // Codegen, right after `i = init` and before the loop itself. False if the loop doesn't qualify anymore
+  // (folding happened in between), and then nothing was emitted
+  static bool emit(ForStmt *loop, size_t label);
+
+private:
+  enum class Kind { Map, Reduce, Count, Search };
+
+  struct Plan {
+    Kind kind;
+    std::string var;                      // `i`
+    int width = 0;                        // bytes per element
+    bool isInclusive = false;             // i <= n
+    Node::Expr *bound = nullptr;
+    Node::Expr *value = nullptr;          // Map, Reduce: what goes in the lanes. Count, Search: what x[i] is compared to
+    IndexExpr *target = nullptr;          // Map: d[i]. Count, Search: x[i]
+    std::string op;                       // Reduce: how the lanes go into `result`. Count, Search: == or !=
+    IdentExpr *result = nullptr;          // Reduce: the accumulator. Count: the counter
+    std::vector<IdentExpr *> bases;       // every array we index, once each
+    std::vector<Node::Expr *> invariants; // broadcast before the loop
+    std::vector<std::string> reads;       // every scalar it reads
+    bool needsZero = false;
+  };
+
+  static void collect(Node::Stmt *stmt);
+  static void visit(Node::Stmt *stmt);
+  static bool analyze(ForStmt *loop, Plan &out);
+  static bool isSafe(ForStmt *loop, const Plan &plan);
+  static bool isLanes(Node::Expr *expr, Plan &plan, size_t &nodes);
+  static bool isInvariant(Node::Expr *expr, Plan &plan);
+  static bool isLoad(Node::Expr *expr, Plan &plan);
+  static bool isComparable(Node::Expr *expr, Plan &plan);
+  static long long lanesPerVector(int bytes);
+
+  // Codegen
+  static int lanes(Node::Expr *expr);
+  static int combine(const std::string &op, int lhs, int rhs, bool isCommutative);
+  static void accumulate(const std::string &op, int from, int into);
+  static void compare(int against, int into);
+  static void broadcast(int reg);
+  static void fold(int reg, const std::string &op, int bytes);
+  static void vop(const std::string &op, const std::vector<std::string> &operands);
+  static std::string reg(int index);
+  static std::string address(IndexExpr *load);
+  static std::string suffix();
+  static std::string packed(const std::string &op, int bytes);
+  static int take(bool isTemp = true);
+  static void give(int index);
+
+  static inline std::vector<FnStmt *> functions = {};
+  static inline std::set<std::string> escaped = {};     // &x somewhere in the function we're in
+  static inline std::set<std::string> localArrays = {}; // declared in it, so nothing else can point into them
+  static inline size_t loopCount = 0;
+
+  // While emitting
+  static inline bool isWide = false; // ymm
+  static inline int width = 0;
+  static inline std::vector<int> taken = {}; // 0 = free, 1 = held for the whole loop, 2 = a temporary
+  static inline std::unordered_map<Node::Expr *, int> broadcasts = {};
+  static inline std::unordered_map<std::string, std::string> baseRegisters = {};
+  static inline int zero = -1;
+
+  static constexpr size_t maxNodes = 10; // in <lanes>, so we never run out of vector registers
+  static constexpr size_t maxBases = 6;  // %rsi, %rdi, %r8-%r11
+};
@@ -5,7 +5,7 @@
 #include <string>
 
 #include "../codegen/gen.hpp"
-#include "../codegen/optimizer/compiler.hpp"
+#include "../codegen/optimizer/passes.hpp"
 #include "../common.hpp"
 #include "../parser/parser.hpp"
 #include "../typeChecker/type.hpp"
@@ -64,9 +64,9 @@ void Flags::runFile(const char *path, std::string outName, bool save,
   TypeChecker::performCheck(result);
   if (echoOn) Flags::updateProgressBar(0.5);
 
-  result = CompileOptimizer::optimizeStmt(result);
   if (echoOn) Flags::updateProgressBar(0.75);
   codegen::gen(result, save, outName, path, debug);
+  if (PassManager::timePasses) PassManager::printReport();
   if (echoOn) Flags::updateProgressBar(1.0);
 
   bool hadErrors = Error::report_error();
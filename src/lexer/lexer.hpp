@@ -112,6 +112,10 @@ enum TokenKind {
   RECV,   // receive bytes from a connection
   SEND,   // send bytes to a connection
   COMMAND, // run a command in the shell
+  INLINE,   // @inline fn ... - always inline this function
+  NOINLINE, // @noinline fn ... - never inline this function
+  UNROLL,   // @unroll(n) loop ... - unroll this loop n times
+  TAILCALL, // @tailcall return f(...); - this call has to become a jump
 
   // Error
   ERROR_,
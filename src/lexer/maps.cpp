@@ -51,6 +51,10 @@ void Lexer::initMap() {
       {"@getArgc", TokenKind::GETARGC},
       {"@streq", TokenKind::STRCMP},
       {"@command", TokenKind::COMMAND},
+      {"@inline", TokenKind::INLINE},
+      {"@noinline", TokenKind::NOINLINE},
+      {"@unroll", TokenKind::UNROLL},
+      {"@tailcall", TokenKind::TAILCALL},
       // file management
       {"@open", TokenKind::OPEN},
       {"@close", TokenKind::CLOSE},
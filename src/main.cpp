@@ -3,10 +3,14 @@
 #include <chrono>
 #include <cstdlib>  // Include this for std::system
 #include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <string>
 
 #include "common.hpp"
+#include "codegen/optimizer/frame.hpp"
+#include "codegen/optimizer/passes.hpp"
+#include "codegen/optimizer/profile.hpp"
 #include "helper/flags.hpp"
 #include "server/lsp.hpp"
 
@@ -35,6 +39,14 @@ void FlagConfig::print(int argc, char **argv) {
           "\n  -name [name]  Set the name of the output file"
           "\n  -save [path]  Save the output file to a specific path"
           "\n  -clean        Clean the build files [*.asm, *.o]"
+          "\n  -O0 -O1 -O2   Optimization level (default -O2)"
+          "\n  -Os           Optimize, but keep the output small"
+          "\n  -march=[arch] Vector instructions loops can use: x86-64 (SSE2, default), x86-64-v2, x86-64-v3 (AVX2) or native"
+          "\n  -profile-generate[=file]  Count what runs, into file (default [name].zprof) when the program exits"
+          "\n  -profile-use[=file]       Optimize for what the counts in file say runs the most"
+          "\n  -keep-frame-pointer  Keep %rbp in leaf functions too, for profilers that walk the frame chain"
+          "\n  -time-passes  Show what every optimization pass did and how long it took"
+          "\n  -dump-ir      Print the optimized IR of every function that goes through it"
           "\n Zura Lsp Flags:"
           "\n  -lsp          Create an LSP connection via stdio."};
 
@@ -126,9 +138,34 @@ void FlagConfig::runBuild(int argc, char **argv) {
             isDebug = true;
           } else if (strcmp(argv[j], "-quiet") == 0) {
             Flags::quiet = isQuiet = true;
+          } else if (strcmp(argv[j], "-time-passes") == 0) {
+            PassManager::timePasses = true;
+          } else if (strcmp(argv[j], "-dump-ir") == 0) {
+            PassManager::dumpIr = true;
+          } else if (strcmp(argv[j], "-keep-frame-pointer") == 0) {
+            FrameOmission::isEnabled = false;
+          } else if (strncmp(argv[j], "-march=", 7) == 0) {
+            if (!PassManager::parseArch(argv[j] + 7)) {
+              std::cout << "Unknown -march: " << argv[j] + 7 << " (try x86-64, x86-64-v2, x86-64-v3 or native)" << std::endl;
+              Exit(ExitValue::INVALID_FILE);
+            }
+          } else if (strncmp(argv[j], "-profile-generate", 17) == 0 && (argv[j][17] == '\0' || argv[j][17] == '=')) {
+            Profile::mode = Profile::Mode::Generate;
+            if (argv[j][17] == '=') Profile::path = argv[j] + 18;
+          } else if (strncmp(argv[j], "-profile-use", 12) == 0 && (argv[j][12] == '\0' || argv[j][12] == '=')) {
+            Profile::mode = Profile::Mode::Use;
+            if (argv[j][12] == '=') Profile::path = argv[j] + 13;
+          } else if (PassManager::parseLevel(argv[j])) {
+            // -O0, -O1, -O2 or -Os
           }
         }
 
+        // The instrumented program could be run from anywhere, so it gets told exactly where the counts go
+        if (Profile::mode != Profile::Mode::Off) {
+          if (Profile::path.empty()) Profile::path = std::string(outputName) + ".zprof";
+          Profile::path = std::filesystem::absolute(Profile::path).string();
+        }
+
         Flags::runFile(fileName, outputName, saveFlag, isDebug, !isQuiet);
         return;  // Exit after handling the 'build' command
       }
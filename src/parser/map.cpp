@@ -71,6 +71,10 @@ void Parser::createMaps() {
       {TokenKind::INPUT, inputStmt},
       {TokenKind::CLOSE, closeStmt},
       {TokenKind::PRINTLN, printlnStmt},
+      {TokenKind::INLINE, inlineStmt},
+      {TokenKind::NOINLINE, inlineStmt},
+      {TokenKind::UNROLL, unrollStmt},
+      {TokenKind::TAILCALL, tailCallStmt},
   };
   nud_lu = {
       {TokenKind::INT, primary},
@@ -146,6 +146,9 @@ Node::Stmt *printStmt(PStruct *psr, std::string name);
 Node::Stmt *printlnStmt(PStruct *psr, std::string name);
 Node::Stmt *varStmt(PStruct *psr, std::string name);
 Node::Stmt *funStmt(PStruct *psr, std::string name);
+Node::Stmt *inlineStmt(PStruct *psr, std::string name);
+Node::Stmt *unrollStmt(PStruct *psr, std::string name);
+Node::Stmt *tailCallStmt(PStruct *psr, std::string name);
 Node::Stmt *ifStmt(PStruct *psr, std::string name);
 Node::Stmt *breakStmt(PStruct *psr, std::string name);
 Node::Stmt *continueStmt(PStruct *psr, std::string name);
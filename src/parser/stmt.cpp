@@ -276,6 +276,72 @@ Node::Stmt *Parser::funStmt(PStruct *psr, std::string name) {
                     false, false, false, codegen::getFileID(psr->current_file));
 }
 
+// const add := @inline fn (a: int!, b: int!) int! { ... };
+// Only a hint for the inliner, the function itself parses exactly like any other
+Node::Stmt *Parser::inlineStmt(PStruct *psr, std::string name) {
+  FnStmt::Inline hint = psr->current().kind == TokenKind::INLINE
+                            ? FnStmt::Inline::Always
+                            : FnStmt::Inline::Never;
+  psr->advance(); // Consume the @inline / @noinline
+
+  if (psr->current().kind != TokenKind::FUN) {
+    Error::handle_error("Parser", psr->current_file,
+                        "Expected a function after @inline / @noinline",
+                        psr->tks, psr->current().line, psr->current().column,
+                        psr->current().column + 1);
+    return nullptr;
+  }
+  FnStmt *fn = static_cast<FnStmt *>(funStmt(psr, name));
+  fn->inlineHint = hint;
+  return fn;
+}
+
+// @unroll(4) loop (i = 0; i < n) : (i++) { ... }
+// Same deal as @inline, just a hint. Only counted loops can be unrolled, so it has to be a for loop
+Node::Stmt *Parser::unrollStmt(PStruct *psr, std::string name) {
+  psr->advance(); // Consume the @unroll
+  psr->expect(TokenKind::LEFT_PAREN, "Expected a L_PAREN after @unroll");
+  Lexer::Token count = psr->current();
+  psr->expect(TokenKind::INT, "Expected how many times to unroll the loop in @unroll(n)");
+  psr->expect(TokenKind::RIGHT_PAREN, "Expected a R_PAREN to end @unroll(n)");
+
+  if (psr->current().kind != TokenKind::LOOP || psr->peek(3).kind != TokenKind::EQUAL) {
+    Error::handle_error("Parser", psr->current_file,
+                        "Expected a for loop (loop (i = ...; ...)) after @unroll",
+                        psr->tks, psr->current().line, psr->current().column,
+                        psr->current().column + 1);
+    return nullptr;
+  }
+  ForStmt *loop = static_cast<ForStmt *>(loopStmt(psr, name));
+  if (loop == nullptr) return nullptr;
+  loop->unroll = std::stoi(count.value);
+  return loop;
+}
+
+// @tailcall return f(x - 1, acc * x);
+// Unlike @inline and @unroll this is no hint: the call jumps straight to f, reusing our frame, or it doesn't compile
+Node::Stmt *Parser::tailCallStmt(PStruct *psr, std::string name) {
+  psr->advance(); // Consume the @tailcall
+
+  if (psr->current().kind != TokenKind::RETURN) {
+    Error::handle_error("Parser", psr->current_file,
+                        "Expected a return after @tailcall",
+                        psr->tks, psr->current().line, psr->current().column,
+                        psr->current().column + 1);
+    return nullptr;
+  }
+  Lexer::Token start = psr->current();
+  ReturnStmt *ret = static_cast<ReturnStmt *>(returnStmt(psr, name));
+  if (ret->expr == nullptr || ret->expr->kind != ND_CALL) {
+    Error::handle_error("Parser", psr->current_file,
+                        "Expected a function call to return after @tailcall",
+                        psr->tks, start.line, start.column, start.column + 1);
+    return ret;
+  }
+  ret->isTailCall = true;
+  return ret;
+}
+
 Node::Stmt *Parser::returnStmt(PStruct *psr, std::string name) {
   int line = psr->tks[psr->pos].line;
   int column = psr->tks[psr->pos].column;
@@ -507,6 +507,51 @@ std::string lsp::getBuiltinNote(const std::string &builtin) {
             "};\n"
             "```";
   } else
+  if (builtin == "@inline" || builtin == "@noinline") {
+    return "This annotation goes right before `fn` and tells the compiler whether to paste the function's body into every place it is called.\n"
+           "`@inline` skips the size limit that small functions normally have to fit under, and `@noinline` makes sure the function is always really called.\n"
+           "Without either, the compiler decides on its own (tiny helpers get inlined, big ones don't).\n"
+           "> [!NOTE]\n"
+           "> `@inline` is a hint. Recursive functions, functions that touch structs, arrays or globals, and functions using `match` are still called normally.\n"
+           "Example:\n"
+           "```zura\n"
+           "const square := @inline fn (x: int!) int! {\n"
+           "\treturn x * x;\n"
+           "};\n"
+           "const main := fn () int! {\n"
+           "\treturn square(4); # Compiles to 4 * 4, no call\n"
+           "};\n"
+           "```";
+  } else
+  if (builtin == "@unroll") {
+    return "This annotation goes right before a counted `loop` and tells the compiler how many copies of the body to put in a row.\n"
+           "`@unroll(n)` pastes the body n times per trip around the loop (and unrolls the loop away completely if it only runs n times or less), `@unroll(1)` keeps the loop as it is.\n"
+           "Without it, `-O2` unrolls small loops on its own. `-O1` and `-Os` only unroll loops marked with `@unroll`.\n"
+           "> [!NOTE]\n"
+           "> Only loops like `loop (i = 0; i < n) : (i++)` can be unrolled, where `n` is a number or a local the loop doesn't change. Loops with `break` or `continue` are always left alone.\n"
+           "Example:\n"
+           "```zura\n"
+           "have sum: int! = 0;\n"
+           "@unroll(4) loop (i = 0; i < 64) : (i++) {\n"
+           "\tsum = sum + buffer[i]; # Runs 16 times, 4 elements at a time\n"
+           "}\n"
+           "```";
+  } else
+  if (builtin == "@tailcall") {
+    return "This annotation goes right before `return f(...);` and makes the call a jump: `f` takes over the current function's frame and returns straight to our caller, so the stack doesn't grow.\n"
+           "A function returning a call to itself becomes a loop, calls to other functions become a `jmp`.\n"
+           "Without it, `-O1`, `-O2` and `-Os` still do this wherever they can. With it, the program doesn't compile if it can't be done, even at `-O0`.\n"
+           "> [!NOTE]\n"
+           "> The call has to be the very last thing that happens: nothing can be done with its result but return it. It can't need arguments on the stack or pass structs, and `main` can't do it (it exits instead of returning).\n"
+           "> Locals whose address is taken, arrays and structs live in the frame that goes away, so functions with those can't do it either.\n"
+           "Example:\n"
+           "```zura\n"
+           "const sum := fn (n: int!, acc: int!) int! {\n"
+           "\tif (n == 0) { return acc; }\n"
+           "\t@tailcall return sum(n - 1, acc + n); # A loop, however big n gets\n"
+           "};\n"
+           "```";
+  } else
   if (builtin == "@streq") {
     return "This function will compare two strings and return a boolean for whether or not they match.\n"
            "It takes in two string arguments and returns a boolean value. Obviously.\n"
@@ -21,6 +21,8 @@ void TypeChecker::visitTemplateCall(Node::Expr *expr) {
 
 void TypeChecker::visitExternalCall(Node::Expr *expr) {
   // There's not really a whole lot to typecheck here , lol
+  // ... but codegen needs the argument types, floats and doubles go in different registers than everything else
+  for (Node::Expr *arg : static_cast<ExternalCall *>(expr)->args) visitExpr(arg);
   return_type = std::make_shared<SymbolType>(
       "unknown"); // Unknown type, imagine that this is cast to like int or
                   // whatever